@@ -1,6 +1,8 @@
 
 #include <map>
 #include <vector>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
 
 #include <ft2build.h>
@@ -181,6 +183,7 @@ public:
     };
 
     KTFont(const std::string& ttf, const int font_size);
+    KTFont(const unsigned char* data, const uint32_t length, const int font_size);
     bool load();
     bool generate_glyph_texture(wchar_t ch);
 
@@ -198,6 +201,7 @@ public:
     float get_char_tex_coord_y(wchar_t ch) { return char_properties_[ch].tex_coord_y; }
 private:
     std::string ttf_;
+    std::vector<unsigned char> ttf_data_; //FreeType reads from this for as long as the face exists
     int font_size_;
     FT_Face face_;
 
@@ -229,6 +233,12 @@ font_size_(font_size) {
 
 }
 
+KTFont::KTFont(const unsigned char* data, const uint32_t length, const int font_size):
+ttf_data_(data, data + length),
+font_size_(font_size) {
+
+}
+
 static uint32_t pow2(uint32_t i) {
     if(i == 1) return 2;
 
@@ -290,7 +300,11 @@ bool KTFont::generate_glyph_texture(wchar_t ch) {
 }
 
 bool KTFont::load() {
-    if(FT_New_Face(ft.ftlib, ttf_.c_str(), 0, &face_) != 0) {
+    if(!ttf_data_.empty()) {
+        if(FT_New_Memory_Face(ft.ftlib, &ttf_data_[0], ttf_data_.size(), 0, &face_) != 0) {
+            return false;
+        }
+    } else if(FT_New_Face(ft.ftlib, ttf_.c_str(), 0, &face_) != 0) {
         return false;
     }
 
@@ -332,6 +346,11 @@ void ktLoadFont(const char* name, KTsizei size) {
     assert(fonts_[current_font_]->load());
 }
 
+void ktLoadFontFromMemory(const unsigned char* data, const KTsizei length, const KTsizei size) {
+    fonts_[current_font_] = KTFont::ptr(new KTFont(data, length, size));
+    assert(fonts_[current_font_]->load());
+}
+
 void ktDrawText(float x, float y, const KTchar* text_in) {
     if(!program_id) {
         compile_shader();
@@ -339,19 +358,13 @@ void ktDrawText(float x, float y, const KTchar* text_in) {
 
     glPushAttrib(GL_ENABLE_BIT);
 
-    std::string text_utf8(text_in);
-    std::vector<uint32_t> text;
-    utf8::utf8to32(text_utf8.begin(), text_utf8.end(), std::back_inserter(text));
-
     KTFont::ptr font = fonts_.at(current_font_);
 
-    std::vector<float> positions;
-    std::vector<float> texcoords;
-    std::vector<float> colours;
-
-    positions.resize(3 * 4, 0);
-    texcoords.resize(2 * 4, 0);
-    colours.resize(4 * 4, 1.0);
+    //This is called for every string every frame, so everything lives on the stack
+    float positions[3 * 4] = { 0 };
+    float texcoords[2 * 4] = { 0 };
+    float colours[4 * 4];
+    std::fill(colours, colours + (4 * 4), 1.0f);
 
     float x_offset = x;
     float y_offset = y;
@@ -366,8 +379,11 @@ void ktDrawText(float x, float y, const KTchar* text_in) {
 
     glClientActiveTexture(GL_TEXTURE0);
 
-    for(std::vector<uint32_t>::const_iterator it = text.begin(); it != text.end(); ++it) {
-        uint32_t ch = (*it);
+    //Decode the UTF-8 as we go rather than converting the whole string first
+    const KTchar* it = text_in;
+    const KTchar* end = text_in + strlen(text_in);
+    while(it != end) {
+        uint32_t ch = utf8::next(it, end);
 
         font->generate_glyph_texture(ch);
 
@@ -426,12 +442,11 @@ void ktCacheString(const KTwchar* s) {
 KTfloat ktStringWidthInPixels(const KTchar* text_in) {
     KTFont::ptr font = fonts_[current_font_];
     
-    std::string text_utf8(text_in);
-    std::vector<uint32_t> text;
-    utf8::utf8to32(text_utf8.begin(), text_utf8.end(), std::back_inserter(text));
     int len = 0;
-    for(std::vector<uint32_t>::const_iterator it = text.begin(); it != text.end(); ++it) {
-        uint32_t ch = (*it);
+    const KTchar* it = text_in;
+    const KTchar* end = text_in + strlen(text_in);
+    while(it != end) {
+        uint32_t ch = utf8::next(it, end);
         font->generate_glyph_texture(ch);
         len += font->get_char_advance_x(ch);
     }
@@ -16,6 +16,7 @@ typedef float KTfloat;
 void ktGenFonts(KTsizei n, KTuint* fonts);
 void ktBindFont(KTuint font);
 void ktLoadFont(const KTchar* filename, const KTsizei font_size);
+void ktLoadFontFromMemory(const unsigned char* data, const KTsizei length, const KTsizei font_size); //Copies the data
 void ktDrawText(KTfloat x, KTfloat y, const KTchar* text);
 void ktDrawTextCentred(KTfloat x, KTfloat y, const KTchar* text);
 void ktDrawTextWrapped(KTfloat x, KTfloat y, KTfloat width, KTfloat height, const KTchar* text, KTuint alignment);
@@ -102,7 +102,9 @@ BackgroundLayer::~BackgroundLayer() {
 }
 
 Background::Background(Scene *scene):
-    Object(scene) {
+    Object(scene),
+    visible_x_(0),
+    visible_y_(0) {
 
 }
 
@@ -113,6 +115,8 @@ void Background::add_layer(const std::string &image_path) {
     if(layer_count() == 1) {
         set_visible_dimensions(new_layer->width(), new_layer->height());
     }
+
+    mark_render_state_dirty();
 }
 
 void Background::set_visible_dimensions(double width, double height) {
@@ -126,6 +130,19 @@ void Background::set_visible_dimensions(double width, double height) {
 
     visible_x_ = width;
     visible_y_ = height;
+    mark_render_state_dirty();
+}
+
+void Background::publish() {
+    Object::publish();
+
+    background_state_.visible_x = visible_x_;
+    background_state_.visible_y = visible_y_;
+
+    background_state_.layers.clear();
+    for(std::tr1::shared_ptr<BackgroundLayer>& layer: layers_) {
+        background_state_.layers.push_back(layer->mesh_id());
+    }
 }
 
 }
@@ -63,11 +63,31 @@ public:
     double visible_x() const { return visible_x_; }
     double visible_y() const { return visible_y_; }
 
+    /*
+     *  What the renderer draws, as of the last publish (see Object::render_state()). The
+     *  layer meshes aren't in the scene's tree, Scene::publish_frame() publishes them.
+     */
+    struct BackgroundRenderState {
+        BackgroundRenderState():
+            visible_x(0),
+            visible_y(0) {}
+
+        double visible_x;
+        double visible_y;
+        std::vector<MeshID> layers;
+    };
+
+    const BackgroundRenderState& background_state() const { return background_state_; }
+
 private:
     std::vector<std::tr1::shared_ptr<BackgroundLayer> > layers_;
     double visible_x_;
     double visible_y_;
 
+    BackgroundRenderState background_state_;
+
+    void publish();
+
     kmMat4 tmp_projection_;
 
     void destroy() {}
@@ -1,4 +1,6 @@
 
+#include <cmath>
+
 #include "camera.h"
 #include "scene.h"
 #include "window_base.h"
@@ -7,22 +9,30 @@ namespace kglt {
 
 Camera::Camera(Scene *scene, CameraID id):
     Object(scene),
-    generic::Identifiable<CameraID>(id) {
+    generic::Identifiable<CameraID>(id),
+    near_distance_(1.0) {
 
     kmQuaternionRotationYawPitchRoll(&rotation(), 180.0, 0.0, 0.0);
     kmQuaternionNormalize(&rotation(), &rotation());
 
     kmMat4Identity(&projection_matrix_); //Initialize the projection matrix
+    kmMat4Identity(&camera_state_.view_matrix);
+    kmMat4Identity(&camera_state_.projection_matrix);
+    camera_state_.near_distance = near_distance_;
 }
 
 void Camera::set_perspective_projection(double fov, double aspect, double near, double far) {
     kmMat4PerspectiveProjection(&projection_matrix_, fov, aspect, near, far);
+    near_distance_ = near;
     update_frustum();
+    mark_render_state_dirty();
 }
 
 void Camera::set_orthographic_projection(double left, double right, double bottom, double top, double near, double far) {
     kmMat4OrthographicProjection(&projection_matrix_, left, right, bottom, top, near, far);
+    near_distance_ = std::fabs(near);
     update_frustum();
+    mark_render_state_dirty();
 }
 
 double Camera::set_orthographic_projection_from_height(double desired_height_in_units, double ratio) {
@@ -31,4 +41,15 @@ double Camera::set_orthographic_projection_from_height(double desired_height_in_
     return width;
 }
 
+void Camera::publish() {
+    Object::publish();
+
+    apply(&camera_state_.view_matrix);
+    kmMat4Assign(&camera_state_.projection_matrix, &projection_matrix_);
+    camera_state_.near_distance = near_distance_;
+
+    //Culling for the published frame has to match what it's drawn with
+    update_frustum();
+}
+
 }
@@ -45,6 +45,7 @@ public:
     }
 
     Frustum& frustum() { return frustum_; }
+    const Frustum& frustum() const { return frustum_; }
 
     void set_perspective_projection(double fov, double aspect, double near=1.0, double far=1000.0f);
     void set_orthographic_projection(double left, double right, double bottom, double top, double near=-1.0, double far=1.0);
@@ -52,9 +53,17 @@ public:
 
     const kmMat4& projection_matrix() const { return projection_matrix_; }
 
-private:
-    Frustum frustum_;
-    kmMat4 projection_matrix_;
+    /*
+     *  The view and projection the renderer uses, as of the last publish (see
+     *  Object::render_state()). The frustum is rebuilt when they're published.
+     */
+    struct CameraRenderState {
+        kmMat4 view_matrix;
+        kmMat4 projection_matrix;
+        float near_distance; ///< How far in front of the camera the near plane is
+    };
+
+    const CameraRenderState& camera_state() const { return camera_state_; }
 
     void update_frustum() {
         kmMat4 modelview;
@@ -63,6 +72,15 @@ private:
         kmMat4Multiply(&mvp, &projection_matrix_, &modelview);
         frustum_.build(&mvp); //Update the frustum for this camera
     }
+
+private:
+    Frustum frustum_;
+    kmMat4 projection_matrix_;
+    float near_distance_;
+
+    CameraRenderState camera_state_;
+
+    void publish();
 };
 
 }
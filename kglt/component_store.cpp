@@ -0,0 +1,186 @@
+#include <cassert>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "component_store.h"
+#include "object.h"
+
+namespace kglt {
+
+template<typename Function>
+void ComponentStore::for_each_array(const Function& func) {
+    std::vector<float>* arrays[] = {
+        &x_, &y_, &z_,
+        &velocity_x_, &velocity_y_, &velocity_z_,
+        &min_x_, &min_y_, &min_z_, &max_x_, &max_y_, &max_z_,
+        &world_min_x_, &world_min_y_, &world_min_z_, &world_max_x_, &world_max_y_, &world_max_z_
+    };
+
+    for(std::vector<float>* array: arrays) {
+        func(*array);
+    }
+}
+
+ComponentStore::~ComponentStore() {
+    clear();
+}
+
+uint32_t ComponentStore::add(Object& owner) {
+    assert(owner.component_ == NO_ENTRY);
+
+    uint32_t entry = owners_.size();
+    owners_.push_back(&owner);
+    renderables_.push_back(0);
+    for_each_array([](std::vector<float>& array) { array.push_back(0); });
+
+    owner.component_ = entry;
+    set_position(entry, owner.position());
+    return entry;
+}
+
+void ComponentStore::remove(uint32_t entry) {
+    assert(entry < owners_.size());
+
+    owners_[entry]->component_ = NO_ENTRY;
+
+    //Move the last entry into the gap
+    uint32_t last = owners_.size() - 1;
+    if(entry != last) {
+        owners_[entry] = owners_[last];
+        owners_[entry]->component_ = entry;
+        renderables_[entry] = renderables_[last];
+        for_each_array([=](std::vector<float>& array) { array[entry] = array[last]; });
+    }
+
+    owners_.pop_back();
+    renderables_.pop_back();
+    for_each_array([](std::vector<float>& array) { array.pop_back(); });
+}
+
+void ComponentStore::clear() {
+    for(Object* owner: owners_) {
+        owner->component_ = NO_ENTRY;
+    }
+
+    owners_.clear();
+    renderables_.clear();
+    for_each_array([](std::vector<float>& array) { array.clear(); });
+}
+
+void ComponentStore::set_position(uint32_t entry, const kmVec3& position) {
+    x_[entry] = position.x;
+    y_[entry] = position.y;
+    z_[entry] = position.z;
+}
+
+kmVec3 ComponentStore::velocity(uint32_t entry) const {
+    kmVec3 result;
+    kmVec3Fill(&result, velocity_x_[entry], velocity_y_[entry], velocity_z_[entry]);
+    return result;
+}
+
+void ComponentStore::set_velocity(uint32_t entry, const kmVec3& velocity) {
+    velocity_x_[entry] = velocity.x;
+    velocity_y_[entry] = velocity.y;
+    velocity_z_[entry] = velocity.z;
+}
+
+void ComponentStore::set_bounds(uint32_t entry, const AABB& bounds) {
+    min_x_[entry] = bounds.min.x;
+    min_y_[entry] = bounds.min.y;
+    min_z_[entry] = bounds.min.z;
+    max_x_[entry] = bounds.max.x;
+    max_y_[entry] = bounds.max.y;
+    max_z_[entry] = bounds.max.z;
+}
+
+void ComponentStore::set_renderable(uint32_t entry, MeshID mesh) {
+    renderables_[entry] = mesh;
+}
+
+//out[i] = a[i] + b[i] * scale
+static void multiply_add(float* out, const float* a, const float* b, float scale, uint32_t count) {
+    uint32_t i = 0;
+
+#ifdef __SSE__
+    __m128 s = _mm_set1_ps(scale);
+    for(; i + 4 <= count; i += 4) {
+        __m128 result = _mm_add_ps(_mm_loadu_ps(a + i), _mm_mul_ps(_mm_loadu_ps(b + i), s));
+        _mm_storeu_ps(out + i, result);
+    }
+#endif
+
+    for(; i < count; ++i) {
+        out[i] = a[i] + b[i] * scale;
+    }
+}
+
+void ComponentStore::integrate(double dt) {
+    uint32_t count = owners_.size();
+    if(!count) {
+        return;
+    }
+
+    float step = dt;
+    multiply_add(&x_[0], &x_[0], &velocity_x_[0], step, count);
+    multiply_add(&y_[0], &y_[0], &velocity_y_[0], step, count);
+    multiply_add(&z_[0], &z_[0], &velocity_z_[0], step, count);
+
+    for(uint32_t i = 0; i < count; ++i) {
+        Object* owner = owners_[i];
+        kmVec3Fill(&owner->position_, x_[i], y_[i], z_[i]);
+        owner->invalidate_transform();
+    }
+}
+
+void ComponentStore::update_bounds() {
+    uint32_t count = owners_.size();
+    if(!count) {
+        return;
+    }
+
+    //Borrow the world arrays for the positions, the bounds are added on in place
+    for(uint32_t i = 0; i < count; ++i) {
+        const kmVec3& position = owners_[i]->absolute_position();
+        world_min_x_[i] = world_max_x_[i] = position.x;
+        world_min_y_[i] = world_max_y_[i] = position.y;
+        world_min_z_[i] = world_max_z_[i] = position.z;
+    }
+
+    multiply_add(&world_min_x_[0], &world_min_x_[0], &min_x_[0], 1.0f, count);
+    multiply_add(&world_min_y_[0], &world_min_y_[0], &min_y_[0], 1.0f, count);
+    multiply_add(&world_min_z_[0], &world_min_z_[0], &min_z_[0], 1.0f, count);
+    multiply_add(&world_max_x_[0], &world_max_x_[0], &max_x_[0], 1.0f, count);
+    multiply_add(&world_max_y_[0], &world_max_y_[0], &max_y_[0], 1.0f, count);
+    multiply_add(&world_max_z_[0], &world_max_z_[0], &max_z_[0], 1.0f, count);
+}
+
+void ComponentStore::visible_renderables(const Frustum& frustum, std::vector<MeshID>& out) {
+    out.clear();
+
+    uint32_t count = owners_.size();
+    if(!count) {
+        return;
+    }
+
+    visibility_.resize((count + 31) / 32);
+    frustum.cull_aabbs(world_bounds(), count, &visibility_[0]);
+
+    for(uint32_t i = 0; i < count; ++i) {
+        if(renderables_[i] && (visibility_[i / 32] & (1u << (i % 32)))) {
+            out.push_back(renderables_[i]);
+        }
+    }
+}
+
+AABBArrays ComponentStore::world_bounds() const {
+    AABBArrays arrays = {
+        world_min_x_.data(), world_min_y_.data(), world_min_z_.data(),
+        world_max_x_.data(), world_max_y_.data(), world_max_z_.data()
+    };
+    return arrays;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef COMPONENT_STORE_H
+#define COMPONENT_STORE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "kazmath/vec3.h"
+
+#include "types.h"
+#include "frustum.h"
+
+namespace kglt {
+
+class Object;
+
+/*
+ *  Per-object data for things that move every frame (particles, bullets, crowds), kept
+ *  as structure-of-arrays so the systems below can chew through it in batches with SSE
+ *  rather than visiting each object through its virtual methods.
+ *
+ *  Each entry belongs to an Object, which keeps its usual API: move_to() and friends
+ *  write through to the entry, and integrate() writes the new positions back. Objects
+ *  get an entry when they're given a velocity (Object::set_velocity) and lose it when
+ *  they're destroyed. Entries are packed, so removing one moves the last into its place.
+ *
+ *  Positions are the objects' local positions, bounds are relative to the object's
+ *  origin, and world bounds are those offset by the object's absolute position.
+ */
+class ComponentStore {
+public:
+    static const uint32_t NO_ENTRY = ~0u;
+
+    ComponentStore() {}
+    ~ComponentStore();
+
+    uint32_t add(Object& owner);
+    void remove(uint32_t entry);
+    void clear(); ///< Removes every entry, the owners are left without one
+
+    uint32_t size() const { return owners_.size(); }
+    Object& owner(uint32_t entry) { return *owners_[entry]; }
+
+    void set_position(uint32_t entry, const kmVec3& position);
+    kmVec3 velocity(uint32_t entry) const;
+    void set_velocity(uint32_t entry, const kmVec3& velocity);
+    void set_bounds(uint32_t entry, const AABB& bounds);
+    void set_renderable(uint32_t entry, MeshID mesh); ///< The mesh to report from visible_renderables()
+
+    /*
+     *  The systems. integrate() moves every entry along its velocity and tells the owners,
+     *  update_bounds() recalculates the world bounds from the owners' absolute positions
+     *  (so run it after transforms are resolved) and visible_renderables() culls those
+     *  bounds against a frustum.
+     */
+    void integrate(double dt);
+    void update_bounds();
+    void visible_renderables(const Frustum& frustum, std::vector<MeshID>& out);
+
+    AABBArrays world_bounds() const;
+
+private:
+    ComponentStore(const ComponentStore&);
+    ComponentStore& operator=(const ComponentStore&);
+
+    std::vector<Object*> owners_;
+
+    //Transforms
+    std::vector<float> x_, y_, z_;
+
+    //Velocities
+    std::vector<float> velocity_x_, velocity_y_, velocity_z_;
+
+    //Bounds, relative to the owner and in world space
+    std::vector<float> min_x_, min_y_, min_z_;
+    std::vector<float> max_x_, max_y_, max_z_;
+    std::vector<float> world_min_x_, world_min_y_, world_min_z_;
+    std::vector<float> world_max_x_, world_max_y_, world_max_z_;
+
+    //Renderable references
+    std::vector<MeshID> renderables_;
+
+    std::vector<uint32_t> visibility_;
+
+    template<typename Function>
+    void for_each_array(const Function& func);
+};
+
+}
+
+#endif // COMPONENT_STORE_H
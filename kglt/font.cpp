@@ -1,31 +1,115 @@
 #include "font.h"
 #include "kazbase/os/path.h"
 #include "kazbase/exceptions.h"
+#include "utils/gl_thread.h"
 
 namespace kglt {
 
 Font::Font(Scene* scene, FontID id):
     generic::Identifiable<FontID>(id),
-    kt_font_(0) {
-    ktGenFonts(1, &kt_font_);
+    kt_font_(0),
+    font_size_(0),
+    load_pending_(false) {
+
 }
 
 Font::~Font() {
-    ktDeleteFonts(1, &kt_font_);
-    kt_font_ = 0;
+    if(kt_font_) {
+        KTuint font = kt_font_;
+        run_on_gl_thread([=]() { ktDeleteFonts(1, &font); });
+        kt_font_ = 0;
+    }
 }
 
 void Font::initialize(const std::string& ttf_path, const uint32_t font_size) {
     if(!os::path::exists(ttf_path)) {
         throw IOError("TTF file doesn't exist: " + ttf_path);
     }
-    ktBindFont(kt_font_);
-    ktLoadFont(ttf_path.c_str(), font_size);
+    ttf_path_ = ttf_path;
+    ttf_data_.clear();
+    font_size_ = font_size;
+    {
+        boost::mutex::scoped_lock lock(advances_lock_);
+        advances_.reset(); //Measured again once it's loaded at the new size
+    }
+    __atomic_store_n(&load_pending_, true, __ATOMIC_RELEASE); //Publishes the path and size with it
+}
+
+void Font::initialize_from_memory(const std::vector<uint8_t>& ttf_data, const uint32_t font_size) {
+    if(ttf_data.empty()) {
+        throw IOError("No TTF data to load the font from");
+    }
+    ttf_path_.clear();
+    ttf_data_ = ttf_data;
     font_size_ = font_size;
+    {
+        boost::mutex::scoped_lock lock(advances_lock_);
+        advances_.reset();
+    }
+    __atomic_store_n(&load_pending_, true, __ATOMIC_RELEASE);
 }
 
-double Font::string_width_in_pixels(const std::string& str) const {
-    return ktStringWidthInPixels(str.c_str());
+KTuint Font::kt_font() {
+    if(!kt_font_) {
+        ktGenFonts(1, &kt_font_);
+    }
+
+    if(__atomic_exchange_n(&load_pending_, false, __ATOMIC_ACQ_REL)) {
+        ktBindFont(kt_font_);
+        if(!ttf_data_.empty()) {
+            ktLoadFontFromMemory(&ttf_data_[0], ttf_data_.size(), font_size_);
+            ttf_data_.clear(); //kaztext keeps its own copy
+        } else {
+            ktLoadFont(ttf_path_.c_str(), font_size_);
+        }
+        cache_advances();
+    }
+
+    return kt_font_;
+}
+
+void Font::cache_advances() {
+    //kaztext's string width is just the sum of the advances, so a glyph at a time is the same
+    std::tr1::shared_ptr<std::vector<float> > advances(new std::vector<float>(CACHED_ADVANCES, 0));
+    for(uint32_t c = 1; c < CACHED_ADVANCES; ++c) {
+        char str[] = { char(c), '\0' };
+        (*advances)[c] = ktStringWidthInPixels(str);
+    }
+
+    boost::mutex::scoped_lock lock(advances_lock_);
+    advances_ = advances;
+}
+
+double Font::string_width_in_pixels(const std::string& str) {
+    std::tr1::shared_ptr<const std::vector<float> > advances;
+    {
+        boost::mutex::scoped_lock lock(advances_lock_);
+        advances = advances_;
+    }
+
+    if(advances) {
+        double width = 0;
+        bool cached = true;
+        for(char c: str) {
+            if(uint8_t(c) >= CACHED_ADVANCES) {
+                cached = false;
+                break;
+            }
+            width += (*advances)[uint8_t(c)];
+        }
+
+        if(cached) {
+            return width;
+        }
+    }
+
+    //kaztext isn't thread safe, and the font may not have been loaded yet
+    double width = 0;
+    run_on_gl_thread_and_wait([&]() {
+        ktBindFont(kt_font());
+        width = ktStringWidthInPixels(str.c_str());
+    });
+    return width;
 }
 
 }
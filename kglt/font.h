@@ -3,9 +3,12 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 #include <tr1/memory>
+#include <boost/thread/mutex.hpp>
 
 #include "generic/identifiable.h"
+#include "loadable.h"
 #include "kaztext/kaztext.h"
 #include "types.h"
 
@@ -14,6 +17,7 @@ namespace kglt {
 class Scene;
 
 class Font :
+    public Loadable,
     public generic::Identifiable<FontID> {
 
 public:
@@ -22,14 +26,37 @@ public:
     Font(Scene* scene, FontID id);
     ~Font();
 
+    /*
+     *  These can be called from any thread. The kaztext font (and its glyph textures) is
+     *  only created when kt_font() is first called, which has to be on the GL thread.
+     */
     void initialize(const std::string& ttf_path, const uint32_t font_size);
-    double string_width_in_pixels(const std::string& str) const;
+    void initialize_from_memory(const std::vector<uint8_t>& ttf_data, const uint32_t font_size);
+
+    void set_size(uint32_t font_size) { font_size_ = font_size; } ///< The size loaders use when none is given
+    /*
+     *  Any thread. Once the font is loaded, ASCII strings are measured on the calling thread
+     *  from the glyph advances kt_font() caches. Anything else (or a font that hasn't been
+     *  loaded yet) waits for the GL thread to measure it, so keep those off per-frame paths.
+     */
+    double string_width_in_pixels(const std::string& str);
     uint32_t size() const { return font_size_; }
-    KTuint kt_font() const { return kt_font_; } //Underlying kaztext font ID
+    KTuint kt_font(); //Underlying kaztext font ID
 
 private:
     KTuint kt_font_;
     uint32_t font_size_;
+
+    bool load_pending_;
+    std::string ttf_path_;
+    std::vector<uint8_t> ttf_data_;
+
+    static const uint32_t CACHED_ADVANCES = 128; ///< ASCII
+
+    boost::mutex advances_lock_;
+    std::tr1::shared_ptr<const std::vector<float> > advances_; ///< Null until loaded
+
+    void cache_advances();
 };
 
 }
@@ -0,0 +1,41 @@
+#include "glee/GLee.h"
+
+#include "frame_packet.h"
+
+namespace kglt {
+
+void FramePacket::clear() {
+    passes.clear();
+    items.clear(); //Lets go of the geometry buffers
+    material_passes.clear();
+    textures.clear();
+    lights.clear();
+    text.clear();
+}
+
+void FramePacket::upload_geometry() const {
+    for(const RenderItem& item: items) {
+        if(item.type != RENDER_ITEM_MESH || item.buffer->uploaded_version == item.geometry_version) {
+            continue;
+        }
+
+        GeometryBuffer& buffer = *item.buffer;
+        if(!buffer.vbo) {
+            glGenBuffers(1, &buffer.vbo);
+        }
+
+        const std::vector<float>& geometry = *item.geometry;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+        glBufferData(
+            GL_ARRAY_BUFFER,
+            geometry.size() * sizeof(float),
+            geometry.empty() ? nullptr : &geometry[0],
+            GL_STATIC_DRAW
+        );
+        buffer.uploaded_version = item.geometry_version;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+}
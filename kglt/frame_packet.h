@@ -0,0 +1,121 @@
+#ifndef KGLT_FRAME_PACKET_H
+#define KGLT_FRAME_PACKET_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+
+#include "kazmath/mat4.h"
+
+#include "types.h"
+#include "mesh.h"
+#include "material.h"
+#include "light.h"
+#include "pass.h"
+
+namespace kglt {
+
+/*
+ *  One pass of a mesh's material, with the textures it had (animated ones included)
+ *  when the frame was recorded.
+ */
+struct MaterialPassState {
+    ShaderID shader;
+    IterationType iteration;
+    uint32_t max_iterations;
+
+    uint32_t first_texture; ///< Into FramePacket::textures
+    uint32_t texture_count;
+};
+
+enum RenderItemType {
+    RENDER_ITEM_MESH,
+    RENDER_ITEM_TEXT
+};
+
+/*
+ *  Something to draw, with everything the renderer needs to know about it copied in,
+ *  so drawing it doesn't touch the object.
+ */
+struct RenderItem {
+    RenderItemType type;
+
+    kmMat4 modelview;
+    kmMat4 projection;
+
+    //Meshes
+    MeshID mesh_id; ///< 0 for meshes the scene doesn't manage itself, e.g. submeshes
+    uint64_t uuid;
+    std::tr1::shared_ptr<GeometryBuffer> buffer;
+    std::tr1::shared_ptr<const std::vector<float> > geometry; ///< Shared with the mesh's published state
+    uint32_t geometry_version; ///< Uploaded if the buffer holds an older one
+    MeshArrangement arrangement;
+    uint32_t draw_count;
+
+    AABB bounds; ///< Relative to the mesh
+    bool camera_inside_bounds;
+    bool depth_test;
+    bool depth_writes;
+    bool occlusion_culling;
+
+    uint32_t first_pass; ///< Into FramePacket::material_passes
+    uint32_t pass_count;
+    uint32_t first_light; ///< Into FramePacket::lights
+    uint32_t light_count;
+
+    //Text
+    FontID font;
+    uint32_t font_size;
+    uint32_t first_char; ///< Into FramePacket::text, where the run is followed by a NUL
+    uint32_t char_count;
+};
+
+/*
+ *  A render pass: the scene's Pass as it was, and the run of items its renderer recorded.
+ */
+struct PassPacket {
+    PassPacket(const Pass& pass):
+        pass(pass),
+        first_item(0),
+        item_count(0) {}
+
+    Pass pass;
+    RenderOptions options;
+
+    uint32_t first_item; ///< Into FramePacket::items
+    uint32_t item_count;
+};
+
+/*
+ *  Everything needed to draw a frame, recorded by Scene::prepare_frame() from the state
+ *  Scene::publish_frame() published, and drawn by Scene::render_frame(). Nothing in here
+ *  may point into the scene other than resources (textures, shaders and fonts), which the
+ *  scene doesn't delete until the packets that could use them have been drawn.
+ *
+ *  Packets are reused, clear() keeps the memory, so recording a frame stops allocating
+ *  once the packets have grown to fit.
+ */
+class FramePacket {
+public:
+    FramePacket():
+        frame(0) {}
+
+    void clear();
+
+    void upload_geometry() const; ///< GL thread only. Fills the buffers of items whose geometry changed
+
+    uint64_t frame;
+    Colour ambient_light;
+
+    std::vector<PassPacket> passes;
+    std::vector<RenderItem> items;
+    std::vector<MaterialPassState> material_passes;
+    std::vector<TextureID> textures;
+    std::vector<LightState> lights;
+    std::string text;
+};
+
+}
+
+#endif // KGLT_FRAME_PACKET_H
@@ -1,16 +1,213 @@
 #include <cassert>
+#include <algorithm>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "frustum.h"
 
 namespace kglt {
 
+namespace {
+
+/*
+ *  The batch culling kernels. Each tester knows how to test one kind of bounds
+ *  against a plane, either one at a time or (with SSE) four at a time.
+ */
+struct SphereTester {
+    const SphereArrays& spheres;
+
+    SphereTester(const SphereArrays& spheres):
+        spheres(spheres) {}
+
+    void test(uint32_t i, const kmPlane& plane, bool& outside, bool& inside) const {
+        float d = plane.a * spheres.x[i] + plane.b * spheres.y[i] + plane.c * spheres.z[i] + plane.d;
+        outside = d < -spheres.radius[i];
+        inside = d >= spheres.radius[i];
+    }
+
+#ifdef __SSE__
+    void test4(uint32_t i, const kmPlane& plane, __m128& outside, __m128& inside) const {
+        __m128 d = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(plane.a), _mm_loadu_ps(spheres.x + i)),
+                _mm_mul_ps(_mm_set1_ps(plane.b), _mm_loadu_ps(spheres.y + i))
+            ),
+            _mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(plane.c), _mm_loadu_ps(spheres.z + i)),
+                _mm_set1_ps(plane.d)
+            )
+        );
+
+        __m128 radius = _mm_loadu_ps(spheres.radius + i);
+        outside = _mm_cmplt_ps(d, _mm_sub_ps(_mm_setzero_ps(), radius));
+        inside = _mm_cmpge_ps(d, radius);
+    }
+#endif
+};
+
+struct AABBTester {
+    const AABBArrays& boxes;
+
+    AABBTester(const AABBArrays& boxes):
+        boxes(boxes) {}
+
+    void test(uint32_t i, const kmPlane& plane, bool& outside, bool& inside) const {
+        //The corner furthest along the normal decides if it's outside, the nearest if it's inside
+        float px = (plane.a >= 0) ? boxes.max_x[i] : boxes.min_x[i];
+        float py = (plane.b >= 0) ? boxes.max_y[i] : boxes.min_y[i];
+        float pz = (plane.c >= 0) ? boxes.max_z[i] : boxes.min_z[i];
+        float nx = (plane.a >= 0) ? boxes.min_x[i] : boxes.max_x[i];
+        float ny = (plane.b >= 0) ? boxes.min_y[i] : boxes.max_y[i];
+        float nz = (plane.c >= 0) ? boxes.min_z[i] : boxes.max_z[i];
+
+        outside = (plane.a * px + plane.b * py + plane.c * pz + plane.d) < 0;
+        inside = (plane.a * nx + plane.b * ny + plane.c * nz + plane.d) >= 0;
+    }
+
+#ifdef __SSE__
+    void test4(uint32_t i, const kmPlane& plane, __m128& outside, __m128& inside) const {
+        //The plane is the same for all four boxes, so the corner choice is too
+        const float* px = (plane.a >= 0) ? boxes.max_x : boxes.min_x;
+        const float* py = (plane.b >= 0) ? boxes.max_y : boxes.min_y;
+        const float* pz = (plane.c >= 0) ? boxes.max_z : boxes.min_z;
+        const float* nx = (plane.a >= 0) ? boxes.min_x : boxes.max_x;
+        const float* ny = (plane.b >= 0) ? boxes.min_y : boxes.max_y;
+        const float* nz = (plane.c >= 0) ? boxes.min_z : boxes.max_z;
+
+        __m128 a = _mm_set1_ps(plane.a);
+        __m128 b = _mm_set1_ps(plane.b);
+        __m128 c = _mm_set1_ps(plane.c);
+        __m128 d = _mm_set1_ps(plane.d);
+
+        __m128 positive = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(px + i)), _mm_mul_ps(b, _mm_loadu_ps(py + i))),
+            _mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(pz + i)), d)
+        );
+
+        __m128 negative = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(nx + i)), _mm_mul_ps(b, _mm_loadu_ps(ny + i))),
+            _mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(nz + i)), d)
+        );
+
+        outside = _mm_cmplt_ps(positive, _mm_setzero_ps());
+        inside = _mm_cmpge_ps(negative, _mm_setzero_ps());
+    }
+#endif
+};
+
+template<typename Tester>
+uint32_t cull_batch(const kmPlane* planes, const Tester& tester, uint32_t count, uint32_t* visible_out,
+                    uint8_t* inside_out, uint8_t* plane_cache, uint8_t plane_mask) {
+
+    std::fill(visible_out, visible_out + ((count + 31) / 32), 0);
+
+    uint32_t visible = 0;
+    uint32_t i = 0;
+
+#ifdef __SSE__
+    for(; i + 4 <= count; i += 4) {
+        __m128 outside = _mm_setzero_ps();
+        uint8_t inside[4] = { 0, 0, 0, 0 };
+
+        //Start with the plane that rejected the first of these last time, neighbours tend to agree
+        uint32_t first = (plane_cache && plane_cache[i] < FRUSTUM_PLANE_MAX) ? plane_cache[i] : 0;
+
+        for(uint32_t n = 0; n < FRUSTUM_PLANE_MAX; ++n) {
+            uint32_t p = (first + n) % FRUSTUM_PLANE_MAX;
+            if(!(plane_mask & (1 << p))) {
+                continue;
+            }
+
+            __m128 plane_outside, plane_inside;
+            tester.test4(i, planes[p], plane_outside, plane_inside);
+
+            if(plane_cache) {
+                int rejected = _mm_movemask_ps(_mm_andnot_ps(outside, plane_outside));
+                for(uint32_t lane = 0; lane < 4; ++lane) {
+                    if(rejected & (1 << lane)) {
+                        plane_cache[i + lane] = p;
+                    }
+                }
+            }
+
+            outside = _mm_or_ps(outside, plane_outside);
+
+            int inside_lanes = _mm_movemask_ps(plane_inside);
+            for(uint32_t lane = 0; lane < 4; ++lane) {
+                if(inside_lanes & (1 << lane)) {
+                    inside[lane] |= (1 << p);
+                }
+            }
+
+            if(_mm_movemask_ps(outside) == 0xF) {
+                break; //All four are outside, no point testing any more planes
+            }
+        }
+
+        int outside_lanes = _mm_movemask_ps(outside);
+        for(uint32_t lane = 0; lane < 4; ++lane) {
+            uint32_t idx = i + lane;
+            if(!(outside_lanes & (1 << lane))) {
+                visible_out[idx >> 5] |= (1u << (idx & 31));
+                ++visible;
+            }
+
+            if(inside_out) {
+                inside_out[idx] = inside[lane];
+            }
+        }
+    }
+#endif
+
+    for(; i < count; ++i) {
+        uint32_t first = (plane_cache && plane_cache[i] < FRUSTUM_PLANE_MAX) ? plane_cache[i] : 0;
+
+        bool rejected = false;
+        uint8_t inside = 0;
+        for(uint32_t n = 0; n < FRUSTUM_PLANE_MAX; ++n) {
+            uint32_t p = (first + n) % FRUSTUM_PLANE_MAX;
+            if(!(plane_mask & (1 << p))) {
+                continue;
+            }
+
+            bool plane_outside, plane_inside;
+            tester.test(i, planes[p], plane_outside, plane_inside);
+            if(plane_outside) {
+                if(plane_cache) {
+                    plane_cache[i] = p;
+                }
+                rejected = true;
+                break;
+            }
+
+            if(plane_inside) {
+                inside |= (1 << p);
+            }
+        }
+
+        if(!rejected) {
+            visible_out[i >> 5] |= (1u << (i & 31));
+            ++visible;
+        }
+
+        if(inside_out) {
+            inside_out[i] = inside;
+        }
+    }
+
+    return visible;
+}
+
+}
+
 Frustum::Frustum():
     initialized_(false) {
 
 }
 
 void Frustum::build(const kmMat4* modelview_projection) {
-    planes_.resize(FRUSTUM_PLANE_MAX);
-
     kmPlaneExtractFromMat4(&planes_[FRUSTUM_PLANE_LEFT], modelview_projection, 1);
     kmPlaneExtractFromMat4(&planes_[FRUSTUM_PLANE_RIGHT], modelview_projection, -1);
     kmPlaneExtractFromMat4(&planes_[FRUSTUM_PLANE_BOTTOM], modelview_projection, 2);
@@ -18,7 +215,6 @@ void Frustum::build(const kmMat4* modelview_projection) {
     kmPlaneExtractFromMat4(&planes_[FRUSTUM_PLANE_NEAR], modelview_projection, 3);
     kmPlaneExtractFromMat4(&planes_[FRUSTUM_PLANE_FAR], modelview_projection, -3);
 
-    near_corners_.resize(FRUSTUM_CORNER_MAX);
     kmPlaneGetIntersection(
         &near_corners_[FRUSTUM_CORNER_BOTTOM_LEFT],
         &planes_[FRUSTUM_PLANE_LEFT],
@@ -47,7 +243,6 @@ void Frustum::build(const kmMat4* modelview_projection) {
         &planes_[FRUSTUM_PLANE_NEAR]
     );
 
-    far_corners_.resize(FRUSTUM_CORNER_MAX);
     kmPlaneGetIntersection(
         &far_corners_[FRUSTUM_CORNER_BOTTOM_LEFT],
         &planes_[FRUSTUM_PLANE_LEFT],
@@ -81,15 +276,66 @@ void Frustum::build(const kmMat4* modelview_projection) {
 }
 
 std::vector<kmVec3> Frustum::near_corners() const {
-    return near_corners_;
+    return std::vector<kmVec3>(near_corners_, near_corners_ + FRUSTUM_CORNER_MAX);
 }
 
 std::vector<kmVec3> Frustum::far_corners() const {
-    return far_corners_;
+    return std::vector<kmVec3>(far_corners_, far_corners_ + FRUSTUM_CORNER_MAX);
 }
 
 bool Frustum::contains_point(const kmVec3& point) const {
-    assert(0 && "Not implemented");
+    assert(initialized_);
+
+    //The planes face inwards, so anything behind one of them is outside
+    for(const kmPlane& plane: planes_) {
+        if(kmPlaneDotCoord(&plane, &point) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersects_sphere(const kmVec3& centre, float radius) const {
+    assert(initialized_);
+
+    for(const kmPlane& plane: planes_) {
+        if(kmPlaneDotCoord(&plane, &centre) < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+FrustumClassification Frustum::classify_aabb(const AABB& box) const {
+    uint8_t inside = 0;
+    return classify_aabb(box, FRUSTUM_ALL_PLANES, inside);
+}
+
+FrustumClassification Frustum::classify_aabb(const AABB& box, uint8_t plane_mask, uint8_t& inside_out) const {
+    assert(initialized_);
+
+    AABBArrays arrays = { &box.min.x, &box.min.y, &box.min.z, &box.max.x, &box.max.y, &box.max.z };
+
+    uint32_t visible = 0;
+    uint8_t inside = 0;
+    if(!cull_aabbs(arrays, 1, &visible, &inside, nullptr, plane_mask)) {
+        return FRUSTUM_CLASSIFICATION_OUTSIDE;
+    }
+
+    inside_out = inside;
+    return (inside == plane_mask) ? FRUSTUM_CLASSIFICATION_INSIDE : FRUSTUM_CLASSIFICATION_INTERSECTS;
+}
+
+uint32_t Frustum::cull_spheres(const SphereArrays& spheres, uint32_t count, uint32_t* visible_out,
+                               uint8_t* inside_out, uint8_t* plane_cache, uint8_t plane_mask) const {
+    assert(initialized_);
+    return cull_batch(planes_, SphereTester(spheres), count, visible_out, inside_out, plane_cache, plane_mask);
+}
+
+uint32_t Frustum::cull_aabbs(const AABBArrays& boxes, uint32_t count, uint32_t* visible_out,
+                             uint8_t* inside_out, uint8_t* plane_cache, uint8_t plane_mask) const {
+    assert(initialized_);
+    return cull_batch(planes_, AABBTester(boxes), count, visible_out, inside_out, plane_cache, plane_mask);
 }
 
 }
@@ -6,6 +6,8 @@
 #include <cstdint>
 #include <vector>
 
+#include "types.h"
+
 namespace kglt {
 
 enum FrustumCorner {
@@ -26,6 +28,34 @@ enum FrustumPlane {
     FRUSTUM_PLANE_MAX
 };
 
+const uint8_t FRUSTUM_ALL_PLANES = (1 << FRUSTUM_PLANE_MAX) - 1;
+
+/*
+ *  Bounds stored as a structure of arrays, so that several of them can be
+ *  tested against a plane at once by the batch culling functions
+ */
+struct SphereArrays {
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* radius;
+};
+
+struct AABBArrays {
+    const float* min_x;
+    const float* min_y;
+    const float* min_z;
+    const float* max_x;
+    const float* max_y;
+    const float* max_z;
+};
+
+enum FrustumClassification {
+    FRUSTUM_CLASSIFICATION_OUTSIDE = 0,
+    FRUSTUM_CLASSIFICATION_INTERSECTS,
+    FRUSTUM_CLASSIFICATION_INSIDE
+};
+
 class Frustum {
 public:
     Frustum();
@@ -34,7 +64,33 @@ public:
 
     std::vector<kmVec3> near_corners() const; ///< Returns the near 4 corners of the frustum
     std::vector<kmVec3> far_corners() const; ///< Returns the far 4 corners of the frustum
+    const kmVec3& near_corner(FrustumCorner corner) const { return near_corners_[corner]; }
+    const kmVec3& far_corner(FrustumCorner corner) const { return far_corners_[corner]; }
     bool contains_point(const kmVec3& point) const; ///< Returns true if the frustum contains point
+    bool intersects_sphere(const kmVec3& centre, float radius) const; ///< Returns true if any part of the sphere is inside the frustum
+    FrustumClassification classify_aabb(const AABB& box) const; ///< Returns whether the box is outside, straddling or entirely inside the frustum
+
+    /*
+     *  Hierarchical version of classify_aabb. Only the planes in plane_mask are tested
+     *  and inside_out receives the planes that the box is entirely inside, which its
+     *  children don't need to test again.
+     */
+    FrustumClassification classify_aabb(const AABB& box, uint8_t plane_mask, uint8_t& inside_out) const;
+
+    /*
+     *  Batch culling, using SSE where available. Bit i of visible_out is set if object i
+     *  is at least partly inside the frustum, visible_out must hold (count + 31) / 32 words.
+     *
+     *  Only the planes in plane_mask are tested. If inside_out is passed, it receives
+     *  the planes each object is fully inside. If plane_cache is passed, each entry is
+     *  the plane that last rejected the object, that plane is tested first and the
+     *  entry is updated. Returns the number of visible objects.
+     */
+    uint32_t cull_spheres(const SphereArrays& spheres, uint32_t count, uint32_t* visible_out,
+                          uint8_t* inside_out=nullptr, uint8_t* plane_cache=nullptr, uint8_t plane_mask=FRUSTUM_ALL_PLANES) const;
+
+    uint32_t cull_aabbs(const AABBArrays& boxes, uint32_t count, uint32_t* visible_out,
+                        uint8_t* inside_out=nullptr, uint8_t* plane_cache=nullptr, uint8_t plane_mask=FRUSTUM_ALL_PLANES) const;
     bool initialized() const { return initialized_; }
 
     double near_height() const {
@@ -93,9 +149,9 @@ public:
 private:
     bool initialized_;
 
-    std::vector<kmVec3> near_corners_;
-    std::vector<kmVec3> far_corners_;
-    std::vector<kmPlane> planes_;
+    kmVec3 near_corners_[FRUSTUM_CORNER_MAX];
+    kmVec3 far_corners_[FRUSTUM_CORNER_MAX];
+    kmPlane planes_[FRUSTUM_PLANE_MAX];
 };
 
 }
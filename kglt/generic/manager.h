@@ -2,9 +2,12 @@
 #define MANAGER_H
 
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <sigc++/sigc++.h>
 #include "kazbase/list_utils.h"
+#include "object_pool.h"
 
 namespace kglt {
 namespace generic {
@@ -23,67 +26,183 @@ protected:
     mutable boost::recursive_mutex manager_lock_;
 };
 
-template<typename T>
-class IncrementalGetNextID {
+class TooManyObjectsError : public std::runtime_error {
 public:
-    T operator()() {
-        static T counter = 0;
-        return ++counter;
-    }
+    TooManyObjectsError():
+        std::runtime_error("The manager has run out of slots for new objects") {}
 };
 
-template<typename Derived, typename ObjectType, typename ObjectIDType, typename NewIDGenerator=IncrementalGetNextID<ObjectIDType> >
+/*
+ *  The IDs a TemplatedManager hands out are generational handles. The low bits are the
+ *  index of the object's slot, the high bits count how many times that slot has been
+ *  reused, so an ID kept after its object was deleted won't match whatever takes the
+ *  slot next. Generations start at 1, so 0 is never a valid ID. A slot whose generation
+ *  has reached MAX_GENERATION is retired when its object is deleted rather than wrapping
+ *  round, which would make IDs from its first generations valid again.
+ */
+namespace handle {
+
+const uint32_t INDEX_BITS = 20;
+const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+const uint32_t MAX_INDEX = INDEX_MASK;
+const uint32_t MAX_GENERATION = (1u << (32 - INDEX_BITS)) - 1;
+
+inline uint32_t make(uint32_t index, uint32_t generation) { return (generation << INDEX_BITS) | index; }
+inline uint32_t index(uint32_t id) { return id & INDEX_MASK; }
+inline uint32_t generation(uint32_t id) { return id >> INDEX_BITS; }
+
+}
+
+/*
+ *  Objects live in a chunked ObjectPool rather than each being a separate allocation, so
+ *  their addresses never change and freed memory is reused. IDs are looked up in a slot
+ *  map (see handle above), and the manager keeps a dense list of every object for
+ *  iterating. Once everything has grown, creating and deleting objects doesn't allocate
+ *  (beyond whatever the object's own constructor does).
+ *
+ *  Lookups (manager_get, manager_contains) take no lock, so any number of threads can
+ *  query at once. Slots are stored in fixed pages that are never moved or freed until
+ *  the manager goes, and each slot publishes its current ID atomically, so a reader
+ *  either sees a live object or nothing. Creating and deleting are serialised by
+ *  manager_lock_. As before, it's up to the caller not to delete an object while
+ *  another thread is still using it, and manager_objects() is for the thread that
+ *  creates and deletes.
+ *
+ *  ObjectType must have an id() method returning the ID it was constructed with, which
+ *  every generic::Identifiable does.
+ */
+template<typename Derived, typename ObjectType, typename ObjectIDType>
 class TemplatedManager : public virtual BaseManager {
 public:
+    TemplatedManager():
+        slot_count_(0),
+        free_slot_(NO_SLOT) {
+
+        std::fill(pages_, pages_ + PAGE_COUNT, (Slot*) nullptr);
+    }
+
+    virtual ~TemplatedManager() {
+        for(ObjectType* object: dense_objects_) {
+            pool_.destroy(object);
+        }
+
+        for(Slot* page: pages_) {
+            delete [] page;
+        }
+    }
+
     ObjectIDType manager_new() {
         ObjectIDType id = 0;
+        ObjectType* object = nullptr;
         {
             boost::recursive_mutex::scoped_lock lock(manager_lock_);
-            id = NewIDGenerator()();
-            objects_.insert(std::make_pair(id, typename ObjectType::ptr(new ObjectType((Derived*)this, id))));
+
+            uint32_t index = free_slot_;
+            if(index == NO_SLOT) {
+                index = add_slot();
+            } else {
+                free_slot_ = slot(index).next_free;
+                slot(index).next_free = NO_SLOT;
+            }
+
+            id = handle::make(index, slot(index).generation);
+
+            try {
+                object = pool_.create((Derived*)this, id);
+            } catch(...) {
+                slot(index).next_free = free_slot_;
+                free_slot_ = index;
+                throw;
+            }
+
+            Slot& s = slot(index);
+            s.dense_index = dense_objects_.size();
+
+            //Readers check live_id first, so the object has to be in place before it changes
+            __atomic_store_n(&s.object, object, __ATOMIC_RELEASE);
+            __atomic_store_n(&s.live_id, id, __ATOMIC_RELEASE);
+
+            dense_objects_.push_back(object);
+            dense_slots_.push_back(index);
         }
 
-        signal_post_create_(*objects_[id], id);
+        signal_post_create_(*object, id);
 
         return id;
     }
 
     void manager_delete(ObjectIDType id) {
-        if(manager_contains(id)) {
-            boost::recursive_mutex::scoped_lock lock(manager_lock_);
+        boost::recursive_mutex::scoped_lock lock(manager_lock_);
 
-            ObjectType& obj = *objects_[id];
-            signal_pre_delete_(obj, id);
+        ObjectType* object = lookup(id);
+        if(!object) {
+            return;
+        }
 
-            if(manager_contains(id)) {
-                objects_.erase(id);
-            }
+        signal_pre_delete_(*object, id);
+
+        //The signal handlers might have deleted it already
+        if(!lookup(id)) {
+            return;
+        }
+
+        uint32_t index = handle::index(id);
+        Slot& s = slot(index);
+
+        __atomic_store_n(&s.live_id, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&s.object, (ObjectType*) nullptr, __ATOMIC_RELEASE);
+
+        //Swap the last object into the gap so the dense list stays packed
+        uint32_t last = dense_objects_.size() - 1;
+        if(s.dense_index != last) {
+            dense_objects_[s.dense_index] = dense_objects_[last];
+            dense_slots_[s.dense_index] = dense_slots_[last];
+            slot(dense_slots_[s.dense_index]).dense_index = s.dense_index;
         }
+        dense_objects_.pop_back();
+        dense_slots_.pop_back();
+
+        //Bumping the generation is what makes any copies of the old ID stale. Once there
+        //are none left the slot is never reused, new objects take other slots
+        if(s.generation < handle::MAX_GENERATION) {
+            ++s.generation;
+            s.next_free = free_slot_;
+            free_slot_ = index;
+        }
+
+        pool_.destroy(object);
     }
 
     ObjectType& manager_get(ObjectIDType id) {
-        boost::recursive_mutex::scoped_lock lock(manager_lock_);
-
-        if(!container::contains(objects_, id)) {
+        ObjectType* object = lookup(id);
+        if(!object) {
             throw NoSuchObjectError();
         }
 
-        return *objects_[id];
+        return *object;
     }
 
     const ObjectType& manager_get(ObjectIDType id) const {
-        boost::recursive_mutex::scoped_lock lock(manager_lock_);
-        if(!container::contains(objects_, id)) {
+        const ObjectType* object = lookup(id);
+        if(!object) {
             throw NoSuchObjectError();
         }
-        typename std::map<ObjectIDType, typename ObjectType::ptr>::const_iterator it = objects_.find(id);
-        return *(it->second);
+
+        return *object;
     }
 
     bool manager_contains(ObjectIDType id) const {
-        return objects_.find(id) != objects_.end();
+        return lookup(id) != nullptr;
     }
 
+    uint32_t manager_count() const { return dense_objects_.size(); }
+
+    /*
+     *  Every object, in no particular order. The list is packed, so this is the fast way
+     *  to visit them all, but deleting an object reorders it.
+     */
+    const std::vector<ObjectType*>& manager_objects() const { return dense_objects_; }
+
     sigc::signal<void, ObjectType&, ObjectIDType>& signal_post_create() { return signal_post_create_; }
     sigc::signal<void, ObjectType&, ObjectIDType>& signal_pre_delete() { return signal_pre_delete_; }
 
@@ -91,17 +210,77 @@ private:
     sigc::signal<void, ObjectType&, ObjectIDType> signal_post_create_;
     sigc::signal<void, ObjectType&, ObjectIDType> signal_pre_delete_;
 
-protected:
-    std::map<ObjectIDType, typename ObjectType::ptr> objects_;
+    static const uint32_t NO_SLOT = ~0u;
+    static const uint32_t PAGE_BITS = 10;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static const uint32_t PAGE_COUNT = (handle::MAX_INDEX + 1) / PAGE_SIZE;
 
-    ObjectIDType _get_object_id_from_ptr(ObjectType* ptr) {
-        for(std::pair<ObjectIDType, typename ObjectType::ptr> pair: objects_) {
-            if(pair.second.get() == ptr) {
-                return pair.first;
+    struct Slot {
+        ObjectIDType live_id; ///< The ID of the object in the slot, 0 while it's free. Read by lookup()
+        ObjectType* object; ///< Read by lookup()
+        uint32_t generation;
+        uint32_t dense_index;
+        uint32_t next_free;
+    };
+
+    ObjectPool<ObjectType, 32> pool_;
+
+    Slot* pages_[PAGE_COUNT];
+    uint32_t slot_count_; ///< Published after a new slot's page exists, so readers can trust it
+    uint32_t free_slot_; ///< Head of the list of free slots, linked through Slot::next_free
+
+    std::vector<ObjectType*> dense_objects_;
+    std::vector<uint32_t> dense_slots_; ///< Parallel to dense_objects_
+
+    Slot& slot(uint32_t index) const {
+        return pages_[index >> PAGE_BITS][index & (PAGE_SIZE - 1)];
+    }
+
+    uint32_t add_slot() {
+        uint32_t index = slot_count_;
+        if(index > handle::MAX_INDEX) {
+            throw TooManyObjectsError();
+        }
+
+        Slot*& page = pages_[index >> PAGE_BITS];
+        if(!page) {
+            Slot* new_page = new Slot[PAGE_SIZE];
+            for(uint32_t i = 0; i < PAGE_SIZE; ++i) {
+                Slot empty = { 0, nullptr, 1, 0, NO_SLOT };
+                new_page[i] = empty;
             }
+            __atomic_store_n(&page, new_page, __ATOMIC_RELEASE);
+        }
+
+        __atomic_store_n(&slot_count_, index + 1, __ATOMIC_RELEASE);
+        return index;
+    }
+
+    ObjectType* lookup(ObjectIDType id) const {
+        uint32_t index = handle::index(id);
+        if(index >= __atomic_load_n(&slot_count_, __ATOMIC_ACQUIRE)) {
+            return nullptr;
         }
 
-        return 0;
+        const Slot& s = slot(index);
+        if(__atomic_load_n(&s.live_id, __ATOMIC_ACQUIRE) != id || !id) {
+            return nullptr;
+        }
+
+        ObjectType* object = __atomic_load_n(&s.object, __ATOMIC_ACQUIRE);
+
+        //If the slot was emptied and refilled while we read it, the object isn't ours
+        if(__atomic_load_n(&s.live_id, __ATOMIC_ACQUIRE) != id) {
+            return nullptr;
+        }
+        return object;
+    }
+
+protected:
+    ObjectIDType _get_object_id_from_ptr(ObjectType* ptr) {
+        //Objects that aren't ours (e.g. submeshes) won't be in the slot their ID points at
+        ObjectIDType id = ptr->id();
+        return (lookup(id) == ptr) ? id : 0;
     }
 };
 
@@ -0,0 +1,149 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+namespace kglt {
+namespace generic {
+
+/*
+ *  Hands out fixed-size blocks of memory carved from larger chunks. Freed blocks go on an
+ *  intrusive free list and are reused before any new chunk is allocated, so once a pool
+ *  has grown to its peak size allocating and freeing never touch the heap. Blocks never
+ *  move, and chunks are only released when the pool is destroyed.
+ *
+ *  A block size of 0 means "whatever size is asked for first", which is handy when the
+ *  size isn't known up front.
+ */
+class BlockPool {
+public:
+    BlockPool(std::size_t block_size=0, uint32_t blocks_per_chunk=64):
+        block_size_(0),
+        blocks_per_chunk_(blocks_per_chunk),
+        free_list_(nullptr),
+        allocated_(0) {
+
+        if(block_size) {
+            set_block_size(block_size);
+        }
+    }
+
+    ~BlockPool() {
+        for(char* chunk: chunks_) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* allocate(std::size_t size) {
+        if(!block_size_) {
+            set_block_size(size);
+        }
+
+        if(size > block_size_) {
+            //Too big for the pool, shouldn't happen but better than failing
+            return ::operator new(size);
+        }
+
+        if(!free_list_) {
+            add_chunk();
+        }
+
+        FreeBlock* block = free_list_;
+        free_list_ = block->next;
+        ++allocated_;
+        return block;
+    }
+
+    void deallocate(void* ptr, std::size_t size) {
+        if(size > block_size_) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = free_list_;
+        free_list_ = block;
+        --allocated_;
+    }
+
+    uint32_t allocated() const { return allocated_; }
+    uint32_t capacity() const { return chunks_.size() * blocks_per_chunk_; }
+    std::size_t block_size() const { return block_size_; }
+
+private:
+    BlockPool(const BlockPool&);
+    BlockPool& operator=(const BlockPool&);
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::size_t block_size_;
+    uint32_t blocks_per_chunk_;
+
+    std::vector<char*> chunks_;
+    FreeBlock* free_list_;
+    uint32_t allocated_;
+
+    void set_block_size(std::size_t size) {
+        //Keep every block aligned for anything operator new would return
+        const std::size_t alignment = __alignof__(long double) > __alignof__(void*) ? __alignof__(long double) : __alignof__(void*);
+        size = std::max(size, sizeof(FreeBlock));
+        block_size_ = (size + alignment - 1) & ~(alignment - 1);
+    }
+
+    void add_chunk() {
+        char* chunk = static_cast<char*>(::operator new(block_size_ * blocks_per_chunk_));
+        chunks_.push_back(chunk);
+
+        //Thread the new blocks onto the free list, first block first
+        for(uint32_t i = blocks_per_chunk_; i > 0; --i) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + (i - 1) * block_size_);
+            block->next = free_list_;
+            free_list_ = block;
+        }
+    }
+};
+
+/*
+ *  Chunked storage for objects of one type, with stable addresses.
+ */
+template<typename T, uint32_t ChunkSize=64>
+class ObjectPool {
+public:
+    ObjectPool():
+        blocks_(sizeof(T), ChunkSize) {}
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        void* memory = blocks_.allocate(sizeof(T));
+        try {
+            return new(memory) T(std::forward<Args>(args)...);
+        } catch(...) {
+            blocks_.deallocate(memory, sizeof(T));
+            throw;
+        }
+    }
+
+    void destroy(T* object) {
+        object->~T();
+        blocks_.deallocate(object, sizeof(T));
+    }
+
+    uint32_t size() const { return blocks_.allocated(); }
+    uint32_t capacity() const { return blocks_.capacity(); }
+
+private:
+    BlockPool blocks_;
+};
+
+}
+}
+
+#endif // OBJECT_POOL_H
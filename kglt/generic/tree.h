@@ -2,8 +2,10 @@
 #define TREE_H
 
 #include <boost/iterator/iterator_facade.hpp>
+#include <cstdint>
 #include <stdexcept>
 #include <vector>
+#include <algorithm>
 #include <tr1/memory>
 #include <sigc++/sigc++.h>
 
@@ -19,69 +21,89 @@ public:
 };
 
 template<typename T>
+class TreeNode;
+
+/*
+ *  Walks a node and all of its descendants, depth first, parents before children. The
+ *  order comes from the node's cached linearization (see TreeNode), so iterating is just
+ *  stepping through an array. Changing the tree doesn't affect an iterator that's
+ *  already running, unless begin() is called on the same node again before it finishes.
+ */
+template<typename N>
 class tree_iterator :
         public boost::iterator_facade<
-            tree_iterator<T>,
-            T,
+            tree_iterator<N>,
+            N,
             boost::forward_traversal_tag,
-            T&
+            N&
         > {
 
 public:
+    typedef typename N::node_type Node;
+
     tree_iterator():
+        nodes_(nullptr),
+        subtree_end_(nullptr),
         position_(0) {
     }
 
-    explicit tree_iterator(T& p):
+    explicit tree_iterator(N& p):
         position_(0) {
-        linearized_tree_ = linearize_tree(&p);
-    }
-
-private:
-    friend class boost::iterator_core_access;
 
-    void linearize_recurse(T* node, std::vector<T*>& results) {
-        results.push_back(node);
-        for(uint32_t i = 0; i < node->child_count(); ++i) {
-            linearize_recurse(&node->child(i), results);
-        }
+        const typename TreeNode<Node>::Linearization& linearization = p.linearization();
+        nodes_ = &linearization.nodes;
+        subtree_end_ = &linearization.subtree_end;
     }
 
-    std::vector<T*> linearize_tree(T* start) {
-        std::vector<T*> results;
-        linearize_recurse(start, results);
-        return results;
+    /*
+     * Makes the next increment step over the descendants of the current node
+     */
+    void skip_children() {
+        position_ = subtree_end_->at(position_) - 1;
     }
 
-    std::vector<T*> linearized_tree_;
+private:
+    friend class boost::iterator_core_access;
+
+    const std::vector<Node*>* nodes_;
+    const std::vector<uint32_t>* subtree_end_; ///< One past the last descendant of each node
     uint32_t position_;
 
     void increment() {
         ++position_;
 
-        if(position_ == linearized_tree_.size()) {
+        if(position_ == nodes_->size()) {
+            nodes_ = nullptr;
+            subtree_end_ = nullptr;
             position_ = 0;
-            linearized_tree_.clear();
         }
     }
 
-    bool equal(tree_iterator<T> const& other) const {
-        return this->linearized_tree_ == other.linearized_tree_ &&
+    bool equal(tree_iterator<N> const& other) const {
+        return this->nodes_ == other.nodes_ &&
                 this->position_ == other.position_;
     }
 
-    T& dereference() const {
-        return *linearized_tree_.at(position_);
+    N& dereference() const {
+        return *nodes_->at(position_);
     }
 };
 
+/*
+ *  Each node can cache the depth first order of its subtree, which is what tree_iterator
+ *  walks. It's built by the first begin() after the subtree changes; attaching or
+ *  detaching a child throws away the caches of that node and all of its ancestors.
+ */
 template<typename T>
 class TreeNode {
 public:
+    typedef T node_type;
     typedef tree_iterator<TreeNode<T> > iterator;
 
     TreeNode():
-        parent_(nullptr) {}
+        parent_(nullptr),
+        linearization_dirty_(true),
+        linearization_generation_(0) {}
 
     virtual ~TreeNode() {
         try {
@@ -163,15 +185,65 @@ public:
 
     bool has_siblings() const { return has_parent() ? parent().child_count() > 1 : false; }
 
+    /*
+     *  Goes up every time the depth first order is rebuilt, so anything holding a copy of
+     *  it can tell whether the copy is still current.
+     */
+    uint64_t linearization_generation() { linearization(); return linearization_generation_; }
+
 protected:
-    std::vector<T*>& children() { return children_; }
+    const std::vector<T*>& children() const { return children_; }
 
 private:
+    template<typename N> friend class tree_iterator;
+
+    struct Linearization {
+        std::vector<T*> nodes;
+        std::vector<uint32_t> subtree_end; ///< One past the last descendant of each node
+    };
+
     T* parent_;
     std::vector<T*> children_;
 
+    Linearization linearization_;
+    bool linearization_dirty_;
+    uint64_t linearization_generation_;
+
     sigc::signal<void, T*, T*> signal_parent_changed_;
 
+    const Linearization& linearization() {
+        if(linearization_dirty_) {
+            //Clearing keeps the capacity, so rebuilding doesn't normally allocate
+            linearization_.nodes.clear();
+            linearization_.subtree_end.clear();
+            linearize_recurse((T*)this);
+            linearization_dirty_ = false;
+            ++linearization_generation_;
+        }
+        return linearization_;
+    }
+
+    void linearize_recurse(T* node) {
+        uint32_t index = linearization_.nodes.size();
+        linearization_.nodes.push_back(node);
+        linearization_.subtree_end.push_back(0);
+
+        for(T* child: node->children_) {
+            linearize_recurse(child);
+        }
+
+        linearization_.subtree_end[index] = linearization_.nodes.size();
+    }
+
+    void invalidate_linearization() {
+        //Every ancestor's cache includes this subtree, so they all have to go
+        TreeNode<T>* node = this;
+        while(node) {
+            node->linearization_dirty_ = true;
+            node = node->parent_;
+        }
+    }
+
     void attach_child(T* child) {
         if(child->has_parent()) {
             child->parent().detach_child(child);
@@ -179,6 +251,7 @@ private:
 
         child->parent_ = (T*)this;
         children_.push_back(child);
+        invalidate_linearization();
     }
 
     void detach_child(T* child) {
@@ -195,6 +268,7 @@ private:
         //Erase the child from our children and set its parent to null
         child->parent_ = nullptr;
         children_.erase(std::remove(children_.begin(), children_.end(), child), children_.end());
+        invalidate_linearization();
     }
 
     virtual bool can_set_parent(T* parent) {
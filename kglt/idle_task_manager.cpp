@@ -1,47 +1,129 @@
 #include <utility>
 #include <tr1/functional>
-#include "kazbase/logging/logging.h"
 #include "idle_task_manager.h"
 
 namespace kglt {
 
 static ConnectionID connection_counter = 0;
 
-IdleTaskManager::IdleTaskManager() {
+const double IdleTaskManager::DEFAULT_BUDGET = 4.0;
 
+static boost::posix_time::ptime now() {
+    return boost::posix_time::microsec_clock::universal_time();
 }
 
-ConnectionID IdleTaskManager::add(std::tr1::function<bool ()> callback) {
-    ConnectionID new_id = ++connection_counter;
-    signals_.insert(std::make_pair(new_id, callback));
-    return new_id;
+IdleTaskManager::IdleTaskManager():
+    running_(0),
+    running_removed_(false),
+    budget_(DEFAULT_BUDGET),
+    executing_(false) {
+
+    stats_ = IdleTaskStats();
+}
+
+ConnectionID IdleTaskManager::add(std::tr1::function<bool ()> callback, IdleTaskPriority priority) {
+    Task task;
+    task.id = __sync_add_and_fetch(&connection_counter, 1);
+    task.callback = callback;
+
+    boost::mutex::scoped_lock lock(lock_);
+    queues_[priority].push_back(task);
+    return task.id;
+}
+
+ConnectionID IdleTaskManager::add_once(std::tr1::function<void ()> callback, IdleTaskPriority priority) {
+    return add([=]() -> bool {
+        callback();
+        return false;
+    }, priority);
+}
+
+void IdleTaskManager::remove(ConnectionID connection) {
+    boost::mutex::scoped_lock lock(lock_);
+
+    if(connection == running_) {
+        running_removed_ = true;
+        return;
+    }
+
+    for(std::deque<Task>& queue: queues_) {
+        for(std::deque<Task>::iterator it = queue.begin(); it != queue.end(); ++it) {
+            if((*it).id == connection) {
+                queue.erase(it);
+                return;
+            }
+        }
+    }
 }
 
-ConnectionID IdleTaskManager::add_once(std::tr1::function<void ()> callback) {
-    ConnectionID new_id = ++connection_counter;
-    signals_once_.insert(std::make_pair(new_id, callback));
-    return new_id;
+bool IdleTaskManager::should_yield() const {
+    return executing_ && now() >= deadline_;
 }
 
 void IdleTaskManager::execute() {
-    std::map<ConnectionID, std::tr1::function<bool ()> > signals = signals_;
-    
-    std::map<ConnectionID, std::tr1::function<bool ()> >::iterator it = signals.begin();
-    
-    for(; it != signals.end(); ++it) {
-        L_DEBUG("Executing idle task");
-        bool result = (*it).second();
-        if(!result) {
-            L_DEBUG("Idle task returned false. Removing.");
-            signals_.erase((*it).first);
+    boost::posix_time::ptime start = now();
+    deadline_ = start + boost::posix_time::microseconds(int64_t(budget_ * 1000.0));
+    executing_ = true;
+
+    uint32_t run = 0;
+    uint32_t carried_over = 0;
+
+    for(uint32_t priority = 0; priority < IDLE_TASK_PRIORITY_MAX; ++priority) {
+        std::deque<Task>& queue = queues_[priority];
+
+        //Tasks that are put back (or added) while we're going round wait for the next frame
+        uint32_t count = 0;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            count = queue.size();
+        }
+
+        for(uint32_t i = 0; i < count; ++i) {
+            if(run && now() >= deadline_) {
+                carried_over += count - i;
+                break;
+            }
+
+            Task task;
+            {
+                boost::mutex::scoped_lock lock(lock_);
+                if(queue.empty()) {
+                    break;
+                }
+
+                task.id = queue.front().id;
+                task.callback.swap(queue.front().callback);
+                queue.pop_front();
+
+                running_ = task.id;
+                running_removed_ = false;
+            }
+
+            bool again = task.callback();
+            ++run;
+
+            boost::mutex::scoped_lock lock(lock_);
+            if(again && !running_removed_) {
+                queue.push_back(Task());
+                queue.back().id = task.id;
+                queue.back().callback.swap(task.callback);
+            }
+            running_ = 0;
         }
     }
-    
-    for(std::pair<ConnectionID, std::tr1::function<void ()> > p: signals_once_) {
-        L_DEBUG("Executing one-off idle task");
-        p.second();
+
+    executing_ = false;
+
+    double milliseconds = double((now() - start).total_microseconds()) / 1000.0;
+    stats_.run = run;
+    stats_.carried_over = carried_over;
+    stats_.milliseconds = milliseconds;
+    stats_.total_milliseconds += milliseconds;
+
+    boost::mutex::scoped_lock lock(lock_);
+    for(uint32_t priority = 0; priority < IDLE_TASK_PRIORITY_MAX; ++priority) {
+        stats_.queued[priority] = queues_[priority].size();
     }
-    signals_once_.clear();
 }
 
 }
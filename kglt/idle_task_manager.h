@@ -4,27 +4,82 @@
 #include <cstdint>
 #include <sigc++/sigc++.h>
 #include <tr1/functional>
-#include <map>
+#include <deque>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 namespace kglt {
 
 typedef uint32_t ConnectionID;
 
+enum IdleTaskPriority {
+    IDLE_TASK_PRIORITY_HIGH = 0,
+    IDLE_TASK_PRIORITY_NORMAL,
+    IDLE_TASK_PRIORITY_LOW,
+    IDLE_TASK_PRIORITY_MAX
+};
+
+struct IdleTaskStats {
+    uint32_t queued[IDLE_TASK_PRIORITY_MAX]; ///< Tasks waiting, as of the end of the last execute()
+    uint32_t run; ///< Tasks the last execute() ran
+    uint32_t carried_over; ///< Tasks the last execute() ran out of time for
+    double milliseconds; ///< Time spent in the last execute()
+    double total_milliseconds; ///< Time spent in every execute() so far
+};
+
+/*
+ *  Runs callbacks on the main thread between frames, within a time budget.
+ *
+ *  Tasks added with add() are called again for as long as they return true, tasks added
+ *  with add_once() are called once. Higher priority tasks run first. Once the budget for
+ *  the frame is spent, the remaining tasks wait until the next frame, where they're the
+ *  first of their priority to run. At least one task runs every frame however small the
+ *  budget, so everything gets there eventually, but a high priority task that runs every
+ *  frame can keep lower priorities waiting.
+ *
+ *  Long tasks should split their work up: do a bit, check should_yield(), and return true
+ *  to carry on next frame.
+ *
+ *  Tasks can be added and removed from any thread, but only run from execute().
+ */
 class IdleTaskManager {
 public:
+    static const double DEFAULT_BUDGET; ///< In milliseconds
+
     IdleTaskManager();
 
-    ConnectionID add(std::tr1::function<bool ()> callback);
-    ConnectionID add_once(std::tr1::function<void ()> callback);
-    
+    ConnectionID add(std::tr1::function<bool ()> callback, IdleTaskPriority priority=IDLE_TASK_PRIORITY_NORMAL);
+    ConnectionID add_once(std::tr1::function<void ()> callback, IdleTaskPriority priority=IDLE_TASK_PRIORITY_NORMAL);
+
     void remove(ConnectionID connection);
 
     void execute();
 
+    void set_budget(double milliseconds) { budget_ = milliseconds; }
+    double budget() const { return budget_; }
+
+    bool should_yield() const; ///< True when a task called from execute() has used up the frame's budget
+
+    const IdleTaskStats& stats() const { return stats_; }
+
 private:
-    std::map<ConnectionID, std::tr1::function<bool ()> > signals_;
-    std::map<ConnectionID, std::tr1::function<void ()> > signals_once_;
+    struct Task {
+        ConnectionID id;
+        std::tr1::function<bool ()> callback;
+    };
+
+    boost::mutex lock_;
+    std::deque<Task> queues_[IDLE_TASK_PRIORITY_MAX];
+
+    ConnectionID running_; ///< The task execute() is in, 0 if none
+    bool running_removed_; ///< Set if the running task removes itself
+
+    double budget_;
+    boost::posix_time::ptime deadline_;
+    bool executing_;
 
+    IdleTaskStats stats_;
 };
 
 }
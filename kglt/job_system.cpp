@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <cassert>
+
+#include "job_system.h"
+
+namespace kglt {
+
+//Which worker (if any) the current thread is, so jobs it makes ready stay local
+static __thread JobSystem* current_system = nullptr;
+static __thread int32_t current_worker = -1;
+
+JobSystem::JobSystem(IdleTaskManager& idle, uint32_t thread_count):
+    idle_(idle),
+    idle_connection_(0),
+    pumping_(false),
+    main_thread_(boost::this_thread::get_id()),
+    queued_(0),
+    stopping_(false),
+    waiters_(0),
+    chunks_available_(false),
+    chunk_caller_(nullptr),
+    chunk_func_(nullptr),
+    chunk_item_count_(0),
+    chunk_grain_(1),
+    next_chunk_(0),
+    total_chunks_(0),
+    finished_chunks_(0) {
+
+    if(thread_count == AUTOMATIC) {
+        //Background work has to make progress even on one core
+        uint32_t cores = boost::thread::hardware_concurrency();
+        thread_count = (cores > 2) ? cores - 1 : 1;
+    }
+
+    for(uint32_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(std::tr1::shared_ptr<Worker>(new Worker()));
+    }
+
+    for(uint32_t i = 0; i < thread_count; ++i) {
+        threads_.push_back(std::tr1::shared_ptr<boost::thread>(
+            new boost::thread(std::tr1::bind(&JobSystem::worker_loop, this, i))
+        ));
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        boost::mutex::scoped_lock lock(main_lock_);
+        if(pumping_) {
+            idle_.remove(idle_connection_);
+            pumping_ = false;
+        }
+    }
+
+    {
+        boost::mutex::scoped_lock lock(sleep_lock_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+
+    for(std::tr1::shared_ptr<boost::thread> thread: threads_) {
+        thread->join();
+    }
+}
+
+Job::ptr JobSystem::schedule(std::tr1::function<void ()> func, const std::vector<Job::ptr>& dependencies) {
+    return create(func, false, dependencies);
+}
+
+Job::ptr JobSystem::schedule_on_main_thread(std::tr1::function<void ()> func, const std::vector<Job::ptr>& dependencies) {
+    return create(func, true, dependencies);
+}
+
+Job::ptr JobSystem::create(std::tr1::function<void ()> func, bool main_thread, const std::vector<Job::ptr>& dependencies) {
+    Job::ptr job(new Job(func, main_thread));
+
+    for(Job::ptr dependency: dependencies) {
+        if(!dependency) {
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(dependency->lock_);
+        if(!dependency->finished_) {
+            __atomic_add_fetch(&job->unfinished_dependencies_, 1, __ATOMIC_RELAXED);
+            dependency->dependents_.push_back(job);
+        }
+    }
+
+    //Drop the count we started with, if everything had already finished the job is ready now
+    dependency_finished(job);
+    return job;
+}
+
+void JobSystem::dependency_finished(Job::ptr job) {
+    if(__atomic_sub_fetch(&job->unfinished_dependencies_, 1, __ATOMIC_ACQ_REL) == 0) {
+        enqueue(job);
+    }
+}
+
+void JobSystem::enqueue(Job::ptr job) {
+    if(job->main_thread_) {
+        boost::mutex::scoped_lock lock(main_lock_);
+        main_jobs_.push_back(job);
+        start_pumping();
+        return;
+    }
+
+    if(current_system == this && current_worker >= 0) {
+        Worker& worker = *workers_[current_worker];
+        boost::mutex::scoped_lock lock(worker.lock);
+        worker.jobs.push_back(job);
+    } else {
+        boost::mutex::scoped_lock lock(shared_lock_);
+        shared_jobs_.push_back(job);
+    }
+
+    //Without workers these run from the idle task too
+    if(workers_.empty()) {
+        boost::mutex::scoped_lock lock(main_lock_);
+        start_pumping();
+    }
+
+    //Counted before taking the sleep lock, so a worker can't check it and then miss the notify
+    __atomic_add_fetch(&queued_, 1, __ATOMIC_RELEASE);
+    {
+        boost::mutex::scoped_lock lock(sleep_lock_);
+    }
+    work_available_.notify_one();
+}
+
+void JobSystem::start_pumping() {
+    if(pumping_) {
+        return;
+    }
+
+    //High priority, as the rest of a job graph may be waiting on these
+    pumping_ = true;
+    idle_connection_ = idle_.add(std::tr1::bind(&JobSystem::pump, this), IDLE_TASK_PRIORITY_HIGH);
+}
+
+bool JobSystem::pump() {
+    run_main_thread_jobs();
+
+    //Checked under main_lock_, so anything queued after this starts the task again
+    boost::mutex::scoped_lock lock(main_lock_);
+    bool more = !main_jobs_.empty();
+    if(!more && workers_.empty()) {
+        boost::mutex::scoped_lock shared(shared_lock_);
+        more = !shared_jobs_.empty();
+    }
+
+    pumping_ = more;
+    return more;
+}
+
+Job::ptr JobSystem::take_job(int32_t worker) {
+    Job::ptr job;
+
+    //Our own queue first, newest first as it's most likely still in the cache
+    if(worker >= 0) {
+        Worker& own = *workers_[worker];
+        boost::mutex::scoped_lock lock(own.lock);
+        if(!own.jobs.empty()) {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+        }
+    }
+
+    if(!job) {
+        boost::mutex::scoped_lock lock(shared_lock_);
+        if(!shared_jobs_.empty()) {
+            job = shared_jobs_.front();
+            shared_jobs_.pop_front();
+        }
+    }
+
+    //Steal the oldest job from someone else, starting with our neighbour so thieves spread out
+    uint32_t count = workers_.size();
+    for(uint32_t i = 1; !job && i <= count; ++i) {
+        uint32_t victim = (std::max(worker, 0) + i) % count;
+        if(int32_t(victim) == worker) {
+            continue;
+        }
+
+        Worker& other = *workers_[victim];
+        boost::mutex::scoped_lock lock(other.lock);
+        if(!other.jobs.empty()) {
+            job = other.jobs.front();
+            other.jobs.pop_front();
+        }
+    }
+
+    if(job) {
+        __atomic_sub_fetch(&queued_, 1, __ATOMIC_RELAXED);
+    }
+
+    return job;
+}
+
+Job::ptr JobSystem::take_main_thread_job() {
+    boost::mutex::scoped_lock lock(main_lock_);
+    if(main_jobs_.empty()) {
+        return Job::ptr();
+    }
+
+    Job::ptr job = main_jobs_.front();
+    main_jobs_.pop_front();
+    return job;
+}
+
+void JobSystem::execute(Job::ptr job) {
+    try {
+        job->func_();
+    } catch(...) {
+        job->error_ = std::current_exception();
+    }
+
+    //Nothing needs the function any more, and it may be holding on to a lot
+    job->func_ = std::tr1::function<void ()>();
+
+    mark_finished(job);
+}
+
+Job::ptr JobSystem::schedule_event() {
+    //Keeps the count it starts with, so it's never queued
+    return Job::ptr(new Job(std::tr1::function<void ()>(), false));
+}
+
+void JobSystem::complete(Job::ptr event, std::exception_ptr error) {
+    assert(!event->is_finished());
+
+    event->error_ = error;
+    mark_finished(event);
+}
+
+void JobSystem::mark_finished(Job::ptr job) {
+    std::vector<Job::ptr> dependents;
+    {
+        boost::mutex::scoped_lock lock(job->lock_);
+        __atomic_store_n(&job->finished_, true, __ATOMIC_SEQ_CST);
+        dependents.swap(job->dependents_);
+    }
+
+    for(Job::ptr dependent: dependents) {
+        dependency_finished(dependent);
+    }
+
+    //Sequentially consistent with wait(), so either it sees the job finished or we see the waiter
+    if(__atomic_load_n(&waiters_, __ATOMIC_SEQ_CST)) {
+        {
+            boost::mutex::scoped_lock lock(finished_lock_);
+        }
+        job_finished_.notify_all();
+    }
+}
+
+void JobSystem::wait(Job::ptr job) {
+    bool on_main_thread = boost::this_thread::get_id() == main_thread_;
+    int32_t worker = (current_system == this) ? current_worker : -1;
+
+    while(!job->is_finished()) {
+        if(run_chunks()) {
+            continue;
+        }
+
+        Job::ptr other = take_job(worker);
+        if(!other && on_main_thread) {
+            other = take_main_thread_job();
+        }
+
+        if(other) {
+            execute(other);
+            continue;
+        }
+
+        //Nothing we can help with, so sleep until something finishes
+        boost::mutex::scoped_lock lock(finished_lock_);
+        __atomic_add_fetch(&waiters_, 1, __ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&job->finished_, __ATOMIC_SEQ_CST)) {
+            job_finished_.wait(lock);
+        }
+        __atomic_sub_fetch(&waiters_, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if(job->error_) {
+        std::rethrow_exception(job->error_);
+    }
+}
+
+void JobSystem::run_main_thread_jobs() {
+    //Only what's queued now, anything these jobs make ready waits for the next frame
+    uint32_t count = 0;
+    {
+        boost::mutex::scoped_lock lock(main_lock_);
+        count = main_jobs_.size();
+    }
+
+    //At least one job each time, so they get somewhere however small the budget
+    uint32_t ran = 0;
+    for(uint32_t i = 0; i < count && (!ran || !idle_.should_yield()); ++i) {
+        Job::ptr job = take_main_thread_job();
+        if(!job) {
+            break;
+        }
+        execute(job);
+        ++ran;
+    }
+
+    if(workers_.empty()) {
+        while(!ran || !idle_.should_yield()) {
+            Job::ptr job = take_job(-1);
+            if(!job) {
+                break;
+            }
+            execute(job);
+            ++ran;
+        }
+    }
+}
+
+void JobSystem::worker_loop(uint32_t index) {
+    current_system = this;
+    current_worker = index;
+
+    while(true) {
+        //Someone's waiting on these, so they come first
+        if(run_chunks()) {
+            continue;
+        }
+
+        Job::ptr job = take_job(index);
+        if(job) {
+            execute(job);
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(sleep_lock_);
+        while(!stopping_ && !__atomic_load_n(&queued_, __ATOMIC_ACQUIRE) && !__atomic_load_n(&chunks_available_, __ATOMIC_ACQUIRE)) {
+            work_available_.wait(lock);
+        }
+
+        if(stopping_) {
+            return;
+        }
+    }
+}
+
+void JobSystem::run_parallel(uint32_t count, uint32_t grain, ChunkCaller caller, const void* func) {
+    if(!count) {
+        return;
+    }
+
+    grain = std::max(grain, uint32_t(1));
+    uint32_t chunks = chunk_count(count, grain);
+
+    if(workers_.empty() || chunks == 1) {
+        //Not worth waking anyone up
+        for(uint32_t i = 0; i < chunks; ++i) {
+            caller(func, i, i * grain, std::min(count, (i + 1) * grain));
+        }
+        return;
+    }
+
+    boost::mutex::scoped_lock call(parallel_call_lock_);
+
+    {
+        boost::mutex::scoped_lock lock(parallel_lock_);
+        chunk_caller_ = caller;
+        chunk_func_ = func;
+        chunk_item_count_ = count;
+        chunk_grain_ = grain;
+        next_chunk_ = 0;
+        total_chunks_ = chunks;
+        finished_chunks_ = 0;
+        __atomic_store_n(&chunks_available_, true, __ATOMIC_RELEASE);
+    }
+
+    //As in enqueue(), so a worker can't check for chunks and then miss the notify
+    {
+        boost::mutex::scoped_lock lock(sleep_lock_);
+    }
+    work_available_.notify_all();
+
+    run_chunks();
+
+    boost::mutex::scoped_lock lock(parallel_lock_);
+    while(finished_chunks_ < total_chunks_) {
+        chunks_finished_.wait(lock);
+    }
+
+    chunk_func_ = nullptr;
+}
+
+bool JobSystem::run_chunks() {
+    bool ran = false;
+
+    while(__atomic_load_n(&chunks_available_, __ATOMIC_ACQUIRE)) {
+        ChunkCaller caller = nullptr;
+        const void* func = nullptr;
+        uint32_t chunk = 0, begin = 0, end = 0;
+        {
+            boost::mutex::scoped_lock lock(parallel_lock_);
+            if(next_chunk_ >= total_chunks_) {
+                break;
+            }
+
+            chunk = next_chunk_++;
+            if(next_chunk_ == total_chunks_) {
+                __atomic_store_n(&chunks_available_, false, __ATOMIC_RELEASE);
+            }
+
+            caller = chunk_caller_;
+            func = chunk_func_;
+            begin = chunk * chunk_grain_;
+            end = std::min(chunk_item_count_, (chunk + 1) * chunk_grain_);
+        }
+
+        caller(func, chunk, begin, end);
+        ran = true;
+
+        bool last = false;
+        {
+            boost::mutex::scoped_lock lock(parallel_lock_);
+            last = (++finished_chunks_ == total_chunks_);
+        }
+
+        if(last) {
+            chunks_finished_.notify_all();
+        }
+    }
+
+    return ran;
+}
+
+}
@@ -0,0 +1,251 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <exception>
+#include <tr1/memory>
+#include <tr1/functional>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "idle_task_manager.h"
+
+namespace kglt {
+
+class JobSystem;
+
+/*
+ *  A unit of work scheduled on a JobSystem. Jobs only run once every job they depend on
+ *  has finished, so a set of jobs and their dependencies make up a task graph.
+ *
+ *  Jobs are created by JobSystem::schedule() and friends, and are only useful as handles:
+ *  to pass as dependencies, to poll with is_finished() or to wait on.
+ */
+class Job {
+public:
+    typedef std::tr1::shared_ptr<Job> ptr;
+
+    bool is_finished() const { return __atomic_load_n(&finished_, __ATOMIC_ACQUIRE); }
+    bool runs_on_main_thread() const { return main_thread_; }
+
+private:
+    friend class JobSystem;
+
+    Job(std::tr1::function<void ()> func, bool main_thread):
+        func_(func),
+        main_thread_(main_thread),
+        unfinished_dependencies_(1),
+        finished_(false) {}
+
+    Job(const Job&);
+    Job& operator=(const Job&);
+
+    std::tr1::function<void ()> func_;
+    bool main_thread_;
+
+    uint32_t unfinished_dependencies_; ///< Starts at one so the job can't run until it's fully scheduled
+    bool finished_;
+
+    boost::mutex lock_; ///< Protects dependents_, and finished_ against new dependents
+    std::vector<Job::ptr> dependents_;
+
+    std::exception_ptr error_;
+};
+
+/*
+ *  The result of a job scheduled with JobSystem::async(). get() waits for the job (helping
+ *  out with other jobs meanwhile) and rethrows anything it threw. job() can be used as a
+ *  dependency, e.g. to upload loaded data on the main thread once it's ready.
+ */
+template<typename T>
+class Future {
+public:
+    Future():
+        system_(nullptr) {}
+
+    bool is_valid() const { return bool(job_); }
+    bool is_ready() const { return job_ && job_->is_finished(); }
+
+    const T& get();
+    Job::ptr job() const { return job_; }
+
+private:
+    friend class JobSystem;
+
+    Future(JobSystem* system, Job::ptr job, std::tr1::shared_ptr<T> value):
+        system_(system),
+        job_(job),
+        value_(value) {}
+
+    JobSystem* system_;
+    Job::ptr job_;
+    std::tr1::shared_ptr<T> value_;
+};
+
+/*
+ *  A work-stealing thread pool for background work: loading, decoding, building meshes.
+ *
+ *  Each worker has its own queue. Jobs made ready on a worker (because the job they were
+ *  waiting on just finished there) go on that worker's queue, and jobs scheduled from other
+ *  threads go on a shared queue. Workers take from their own queue newest first, then from
+ *  the shared queue, then steal the oldest job from another worker.
+ *
+ *  Jobs scheduled with schedule_on_main_thread() run from the window's IdleTaskManager
+ *  between frames instead, which is where anything touching GL belongs. They can depend on
+ *  worker jobs and the other way around. The idle task is only there while such jobs are
+ *  queued, so it doesn't take the frame's slot from other idle tasks when there's nothing to do.
+ *
+ *  parallel_for() is for the other kind of work: a loop the frame has to wait for, split
+ *  into chunks across the same threads (see below).
+ *
+ *  With no threads, worker jobs also run from the idle task (or from wait()), which is
+ *  handy for debugging.
+ */
+class JobSystem {
+public:
+    static const uint32_t AUTOMATIC = ~0u; ///< One thread per core but one, and at least one
+
+    JobSystem(IdleTaskManager& idle, uint32_t thread_count=AUTOMATIC);
+    ~JobSystem();
+
+    Job::ptr schedule(std::tr1::function<void ()> func, const std::vector<Job::ptr>& dependencies=std::vector<Job::ptr>());
+    Job::ptr schedule_on_main_thread(std::tr1::function<void ()> func, const std::vector<Job::ptr>& dependencies=std::vector<Job::ptr>());
+
+    template<typename T>
+    Future<T> async(std::tr1::function<T ()> func, const std::vector<Job::ptr>& dependencies=std::vector<Job::ptr>()) {
+        std::tr1::shared_ptr<T> value(new T());
+        Job::ptr job = schedule([=]() { *value = func(); }, dependencies);
+        return Future<T>(this, job, value);
+    }
+
+    template<typename T>
+    Future<T> async_on_main_thread(std::tr1::function<T ()> func, const std::vector<Job::ptr>& dependencies=std::vector<Job::ptr>()) {
+        std::tr1::shared_ptr<T> value(new T());
+        Job::ptr job = schedule_on_main_thread([=]() { *value = func(); }, dependencies);
+        return Future<T>(this, job, value);
+    }
+
+    /*
+     *  A job that runs nothing and finishes when complete() is called, for work that's driven
+     *  some other way (e.g. stepped from main thread jobs) that other jobs need to depend on.
+     *  The error, if any, is rethrown by wait() like a job's.
+     */
+    Job::ptr schedule_event();
+    void complete(Job::ptr event, std::exception_ptr error=std::exception_ptr());
+
+    /*
+     *  Blocks until the job has finished, running other jobs in the meantime (including
+     *  main thread jobs, when called from the main thread). Rethrows anything the job threw.
+     */
+    void wait(Job::ptr job);
+
+    void run_main_thread_jobs(); ///< Called by the idle task, runs what's queued for the main thread until the idle budget is spent
+
+    /*
+     *  Divides [0, count) into chunks of at most `grain` items and blocks until every chunk
+     *  has run. The caller works through chunks too, and workers take chunks ahead of jobs
+     *  (as well as between them while they wait()) since the caller is holding up the frame.
+     *  Chunks are numbered from zero, so callers can give each chunk its own scratch space
+     *  and merge the results afterwards. Without threads everything runs on the caller.
+     *
+     *  The function is called through a pointer rather than copied into a job, so handing
+     *  out work doesn't allocate. Calls from different threads take turns, and calling it
+     *  from inside a chunk deadlocks.
+     */
+    template<typename Function>
+    void parallel_for(uint32_t count, uint32_t grain, const Function& func) { ///< func(chunk, begin, end)
+        run_parallel(count, grain, &call_chunk<Function>, &func);
+    }
+
+    static uint32_t chunk_count(uint32_t count, uint32_t grain) {
+        return (count + grain - 1) / grain;
+    }
+
+    uint32_t thread_count() const { return workers_.size(); }
+    IdleTaskManager& idle() { return idle_; } ///< Where main thread jobs run from
+
+private:
+    JobSystem(const JobSystem&);
+    JobSystem& operator=(const JobSystem&);
+
+    struct Worker {
+        boost::mutex lock;
+        std::deque<Job::ptr> jobs;
+    };
+
+    IdleTaskManager& idle_;
+    ConnectionID idle_connection_; ///< The idle task running main thread jobs, while pumping_
+    bool pumping_; ///< Protected by main_lock_
+    boost::thread::id main_thread_;
+
+    std::vector<std::tr1::shared_ptr<Worker> > workers_;
+    std::vector<std::tr1::shared_ptr<boost::thread> > threads_;
+
+    boost::mutex shared_lock_;
+    std::deque<Job::ptr> shared_jobs_;
+
+    boost::mutex main_lock_;
+    std::deque<Job::ptr> main_jobs_;
+
+    //Workers sleep here when there's nothing to take
+    boost::mutex sleep_lock_;
+    boost::condition_variable work_available_;
+    uint32_t queued_;
+    bool stopping_;
+
+    //Waiters sleep here until something finishes
+    boost::mutex finished_lock_;
+    boost::condition_variable job_finished_;
+    uint32_t waiters_;
+
+    typedef void (*ChunkCaller)(const void* func, uint32_t chunk, uint32_t begin, uint32_t end);
+
+    template<typename Function>
+    static void call_chunk(const void* func, uint32_t chunk, uint32_t begin, uint32_t end) {
+        (*static_cast<const Function*>(func))(chunk, begin, end);
+    }
+
+    //The parallel_for() in progress, if any
+    boost::mutex parallel_call_lock_; ///< Held for the whole call, so callers take turns
+    boost::mutex parallel_lock_; ///< Protects the rest
+    boost::condition_variable chunks_finished_;
+    bool chunks_available_; ///< Also read unlocked, by workers deciding whether to sleep
+    ChunkCaller chunk_caller_;
+    const void* chunk_func_;
+    uint32_t chunk_item_count_;
+    uint32_t chunk_grain_;
+    uint32_t next_chunk_;
+    uint32_t total_chunks_;
+    uint32_t finished_chunks_;
+
+    Job::ptr create(std::tr1::function<void ()> func, bool main_thread, const std::vector<Job::ptr>& dependencies);
+    void dependency_finished(Job::ptr job);
+    void enqueue(Job::ptr job);
+
+    void start_pumping(); ///< Called with main_lock_ held
+    bool pump();
+
+    Job::ptr take_job(int32_t worker);
+    Job::ptr take_main_thread_job();
+    void execute(Job::ptr job);
+    void mark_finished(Job::ptr job);
+
+    void run_parallel(uint32_t count, uint32_t grain, ChunkCaller caller, const void* func);
+    bool run_chunks(); ///< Runs chunks until there are none left to take, returns true if it ran any
+
+    void worker_loop(uint32_t index);
+};
+
+template<typename T>
+const T& Future<T>::get() {
+    system_->wait(job_);
+    return *value_;
+}
+
+}
+
+#endif // JOB_SYSTEM_H
@@ -10,6 +10,10 @@
 #include "shader.h"
 
 #include "rendering/selection_renderer.h"
+#include "partitioners/null_partitioner.h"
+#include "partitioners/octree_partitioner.h"
+#include "partitioners/bvh_partitioner.h"
+#include "partitioners/spatial_hash_partitioner.h"
 #include "procedural/mesh.h"
 
 #include "kglt/ui/label.h"
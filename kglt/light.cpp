@@ -1,4 +1,5 @@
 #include "light.h"
+#include "scene.h"
 
 namespace kglt {
 
@@ -15,6 +16,8 @@ void Light::set_attenuation(float range, float constant, float linear, float qua
     const_attenuation_ = constant;
     linear_attenuation_ = linear;
     quadratic_attenuation_ = quadratic;
+
+    bounds_changed();
 }
 
 /**
@@ -30,6 +33,25 @@ void Light::set_attenuation_from_range(float range) {
     const_attenuation_ = 0.5;
     linear_attenuation_ = 4.5 / range;
     quadratic_attenuation_ = 75.0 / (range * range);
+
+    bounds_changed();
+}
+
+void Light::bounds_changed() {
+    scene().queue_relocation(*this);
+    mark_render_state_dirty();
+}
+
+void Light::publish() {
+    Object::publish();
+
+    light_state_.position = position();
+    light_state_.ambient = ambient_;
+    light_state_.diffuse = diffuse_;
+    light_state_.specular = specular_;
+    light_state_.constant_attenuation = const_attenuation_;
+    light_state_.linear_attenuation = linear_attenuation_;
+    light_state_.quadratic_attenuation = quadratic_attenuation_;
 }
 
 }
@@ -15,6 +15,20 @@ enum LightType {
     LIGHT_TYPE_SPOT_LIGHT
 };
 
+/*
+ *  What the renderer lights meshes with, as of the last publish (see
+ *  Object::render_state()).
+ */
+struct LightState {
+    kmVec3 position;
+    Colour ambient;
+    Colour diffuse;
+    Colour specular;
+    float constant_attenuation;
+    float linear_attenuation;
+    float quadratic_attenuation;
+};
+
 class Light :
     public Object,
     public generic::Identifiable<LightID> {
@@ -35,18 +49,24 @@ public:
         set_attenuation_from_range(100.0);
     }
 
-    void set_type(LightType type) { type_ = type; }
+    void set_type(LightType type) {
+        type_ = type;
+        bounds_changed();
+    }
 
     void set_diffuse(const kglt::Colour& colour) {
         diffuse_ = colour;
+        mark_render_state_dirty();
     }
 
     void set_ambient(const kglt::Colour& colour) {
         ambient_ = colour;
+        mark_render_state_dirty();
     }
 
     void set_specular(const kglt::Colour& colour) {
         specular_ = colour;
+        mark_render_state_dirty();
     }
 
     LightType type() const { return type_; }
@@ -63,7 +83,15 @@ public:
     float linear_attenuation() const { return linear_attenuation_; }
     float quadratic_attenuation() const { return quadratic_attenuation_; }
 
+    const LightState& light_state() const { return light_state_; }
+
 private:
+    void transformation_changed() { bounds_changed(); }
+    void bounds_changed();
+    void publish();
+
+    LightState light_state_;
+
     LightType type_;
 
     kmVec3 direction_;
@@ -1,12 +1,182 @@
 #include "loader.h"
 #include "scene.h"
 
+#include "kazbase/logging/logging.h"
+
 namespace kglt {
 
+bool IncrementalLoad::step() {
+    if(finished_) {
+        return false;
+    }
+
+    if(cancel_requested_) {
+        cancel_now();
+        return false;
+    }
+
+    stepping_ = true;
+    bool more = false;
+    try {
+        more = do_step();
+    } catch(...) {
+        stepping_ = false;
+        throw;
+    }
+    stepping_ = false;
+
+    if(cancel_requested_) {
+        cancel_now();
+        return false;
+    }
+
+    if(!more) {
+        set_progress(1.0);
+        finish();
+    }
+
+    return more;
+}
+
+void IncrementalLoad::run() {
+    while(step()) {}
+}
+
+void IncrementalLoad::run_when_idle(IdleTaskManager& idle, IdleTaskPriority priority) {
+    IncrementalLoad::ptr self = shared_from_this();
+
+    idle.add([=, &idle]() -> bool {
+        try {
+            while(self->step()) {
+                if(idle.should_yield()) {
+                    return true;
+                }
+            }
+        } catch(std::exception& e) {
+            L_ERROR(std::string("Incremental load failed: ") + e.what());
+            self->error_ = e.what();
+            self->finish();
+        }
+        return false;
+    }, priority);
+}
+
+void IncrementalLoad::cancel() {
+    if(finished_) {
+        return;
+    }
+
+    cancel_requested_ = true;
+    if(!stepping_) {
+        cancel_now();
+    }
+}
+
+void IncrementalLoad::set_progress(float progress) {
+    progress_ = progress;
+    signal_progress_(progress);
+}
+
+void IncrementalLoad::finish() {
+    finished_ = true;
+    signal_finished_();
+}
+
+void IncrementalLoad::cancel_now() {
+    do_cancel();
+    cancelled_ = true;
+    finish();
+}
+
+//Used by loaders that can't split up their work
+class WholeLoad : public IncrementalLoad {
+public:
+    WholeLoad(Loader::ptr loader, Loadable& resource):
+        loader_(loader),
+        resource_(resource) {}
+
+private:
+    bool do_step() {
+        loader_->into(resource_);
+        return false;
+    }
+
+    Loader::ptr loader_;
+    Loadable& resource_;
+};
+
+//Used by loaders that can't split up their main thread stage
+class FinishLoad : public IncrementalLoad {
+public:
+    FinishLoad(Loader::ptr loader, Loadable& resource):
+        loader_(loader),
+        resource_(resource) {}
+
+private:
+    bool do_step() {
+        loader_->finish(resource_);
+        return false;
+    }
+
+    Loader::ptr loader_;
+    Loadable& resource_;
+};
+
+//Steps the load from main thread jobs until the idle budget is spent, then carries on in another
+static void step_from_jobs(JobSystem& jobs, IncrementalLoad::ptr load, Job::ptr finished) {
+    try {
+        while(load->step()) {
+            if(jobs.idle().should_yield()) {
+                jobs.schedule_on_main_thread([=, &jobs]() { step_from_jobs(jobs, load, finished); });
+                return;
+            }
+        }
+    } catch(...) {
+        jobs.complete(finished, std::current_exception());
+        return;
+    }
+
+    jobs.complete(finished);
+}
+
 Loader::~Loader() {
 
 }
 
+IncrementalLoad::ptr Loader::into_incrementally(Loadable& resource) {
+    return IncrementalLoad::ptr(new WholeLoad(shared_from_this(), resource));
+}
+
+IncrementalLoad::ptr Loader::finish_incrementally(Loadable& resource) {
+    return IncrementalLoad::ptr(new FinishLoad(shared_from_this(), resource));
+}
+
+Future<Loadable*> Loader::into_async(Loadable& resource, JobSystem& jobs) {
+    Loader::ptr self = shared_from_this();
+    Loadable* target = &resource;
+
+    begin_async(resource);
+
+    Job::ptr prepared = jobs.schedule([=]() { self->prepare(); });
+    Job::ptr finished = jobs.schedule_event();
+
+    jobs.schedule_on_main_thread([=, &jobs]() {
+        try {
+            jobs.wait(prepared); //Already finished, but rethrows if prepare() failed
+        } catch(...) {
+            jobs.complete(finished, std::current_exception());
+            return;
+        }
+
+        step_from_jobs(jobs, self->finish_incrementally(*target), finished);
+    }, { prepared });
+
+    return jobs.async_on_main_thread<Loadable*>([=, &jobs]() -> Loadable* {
+        jobs.wait(finished); //Rethrows if either stage failed
+        return target;
+    }, { finished });
+}
+
 Scene* Loader::loadable_to_scene_ptr(Loadable& resource) {
     Loadable* res_ptr = &resource;
     Scene* scene = dynamic_cast<Scene*>(res_ptr);
@@ -4,7 +4,10 @@
 #include <stdexcept>
 #include <string>
 #include <tr1/memory>
+#include <sigc++/sigc++.h>
 #include "loadable.h"
+#include "idle_task_manager.h"
+#include "job_system.h"
 
 #include "kglt/option_list.h"
 
@@ -23,12 +26,73 @@ public:
     LoaderRequiresOptionsError():
         std::logic_error("This loader requires options") {}
 };
+/*
+ *  A load that can be done a slice at a time, so it can run on the main thread without
+ *  stopping the game from drawing (a loading screen, say) while it goes.
+ *
+ *  step() does the next slice. run_when_idle() steps it from the idle tasks, as many
+ *  slices a frame as the idle budget allows, until it's finished.
+ *
+ *  cancel() stops the load and removes whatever it has added so far. If called from
+ *  inside a step (e.g. from a progress handler), it happens at the start of the next one.
+ */
+class IncrementalLoad:
+    public std::tr1::enable_shared_from_this<IncrementalLoad> {
+
+public:
+    typedef std::tr1::shared_ptr<IncrementalLoad> ptr;
+
+    virtual ~IncrementalLoad() {}
+
+    bool step(); ///< Returns false once there's nothing left to do
+    void run(); ///< Does the rest of the load now
+    void run_when_idle(IdleTaskManager& idle, IdleTaskPriority priority=IDLE_TASK_PRIORITY_NORMAL);
+    void cancel();
+
+    float progress() const { return progress_; } ///< From 0 to 1
+    bool is_finished() const { return finished_; } ///< True once it's done, cancelled or failed
+    bool is_cancelled() const { return cancelled_; }
+    const std::string& error() const { return error_; } ///< Why it failed, if it threw while running from the idle tasks
+
+    sigc::signal<void, float>& signal_progress() { return signal_progress_; }
+    sigc::signal<void>& signal_finished() { return signal_finished_; }
+
+protected:
+    IncrementalLoad():
+        progress_(0),
+        finished_(false),
+        cancelled_(false),
+        cancel_requested_(false),
+        stepping_(false) {}
+
+    virtual bool do_step() = 0; ///< Does a slice, returns false when that was the last one
+    virtual void do_cancel() {} ///< Removes whatever the load has added so far
+
+    void set_progress(float progress);
+
+private:
+    float progress_;
+    bool finished_;
+    bool cancelled_;
+    bool cancel_requested_;
+    bool stepping_;
+    std::string error_;
+
+    sigc::signal<void, float> signal_progress_;
+    sigc::signal<void> signal_finished_;
+
+    void finish();
+    void cancel_now();
+};
+
 /*
     if(LoaderType().supports("filename")) {
         Loader::ptr = LoaderType().loader(filename);
     }
 */
-class Loader {
+class Loader:
+    public std::tr1::enable_shared_from_this<Loader> {
+
 public:
     typedef std::tr1::shared_ptr<Loader> ptr;
 
@@ -43,6 +107,29 @@ public:
     virtual void into(Loadable& resource, const kglt::option_list::OptionList& options) {
         throw LoaderOptionsUnsupportedError();
     }
+
+    /*
+     *  Starts loading into the resource a slice at a time. Loaders that can't split up
+     *  their work do the whole lot in the first step. The load keeps the loader alive.
+     */
+    virtual IncrementalLoad::ptr into_incrementally(Loadable& resource);
+
+    /*
+     *  Loads into the resource in two stages: prepare() runs on one of the job system's
+     *  workers to do the file reading and decoding, then finish() runs on the main thread
+     *  to fill in the resource and create its GL objects (textures are uploaded). The
+     *  main thread stage is stepped from main thread jobs, as much as the idle budget
+     *  allows each frame, so loaders that split it up with finish_incrementally() don't
+     *  hold up the frame. The future holds the resource once it's ready, and get()
+     *  rethrows anything that failed.
+     */
+    Future<Loadable*> into_async(Loadable& resource, JobSystem& jobs);
+
+    virtual void begin_async(Loadable& resource) {} ///< Called by into_async() on the calling thread, before prepare() is scheduled
+    virtual void prepare() {} ///< The worker stage, mustn't touch the resource or GL
+    virtual void finish(Loadable& resource) { into(resource); } ///< The main thread stage
+    virtual IncrementalLoad::ptr finish_incrementally(Loadable& resource); ///< The main thread stage a slice at a time, by default all of finish() in one step
+
 protected:
     std::string filename_;
 
@@ -0,0 +1,55 @@
+#include <cassert>
+#include <fstream>
+#include <iterator>
+
+#include "kglt/option_list.h"
+#include "kazbase/exceptions.h"
+
+#include "font_loader.h"
+#include "../font.h"
+
+namespace kglt {
+namespace loaders {
+
+static Font& loadable_to_font(Loadable& resource) {
+    Loadable* res_ptr = &resource;
+    Font* font = dynamic_cast<Font*>(res_ptr);
+    assert(font && "You passed a Resource that is not a font to the font loader");
+    return *font;
+}
+
+void FontLoader::into(Loadable& resource) {
+    Font& font = loadable_to_font(resource);
+    if(!font.size()) {
+        throw LoaderRequiresOptionsError();
+    }
+
+    font.initialize(filename_, font.size());
+}
+
+void FontLoader::into(Loadable& resource, const kglt::option_list::OptionList& options) {
+    Font& font = loadable_to_font(resource);
+    font.initialize(filename_, kglt::option_list::get_as<uint32_t>(options, "SIZE"));
+}
+
+void FontLoader::prepare() {
+    std::ifstream file(filename_.c_str(), std::ios::binary);
+    if(!file.good()) {
+        throw IOError("TTF file doesn't exist: " + filename_);
+    }
+
+    data_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void FontLoader::finish(Loadable& resource) {
+    Font& font = loadable_to_font(resource);
+    if(!font.size()) {
+        throw LoaderRequiresOptionsError();
+    }
+
+    font.initialize_from_memory(data_, font.size());
+    data_.clear();
+}
+
+}
+}
@@ -0,0 +1,45 @@
+#ifndef KGLT_FONT_LOADER_H
+#define KGLT_FONT_LOADER_H
+
+#include <vector>
+#include "../loader.h"
+
+namespace kglt {
+namespace loaders {
+
+/*
+ *  Loads TrueType fonts. The size comes from the "SIZE" option, or without options from
+ *  the font's own size (see Font::set_size), which is the only way to give one to
+ *  into_async(). prepare() reads the file, finish() builds the glyphs.
+ */
+class FontLoader : public Loader {
+public:
+    FontLoader(const std::string& filename):
+        Loader(filename) {}
+
+    void into(Loadable& resource);
+    void into(Loadable& resource, const kglt::option_list::OptionList& options);
+
+    void prepare();
+    void finish(Loadable& resource);
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+class FontLoaderType : public LoaderType {
+public:
+    std::string name() { return "font_loader"; }
+    bool supports(const std::string& filename) const {
+        return filename.find(".ttf") != std::string::npos;
+    }
+
+    Loader::ptr loader_for(const std::string& filename) const {
+        return Loader::ptr(new FontLoader(filename));
+    }
+};
+
+}
+}
+
+#endif
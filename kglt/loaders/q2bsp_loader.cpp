@@ -2,7 +2,9 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <set>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "../window.h"
 #include "../scene.h"
@@ -15,6 +17,7 @@
 #include "kazmath/mat4.h"
 
 #include "q2bsp_loader.h"
+#include "../partitioners/bsp_partitioner.h"
 
 #include "kglt/shortcuts.h"
 
@@ -63,6 +66,44 @@ struct Edge {
     uint16_t b;
 };
 
+struct Plane {
+    Point3f normal;
+    float distance;
+    uint32_t type;
+};
+
+struct Node {
+    uint32_t plane;
+    int32_t front_child;        // negative values are leaves: -(leaf + 1)
+    int32_t back_child;
+    Point3s bbox_min;
+    Point3s bbox_max;
+    uint16_t first_face;
+    uint16_t num_faces;
+};
+
+struct Leaf {
+    uint32_t brush_or;
+    int16_t cluster;            // -1 for leaves that can't be seen into
+    uint16_t area;
+    Point3s bbox_min;
+    Point3s bbox_max;
+    uint16_t first_leaf_face;   // index into the leaf face table
+    uint16_t num_leaf_faces;
+    uint16_t first_leaf_brush;
+    uint16_t num_leaf_brushes;
+};
+
+struct Area {
+    uint32_t num_area_portals;
+    uint32_t first_area_portal; // index into the area portal lump
+};
+
+struct AreaPortal {
+    uint32_t portal_num;        // the same portal number appears in both areas
+    uint32_t other_area;
+};
+
 struct TextureInfo {
     Point3f u_axis;
     float u_offset;
@@ -103,6 +144,34 @@ struct Header {
 
 typedef std::map<std::string, std::string> EntityProperties;
 
+struct FaceTriangle {
+    uint32_t vertices[3]; ///< Indexes into the group's vertices
+    kmVec3 normal;
+    float uvs[3][2]; ///< In texels, divided by the texture size once it's loaded
+};
+
+/*
+ * Faces are grouped by the set of cluster/area pairs that can see them, each group
+ * becomes a mesh so that the partitioner can cull it as a whole. The geometry is
+ * worked out first, the meshes are only created once it's all there.
+ */
+struct FaceGroup {
+    std::map<uint32_t, uint32_t> vertex_lookup; ///< Map vertex index -> group mesh vertex index
+    std::vector<uint32_t> vertices; ///< The map vertices the group uses, in group order
+    std::map<std::string, std::vector<FaceTriangle> > triangles_for_texture;
+};
+
+template<typename T>
+void read_lump(std::ifstream& file, const Q2::Lump& lump, std::vector<T>& out) {
+    out.resize(lump.length / sizeof(T));
+    if(out.empty()) {
+        return;
+    }
+
+    file.seekg(lump.offset);
+    file.read((char*)&out[0], sizeof(T) * out.size());
+}
+
 void parse_entities(const std::string& entity_string, std::vector<EntityProperties>& entities) {
     bool inside_entity = false;
     EntityProperties current;
@@ -176,7 +245,7 @@ kmVec3 find_player_spawn_point(std::vector<EntityProperties>& entities) {
     return none;
 }
 
-void add_lights_to_scene(Scene& scene, const std::vector<EntityProperties>& entities) {
+void add_lights_to_scene(Scene& scene, const std::vector<EntityProperties>& entities, std::vector<LightID>& added) {
     //Needed because the Quake 2 coord system is weird
     kmMat4 rotation;
     kmMat4RotationX(&rotation, kmDegreesToRadians(-90.0f));
@@ -188,6 +257,7 @@ void add_lights_to_scene(Scene& scene, const std::vector<EntityProperties>& enti
             origin >> pos.x >> pos.y >> pos.z;
 
             kglt::Light& new_light = kglt::return_new_light(scene);
+            added.push_back(new_light.id());
 
             kmVec3Transform(&pos, &pos, &rotation);
             new_light.move_to(pos.x, pos.y, pos.z);
@@ -214,20 +284,198 @@ void add_lights_to_scene(Scene& scene, const std::vector<EntityProperties>& enti
     }
 }
 
-void Q2BSPLoader::into(Loadable& resource) {
-    Loadable* res_ptr = &resource;
-    Scene* scene = dynamic_cast<Scene*>(res_ptr);
-    assert(scene && "You passed a Resource that is not a scene to the Scene loader");
+/*
+ *  The BSP load, split into stages so it can be done a slice at a time. The first step
+ *  reads the file (unless prepare() already has) and sets up the scene and partitioner,
+ *  then each step loads a texture, builds a batch of faces or creates a mesh.
+ *
+ *  prepare() does the parts that don't touch the scene or GL (reading the file, decoding
+ *  textures and building the face geometry) up front, so they can run on a worker. It only
+ *  uses the scene to find the window's texture loaders. Missing textures fail the load.
+ */
+class Q2BSPLoad : public IncrementalLoad {
+public:
+    static const uint32_t FACES_PER_STEP = 256;
+
+    Q2BSPLoad(const std::string& filename):
+        filename_(filename),
+        scene_(nullptr),
+        stage_(STAGE_READ),
+        file_read_(false),
+        mesh_id_(0),
+        camera_moved_(false),
+        camera_id_(0),
+        next_texture_(0),
+        next_face_(0),
+        built_(0) {
+
+        //Needed because the Quake 2 coord system is weird
+        kmMat4RotationX(&rotation_, kmDegreesToRadians(-90.0f));
+    }
+
+    void set_scene(Scene& scene) { scene_ = &scene; }
+    void prepare();
+
+private:
+    enum Stage {
+        STAGE_READ,
+        STAGE_TEXTURES,
+        STAGE_FACES,
+        STAGE_MESHES
+    };
+
+    bool do_step();
+    void do_cancel();
+
+    //These don't touch the scene
+    void read_file();
+    Loader& prepare_texture(const std::string& name);
+    void build_faces(uint32_t count);
+
+    //These do
+    void setup_scene();
+    void load_texture();
+    void build_mesh();
+
+    std::string filename_;
+    Scene* scene_;
+    Stage stage_;
+    kmMat4 rotation_;
+    bool file_read_;
+
+    //What's been added to or changed in the scene, so it can be undone on cancel
+    MeshID mesh_id_;
+    std::vector<LightID> lights_;
+    std::vector<MaterialID> materials_;
+    Partitioner::ptr previous_partitioner_;
+    bool camera_moved_;
+    CameraID camera_id_;
+    kmVec3 previous_camera_position_;
+
+    std::vector<EntityProperties> entities_;
+    std::vector<Q2::Edge> edges_;
+    std::vector<Q2::TextureInfo> textures_;
+    std::vector<Q2::Face> faces_;
+    std::vector<int32_t> face_edges_;
+    std::vector<kmVec3> points_;
+    std::vector<std::vector<BSPPartitioner::Location> > face_locations_;
+
+    std::vector<BSPPartitioner::Plane> bsp_planes_;
+    std::vector<BSPPartitioner::Node> bsp_nodes_;
+    std::vector<BSPPartitioner::Leaf> bsp_leaves_;
+    std::vector<BSPPartitioner::Area> bsp_areas_;
+    std::vector<BSPPartitioner::AreaPortal> bsp_portals_;
+    std::vector<uint8_t> vis_data_;
+    BSPPartitioner::ptr partitioner_;
+
+    std::vector<std::string> texture_names_; ///< Each texture once, in the order they're loaded
+    std::map<std::string, Loader::ptr> texture_loaders_;
+    std::map<std::string, kglt::TextureID> tex_lookup_;
+    std::map<kglt::TextureID, kglt::MaterialID> material_for_texture_;
+    std::map<std::string, std::pair<uint32_t, uint32_t> > texture_dimensions_;
+    std::map<std::vector<BSPPartitioner::Location>, FaceGroup> groups_;
+
+    uint32_t next_texture_;
+    uint32_t next_face_;
+    uint32_t built_;
+    std::map<std::vector<BSPPartitioner::Location>, FaceGroup>::iterator next_group_;
+};
+
+void Q2BSPLoad::prepare() {
+    read_file();
+
+    for(const std::string& name: texture_names_) {
+        prepare_texture(name);
+    }
+
+    build_faces(faces_.size());
+}
+
+bool Q2BSPLoad::do_step() {
+    assert(scene_);
+
+    //Progress is split evenly between the stages
+    switch(stage_) {
+        case STAGE_READ:
+            read_file();
+            setup_scene();
+            stage_ = STAGE_TEXTURES;
+            set_progress(0.25);
+        break;
+        case STAGE_TEXTURES:
+            if(next_texture_ < texture_names_.size()) {
+                load_texture();
+            }
+
+            if(next_texture_ == texture_names_.size()) {
+                std::cout << "Num textures: " << tex_lookup_.size() << std::endl;
+                stage_ = STAGE_FACES;
+            }
+            set_progress(0.25 + 0.25 * (texture_names_.empty() ? 1.0 : float(next_texture_) / texture_names_.size()));
+        break;
+        case STAGE_FACES:
+            build_faces(FACES_PER_STEP);
+            if(next_face_ == faces_.size()) {
+                std::cout << "Num visibility groups: " << groups_.size() << std::endl;
+                L_DEBUG("Compiling meshes");
+                next_group_ = groups_.begin();
+                stage_ = STAGE_MESHES;
+            }
+            set_progress(0.5 + 0.25 * (faces_.empty() ? 1.0 : float(next_face_) / faces_.size()));
+        break;
+        case STAGE_MESHES:
+            if(next_group_ != groups_.end()) {
+                build_mesh();
+                set_progress(0.75 + 0.25 * float(built_) / groups_.size());
+            }
+        break;
+    }
+
+    return !(stage_ == STAGE_MESHES && next_group_ == groups_.end());
+}
+
+void Q2BSPLoad::do_cancel() {
+    if(!scene_) {
+        return;
+    }
+
+    //The group meshes are children of the map mesh, so go with it
+    if(mesh_id_) {
+        scene_->delete_mesh(mesh_id_);
+    }
+
+    for(LightID light_id: lights_) {
+        scene_->delete_light(light_id);
+    }
+
+    for(MaterialID material_id: materials_) {
+        scene_->delete_material(material_id);
+    }
+
+    for(std::pair<std::string, kglt::TextureID> p: tex_lookup_) {
+        scene_->delete_texture(p.second);
+    }
+
+    if(previous_partitioner_) {
+        scene_->set_partitioner(previous_partitioner_);
+    }
+
+    if(camera_moved_) {
+        const kmVec3& pos = previous_camera_position_;
+        scene_->camera(camera_id_).move_to(pos.x, pos.y, pos.z);
+    }
+}
+
+void Q2BSPLoad::read_file() {
+    if(file_read_) {
+        return;
+    }
 
     std::ifstream file(filename_.c_str(), std::ios::binary);
     if(!file.good()) {
         throw std::runtime_error("Couldn't load the BSP file: " + filename_);
     }
 
-    //Needed because the Quake 2 coord system is weird
-    kmMat4 rotation;
-    kmMat4RotationX(&rotation, kmDegreesToRadians(-90.0f));
-
     Q2::Header header;
     file.read((char*)&header, sizeof(Q2::Header));
 
@@ -235,71 +483,116 @@ void Q2BSPLoader::into(Loadable& resource) {
         throw std::runtime_error("Not a valid Q2 map");
     }
 
-    MeshID mid = scene->new_mesh();
-    Mesh& mesh = scene->mesh(mid);
-    //mesh.set_arrangement(MeshArrangement::POINTS);
-
     std::vector<char> entity_buffer(header.lumps[Q2::LumpType::ENTITIES].length);
     file.seekg(header.lumps[Q2::LumpType::ENTITIES].offset);
     file.read(&entity_buffer[0], sizeof(char) * header.lumps[Q2::LumpType::ENTITIES].length);
     std::string entity_string(entity_buffer.begin(), entity_buffer.end());
 
+    parse_entities(entity_string, entities_);
 
-    std::vector<EntityProperties> entities;
-    parse_entities(entity_string, entities);
-    scene->active_camera().position() = find_player_spawn_point(entities);
-    kmVec3Transform(&scene->active_camera().position(), &scene->active_camera().position(), &rotation);
+    std::vector<Q2::Point3f> vertices;
+    read_lump(file, header.lumps[Q2::LumpType::VERTICES], vertices);
 
-    add_lights_to_scene(*scene, entities);
+    read_lump(file, header.lumps[Q2::LumpType::EDGES], edges_);
+    read_lump(file, header.lumps[Q2::LumpType::TEXTURE_INFO], textures_);
 
-    int32_t num_vertices = header.lumps[Q2::LumpType::VERTICES].length / sizeof(Q2::Point3f);
-    std::vector<Q2::Point3f> vertices(num_vertices);
-    file.seekg(header.lumps[Q2::LumpType::VERTICES].offset);
-    file.read((char*)&vertices[0], sizeof(Q2::Point3f) * num_vertices);
+    //Read in the faces
+    read_lump(file, header.lumps[Q2::LumpType::FACES], faces_);
+    read_lump(file, header.lumps[Q2::LumpType::FACE_EDGE_TABLE], face_edges_);
 
-    int32_t num_edges = header.lumps[Q2::LumpType::EDGES].length / sizeof(Q2::Edge);
-    std::vector<Q2::Edge> edges(num_edges);
-    file.seekg(header.lumps[Q2::LumpType::EDGES].offset);
-    file.read((char*)&edges[0], sizeof(Q2::Edge) * num_edges);
+    //Read the BSP tree and the visibility information
+    std::vector<Q2::Plane> planes;
+    read_lump(file, header.lumps[Q2::LumpType::PLANES], planes);
 
-    int32_t num_textures = header.lumps[Q2::LumpType::TEXTURE_INFO].length / sizeof(Q2::TextureInfo);
-    std::vector<Q2::TextureInfo> textures(num_textures);
-    file.seekg(header.lumps[Q2::LumpType::TEXTURE_INFO].offset);
-    file.read((char*)&textures[0], sizeof(Q2::TextureInfo) * num_textures);
+    std::vector<Q2::Node> nodes;
+    read_lump(file, header.lumps[Q2::LumpType::NODES], nodes);
 
-    //Read in the faces
-    int32_t num_faces = header.lumps[Q2::LumpType::FACES].length / sizeof(Q2::Face);
-    std::vector<Q2::Face> faces(num_faces);
-    file.seekg(header.lumps[Q2::LumpType::FACES].offset);
-    file.read((char*)&faces[0], sizeof(Q2::Face) * num_faces);
+    std::vector<Q2::Leaf> leaves;
+    read_lump(file, header.lumps[Q2::LumpType::LEAVES], leaves);
+
+    std::vector<uint16_t> leaf_faces;
+    read_lump(file, header.lumps[Q2::LumpType::LEAF_FACE_TABLE], leaf_faces);
+
+    read_lump(file, header.lumps[Q2::LumpType::VISIBILITY], vis_data_);
+
+    std::vector<Q2::Area> areas;
+    read_lump(file, header.lumps[Q2::LumpType::AREAS], areas);
+
+    std::vector<Q2::AreaPortal> area_portals;
+    read_lump(file, header.lumps[Q2::LumpType::AREA_PORTALS], area_portals);
+
+    for(Q2::Plane& p: planes) {
+        BSPPartitioner::Plane plane;
+        kmVec3Fill(&plane.normal, p.normal.x, p.normal.y, p.normal.z);
+        kmVec3Transform(&plane.normal, &plane.normal, &rotation_);
+        plane.distance = p.distance;
+        bsp_planes_.push_back(plane);
+    }
 
-    int32_t num_face_edges = header.lumps[Q2::LumpType::FACE_EDGE_TABLE].length / sizeof(int32_t);
-    std::vector<int32_t> face_edges(num_face_edges);
-    file.seekg(header.lumps[Q2::LumpType::FACE_EDGE_TABLE].offset);
-    file.read((char*)&face_edges[0], sizeof(int32_t) * num_face_edges);
+    for(Q2::Node& n: nodes) {
+        BSPPartitioner::Node node;
+        node.plane = n.plane;
+        node.front = n.front_child;
+        node.back = n.back_child;
+        bsp_nodes_.push_back(node);
+    }
 
+    for(Q2::Leaf& l: leaves) {
+        BSPPartitioner::Leaf leaf;
+        leaf.cluster = l.cluster;
+        leaf.area = l.area;
+        bsp_leaves_.push_back(leaf);
+    }
+
+    for(Q2::Area& a: areas) {
+        BSPPartitioner::Area area;
+        area.num_portals = a.num_area_portals;
+        area.first_portal = a.first_area_portal;
+        bsp_areas_.push_back(area);
+    }
+
+    for(Q2::AreaPortal& p: area_portals) {
+        BSPPartitioner::AreaPortal portal;
+        portal.portal = p.portal_num;
+        portal.other_area = p.other_area;
+        bsp_portals_.push_back(portal);
+    }
+
+    //Work out which clusters (and areas) each face can be seen from
+    face_locations_.resize(faces_.size());
+    for(Q2::Leaf& l: leaves) {
+        if(l.cluster < 0) {
+            continue;
+        }
 
-    //Copy the vertices to the mesh
+        BSPPartitioner::Location location;
+        location.cluster = l.cluster;
+        location.area = l.area;
+
+        for(uint32_t i = l.first_leaf_face; i < uint32_t(l.first_leaf_face + l.num_leaf_faces); ++i) {
+            std::vector<BSPPartitioner::Location>& locations = face_locations_.at(leaf_faces.at(i));
+            if(std::find(locations.begin(), locations.end(), location) == locations.end()) {
+                locations.push_back(location);
+            }
+        }
+    }
+
+    //Transform the vertices into our coordinate system
     for(Q2::Point3f& p: vertices) {
         kmVec3 point;
         kmVec3Fill(&point, p.x, p.y, p.z);
-        kmVec3Transform(&point, &point, &rotation);
-        mesh.add_vertex(point.x, point.y, point.z);
+        kmVec3Transform(&point, &point, &rotation_);
+        points_.push_back(point);
     }
 
-    std::map<std::string, kglt::TextureID> tex_lookup;
-    std::map<kglt::TextureID, uint32_t> mesh_for_texture;
-    std::map<std::string, std::pair<uint32_t, uint32_t> > texture_dimensions;
-
-    for(Q2::TextureInfo& tex: textures) {
-        MaterialID material_id = scene->new_material(scene->default_material()); //Duplicate the default material
-        Material& mat = scene->material(material_id);
-
+    //...and the texture axes
+    std::set<std::string> seen;
+    for(Q2::TextureInfo& tex: textures_) {
         kmVec3 u_axis, v_axis;
         kmVec3Fill(&u_axis, tex.u_axis.x, tex.u_axis.y, tex.u_axis.z);
         kmVec3Fill(&v_axis, tex.v_axis.x, tex.v_axis.y, tex.v_axis.z);
-        kmVec3Transform(&u_axis, &u_axis, &rotation);
-        kmVec3Transform(&v_axis, &v_axis, &rotation);
+        kmVec3Transform(&u_axis, &u_axis, &rotation_);
+        kmVec3Transform(&v_axis, &v_axis, &rotation_);
         tex.u_axis.x = u_axis.x;
         tex.u_axis.y = u_axis.y;
         tex.u_axis.z = u_axis.z;
@@ -308,53 +601,53 @@ void Q2BSPLoader::into(Loadable& resource) {
         tex.v_axis.y = v_axis.y;
         tex.v_axis.z = v_axis.z;
 
-        if(tex_lookup.find(tex.texture_name) != tex_lookup.end()) continue;
+        if(seen.insert(tex.texture_name).second) {
+            texture_names_.push_back(tex.texture_name);
+        }
+    }
 
-        //Load texture
-        kglt::TextureID tid = scene->new_texture();
-        Texture& texture = scene->texture(tid);
+    file_read_ = true;
+}
 
+Loader& Q2BSPLoad::prepare_texture(const std::string& name) {
+    Loader::ptr& loader = texture_loaders_[name];
+    if(!loader) {
         //HACK!
-        scene->window().loader_for("textures/" + std::string(tex.texture_name) + ".tga")->into(texture);
-
-        //We need to store this to divide the texture coordinates later
-        texture_dimensions[tex.texture_name].first = texture.width();
-        texture_dimensions[tex.texture_name].second = texture.height();
-
-        texture.upload();
-        tex_lookup[tex.texture_name] = tid;
-
-        //Set the texture for unit 0
-        mat.technique().pass(0).set_texture_unit(0, tid);
-
-        //Create a submesh for each texture, set it to use the parent mesh's verticces
-        mesh_for_texture[tid] = mesh.add_submesh(true);
-        Mesh& new_submesh = mesh.submesh(mesh_for_texture[tid]);
-        new_submesh.apply_material(material_id);
+        loader = scene_->window().loader_for("textures/" + name + ".tga");
+        loader->prepare();
     }
+    return *loader;
+}
 
-    std::cout << "Num textures: " << tex_lookup.size() << std::endl;
-    std::cout << "Num submeshes: " << mesh.submeshes().size() << std::endl;
+void Q2BSPLoad::build_faces(uint32_t count) {
+    uint32_t end = std::min<uint32_t>(faces_.size(), next_face_ + count);
+    for(uint32_t face_idx = next_face_; face_idx < end; ++face_idx) {
+        Q2::Face& f = faces_[face_idx];
 
-    for(Q2::Face& f: faces) {
         std::vector<uint32_t> indexes;
         for(uint32_t i = f.first_edge; i < f.first_edge + f.num_edges; ++i) {
-            int32_t edge_idx = face_edges[i];
+            int32_t edge_idx = face_edges_[i];
             if(edge_idx > 0) {
-                Q2::Edge& e = edges[edge_idx];
+                Q2::Edge& e = edges_[edge_idx];
                 indexes.push_back(e.a);
                 indexes.push_back(e.b);
             } else {
                 edge_idx = -edge_idx;
-                Q2::Edge& e = edges[edge_idx];
+                Q2::Edge& e = edges_[edge_idx];
                 indexes.push_back(e.b);
                 indexes.push_back(e.a);
             }
         }
 
-        Q2::TextureInfo& tex = textures[f.texture_info];
-        //std::cout << tex.texture_name << std::endl;
-        Mesh& texture_mesh = mesh.submesh(mesh_for_texture[tex_lookup[tex.texture_name]]);
+        //Find (or create) the group for the clusters that can see this face
+        std::vector<BSPPartitioner::Location>& locations = face_locations_[face_idx];
+        std::sort(locations.begin(), locations.end());
+
+        FaceGroup& group = groups_[locations];
+
+        Q2::TextureInfo& tex = textures_[f.texture_info];
+        std::vector<FaceTriangle>& triangles = group.triangles_for_texture[tex.texture_name];
+
         for(int32_t i = 1; i < (int32_t) indexes.size() - 1; ++i) {
             uint32_t tri_idx[] = {
                 indexes[0],
@@ -362,42 +655,184 @@ void Q2BSPLoader::into(Loadable& resource) {
                 indexes[i]
             };
 
-            Triangle& tri = texture_mesh.add_triangle(tri_idx[0], tri_idx[1], tri_idx[2]);
+            FaceTriangle tri;
+
+            //Add any vertices this group doesn't have yet
+            for(int32_t j = 0; j < 3; ++j) {
+                std::map<uint32_t, uint32_t>::iterator it = group.vertex_lookup.find(tri_idx[j]);
+                if(it == group.vertex_lookup.end()) {
+                    group.vertices.push_back(tri_idx[j]);
+                    it = group.vertex_lookup.insert(std::make_pair(tri_idx[j], group.vertices.size() - 1)).first;
+                }
+                tri.vertices[j] = (*it).second;
+            }
 
-            Vec3 normal;
             Vec3 vec1, vec2;
-            Vec3& v1 = mesh.vertex(tri.index(0));
-            Vec3& v2 = mesh.vertex(tri.index(1));
-            Vec3& v3 = mesh.vertex(tri.index(2));
+            const kmVec3& v1 = points_[tri_idx[0]];
+            const kmVec3& v2 = points_[tri_idx[1]];
+            const kmVec3& v3 = points_[tri_idx[2]];
 
             kmVec3Subtract(&vec1, &v2, &v1);
             kmVec3Subtract(&vec2, &v3, &v1);
-            kmVec3Cross(&normal, &vec1, &vec2);
-            kmVec3Normalize(&normal, &normal);
-
-            tri.set_surface_normal(normal.x, normal.y, normal.z);
+            kmVec3Cross(&tri.normal, &vec1, &vec2);
+            kmVec3Normalize(&tri.normal, &tri.normal);
 
             for(int32_t j = 0; j < 3; ++j) {
-                float u = mesh.vertex(tri_idx[j]).x * tex.u_axis.x
-                        + mesh.vertex(tri_idx[j]).y * tex.u_axis.y
-                        + mesh.vertex(tri_idx[j]).z * tex.u_axis.z + tex.u_offset;
-
-                float v = mesh.vertex(tri_idx[j]).x * tex.v_axis.x
-                        + mesh.vertex(tri_idx[j]).y * tex.v_axis.y
-                        + mesh.vertex(tri_idx[j]).z * tex.v_axis.z + tex.v_offset;
+                const kmVec3& v = points_[tri_idx[j]];
+                float u = v.x * tex.u_axis.x
+                        + v.y * tex.u_axis.y
+                        + v.z * tex.u_axis.z + tex.u_offset;
 
-                float w = float(texture_dimensions[tex.texture_name].first);
-                float h = float(texture_dimensions[tex.texture_name].second);
+                float v_coord = v.x * tex.v_axis.x
+                        + v.y * tex.v_axis.y
+                        + v.z * tex.v_axis.z + tex.v_offset;
 
-                tri.set_uv(j, u / w, v / h);
+                tri.uvs[j][0] = u;
+                tri.uvs[j][1] = v_coord;
             }
+
+            triangles.push_back(tri);
+        }
+    }
+
+    next_face_ = end;
+}
+
+void Q2BSPLoad::setup_scene() {
+    Scene* scene = scene_;
+
+    mesh_id_ = scene->new_mesh();
+    //mesh.set_arrangement(MeshArrangement::POINTS);
+
+    kmVec3 spawn = find_player_spawn_point(entities_);
+    kmVec3Transform(&spawn, &spawn, &rotation_);
+
+    Camera& camera = scene->active_camera();
+    camera_moved_ = true;
+    camera_id_ = camera.id();
+    previous_camera_position_ = camera.position();
+    camera.move_to(spawn.x, spawn.y, spawn.z);
+
+    add_lights_to_scene(*scene, entities_, lights_);
+
+    partitioner_.reset(new BSPPartitioner(*scene));
+    partitioner_->set_tree(bsp_planes_, bsp_nodes_, bsp_leaves_);
+
+    //The lump starts with the cluster count, then a PVS and PHS offset per cluster
+    if(vis_data_.size() >= sizeof(uint32_t)) {
+        uint32_t num_clusters = *(uint32_t*) &vis_data_[0];
+        std::vector<uint32_t> pvs_offsets(num_clusters);
+        for(uint32_t i = 0; i < num_clusters; ++i) {
+            pvs_offsets[i] = *(uint32_t*) &vis_data_[sizeof(uint32_t) + (i * sizeof(uint32_t) * 2)];
         }
+        partitioner_->set_visibility(num_clusters, pvs_offsets, vis_data_);
     }
 
-    L_DEBUG("Compiling meshes");
-    for(Mesh::ptr m: mesh.submeshes()) {
-        m->done();
+    partitioner_->set_areas(bsp_areas_, bsp_portals_);
+    L_DEBUG("Loaded " + boost::lexical_cast<std::string>(partitioner_->portal_count()) + " area portals");
+
+    previous_partitioner_ = scene->partitioner_ptr();
+    scene->set_partitioner(partitioner_);
+}
+
+void Q2BSPLoad::load_texture() {
+    Scene* scene = scene_;
+    const std::string& name = texture_names_[next_texture_++];
+
+    //Load texture, unless prepare() already has
+    Loader& loader = prepare_texture(name);
+
+    kglt::TextureID tid = scene->new_texture();
+    tex_lookup_[name] = tid;
+    Texture& texture = scene->texture(tid);
+    loader.finish(texture); //Uploads it too
+    texture_loaders_.erase(name);
+
+    //We need to store this to divide the texture coordinates later
+    texture_dimensions_[name].first = texture.width();
+    texture_dimensions_[name].second = texture.height();
+
+    MaterialID material_id = scene->new_material(scene->default_material()); //Duplicate the default material
+    materials_.push_back(material_id);
+    Material& mat = scene->material(material_id);
+
+    //Set the texture for unit 0
+    mat.technique().pass(0).set_texture_unit(0, tid);
+    material_for_texture_[tid] = material_id;
+}
+
+void Q2BSPLoad::build_mesh() {
+    Scene* scene = scene_;
+    FaceGroup& group = next_group_->second;
+
+    MeshID group_id = scene->new_mesh(&scene->mesh(mesh_id_));
+    partitioner_->set_mesh_locations(group_id, next_group_->first);
+    Mesh& group_mesh = scene->mesh(group_id);
+
+    for(uint32_t vertex: group.vertices) {
+        const kmVec3& p = points_[vertex];
+        group_mesh.add_vertex(p.x, p.y, p.z);
     }
+
+    //A submesh for each texture, using the group mesh's vertices
+    for(std::pair<const std::string, std::vector<FaceTriangle> >& p: group.triangles_for_texture) {
+        kglt::TextureID tid = tex_lookup_[p.first];
+        float w = float(texture_dimensions_[p.first].first);
+        float h = float(texture_dimensions_[p.first].second);
+
+        Mesh& texture_mesh = group_mesh.submesh(group_mesh.add_submesh(true));
+        texture_mesh.apply_material(material_for_texture_[tid]);
+
+        for(FaceTriangle& face_tri: p.second) {
+            Triangle& tri = texture_mesh.add_triangle(face_tri.vertices[0], face_tri.vertices[1], face_tri.vertices[2]);
+            tri.set_surface_normal(face_tri.normal.x, face_tri.normal.y, face_tri.normal.z);
+
+            for(int32_t j = 0; j < 3; ++j) {
+                tri.set_uv(j, face_tri.uvs[j][0] / w, face_tri.uvs[j][1] / h);
+            }
+        }
+
+        texture_mesh.done();
+    }
+
+    //Nothing needs the geometry now it's in the mesh
+    group = FaceGroup();
+
+    ++next_group_;
+    ++built_;
+}
+
+IncrementalLoad::ptr Q2BSPLoader::into_incrementally(Loadable& resource) {
+    Scene* scene = loadable_to_scene_ptr(resource);
+
+    std::tr1::shared_ptr<Q2BSPLoad> load(new Q2BSPLoad(filename_));
+    load->set_scene(*scene);
+    return load;
+}
+
+void Q2BSPLoader::into(Loadable& resource) {
+    into_incrementally(resource)->run();
+}
+
+void Q2BSPLoader::begin_async(Loadable& resource) {
+    //The scene is only used to find the window's texture loaders on the worker
+    prepared_.reset(new Q2BSPLoad(filename_));
+    prepared_->set_scene(*loadable_to_scene_ptr(resource));
+}
+
+void Q2BSPLoader::prepare() {
+    prepared_->prepare();
+}
+
+void Q2BSPLoader::finish(Loadable& resource) {
+    finish_incrementally(resource)->run();
+}
+
+IncrementalLoad::ptr Q2BSPLoader::finish_incrementally(Loadable& resource) {
+    //The rest of the load builds the scene a texture or a mesh at a time
+    IncrementalLoad::ptr load = prepared_;
+    prepared_.reset();
+    return load;
 }
 
 }
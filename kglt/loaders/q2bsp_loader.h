@@ -6,12 +6,23 @@
 namespace kglt {
 namespace loaders {
 
+class Q2BSPLoad;
+
 class Q2BSPLoader : public Loader {
 public:
     Q2BSPLoader(const std::string& filename):
         Loader(filename) {}
 
     void into(Loadable& resource);
+    IncrementalLoad::ptr into_incrementally(Loadable& resource);
+
+    void begin_async(Loadable& resource);
+    void prepare();
+    void finish(Loadable& resource);
+    IncrementalLoad::ptr finish_incrementally(Loadable& resource);
+
+private:
+    std::tr1::shared_ptr<Q2BSPLoad> prepared_;
 
 };
 
@@ -22,6 +22,32 @@ void TextureLoader::into(Loadable& resource, const kglt::option_list::OptionList
     Texture* tex = dynamic_cast<Texture*>(res_ptr);
     assert(tex && "You passed a Resource that is not a texture to the TGA loader");
 
+    decode(should_fall_back(options));
+    apply(*tex);
+}
+
+void TextureLoader::prepare() {
+    decode(fallback_);
+}
+
+void TextureLoader::finish(Loadable& resource) {
+    Loadable* res_ptr = &resource;
+    Texture* tex = dynamic_cast<Texture*>(res_ptr);
+    assert(tex && "You passed a Resource that is not a texture to the TGA loader");
+
+    apply(*tex);
+    tex->upload();
+}
+
+bool TextureLoader::should_fall_back(const kglt::option_list::OptionList& options) {
+	try {
+		return (bool) kglt::option_list::get_as<int>(options, "FALLBACK_TO_CHECKERBOARD");
+	} catch(kglt::option_list::OptionDoesNotExist& e) {
+		return false;
+	}
+}
+
+void TextureLoader::decode(bool fallback) {
     int width, height, channels;
     unsigned char* data = SOIL_load_image(
         filename_.c_str(),
@@ -31,18 +57,14 @@ void TextureLoader::into(Loadable& resource, const kglt::option_list::OptionList
         SOIL_LOAD_AUTO
     );
 
-	bool fallback = false;
-	try {
-		fallback = (bool) kglt::option_list::get_as<int>(options, "FALLBACK_TO_CHECKERBOARD");
-	} catch(kglt::option_list::OptionDoesNotExist& e) {}
-
     if(!data && fallback) {
         std::cout << "Falling back to checkerboard" << std::endl;
         
         //FIXME: Don't generate this each time!
-        channels = 4;
-        tex->set_bpp(channels * 8);
-        tex->resize(64, 64);
+        channels_ = 4;
+        width_ = 64;
+        height_ = 64;
+        data_.resize(64 * 64 * channels_);
         uint32_t j = 0;
         uint32_t switch_counter = 0;
         bool black = true;                
@@ -60,36 +82,31 @@ void TextureLoader::into(Loadable& resource, const kglt::option_list::OptionList
                 }
             }
             
-            if(black) {
-                tex->data()[i * channels] = 0;
-                tex->data()[(i * channels) + 1] = 0;
-                tex->data()[(i * channels) + 2] = 0;                                
-                tex->data()[(i * channels) + 3] = 255;                
-            } else {
-                tex->data()[i * channels] = 255;
-                tex->data()[(i * channels) + 1] = 255;
-                tex->data()[(i * channels) + 2] = 255;                                
-                tex->data()[(i * channels) + 3] = 255;                            
-            }
+            uint8_t shade = black ? 0 : 255;
+            data_[i * channels_] = shade;
+            data_[(i * channels_) + 1] = shade;
+            data_[(i * channels_) + 2] = shade;
+            data_[(i * channels_) + 3] = 255;
         }
         
     } else if (!data) {
 		throw IOError("Couldn't load the file: " + filename_);		 
     } else {
-        tex->set_bpp(channels * 8);
-        tex->resize(width, height);
-        tex->data().assign(data, data + (width * height * channels));
+        width_ = width;
+        height_ = height;
+        channels_ = channels;
+        data_.assign(data, data + (width * height * channels));
 
         //SOIL loads images upside-down this loop will flip it the right way
-        for(uint32_t j = 0; j * 2 < height; ++j)
+        for(uint32_t j = 0; j * 2 < height_; ++j)
         {
-            int index1 = j * width * channels;
-            int index2 = (height - 1 - j) * width * channels;
-            for(uint32_t i = width * channels; i > 0; --i )
+            int index1 = j * width_ * channels_;
+            int index2 = (height_ - 1 - j) * width_ * channels_;
+            for(uint32_t i = width_ * channels_; i > 0; --i )
             {
-                uint8_t temp = tex->data()[index1];
-                tex->data()[index1] = tex->data()[index2];
-                tex->data()[index2] = temp;
+                uint8_t temp = data_[index1];
+                data_[index1] = data_[index2];
+                data_[index2] = temp;
                 ++index1;
                 ++index2;
             }
@@ -99,5 +116,13 @@ void TextureLoader::into(Loadable& resource, const kglt::option_list::OptionList
     }
 }
 
+void TextureLoader::apply(Texture& texture) {
+    texture.set_bpp(channels_ * 8);
+    texture.resize(width_, height_);
+    texture.data().swap(data_);
+    data_.clear();
+}
+
 }
 }
+
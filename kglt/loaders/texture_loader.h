@@ -1,18 +1,51 @@
 #ifndef KGLT_TGA_LOADER_H
 #define KGLT_TGA_LOADER_H
 
+#include <vector>
 #include "../loader.h"
 
 namespace kglt {
+
+class Texture;
+
 namespace loaders {
 
+/*
+ *  Loads TGA and PNG files. Missing or broken files throw IOError unless the
+ *  "FALLBACK_TO_CHECKERBOARD" option is set, in which case they load as a checkerboard.
+ *  into(resource) without options falls back. The options given to the constructor are
+ *  the ones prepare() uses, as into_async() can't pass any.
+ */
 class TextureLoader : public Loader {
 public:
-    TextureLoader(const std::string& filename):
-        Loader(filename) {}
+    TextureLoader(const std::string& filename, const kglt::option_list::OptionList& options=kglt::option_list::OptionList()):
+        Loader(filename),
+        fallback_(should_fall_back(options)),
+        width_(0),
+        height_(0),
+        channels_(0) {}
 
     void into(Loadable& resource);
     void into(Loadable& resource, const kglt::option_list::OptionList& options);
+
+    void prepare();
+    void finish(Loadable& resource);
+
+    //The decoded image, once prepared
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+private:
+    bool fallback_;
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t channels_;
+    std::vector<uint8_t> data_;
+
+    static bool should_fall_back(const kglt::option_list::OptionList& options);
+
+    void decode(bool fallback);
+    void apply(Texture& texture);
 };
 
 class TextureLoaderType : public LoaderType {
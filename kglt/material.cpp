@@ -2,6 +2,7 @@
 #include <cassert>
 
 #include "material.h"
+#include "scene.h"
 
 namespace kglt {
 
@@ -31,11 +32,55 @@ TextureUnit::TextureUnit(std::vector<TextureID> textures, double duration):
 }
 
 Material::Material(Scene *scene, MaterialID mat_id):
-    generic::Identifiable<MaterialID>(mat_id) {
+    generic::Identifiable<MaterialID>(mat_id),
+    scene_(scene),
+    animated_(false),
+    changed_(false) {
 
     new_technique(DEFAULT_MATERIAL_SCHEME); //Create the default technique
 }
 
+void Material::mark_animated() {
+    if(animated_) {
+        return;
+    }
+
+    animated_ = true;
+    scene_->_add_animated_material(id());
+}
+
+void Material::mark_changed() {
+    if(changed_) {
+        return;
+    }
+
+    changed_ = true;
+    scene_->_material_changed(id());
+}
+
+void Material::_publish() {
+    changed_ = false;
+
+    //FIXME: Read the active technique from somewhere
+    MaterialTechnique& tech = technique(DEFAULT_MATERIAL_SCHEME);
+
+    //The vectors are refilled in place, animated materials are published every frame
+    pass_states_.resize(tech.pass_count());
+    for(uint32_t i = 0; i < tech.pass_count(); ++i) {
+        MaterialPass& pass = tech.pass(i);
+        PassState& state = pass_states_[i];
+
+        state.shader = pass.shader();
+        state.iteration = pass.iteration();
+        state.max_iterations = pass.max_iterations();
+
+        state.textures.clear();
+        for(uint32_t j = 0; j < pass.texture_unit_count(); ++j) {
+            state.textures.push_back(pass.texture_unit(j).texture());
+        }
+    }
+}
+
 MaterialTechnique& Material::technique(const std::string& scheme) {
     if(!has_technique(scheme)) {
         throw std::logic_error("No such technique with scheme: " + scheme);
@@ -50,15 +95,19 @@ MaterialTechnique& Material::new_technique(const std::string& scheme) {
     }
 
     techniques_[scheme].reset(new MaterialTechnique(*this, scheme));
+    mark_changed();
     return technique(scheme);
 }
 
-MaterialTechnique::MaterialTechnique(Material& mat, const std::string& scheme) {
-    scheme_ = scheme;
+MaterialTechnique::MaterialTechnique(Material& mat, const std::string& scheme):
+    material_(mat),
+    scheme_(scheme) {
+
 }
 
 uint32_t MaterialTechnique::new_pass(ShaderID shader) {
-    passes_.push_back(MaterialPass::ptr(new MaterialPass(shader)));
+    passes_.push_back(MaterialPass::ptr(new MaterialPass(material_, shader)));
+    material_.mark_changed();
     return passes_.size() - 1; //Return the index
 }
 
@@ -66,7 +115,8 @@ MaterialPass& MaterialTechnique::pass(uint32_t index) {
     return *passes_.at(index);
 }
 
-MaterialPass::MaterialPass(ShaderID shader):
+MaterialPass::MaterialPass(Material& material, ShaderID shader):
+    material_(material),
     shader_(shader),
     iteration_(ITERATE_ONCE),
     max_iterations_(1) {
@@ -82,6 +132,13 @@ void MaterialPass::set_texture_unit(uint32_t texture_unit_id, TextureID tex) {
         texture_units_.resize(texture_unit_id + 1);
     }
     texture_units_[texture_unit_id] = TextureUnit(tex);
+    material_.mark_changed();
+}
+
+void MaterialPass::set_iteration(IterationType iter_type, uint32_t max) {
+    iteration_ = iter_type;
+    max_iterations_ = max;
+    material_.mark_changed();
 }
 
 void MaterialPass::set_animated_texture_unit(uint32_t texture_unit_id, const std::vector<TextureID> textures, double duration) {
@@ -93,6 +150,8 @@ void MaterialPass::set_animated_texture_unit(uint32_t texture_unit_id, const std
         texture_units_.resize(texture_unit_id + 1);
     }
     texture_units_[texture_unit_id] = TextureUnit(textures, duration);
+    material_.mark_animated();
+    material_.mark_changed();
 }
 
 }
@@ -63,7 +63,7 @@ class MaterialPass {
 public:
     typedef std::tr1::shared_ptr<MaterialPass> ptr;
 
-    MaterialPass(ShaderID shader);
+    MaterialPass(Material& material, ShaderID shader);
     void set_texture_unit(uint32_t texture_unit_id, TextureID tex);
     void set_animated_texture_unit(uint32_t texture_unit_id, const std::vector<TextureID> textures, double duration);
 
@@ -85,12 +85,10 @@ public:
 
     IterationType iteration() const { return iteration_; }
     uint32_t max_iterations() const { return max_iterations_; }
-    void set_iteration(IterationType iter_type, uint32_t max=1) {
-        iteration_ = iter_type;
-        max_iterations_ = max;
-    }
+    void set_iteration(IterationType iter_type, uint32_t max=1);
 
 private:
+    Material& material_;
     ShaderID shader_;
 
     Colour diffuse_;
@@ -122,6 +120,7 @@ public:
     }
 
 private:
+    Material& material_;
     std::string scheme_;
 
     std::vector<MaterialPass::ptr> passes_;
@@ -144,8 +143,38 @@ public:
         }
     }
 
+    /*
+     *  Only animated materials need updating each frame, the scene keeps a list of them.
+     *  Passes call this when they're given an animated texture unit.
+     */
+    bool is_animated() const { return animated_; }
+    void mark_animated();
+
+    /*
+     *  A pass of the default technique as the renderer sees it. Like objects (see
+     *  Object::render_state()) materials are only read by the renderer through what was
+     *  last published. Changed and animated materials are published by
+     *  Scene::publish_frame().
+     */
+    struct PassState {
+        ShaderID shader; ///< 0 for the scene's default shader
+        IterationType iteration;
+        uint32_t max_iterations;
+        std::vector<TextureID> textures;
+    };
+
+    const std::vector<PassState>& pass_states() const { return pass_states_; }
+
+    void mark_changed(); ///< Called by the passes and techniques when something the renderer uses changes
+    void _publish();
+
 private:
+    Scene* scene_;
     std::map<std::string, MaterialTechnique::ptr> techniques_;
+    bool animated_;
+
+    std::vector<PassState> pass_states_;
+    bool changed_; ///< Waiting to be published
 };
 
 }
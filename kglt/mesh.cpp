@@ -2,33 +2,83 @@
 #include "mesh.h"
 #include "kazbase/list_utils.h"
 #include "scene.h"
+#include "utils/gl_thread.h"
 
 namespace kglt {
 
 Mesh::Mesh(Scene* parent, MeshID id):
     Object(parent),
     Identifiable<MeshID>(id),
+    geometry_buffer_(new GeometryBuffer()),
+    geometry_version_(1),
+    aabb_dirty_(true),
     is_submesh_(false),
     use_parent_vertices_(false),
     material_(0),
     diffuse_colour_(1.0, 1.0, 1.0, 1.0),
     depth_test_enabled_(true),
     depth_writes_enabled_(true),
-    branch_selectable_(true) {
+    branch_selectable_(true),
+    occlusion_culling_enabled_(false) {
 
     set_arrangement(MESH_ARRANGEMENT_TRIANGLES);
 }
 
+GeometryBuffer::~GeometryBuffer() {
+    if(vbo) {
+        //The last frame packet using it might be let go of on the game thread
+        GLuint buffer = vbo;
+        run_on_gl_thread([=]() { glDeleteBuffers(1, &buffer); });
+    }
+}
+
 Mesh::~Mesh() {
-    for(std::pair<uint32_t, uint32_t> vbo: vertex_buffer_objects_) {
-        glDeleteBuffers(1, &vbo.second);
+
+}
+
+void Mesh::invalidate() {
+    ++geometry_version_;
+    aabb_dirty_ = true;
+    mark_render_state_dirty();
+
+    if(is_submesh_) {
+        parent_mesh().aabb_dirty_ = true;
+        parent_mesh().mark_render_state_dirty();
     }
+
+    bounds_changed();
 }
 
 void Mesh::destroy() {
     scene().delete_mesh(id());
 }
 
+void Mesh::transformation_changed() {
+    //Submeshes move with their parent, which will already have been queued
+    if(!is_submesh_ && id()) {
+        scene().queue_relocation(*this);
+    }
+}
+
+void Mesh::bounds_changed() {
+    if(is_submesh_) {
+        parent_mesh().bounds_changed();
+    } else if(id()) {
+        scene().queue_relocation(*this);
+    }
+
+    if(component_entry() != ComponentStore::NO_ENTRY) {
+        scene().components().set_bounds(component_entry(), aabb());
+    }
+}
+
+void Mesh::components_added(ComponentStore& store, uint32_t entry) {
+    if(!is_submesh_) {
+        store.set_renderable(entry, id());
+    }
+    store.set_bounds(entry, aabb());
+}
+
 Vertex& Mesh::vertex(uint32_t v) {
     if(use_parent_vertices_) {
         if(!is_submesh_) {
@@ -50,7 +100,7 @@ void Mesh::add_vertex(float x, float y, float z) {
     vert.z = z;
     vertices_.push_back(vert);
 
-    vertex_buffer_objects_.clear(); //Invalidate the vbos
+    invalidate(); //Invalidate the vbos and the bounds
 }
 
 Triangle& Mesh::add_triangle(uint32_t a, uint32_t b, uint32_t c) {
@@ -58,10 +108,68 @@ Triangle& Mesh::add_triangle(uint32_t a, uint32_t b, uint32_t c) {
     t.set_indexes(a, b, c);
     triangles_.push_back(t);
 
-    vertex_buffer_objects_.clear(); //Invalidate the vbos
+    invalidate(); //Invalidate the vbos and the bounds
     return triangles_[triangles_.size() - 1];
 }
 
+const AABB& Mesh::aabb() {
+    if(!aabb_dirty_) {
+        return aabb_;
+    }
+
+    bool first = true;
+    for(Vertex& v: vertices()) {
+        if(first) {
+            kmVec3Assign(&aabb_.min, &v);
+            kmVec3Assign(&aabb_.max, &v);
+            first = false;
+            continue;
+        }
+
+        aabb_.min.x = std::min(aabb_.min.x, v.x);
+        aabb_.min.y = std::min(aabb_.min.y, v.y);
+        aabb_.min.z = std::min(aabb_.min.z, v.z);
+        aabb_.max.x = std::max(aabb_.max.x, v.x);
+        aabb_.max.y = std::max(aabb_.max.y, v.y);
+        aabb_.max.z = std::max(aabb_.max.z, v.z);
+    }
+
+    //Submeshes sharing our vertices can't extend the bounds, others can
+    for(Mesh::ptr m: submeshes_) {
+        if(m->use_parent_vertices_ || m->vertices().empty()) {
+            continue;
+        }
+
+        const AABB& sub = m->aabb();
+        if(first) {
+            aabb_ = sub;
+            first = false;
+            continue;
+        }
+
+        aabb_.min.x = std::min(aabb_.min.x, sub.min.x);
+        aabb_.min.y = std::min(aabb_.min.y, sub.min.y);
+        aabb_.min.z = std::min(aabb_.min.z, sub.min.z);
+        aabb_.max.x = std::max(aabb_.max.x, sub.max.x);
+        aabb_.max.y = std::max(aabb_.max.y, sub.max.y);
+        aabb_.max.z = std::max(aabb_.max.z, sub.max.z);
+    }
+
+    if(first) {
+        aabb_ = AABB();
+    }
+
+    aabb_dirty_ = false;
+    return aabb_;
+}
+
+AABB Mesh::absolute_aabb() {
+    AABB result = aabb();
+    kmVec3Add(&result.min, &result.min, &absolute_position());
+    kmVec3Add(&result.max, &result.max, &absolute_position());
+    return result;
+}
+
 uint32_t Mesh::add_submesh(bool use_parent_vertices) {
     /*
         FIXME: Using Meshes as submeshes seems dodgy, submeshes are part
@@ -75,103 +183,86 @@ uint32_t Mesh::add_submesh(bool use_parent_vertices) {
     submeshes_[id]->set_parent(this); //Add to the tree
     submeshes_[id]->use_parent_vertices_ = use_parent_vertices;
     submeshes_[id]->is_submesh_ = true;
+
+    aabb_dirty_ = true;
+    mark_render_state_dirty();
     return id;
 }
 
-void Mesh::vbo(uint32_t vertex_attributes) {
-    if(!container::contains(vertex_buffer_objects_, vertex_attributes)) {
-        //Build the VBO if necessary
-        vertex_buffer_objects_[vertex_attributes] = build_vbo(vertex_attributes);
-    }
+void Mesh::publish() {
+    Object::publish();
 
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_objects_[vertex_attributes]);
-}
+    mesh_state_.id = id();
+    mesh_state_.cull_id = is_submesh_ ? parent_mesh().id() : id();
+    mesh_state_.material = material_;
+    mesh_state_.arrangement = arrangement_;
+    mesh_state_.draw_count = draw_count();
+    mesh_state_.bounds = aabb();
 
-uint32_t Mesh::build_vbo(uint32_t vertex_attributes) {
-    /**
-     * THIS CODE IS A FUCKING MESS
-     */
-    GLuint vertex_buffer;
-    glGenBuffers(1, &vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    if(mesh_state_.geometry_version != geometry_version_) {
+        //The old vector might still be in a frame being drawn, so it's replaced rather than refilled
+        std::tr1::shared_ptr<std::vector<float> > geometry(new std::vector<float>());
+        write_geometry(*geometry);
+        mesh_state_.geometry = geometry;
+        mesh_state_.geometry_version = geometry_version_;
+    }
 
-    uint32_t stride = 0;
-    if((VERTEX_ATTRIBUTE_POSITION & vertex_attributes) == VERTEX_ATTRIBUTE_POSITION) {
-        stride += sizeof(float) * 3;
+    mesh_state_.depth_test = depth_test_enabled_;
+    mesh_state_.depth_writes = depth_writes_enabled_;
+    mesh_state_.occlusion_culling = occlusion_culling_enabled_;
+    mesh_state_.selectable = branch_selectable_;
+}
 
+uint32_t Mesh::draw_count() {
+    if(arrangement() == MESH_ARRANGEMENT_LINE_STRIP ||
+       arrangement() == MESH_ARRANGEMENT_POINTS) {
+        return vertices().size();
     }
-    if ((VERTEX_ATTRIBUTE_TEXCOORD_1 & vertex_attributes) == VERTEX_ATTRIBUTE_TEXCOORD_1) {
-        stride += sizeof(float) * 2;
 
-    }
-    if ((VERTEX_ATTRIBUTE_DIFFUSE & vertex_attributes) == VERTEX_ATTRIBUTE_DIFFUSE) {
-        stride += sizeof(float) * 4;
-    }
+    return triangles().size() * 3;
+}
 
-    if ((VERTEX_ATTRIBUTE_NORMAL & vertex_attributes) == VERTEX_ATTRIBUTE_NORMAL) {
-        stride += sizeof(float) * 3;
+void Mesh::write_geometry(std::vector<float>& out) {
+    if(!draw_count()) {
+        return;
     }
 
-    uint32_t total_size = triangles().size() * stride * 3;
-    glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
+    uint32_t start = out.size();
+    out.resize(start + draw_count() * GEOMETRY_STRIDE);
+
+    float* data = &out[0] + start;
+    auto write = [&](const float* values, uint32_t count) {
+        for(uint32_t i = 0; i < count; ++i) {
+            *data++ = values[i];
+        }
+    };
 
-    uint32_t offset = 0;
     if(arrangement() == MESH_ARRANGEMENT_LINE_STRIP ||
        arrangement() == MESH_ARRANGEMENT_POINTS) {
-        total_size = vertices().size() * stride;
-        glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
-
-        for(Vertex& v: vertices()) {
-            if((VERTEX_ATTRIBUTE_POSITION & vertex_attributes) == VERTEX_ATTRIBUTE_POSITION) {
-                glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 3, (float*) &v);
-                offset += sizeof(float) * 3;
-            }
-
-            if((VERTEX_ATTRIBUTE_TEXCOORD_1 & vertex_attributes) == VERTEX_ATTRIBUTE_TEXCOORD_1) {
-                Vec2 uv;
-                uv.x = 1.0; uv.y = 1.0;
-                glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 2, (float*) &uv);
-                offset += sizeof(float) * 2;
-            }
+        //Points and lines have no triangles to take texture coordinates and normals from
+        Vec2 uv;
+        uv.x = 1.0; uv.y = 1.0;
 
-            if((VERTEX_ATTRIBUTE_DIFFUSE & vertex_attributes) == VERTEX_ATTRIBUTE_DIFFUSE) {
-                glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 4, (float*) &diffuse_colour_);
-                offset += sizeof(float) * 4;
-            }
+        Vec3 n;
+        kmVec3Fill(&n, 0, 1, 0);
 
-            if((VERTEX_ATTRIBUTE_NORMAL & vertex_attributes) == VERTEX_ATTRIBUTE_NORMAL) {
-                Vec3 n;
-                kmVec3Fill(&n, 0, 1, 0);
-                glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 3, (float*) &n);
-                offset += sizeof(float) * 3;
-            }
+        for(Vertex& v: vertices()) {
+            write((float*) &v, 3);
+            write((float*) &uv, 2);
+            write((float*) &diffuse_colour_, 4);
+            write((float*) &n, 3);
         }
     } else {
         for(Triangle& tri: triangles()) {
             for(uint32_t j = 0; j < 3; ++j) {
                 Vertex& v = vertices()[tri.index(j)];
-                if((VERTEX_ATTRIBUTE_POSITION & vertex_attributes) == VERTEX_ATTRIBUTE_POSITION) {
-                    glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 3, (float*) &v);
-                    offset += sizeof(float) * 3;
-                }
-                if((VERTEX_ATTRIBUTE_TEXCOORD_1 & vertex_attributes) == VERTEX_ATTRIBUTE_TEXCOORD_1) {
-                    Vec2 uv = tri.uv(j);
-                    glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 2, (float*) &uv);
-                    offset += sizeof(float) * 2;
-                }
-                if((VERTEX_ATTRIBUTE_DIFFUSE & vertex_attributes) == VERTEX_ATTRIBUTE_DIFFUSE) {
-                    glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 4, (float*) &diffuse_colour_);
-                    offset += sizeof(float) * 4;
-                }
-                if((VERTEX_ATTRIBUTE_NORMAL & vertex_attributes) == VERTEX_ATTRIBUTE_NORMAL) {
-                    glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(float) * 3, (float*) &tri.normal(j));
-                    offset += sizeof(float) * 3;
-                }
+                write((float*) &v, 3);
+                write((float*) &tri.uv(j), 2);
+                write((float*) &diffuse_colour_, 4);
+                write((float*) &tri.normal(j), 3);
             }
         }
     }
-
-    return vertex_buffer;
 }
 
 }
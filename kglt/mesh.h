@@ -79,6 +79,25 @@ enum VertexAttribute {
     VERTEX_ATTRIBUTE_NORMAL = 8
 };
 
+const uint32_t GEOMETRY_STRIDE = 12; ///< Floats per vertex in a GeometryBuffer
+
+/*
+ *  The GL buffer holding a mesh's geometry, interleaved as position, texture coordinate,
+ *  diffuse colour and normal. Only the thread that renders touches it. Frame packets hold
+ *  a reference, so it stays around until every frame using it has been drawn even if the
+ *  mesh is deleted first.
+ */
+struct GeometryBuffer {
+    GeometryBuffer():
+        vbo(0),
+        uploaded_version(0) {}
+
+    ~GeometryBuffer();
+
+    uint32_t vbo;
+    uint32_t uploaded_version; ///< The Mesh::MeshRenderState::geometry_version in the buffer
+};
+
 class Mesh :
     public Object,
     public generic::Identifiable<MeshID> {
@@ -119,6 +138,8 @@ public:
         return vertices_;
     }
 
+    bool is_submesh() const { return is_submesh_; }
+
     Mesh& parent_mesh() {
         Mesh* mesh = &parent_as<Mesh>();
         if(!is_submesh_ || !mesh) {
@@ -131,13 +152,59 @@ public:
     void add_vertex(float x, float y, float z);
     Triangle& add_triangle(uint32_t a, uint32_t b, uint32_t c);
 
-    void set_arrangement(MeshArrangement m) { arrangement_ = m; }
+    void set_arrangement(MeshArrangement m) {
+        arrangement_ = m;
+        ++geometry_version_; //The vertices are laid out differently
+        mark_render_state_dirty();
+    }
     MeshArrangement arrangement() { return arrangement_; }
 
-    void vbo(uint32_t vertex_attributes);
-
     void done() {}
-    void invalidate() { vertex_buffer_objects_.clear(); }
+    void invalidate(); ///< Marks the geometry (uploaded again when next rendered) and the bounds as changed
+
+    uint32_t draw_count(); ///< The number of vertices drawn, for the mesh's arrangement
+    void write_geometry(std::vector<float>& out); ///< Appends the geometry, laid out as in GeometryBuffer
+
+    /*
+     *  What the renderer draws the mesh with, as of the last publish (see
+     *  Object::render_state()). The geometry is copy-on-write: publishing builds a new
+     *  vector only when the mesh has been invalidated, and leaves the old one to the
+     *  frames still using it.
+     */
+    struct MeshRenderState {
+        MeshRenderState():
+            id(0),
+            cull_id(0),
+            material(0),
+            arrangement(MESH_ARRANGEMENT_TRIANGLES),
+            draw_count(0),
+            geometry_version(0),
+            depth_test(true),
+            depth_writes(true),
+            occlusion_culling(false),
+            selectable(true) {}
+
+        MeshID id; ///< 0 for meshes the scene doesn't manage itself, e.g. submeshes
+        MeshID cull_id; ///< What the partitioner knows the mesh as, submeshes go with their parent
+        MaterialID material;
+        MeshArrangement arrangement;
+        uint32_t draw_count;
+        AABB bounds;
+
+        std::tr1::shared_ptr<const std::vector<float> > geometry;
+        uint32_t geometry_version;
+
+        bool depth_test;
+        bool depth_writes;
+        bool occlusion_culling;
+        bool selectable;
+    };
+
+    const MeshRenderState& mesh_state() const { return mesh_state_; }
+    const std::tr1::shared_ptr<GeometryBuffer>& _geometry_buffer() const { return geometry_buffer_; }
+
+    const AABB& aabb(); ///< Returns the bounds of this mesh (and its submeshes) in local space
+    AABB absolute_aabb(); ///< Returns the bounds offset by the mesh's absolute position
 
     /*
      * 	FIXME: This should apply to the triangles, not the mesh itself
@@ -150,21 +217,39 @@ public:
     bool depth_test_enabled() const { return depth_test_enabled_; }
     bool depth_writes_enabled() const { return depth_writes_enabled_; }
 
-    void enable_depth_test(bool value=true) { depth_test_enabled_ = value; }
-    void enable_depth_writes(bool value=true) { depth_writes_enabled_ = value; }
+    void enable_depth_test(bool value=true) { depth_test_enabled_ = value; mark_render_state_dirty(); }
+    void enable_depth_writes(bool value=true) { depth_writes_enabled_ = value; mark_render_state_dirty(); }
 
     void set_branch_selectable(bool value = true) { ///< Sets this node and its children selectable or not
         branch_selectable_ = value;
+        mark_render_state_dirty();
     }
     bool branch_selectable() const { return branch_selectable_; }
 
-    void apply_material(MaterialID material) { material_ = material; }
+    void apply_material(MaterialID material) { material_ = material; mark_render_state_dirty(); }
     MaterialID material() const { return material_; }
 
+    /*
+     *  When enabled (and the renderer has occlusion culling turned on) the mesh's
+     *  bounding box is tested with a hardware occlusion query whenever the mesh
+     *  wasn't visible the previous frame. Only worth it for expensive meshes.
+     */
+    void enable_occlusion_culling(bool value=true) { occlusion_culling_enabled_ = value; mark_render_state_dirty(); }
+    bool occlusion_culling_enabled() const { return occlusion_culling_enabled_; }
+
 private:
-    std::map<uint32_t, uint32_t> vertex_buffer_objects_;
+    void transformation_changed();
+    void bounds_changed(); ///< Lets the scene know that the partitioner needs to relocate us
+    void components_added(ComponentStore& store, uint32_t entry);
+    void publish();
+
+    std::tr1::shared_ptr<GeometryBuffer> geometry_buffer_;
+    uint32_t geometry_version_; ///< Bumped by invalidate()
+
+    MeshRenderState mesh_state_;
 
-    uint32_t build_vbo(uint32_t vertex_attributes);
+    AABB aabb_;
+    bool aabb_dirty_;
 
     bool is_submesh_;
     bool use_parent_vertices_;
@@ -182,6 +267,7 @@ private:
     bool depth_test_enabled_;
     bool depth_writes_enabled_;
     bool branch_selectable_;
+    bool occlusion_culling_enabled_;
 
     virtual void destroy();
 };
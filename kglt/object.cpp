@@ -14,21 +14,72 @@ uint64_t Object::object_counter = 0;
 Object::Object(Scene *parent_scene):
     uuid_(++object_counter),
     scene_(parent_scene),
+    component_(ComponentStore::NO_ENTRY),
+    update_index_(NOT_UPDATED),
     is_visible_(true) {
 
     kmVec3Fill(&position_, 0.0, 0.0, 0.0);
     kmQuaternionIdentity(&rotation_);
     kmVec3Fill(&absolute_position_, 0.0, 0.0, 0.0);
-    kmQuaternionIdentity(&absolute_orientation_);
+    kmQuaternionIdentity(&absolute_rotation_);
+    kmMat4Identity(&local_matrix_);
+    kmMat4Identity(&world_matrix_);
 
-    update_from_parent();
+    transform_dirty_ = true;
+    descendants_dirty_ = false;
+
+    //Nothing has been published yet
+    kmMat4Identity(&render_state_.world_matrix);
+    kmVec3Fill(&render_state_.absolute_position, 0.0, 0.0, 0.0);
+    render_state_.visible = false;
+    render_state_dirty_ = true;
+    descendants_render_dirty_ = false;
 
     //When the parent changes, update the position/orientation
-    signal_parent_changed().connect(sigc::mem_fun(this, &Object::parent_changed_callback));
+    parent_changed_connection_ = signal_parent_changed().connect(sigc::mem_fun(this, &Object::parent_changed_callback));
 }
 
 Object::~Object() {
+    //The tree node detaches after we're gone, don't let that call back into us
+    parent_changed_connection_.disconnect();
+
+    if(component_ != ComponentStore::NO_ENTRY) {
+        scene_->components().remove(component_);
+    }
+
+    if(updates_enabled()) {
+        scene_->_remove_from_update_list(*this);
+    }
+}
 
+void Object::enable_updates(bool value) {
+    if(value && !updates_enabled()) {
+        scene()._add_to_update_list(*this);
+    } else if(!value && updates_enabled()) {
+        scene()._remove_from_update_list(*this);
+    }
+}
+
+void Object::set_velocity(float x, float y, float z) {
+    ComponentStore& store = scene().components();
+    if(component_ == ComponentStore::NO_ENTRY) {
+        store.add(*this);
+        components_added(store, component_);
+    }
+
+    kmVec3 velocity;
+    kmVec3Fill(&velocity, x, y, z);
+    store.set_velocity(component_, velocity);
+}
+
+kmVec3 Object::velocity() const {
+    if(component_ == ComponentStore::NO_ENTRY) {
+        kmVec3 none;
+        kmVec3Fill(&none, 0, 0, 0);
+        return none;
+    }
+
+    return scene().components().velocity(component_);
 }
 
 void Object::move_to(float x, float y, float z) {
@@ -36,7 +87,7 @@ void Object::move_to(float x, float y, float z) {
     position_.y = y;
     position_.z = z;
 
-    update_from_parent();
+    mark_transform_dirty();
 }
 
 void Object::move_forward(float amount) {
@@ -48,7 +99,7 @@ void Object::move_forward(float amount) {
     kmVec3Scale(&forward, &forward, amount);
     kmVec3Add(&position_, &position_, &forward);
 
-    update_from_parent();
+    mark_transform_dirty();
 }
 
 void Object::rotate_x(float amount) {
@@ -59,7 +110,7 @@ void Object::rotate_x(float amount) {
     rot.w = amount * kmPIOver180;
     kmQuaternionMultiply(&rotation(), &rotation(), &rot);
 
-    update_from_parent();
+    mark_transform_dirty();
 }
 
 void Object::rotate_z(float amount) {
@@ -70,7 +121,7 @@ void Object::rotate_z(float amount) {
     rot.w = amount * kmPIOver180;
     kmQuaternionMultiply(&rotation(), &rot, &rotation());
 
-    update_from_parent();
+    mark_transform_dirty();
 }
 
 void Object::rotate_y(float amount) {
@@ -86,7 +137,134 @@ void Object::rotate_y(float amount) {
     kmQuaternionMultiply(&rotation_, &rot, &rotation_);
     kmQuaternionNormalize(&rotation_, &rotation_);
 
-    update_from_parent();
+    mark_transform_dirty();
+}
+
+void Object::mark_transform_dirty() {
+    //Keep the component store's copy of the position in step
+    if(component_ != ComponentStore::NO_ENTRY) {
+        scene().components().set_position(component_, position_);
+    }
+
+    invalidate_transform();
+}
+
+void Object::invalidate_transform() {
+    transform_dirty_ = true;
+
+    /*
+     *  Flag the path up to the root so resolve_transforms() can find us. If an ancestor
+     *  is already flagged, so is everything above it.
+     */
+    Object* node = has_parent() ? &parent() : nullptr;
+    while(node && !__atomic_load_n(&node->descendants_dirty_, __ATOMIC_RELAXED)) {
+        //Siblings can be doing this at the same time during a parallel update
+        __atomic_store_n(&node->descendants_dirty_, true, __ATOMIC_RELAXED);
+        node = node->has_parent() ? &node->parent() : nullptr;
+    }
+}
+
+void Object::update_transform() const {
+    //Our parents might have moved too, so they have to be sorted out first
+    if(has_parent()) {
+        parent().update_transform();
+    }
+
+    if(transform_dirty_) {
+        recalculate_transform();
+    }
+}
+
+void Object::recalculate_transform() const {
+    kmQuaternion rotation;
+    kmQuaternionNormalize(&rotation, &rotation_);
+
+    kmMat4RotationQuaternion(&local_matrix_, &rotation);
+    local_matrix_.mat[12] = position_.x;
+    local_matrix_.mat[13] = position_.y;
+    local_matrix_.mat[14] = position_.z;
+
+    if(has_parent()) {
+        const Object& p = parent();
+        kmMat4Multiply(&world_matrix_, &p.world_matrix_, &local_matrix_);
+        kmQuaternionMultiply(&absolute_rotation_, &p.absolute_rotation_, &rotation);
+    } else {
+        kmMat4Assign(&world_matrix_, &local_matrix_);
+        kmQuaternionAssign(&absolute_rotation_, &rotation);
+    }
+
+    kmVec3Fill(&absolute_position_, world_matrix_.mat[12], world_matrix_.mat[13], world_matrix_.mat[14]);
+    transform_dirty_ = false;
+
+    //Everything below us moved with us
+    for(Object* child: children()) {
+        child->transform_dirty_ = true;
+    }
+    if(has_children()) {
+        descendants_dirty_ = true;
+    }
+
+    //Lets subclasses react to moving (e.g. meshes queue a relocation in the partitioner)
+    const_cast<Object*>(this)->transformation_changed();
+
+    mark_render_state_dirty();
+}
+
+void Object::resolve_transforms() {
+    if(transform_dirty_) {
+        update_transform();
+    }
+
+    if(descendants_dirty_) {
+        descendants_dirty_ = false;
+        for(Object* child: children()) {
+            child->resolve_transforms();
+        }
+    }
+}
+
+void Object::mark_render_state_dirty() const {
+    render_state_dirty_ = true;
+
+    //The same as invalidate_transform(), so publish_render_state() can find us
+    const Object* node = has_parent() ? &parent() : nullptr;
+    while(node && !__atomic_load_n(&node->descendants_render_dirty_, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&node->descendants_render_dirty_, true, __ATOMIC_RELAXED);
+        node = node->has_parent() ? &node->parent() : nullptr;
+    }
+}
+
+void Object::publish() {
+    kmMat4Assign(&render_state_.world_matrix, &world_matrix());
+    kmVec3Assign(&render_state_.absolute_position, &absolute_position());
+    render_state_.visible = is_visible_;
+}
+
+void Object::publish_render_state() {
+    if(render_state_dirty_) {
+        render_state_dirty_ = false;
+        publish();
+    }
+
+    if(descendants_render_dirty_) {
+        descendants_render_dirty_ = false;
+        for(Object* child: children()) {
+            child->publish_render_state();
+        }
+    }
+}
+
+void PublishedOrder::update(Object& root) {
+    uint64_t generation = root.linearization_generation();
+    if(generation == generation_) {
+        return;
+    }
+
+    objects_.clear();
+    for(Object::iterator it = root.begin(); it != root.end(); ++it) {
+        objects_.push_back(&static_cast<Object&>(*it));
+    }
+    generation_ = generation;
 }
 
 }
@@ -14,8 +14,10 @@
 #include "generic/visitor.h"
 
 #include "kazmath/vec3.h"
+#include "kazmath/mat4.h"
 #include "kazmath/quaternion.h"
 #include "types.h"
+#include "component_store.h"
 
 namespace kglt {
 
@@ -34,16 +36,7 @@ public:
     Object(Scene* parent_scene);
     virtual ~Object();
 
-	virtual void update(double dt) {
-		do_update(dt);
-		
-        for(uint32_t i = 0; i < child_count(); ++i) {
-            Object& c = child(i);
-            c.update(dt);
-		}
-	}
-
-	void set_visible(bool value=true) { is_visible_ = value; }
+    void set_visible(bool value=true) { is_visible_ = value; mark_render_state_dirty(); }
 	bool is_visible() const { return is_visible_; }
 
     virtual void move_to(float x, float y, float z);
@@ -54,10 +47,58 @@ public:
     virtual void rotate_z(float amount);
 
     kmVec3& position() { return position_; }
-    kmVec3& absolute_position() { return absolute_position_; }
-
     kmQuaternion& rotation() { return rotation_; }
 
+    /*
+     *  The world transform is only worked out when something asks for it, so moving an
+     *  object (or its parents) many times a frame costs nothing until then. The scene
+     *  resolves everything once a frame, before updating the partitioner; after that
+     *  these are just reads of cached values.
+     */
+    const kmVec3& absolute_position() const { update_transform(); return absolute_position_; }
+    const kmQuaternion& absolute_rotation() const { update_transform(); return absolute_rotation_; }
+    const kmMat4& local_matrix() const { update_transform(); return local_matrix_; } ///< Relative to the parent
+    const kmMat4& world_matrix() const { update_transform(); return world_matrix_; }
+
+    void resolve_transforms(); ///< Brings this object and everything below it up to date, top down
+
+    /*
+     *  The renderer never reads the live object. Once a frame the game thread copies what
+     *  it needs into the published render state (Scene::publish_frame()), and frames are
+     *  recorded from that copy, so a render thread can record one frame while the next is
+     *  being updated without either taking a lock. Subclasses publish the rest of what
+     *  they're drawn with alongside this, e.g. Mesh::mesh_state().
+     */
+    struct RenderState {
+        kmMat4 world_matrix;
+        kmVec3 absolute_position;
+        bool visible;
+    };
+
+    const RenderState& render_state() const { return render_state_; }
+
+    /*
+     *  Publishes this object and everything below it that changed since the last call.
+     *  Only the paths leading to changes are walked, so if nothing moved it costs almost
+     *  nothing.
+     */
+    void publish_render_state();
+
+    /*
+     *  Moves the object this many units per second. The object gets an entry in its scene's
+     *  ComponentStore, which moves everything with a velocity in one batch each update.
+     */
+    void set_velocity(float x, float y, float z);
+    kmVec3 velocity() const;
+
+    /*
+     *  The scene only calls do_update() on objects that ask for it, so anything that
+     *  overrides do_update() should call enable_updates() too. Everything else costs
+     *  nothing per frame.
+     */
+    void enable_updates(bool value=true);
+    bool updates_enabled() const { return update_index_ != NOT_UPDATED; }
+
     uint64_t uuid() const { return uuid_; }
         
     virtual void _initialize(Scene& scene) {}
@@ -81,19 +122,22 @@ public:
     }
 
 protected:
-    void update_from_parent() {
-        if(!has_parent()) {
-            kmVec3Assign(&absolute_position_, &position_);
-            kmQuaternionAssign(&absolute_orientation_, &rotation_);
-        } else {
-            kmVec3Add(&absolute_position_, &parent().absolute_position_, &position_);
-            kmQuaternionAdd(&absolute_orientation_, &parent().absolute_orientation_, &rotation_);
-        }
+    void mark_transform_dirty(); ///< Call after changing position() or rotation() directly
 
-        std::for_each(children().begin(), children().end(), [](Object* x) { x->update_from_parent(); });
-    }
+    uint32_t component_entry() const { return component_; } ///< ComponentStore::NO_ENTRY without a velocity
+    virtual void components_added(ComponentStore& store, uint32_t entry) {} ///< Lets subclasses fill in their bounds and renderable
+
+    virtual void transformation_changed() {} ///< Called whenever the world transform is recalculated
+
+    void mark_render_state_dirty() const; ///< Call after changing anything publish() copies
+    virtual void publish(); ///< Copies the state the renderer needs, overrides must call the base
 
 private:
+    friend class ComponentStore;
+    friend class Scene;
+
+    static const uint32_t NOT_UPDATED = ~0u;
+
     static uint64_t object_counter;
     uint64_t uuid_;
 
@@ -102,16 +146,52 @@ private:
     kmVec3 position_;
     kmQuaternion rotation_;
 
-    kmVec3 absolute_position_;
-    kmQuaternion absolute_orientation_;
+    //The cached world transform, recalculated by update_transform()
+    mutable kmVec3 absolute_position_;
+    mutable kmQuaternion absolute_rotation_;
+    mutable kmMat4 local_matrix_;
+    mutable kmMat4 world_matrix_;
+
+    mutable bool transform_dirty_; ///< The cached transform is out of date
+    mutable bool descendants_dirty_; ///< Something below us has transform_dirty_ set
+
+    RenderState render_state_;
+    mutable bool render_state_dirty_; ///< Changed since the last publish
+    mutable bool descendants_render_dirty_; ///< Something below us has render_state_dirty_ set
+
+    uint32_t component_;
+    uint32_t update_index_; ///< Our position in the scene's update list
+
+    void invalidate_transform();
+    void update_transform() const;
+    void recalculate_transform() const;
 
     void parent_changed_callback(Object* old_parent, Object* new_parent) {
-        update_from_parent();
+        mark_transform_dirty();
     }
+    sigc::connection parent_changed_connection_;
 
     bool is_visible_;
 };
 
+/*
+ *  A copy of the depth first order of an object's subtree, for walking while the tree
+ *  itself is being changed on another thread. update() only copies it again when the
+ *  tree has changed since the last time.
+ */
+class PublishedOrder {
+public:
+    PublishedOrder():
+        generation_(0) {}
+
+    void update(Object& root);
+    const std::vector<Object*>& objects() const { return objects_; }
+
+private:
+    std::vector<Object*> objects_;
+    uint64_t generation_;
+};
+
 }
 
 #endif // OBJECT_H_INCLUDED
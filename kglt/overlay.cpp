@@ -14,6 +14,14 @@ Overlay::Overlay(Scene *scene, OverlayID id):
 
 void Overlay::set_ortho(double left, double right, double bottom, double top) {
     kmMat4OrthographicProjection(&projection_matrix_, left, right, bottom, top, -1.0, 1.0);
+    mark_render_state_dirty();
+}
+
+void Overlay::publish() {
+    Object::publish();
+
+    overlay_state_.zindex = zindex_;
+    kmMat4Assign(&overlay_state_.projection_matrix, &projection_matrix_);
 }
 
 }
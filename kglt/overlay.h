@@ -34,16 +34,34 @@ public:
 
     Overlay(Scene* scene, OverlayID id=0);
 
-    void set_zindex(int32_t zindex) { zindex_ = zindex; }
+    void set_zindex(int32_t zindex) { zindex_ = zindex; mark_render_state_dirty(); }
     int32_t zindex() const { return zindex_; }
 
     void set_ortho(double left, double right, double bottom, double top);
     const kmMat4& projection_matrix() const { return projection_matrix_; }
 
+    /*
+     *  What the renderer draws the overlay with, as of the last publish (see
+     *  Object::render_state()). The order is the overlay and everything on it.
+     */
+    struct OverlayRenderState {
+        int32_t zindex;
+        kmMat4 projection_matrix;
+    };
+
+    const OverlayRenderState& overlay_state() const { return overlay_state_; }
+    const PublishedOrder& published_order() const { return published_order_; }
+    void _update_published_order() { published_order_.update(*this); } ///< Called by Scene::publish_frame()
+
 private:
     int32_t zindex_;
     kmMat4 projection_matrix_;
 
+    OverlayRenderState overlay_state_;
+    PublishedOrder published_order_;
+
+    void publish();
+
     bool can_set_parent(Object* p) { return false; } //Don't allow overlays to be attached to anything
 };
 
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "scene.h"
+#include "window_base.h"
+#include "partitioner.h"
+
+namespace kglt {
+
+JobSystem& Partitioner::jobs() {
+    return scene().window().jobs();
+}
+
+std::vector<Partitioner::CullChunk>& Partitioner::cull_chunks(uint32_t count) {
+    //Only ever grow, so the chunks' buffers are reused from frame to frame
+    if(cull_chunks_.size() < count) {
+        cull_chunks_.resize(count);
+    }
+
+    for(uint32_t i = 0; i < count; ++i) {
+        cull_chunks_[i].visible.clear();
+    }
+
+    used_chunks_ = count;
+    return cull_chunks_;
+}
+
+void Partitioner::merge_cull_chunks(std::vector<MeshID>& out) {
+    for(uint32_t i = 0; i < used_chunks_; ++i) {
+        out.insert(out.end(), cull_chunks_[i].visible.begin(), cull_chunks_[i].visible.end());
+    }
+    used_chunks_ = 0;
+
+    std::sort(out.begin(), out.end());
+}
+
+void Partitioner::finish_light_query(std::vector<LightID>& out) {
+    std::sort(light_distances_.begin(), light_distances_.end(),
+              [](const std::pair<LightID, float>& lhs, const std::pair<LightID, float>& rhs) { return lhs.second < rhs.second; });
+
+    out.clear();
+    for(const std::pair<LightID, float>& p: light_distances_) {
+        out.push_back(p.first);
+    }
+}
+
+void QueryArena::reset(Partitioner& partitioner, const Camera& camera) {
+    partitioner_ = &partitioner;
+    partitioner.meshes_visible_from(camera, visible_meshes_);
+
+    Range unqueried = { NOT_QUERIED, 0 };
+    mesh_lights_.assign(visible_meshes_.size(), unqueried);
+    lights_.clear();
+}
+
+bool QueryArena::is_visible(MeshID mesh) const {
+    return std::binary_search(visible_meshes_.begin(), visible_meshes_.end(), mesh);
+}
+
+LightSpan QueryArena::lights_for(MeshID mesh, const kmVec3& location) {
+    assert(partitioner_ && "QueryArena::reset() hasn't been called");
+
+    std::vector<MeshID>::const_iterator it = std::lower_bound(visible_meshes_.begin(), visible_meshes_.end(), mesh);
+    if(it == visible_meshes_.end() || *it != mesh) {
+        //Not one of this frame's visible meshes, so there's nowhere to keep the result
+        partitioner_->lights_within_range(location, query_);
+        return LightSpan(query_.empty() ? nullptr : &query_[0], query_.size());
+    }
+
+    Range& range = mesh_lights_[it - visible_meshes_.begin()];
+    if(range.first == NOT_QUERIED) {
+        partitioner_->lights_within_range(location, query_);
+        range.first = lights_.size();
+        range.count = query_.size();
+        lights_.insert(lights_.end(), query_.begin(), query_.end());
+    }
+
+    return LightSpan(range.count ? &lights_[range.first] : nullptr, range.count);
+}
+
+LightSpan QueryArena::lights_of(MeshID mesh) const {
+    std::vector<MeshID>::const_iterator it = std::lower_bound(visible_meshes_.begin(), visible_meshes_.end(), mesh);
+    if(it == visible_meshes_.end() || *it != mesh) {
+        return LightSpan();
+    }
+
+    const Range& range = mesh_lights_[it - visible_meshes_.begin()];
+    if(range.first == NOT_QUERIED || !range.count) {
+        return LightSpan();
+    }
+
+    return LightSpan(&lights_[range.first], range.count);
+}
+
+}
@@ -9,12 +9,41 @@
 
 namespace kglt {
 
+class JobSystem;
+
+/*
+ *  A view of some LightIDs stored elsewhere (e.g. in a QueryArena). Only valid until
+ *  whoever owns the storage adds to it again.
+ */
+struct LightSpan {
+    LightSpan():
+        data(nullptr),
+        count(0) {}
+
+    LightSpan(const LightID* data, uint32_t count):
+        data(data),
+        count(count) {}
+
+    const LightID* data;
+    uint32_t count;
+
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const LightID& operator[](uint32_t i) const { return data[i]; }
+
+    const LightID* begin() const { return data; }
+    const LightID* end() const { return data + count; }
+};
+
 class Partitioner {
 public:
     typedef std::tr1::shared_ptr<Partitioner> ptr;
 
     Partitioner(Scene& scene):
-        scene_(scene) {}
+        scene_(scene),
+        used_chunks_(0) {}
+
+    virtual ~Partitioner() {}
 
     virtual void add(Mesh& obj) = 0;
     virtual void remove(Mesh& obj) = 0;
@@ -24,14 +53,82 @@ public:
     virtual void remove(Light& obj) = 0;
     virtual void relocate(Light& obj) = 0;
 
-    virtual std::vector<LightID> lights_within_range(const kmVec3& location) = 0;
-    virtual std::set<MeshID> meshes_visible_from(const Camera& camera) = 0;
+    /*
+     *  Both queries clear `out` and fill it in, so keep the vectors around between frames
+     *  and they won't need to reallocate once they're big enough. Partitioners keep any
+     *  other scratch space they need themselves, so repeated queries don't allocate either.
+     */
+    virtual void lights_within_range(const kmVec3& location, std::vector<LightID>& out) = 0; ///< Nearest first
+    virtual void meshes_visible_from(const Camera& camera, std::vector<MeshID>& out) = 0; ///< Sorted by ID
 
 protected:
     Scene& scene() { return scene_; }
+    JobSystem& jobs(); ///< The window's, for JobSystem::parallel_for
+
+    static const uint32_t CULL_GRAIN = 1024; ///< Objects per chunk when culling in parallel
+
+    /*
+     *  Scratch space for culling with JobSystem::parallel_for. Each chunk fills in its
+     *  own list and merge_cull_chunks() gathers them up afterwards.
+     */
+    struct CullChunk {
+        std::vector<MeshID> visible;
+        std::vector<uint32_t> visibility;
+        std::vector<std::pair<int32_t, uint8_t> > stack;
+    };
+
+    std::vector<CullChunk>& cull_chunks(uint32_t count); ///< Returns `count` chunks with empty visible lists
+    void merge_cull_chunks(std::vector<MeshID>& out); ///< Appends every chunk's meshes to out, then sorts it
+
+    /*
+     *  For lights_within_range(), call start_light_query(), add_light_in_range() for
+     *  each light that reaches the location, and finish_light_query() to sort them.
+     */
+    void start_light_query() { light_distances_.clear(); }
+    void add_light_in_range(LightID light, float distance) { light_distances_.push_back(std::make_pair(light, distance)); }
+    void finish_light_query(std::vector<LightID>& out);
 
 private:
     Scene& scene_;
+    std::vector<CullChunk> cull_chunks_;
+    uint32_t used_chunks_;
+
+    std::vector<std::pair<LightID, float> > light_distances_;
+};
+
+/*
+ *  Holds the results of a frame's partitioner queries. reset() asks for the visible
+ *  meshes, then the first lights_for() call for each of them stores its lights in one
+ *  shared buffer, so a mesh drawn in several passes only queries the partitioner once.
+ *  Nothing is freed between frames, the buffers are just reused.
+ */
+class QueryArena {
+public:
+    QueryArena():
+        partitioner_(nullptr) {}
+
+    void reset(Partitioner& partitioner, const Camera& camera);
+
+    const std::vector<MeshID>& visible_meshes() const { return visible_meshes_; }
+    bool is_visible(MeshID mesh) const;
+
+    LightSpan lights_for(MeshID mesh, const kmVec3& location); ///< Valid until the next lights_for()
+    LightSpan lights_of(MeshID mesh) const; ///< What lights_for() stored for a visible mesh, empty if it wasn't asked
+
+private:
+    struct Range {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    static const uint32_t NOT_QUERIED = ~0u;
+
+    Partitioner* partitioner_;
+
+    std::vector<MeshID> visible_meshes_;
+    std::vector<Range> mesh_lights_; ///< Parallel to visible_meshes_
+    std::vector<LightID> lights_;
+    std::vector<LightID> query_;
 };
 
 }
@@ -0,0 +1,232 @@
+#include <algorithm>
+
+#include "../scene.h"
+#include "bsp_partitioner.h"
+
+namespace kglt {
+
+void BSPPartitioner::set_tree(const std::vector<Plane>& planes, const std::vector<Node>& nodes, const std::vector<Leaf>& leaves) {
+    planes_ = planes;
+    nodes_ = nodes;
+    leaves_ = leaves;
+
+    pvs_valid_ = false;
+}
+
+void BSPPartitioner::set_visibility(uint32_t num_clusters, const std::vector<uint32_t>& pvs_offsets, const std::vector<uint8_t>& vis_data) {
+    num_clusters_ = num_clusters;
+    pvs_offsets_ = pvs_offsets;
+    vis_data_ = vis_data;
+
+    pvs_.resize((num_clusters_ + 7) / 8);
+    pvs_valid_ = false;
+}
+
+void BSPPartitioner::set_areas(const std::vector<Area>& areas, const std::vector<AreaPortal>& portals) {
+    areas_ = areas;
+    area_portals_ = portals;
+
+    //Portals start open, it's up to the game to close them
+    uint32_t portal_count = 0;
+    for(const AreaPortal& portal: area_portals_) {
+        portal_count = std::max(portal_count, portal.portal + 1);
+    }
+    portal_open_.assign(portal_count, true);
+
+    area_components_valid_ = false;
+}
+
+void BSPPartitioner::set_mesh_locations(MeshID mesh, const std::vector<Location>& locations) {
+    mesh_locations_[mesh] = locations;
+}
+
+void BSPPartitioner::set_portal_open(uint32_t portal, bool value) {
+    if(portal_open_.at(portal) != value) {
+        portal_open_[portal] = value;
+        area_components_valid_ = false;
+    }
+}
+
+int32_t BSPPartitioner::find_leaf(const kmVec3& point) const {
+    if(nodes_.empty()) {
+        return -1;
+    }
+
+    int32_t index = 0;
+    while(index >= 0) {
+        const Node& node = nodes_[index];
+        const Plane& plane = planes_[node.plane];
+
+        float distance = kmVec3Dot(&plane.normal, &point) - plane.distance;
+        index = (distance >= 0) ? node.front : node.back;
+    }
+
+    return -(index + 1);
+}
+
+int32_t BSPPartitioner::cluster_at(const kmVec3& point) const {
+    int32_t leaf = find_leaf(point);
+    if(leaf < 0 || leaf >= (int32_t) leaves_.size()) {
+        return -1;
+    }
+    return leaves_[leaf].cluster;
+}
+
+void BSPPartitioner::update_pvs(int32_t cluster) {
+    if(pvs_valid_ && cluster == current_cluster_) {
+        return;
+    }
+
+    current_cluster_ = cluster;
+    pvs_valid_ = true;
+
+    if(cluster < 0 || cluster >= (int32_t) num_clusters_) {
+        //Outside the map (or no vis data), everything is potentially visible
+        std::fill(pvs_.begin(), pvs_.end(), 0xFF);
+        return;
+    }
+
+    /*
+     * Each row is run-length encoded: a non-zero byte is 8 clusters worth of
+     * visibility bits, a zero byte is followed by a count of zero bytes to skip
+     */
+    std::fill(pvs_.begin(), pvs_.end(), 0);
+
+    uint32_t in = pvs_offsets_[cluster];
+    uint32_t out = 0;
+    while(out < pvs_.size() && in < vis_data_.size()) {
+        if(vis_data_[in]) {
+            pvs_[out++] = vis_data_[in++];
+            continue;
+        }
+
+        if(in + 1 >= vis_data_.size()) {
+            break;
+        }
+
+        out += vis_data_[in + 1];
+        in += 2;
+    }
+}
+
+int32_t BSPPartitioner::area_at(const kmVec3& point) const {
+    int32_t leaf = find_leaf(point);
+    if(leaf < 0 || leaf >= (int32_t) leaves_.size()) {
+        return 0;
+    }
+    return leaves_[leaf].area;
+}
+
+void BSPPartitioner::update_area_components() {
+    if(area_components_valid_) {
+        return;
+    }
+
+    //Flood fill through the open portals, labelling each connected set of areas
+    area_components_.assign(areas_.size(), -1);
+
+    int32_t component = 0;
+    for(uint32_t start = 0; start < areas_.size(); ++start) {
+        if(area_components_[start] != -1) {
+            continue;
+        }
+
+        flood_stack_.clear();
+        flood_stack_.push_back(start);
+        area_components_[start] = component;
+
+        while(!flood_stack_.empty()) {
+            int32_t area = flood_stack_.back();
+            flood_stack_.pop_back();
+
+            const Area& a = areas_[area];
+            for(uint32_t i = a.first_portal; i < a.first_portal + a.num_portals && i < area_portals_.size(); ++i) {
+                const AreaPortal& portal = area_portals_[i];
+                if(!portal_open_[portal.portal]) {
+                    continue;
+                }
+
+                int32_t other = portal.other_area;
+                if(other >= 0 && other < (int32_t) areas_.size() && area_components_[other] == -1) {
+                    area_components_[other] = component;
+                    flood_stack_.push_back(other);
+                }
+            }
+        }
+
+        ++component;
+    }
+
+    area_components_valid_ = true;
+}
+
+bool BSPPartitioner::areas_connected(int32_t lhs, int32_t rhs) {
+    //Area 0 is "no area", don't cull anything based on it
+    if(lhs <= 0 || rhs <= 0 || lhs >= (int32_t) areas_.size() || rhs >= (int32_t) areas_.size()) {
+        return true;
+    }
+
+    update_area_components();
+    return area_components_[lhs] == area_components_[rhs];
+}
+
+bool BSPPartitioner::cluster_visible(int32_t cluster) const {
+    if(!pvs_valid_ || current_cluster_ < 0) {
+        return true;
+    }
+
+    if(cluster < 0 || cluster >= (int32_t) num_clusters_) {
+        return false;
+    }
+
+    return (pvs_[cluster >> 3] & (1 << (cluster & 7))) != 0;
+}
+
+void BSPPartitioner::lights_within_range(const kmVec3& location, std::vector<LightID>& out) {
+    NullPartitioner::lights_within_range(location, out);
+    if(areas_.empty()) {
+        return;
+    }
+
+    //Lights on the other side of a closed portal can't reach the location
+    int32_t area = area_at(location);
+
+    auto blocked = [&](LightID light_id) -> bool {
+        return !areas_connected(area, area_at(scene().light(light_id).absolute_position()));
+    };
+
+    out.erase(std::remove_if(out.begin(), out.end(), blocked), out.end());
+}
+
+void BSPPartitioner::meshes_visible_from(const Camera& camera, std::vector<MeshID>& out) {
+    int32_t leaf = find_leaf(camera.absolute_position());
+    bool valid_leaf = leaf >= 0 && leaf < (int32_t) leaves_.size();
+
+    update_pvs(valid_leaf ? leaves_[leaf].cluster : -1);
+    camera_area_ = valid_leaf ? leaves_[leaf].area : 0;
+
+    NullPartitioner::meshes_visible_from(camera, out);
+    if(current_cluster_ < 0) {
+        return;
+    }
+
+    auto hidden = [&](MeshID mesh_id) -> bool {
+        std::map<MeshID, std::vector<Location> >::const_iterator it = mesh_locations_.find(mesh_id);
+        if(it == mesh_locations_.end() || (*it).second.empty()) {
+            //Not part of the map (or not in any leaf), so always visible
+            return false;
+        }
+
+        for(const Location& location: (*it).second) {
+            if(cluster_visible(location.cluster) && areas_connected(camera_area_, location.area)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    //Filtering in place keeps the meshes in order
+    out.erase(std::remove_if(out.begin(), out.end(), hidden), out.end());
+}
+
+}
@@ -0,0 +1,139 @@
+#ifndef BSP_PARTITIONER_H
+#define BSP_PARTITIONER_H
+
+#include <map>
+#include <vector>
+
+#include "null_partitioner.h"
+
+namespace kglt {
+
+/*
+ *  A partitioner for BSP maps that carry a precomputed potentially visible set (PVS).
+ *
+ *  The loader hands over the BSP tree (planes, nodes and leaves) along with the
+ *  run-length encoded visibility lump, and tells the partitioner which clusters each
+ *  of the map meshes are seen from. Each frame the camera's leaf is located, the PVS
+ *  row for its cluster is decompressed (only when the cluster changes) and any map
+ *  mesh that isn't in a visible cluster is dropped.
+ *
+ *  Maps can also be split into areas joined by portals (e.g. doors). The game opens and
+ *  closes portals with set_portal_open() and anything in an area that can't be reached
+ *  from the camera's area, through open portals, is culled even if the PVS says it's
+ *  visible. Lights are only assigned to meshes in an area connected to the light's.
+ *
+ *  Meshes that weren't registered with set_mesh_locations() are always returned, and
+ *  lights are otherwise handled in the same way as the NullPartitioner.
+ */
+class BSPPartitioner : public NullPartitioner {
+public:
+    typedef std::tr1::shared_ptr<BSPPartitioner> ptr;
+
+    struct Plane {
+        kmVec3 normal;
+        float distance;
+    };
+
+    struct Node {
+        uint32_t plane;
+        int32_t front; ///< Negative values are leaves, stored as -(leaf + 1)
+        int32_t back;
+    };
+
+    struct Leaf {
+        int32_t cluster; ///< -1 if the leaf is solid or outside the map
+        int32_t area; ///< 0 if the leaf isn't part of any area
+    };
+
+    struct Area {
+        uint32_t num_portals;
+        uint32_t first_portal; ///< Index into the area portals passed to set_areas()
+    };
+
+    struct AreaPortal {
+        uint32_t portal; ///< Portal number, shared by the entries on both sides
+        int32_t other_area;
+    };
+
+    /*
+     *  A cluster/area pair that a mesh can be seen from, meshes can have several
+     */
+    struct Location {
+        int32_t cluster;
+        int32_t area;
+
+        bool operator<(const Location& rhs) const {
+            return (cluster != rhs.cluster) ? cluster < rhs.cluster : area < rhs.area;
+        }
+
+        bool operator==(const Location& rhs) const {
+            return cluster == rhs.cluster && area == rhs.area;
+        }
+    };
+
+    BSPPartitioner(Scene& scene):
+        NullPartitioner(scene),
+        num_clusters_(0),
+        current_cluster_(-1),
+        pvs_valid_(false),
+        area_components_valid_(false),
+        camera_area_(0) {}
+
+    void set_tree(const std::vector<Plane>& planes, const std::vector<Node>& nodes, const std::vector<Leaf>& leaves);
+    void set_visibility(uint32_t num_clusters, const std::vector<uint32_t>& pvs_offsets, const std::vector<uint8_t>& vis_data);
+    void set_areas(const std::vector<Area>& areas, const std::vector<AreaPortal>& portals);
+    void set_mesh_locations(MeshID mesh, const std::vector<Location>& locations);
+
+    uint32_t portal_count() const { return portal_open_.size(); }
+    bool portal_open(uint32_t portal) const { return portal_open_.at(portal); }
+    void set_portal_open(uint32_t portal, bool value=true);
+
+    using NullPartitioner::remove;
+
+    void remove(Mesh& obj) {
+        mesh_locations_.erase(obj.id());
+        NullPartitioner::remove(obj);
+    }
+
+    void lights_within_range(const kmVec3& location, std::vector<LightID>& out);
+    void meshes_visible_from(const Camera& camera, std::vector<MeshID>& out);
+
+    int32_t find_leaf(const kmVec3& point) const;
+    int32_t cluster_at(const kmVec3& point) const;
+    int32_t area_at(const kmVec3& point) const;
+    bool cluster_visible(int32_t cluster) const;
+    bool areas_connected(int32_t lhs, int32_t rhs); ///< True if you can get from one area to the other through open portals
+
+private:
+    std::vector<Plane> planes_;
+    std::vector<Node> nodes_;
+    std::vector<Leaf> leaves_;
+
+    uint32_t num_clusters_;
+    std::vector<uint32_t> pvs_offsets_;
+    std::vector<uint8_t> vis_data_;
+
+    int32_t current_cluster_;
+    bool pvs_valid_;
+    std::vector<uint8_t> pvs_; ///< Decompressed row for current_cluster_, one bit per cluster
+
+    void update_pvs(int32_t cluster);
+
+    std::vector<Area> areas_;
+    std::vector<AreaPortal> area_portals_;
+    std::vector<bool> portal_open_;
+
+    bool area_components_valid_;
+    std::vector<int32_t> area_components_; ///< Areas that share a component are connected
+    std::vector<int32_t> flood_stack_;
+
+    void update_area_components();
+
+    int32_t camera_area_;
+
+    std::map<MeshID, std::vector<Location> > mesh_locations_;
+};
+
+}
+
+#endif // BSP_PARTITIONER_H
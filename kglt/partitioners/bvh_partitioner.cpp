@@ -0,0 +1,185 @@
+#include <algorithm>
+
+#include "../scene.h"
+#include "../camera.h"
+#include "../job_system.h"
+#include "bvh_partitioner.h"
+
+namespace kglt {
+
+static AABB light_bounds(Light& light) {
+    const kmVec3& position = light.absolute_position();
+    float range = light.range();
+
+    AABB result;
+    kmVec3Fill(&result.min, position.x - range, position.y - range, position.z - range);
+    kmVec3Fill(&result.max, position.x + range, position.y + range, position.z + range);
+    return result;
+}
+
+static kmVec3 centre_of(const AABB& box) {
+    kmVec3 result;
+    kmVec3Add(&result, &box.min, &box.max);
+    kmVec3Scale(&result, &result, 0.5);
+    return result;
+}
+
+BVHPartitioner::BVHPartitioner(Scene& scene, float margin):
+    Partitioner(scene),
+    mesh_tree_(margin),
+    light_tree_(margin) {
+
+}
+
+void BVHPartitioner::add(Mesh& obj) {
+    AABB box = obj.absolute_aabb();
+
+    Proxy proxy;
+    proxy.id = mesh_tree_.create_proxy(box, obj.id());
+    proxy.centre = centre_of(box);
+    mesh_proxies_[obj.id()] = proxy;
+}
+
+void BVHPartitioner::remove(Mesh& obj) {
+    std::map<MeshID, Proxy>::iterator it = mesh_proxies_.find(obj.id());
+    if(it == mesh_proxies_.end()) {
+        return;
+    }
+
+    mesh_tree_.destroy_proxy((*it).second.id);
+    mesh_proxies_.erase(it);
+}
+
+void BVHPartitioner::relocate(Mesh& obj) {
+    std::map<MeshID, Proxy>::iterator it = mesh_proxies_.find(obj.id());
+    if(it == mesh_proxies_.end()) {
+        add(obj);
+        return;
+    }
+
+    Proxy& proxy = (*it).second;
+
+    AABB box = obj.absolute_aabb();
+    kmVec3 centre = centre_of(box);
+
+    kmVec3 displacement;
+    kmVec3Subtract(&displacement, &centre, &proxy.centre);
+
+    mesh_tree_.move_proxy(proxy.id, box, displacement);
+    proxy.centre = centre;
+}
+
+void BVHPartitioner::add(Light& obj) {
+    if(obj.type() == LIGHT_TYPE_DIRECTIONAL) {
+        directional_lights_.insert(obj.id());
+        return;
+    }
+
+    AABB box = light_bounds(obj);
+
+    Proxy proxy;
+    proxy.id = light_tree_.create_proxy(box, obj.id());
+    proxy.centre = obj.absolute_position();
+    light_proxies_[obj.id()] = proxy;
+}
+
+void BVHPartitioner::remove(Light& obj) {
+    directional_lights_.erase(obj.id());
+
+    std::map<LightID, Proxy>::iterator it = light_proxies_.find(obj.id());
+    if(it == light_proxies_.end()) {
+        return;
+    }
+
+    light_tree_.destroy_proxy((*it).second.id);
+    light_proxies_.erase(it);
+}
+
+void BVHPartitioner::relocate(Light& obj) {
+    std::map<LightID, Proxy>::iterator it = light_proxies_.find(obj.id());
+
+    //The light type might have changed since it was added
+    bool in_tree = it != light_proxies_.end();
+    bool directional = obj.type() == LIGHT_TYPE_DIRECTIONAL;
+    if(!in_tree || directional) {
+        remove(obj);
+        add(obj);
+        return;
+    }
+
+    Proxy& proxy = (*it).second;
+
+    kmVec3 displacement;
+    kmVec3Subtract(&displacement, &obj.absolute_position(), &proxy.centre);
+
+    light_tree_.move_proxy(proxy.id, light_bounds(obj), displacement);
+    proxy.centre = obj.absolute_position();
+}
+
+void BVHPartitioner::lights_within_range(const kmVec3& location, std::vector<LightID>& out) {
+    results_.clear();
+    light_tree_.query_sphere(location, 0, results_);
+
+    start_light_query();
+    for(LightID light_id: directional_lights_) {
+        add_light_in_range(light_id, 0.0f);
+    }
+
+    //The tree only knows about boxes, check the actual distance
+    for(uint32_t light_id: results_) {
+        Light& light = scene().light(light_id);
+
+        kmVec3 diff;
+        kmVec3Subtract(&diff, &location, &light.absolute_position());
+        float dist = kmVec3Length(&diff);
+        if(dist <= light.range()) {
+            add_light_in_range(light_id, dist);
+        }
+    }
+
+    finish_light_query(out);
+}
+
+void BVHPartitioner::meshes_visible_from(const Camera& camera, std::vector<MeshID>& out) {
+    out.clear();
+
+    const Frustum& frustum = camera.frustum();
+    if(!frustum.initialized()) {
+        for(std::pair<MeshID, Proxy> p: mesh_proxies_) {
+            out.push_back(p.first);
+        }
+        return;
+    }
+
+    //Cut the tree into a few subtrees per thread so the work evens out
+    mesh_tree_.split_frustum(frustum, (jobs().thread_count() + 1) * 4, subtrees_);
+
+    uint32_t count = subtrees_.size();
+    std::vector<CullChunk>& chunks = cull_chunks(count);
+
+    jobs().parallel_for(count, 1, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        CullChunk& scratch = chunks[chunk];
+        for(uint32_t i = begin; i < end; ++i) {
+            mesh_tree_.query_frustum(frustum, subtrees_[i], scratch.stack, scratch.visible);
+        }
+    });
+
+    merge_cull_chunks(out);
+}
+
+std::vector<MeshID> BVHPartitioner::meshes_within_sphere(const kmVec3& centre, float radius) {
+    results_.clear();
+    mesh_tree_.query_sphere(centre, radius, results_);
+    return std::vector<MeshID>(results_.begin(), results_.end());
+}
+
+std::vector<MeshID> BVHPartitioner::meshes_hit_by_ray(const kmVec3& origin, const kmVec3& direction, float max_distance) {
+    kmVec3 unit;
+    kmVec3Normalize(&unit, &direction);
+
+    results_.clear();
+    mesh_tree_.query_ray(origin, unit, max_distance, results_);
+    return std::vector<MeshID>(results_.begin(), results_.end());
+}
+
+}
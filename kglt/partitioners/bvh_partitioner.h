@@ -0,0 +1,67 @@
+#ifndef BVH_PARTITIONER_H
+#define BVH_PARTITIONER_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "../mesh.h"
+#include "../light.h"
+
+#include "../partitioner.h"
+#include "dynamic_aabb_tree.h"
+
+namespace kglt {
+
+/*
+ *  A partitioner for scenes with lots of moving objects, built on a DynamicAABBTree.
+ *
+ *  Meshes and lights live in separate trees. Mesh boxes come from Mesh::aabb() offset by
+ *  the mesh's absolute position and point/spot lights are boxed by their range. Objects
+ *  that move by less than the tree margin cost nothing to relocate.
+ *
+ *  Relocation is driven by the Scene, which batches up anything that moved (or changed
+ *  shape) and calls relocate() once per frame before rendering.
+ */
+class BVHPartitioner : public Partitioner {
+public:
+    typedef std::tr1::shared_ptr<BVHPartitioner> ptr;
+
+    BVHPartitioner(Scene& scene, float margin=0.5);
+
+    void add(Mesh& obj);
+    void remove(Mesh& obj);
+    void relocate(Mesh& obj);
+
+    void add(Light& obj);
+    void remove(Light& obj);
+    void relocate(Light& obj);
+
+    void lights_within_range(const kmVec3& location, std::vector<LightID>& out);
+    void meshes_visible_from(const Camera& camera, std::vector<MeshID>& out);
+
+    std::vector<MeshID> meshes_within_sphere(const kmVec3& centre, float radius);
+    std::vector<MeshID> meshes_hit_by_ray(const kmVec3& origin, const kmVec3& direction, float max_distance); ///< Returns the meshes whose bounds the ray passes through
+
+    const DynamicAABBTree& mesh_tree() const { return mesh_tree_; }
+
+private:
+    struct Proxy {
+        int32_t id;
+        kmVec3 centre; ///< Where the object was last time, to predict where it's going
+    };
+
+    DynamicAABBTree mesh_tree_;
+    DynamicAABBTree light_tree_;
+
+    std::map<MeshID, Proxy> mesh_proxies_;
+    std::map<LightID, Proxy> light_proxies_;
+    std::set<LightID> directional_lights_;
+
+    std::vector<uint32_t> results_;
+    std::vector<DynamicAABBTree::CullItem> subtrees_;
+};
+
+}
+
+#endif // BVH_PARTITIONER_H
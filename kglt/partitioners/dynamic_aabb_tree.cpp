@@ -0,0 +1,521 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "dynamic_aabb_tree.h"
+
+namespace kglt {
+
+static AABB combine(const AABB& lhs, const AABB& rhs) {
+    AABB result;
+    kmVec3Fill(&result.min, std::min(lhs.min.x, rhs.min.x), std::min(lhs.min.y, rhs.min.y), std::min(lhs.min.z, rhs.min.z));
+    kmVec3Fill(&result.max, std::max(lhs.max.x, rhs.max.x), std::max(lhs.max.y, rhs.max.y), std::max(lhs.max.z, rhs.max.z));
+    return result;
+}
+
+static float surface_area(const AABB& box) {
+    float w = box.width(), h = box.height(), d = box.depth();
+    return 2.0 * (w * h + w * d + h * d);
+}
+
+static bool contains_box(const AABB& outer, const AABB& inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+static bool intersects_sphere(const AABB& box, const kmVec3& centre, float radius) {
+    //Distance from the centre to the closest point on the box
+    float dx = std::max(box.min.x - centre.x, std::max(0.0f, centre.x - box.max.x));
+    float dy = std::max(box.min.y - centre.y, std::max(0.0f, centre.y - box.max.y));
+    float dz = std::max(box.min.z - centre.z, std::max(0.0f, centre.z - box.max.z));
+    return (dx * dx + dy * dy + dz * dz) <= radius * radius;
+}
+
+static bool intersects_ray(const AABB& box, const kmVec3& origin, const kmVec3& inverse_direction, float max_distance) {
+    //Slab test, an infinite inverse direction component is fine here
+    float tx1 = (box.min.x - origin.x) * inverse_direction.x;
+    float tx2 = (box.max.x - origin.x) * inverse_direction.x;
+    float t_near = std::min(tx1, tx2);
+    float t_far = std::max(tx1, tx2);
+
+    float ty1 = (box.min.y - origin.y) * inverse_direction.y;
+    float ty2 = (box.max.y - origin.y) * inverse_direction.y;
+    t_near = std::max(t_near, std::min(ty1, ty2));
+    t_far = std::min(t_far, std::max(ty1, ty2));
+
+    float tz1 = (box.min.z - origin.z) * inverse_direction.z;
+    float tz2 = (box.max.z - origin.z) * inverse_direction.z;
+    t_near = std::max(t_near, std::min(tz1, tz2));
+    t_far = std::min(t_far, std::max(tz1, tz2));
+
+    return t_far >= std::max(t_near, 0.0f) && t_near <= max_distance;
+}
+
+DynamicAABBTree::DynamicAABBTree(float margin):
+    margin_(margin),
+    root_(NULL_NODE),
+    free_list_(NULL_NODE) {
+
+}
+
+int32_t DynamicAABBTree::allocate_node() {
+    if(free_list_ == NULL_NODE) {
+        nodes_.push_back(Node());
+        nodes_.back().parent = free_list_;
+        free_list_ = nodes_.size() - 1;
+    }
+
+    int32_t node = free_list_;
+    free_list_ = nodes_[node].parent;
+
+    Node& n = nodes_[node];
+    n.parent = NULL_NODE;
+    n.left = NULL_NODE;
+    n.right = NULL_NODE;
+    n.height = 0;
+    n.data = 0;
+    return node;
+}
+
+void DynamicAABBTree::free_node(int32_t node) {
+    nodes_[node].parent = free_list_;
+    nodes_[node].height = -1;
+    free_list_ = node;
+}
+
+int32_t DynamicAABBTree::create_proxy(const AABB& box, uint32_t data) {
+    int32_t proxy = allocate_node();
+
+    Node& node = nodes_[proxy];
+    node.box = box;
+    node.box.min.x -= margin_; node.box.min.y -= margin_; node.box.min.z -= margin_;
+    node.box.max.x += margin_; node.box.max.y += margin_; node.box.max.z += margin_;
+    node.data = data;
+
+    insert_leaf(proxy);
+    return proxy;
+}
+
+void DynamicAABBTree::destroy_proxy(int32_t proxy) {
+    assert(nodes_[proxy].is_leaf());
+
+    remove_leaf(proxy);
+    free_node(proxy);
+}
+
+bool DynamicAABBTree::move_proxy(int32_t proxy, const AABB& box, const kmVec3& displacement) {
+    assert(nodes_[proxy].is_leaf());
+
+    if(contains_box(nodes_[proxy].box, box)) {
+        return false;
+    }
+
+    remove_leaf(proxy);
+
+    //Fatten the box, and stretch it in the direction of travel so that
+    //an object moving steadily doesn't need reinserting every frame
+    AABB fat = box;
+    fat.min.x -= margin_; fat.min.y -= margin_; fat.min.z -= margin_;
+    fat.max.x += margin_; fat.max.y += margin_; fat.max.z += margin_;
+
+    const float PREDICTION = 2.0;
+    (displacement.x < 0 ? fat.min.x : fat.max.x) += PREDICTION * displacement.x;
+    (displacement.y < 0 ? fat.min.y : fat.max.y) += PREDICTION * displacement.y;
+    (displacement.z < 0 ? fat.min.z : fat.max.z) += PREDICTION * displacement.z;
+
+    nodes_[proxy].box = fat;
+    insert_leaf(proxy);
+    return true;
+}
+
+void DynamicAABBTree::insert_leaf(int32_t leaf) {
+    if(root_ == NULL_NODE) {
+        root_ = leaf;
+        nodes_[root_].parent = NULL_NODE;
+        return;
+    }
+
+    //Walk down the tree looking for the cheapest sibling for the new leaf
+    AABB leaf_box = nodes_[leaf].box;
+    int32_t index = root_;
+    while(!nodes_[index].is_leaf()) {
+        const Node& node = nodes_[index];
+
+        float area = surface_area(node.box);
+        float combined_area = surface_area(combine(node.box, leaf_box));
+
+        //Cost of making a new parent for this node and the leaf
+        float cost = 2.0 * combined_area;
+
+        //Minimum cost of pushing the leaf further down the tree
+        float inheritance_cost = 2.0 * (combined_area - area);
+
+        float child_cost[2];
+        int32_t children[2] = { node.left, node.right };
+        for(uint32_t i = 0; i < 2; ++i) {
+            const Node& child = nodes_[children[i]];
+            float new_area = surface_area(combine(leaf_box, child.box));
+            if(child.is_leaf()) {
+                child_cost[i] = new_area + inheritance_cost;
+            } else {
+                child_cost[i] = (new_area - surface_area(child.box)) + inheritance_cost;
+            }
+        }
+
+        if(cost < child_cost[0] && cost < child_cost[1]) {
+            break;
+        }
+
+        index = (child_cost[0] < child_cost[1]) ? children[0] : children[1];
+    }
+
+    int32_t sibling = index;
+
+    //Create a new parent for the sibling and the leaf
+    int32_t old_parent = nodes_[sibling].parent;
+    int32_t new_parent = allocate_node();
+
+    Node& parent = nodes_[new_parent];
+    parent.parent = old_parent;
+    parent.box = combine(leaf_box, nodes_[sibling].box);
+    parent.height = nodes_[sibling].height + 1;
+    parent.left = sibling;
+    parent.right = leaf;
+
+    if(old_parent != NULL_NODE) {
+        if(nodes_[old_parent].left == sibling) {
+            nodes_[old_parent].left = new_parent;
+        } else {
+            nodes_[old_parent].right = new_parent;
+        }
+    } else {
+        root_ = new_parent;
+    }
+
+    nodes_[sibling].parent = new_parent;
+    nodes_[leaf].parent = new_parent;
+
+    refit_ancestors(new_parent);
+}
+
+void DynamicAABBTree::remove_leaf(int32_t leaf) {
+    if(leaf == root_) {
+        root_ = NULL_NODE;
+        return;
+    }
+
+    int32_t parent = nodes_[leaf].parent;
+    int32_t grandparent = nodes_[parent].parent;
+    int32_t sibling = (nodes_[parent].left == leaf) ? nodes_[parent].right : nodes_[parent].left;
+
+    //The sibling takes the parent's place
+    if(grandparent != NULL_NODE) {
+        if(nodes_[grandparent].left == parent) {
+            nodes_[grandparent].left = sibling;
+        } else {
+            nodes_[grandparent].right = sibling;
+        }
+        nodes_[sibling].parent = grandparent;
+        free_node(parent);
+
+        refit_ancestors(grandparent);
+    } else {
+        root_ = sibling;
+        nodes_[sibling].parent = NULL_NODE;
+        free_node(parent);
+    }
+}
+
+void DynamicAABBTree::refit_ancestors(int32_t node) {
+    while(node != NULL_NODE) {
+        node = balance(node);
+
+        Node& current = nodes_[node];
+        const Node& left = nodes_[current.left];
+        const Node& right = nodes_[current.right];
+
+        current.height = 1 + std::max(left.height, right.height);
+        current.box = combine(left.box, right.box);
+
+        node = current.parent;
+    }
+}
+
+int32_t DynamicAABBTree::balance(int32_t a) {
+    Node& A = nodes_[a];
+    if(A.is_leaf() || A.height < 2) {
+        return a;
+    }
+
+    int32_t b = A.left;
+    int32_t c = A.right;
+    Node& B = nodes_[b];
+    Node& C = nodes_[c];
+
+    int32_t difference = C.height - B.height;
+
+    if(difference > 1) {
+        //Rotate C up
+        int32_t f = C.left;
+        int32_t g = C.right;
+        Node& F = nodes_[f];
+        Node& G = nodes_[g];
+
+        C.left = a;
+        C.parent = A.parent;
+        A.parent = c;
+
+        if(C.parent != NULL_NODE) {
+            if(nodes_[C.parent].left == a) {
+                nodes_[C.parent].left = c;
+            } else {
+                nodes_[C.parent].right = c;
+            }
+        } else {
+            root_ = c;
+        }
+
+        if(F.height > G.height) {
+            C.right = f;
+            A.right = g;
+            G.parent = a;
+            A.box = combine(B.box, G.box);
+            C.box = combine(A.box, F.box);
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        } else {
+            C.right = g;
+            A.right = f;
+            F.parent = a;
+            A.box = combine(B.box, F.box);
+            C.box = combine(A.box, G.box);
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+
+        return c;
+    }
+
+    if(difference < -1) {
+        //Rotate B up
+        int32_t d = B.left;
+        int32_t e = B.right;
+        Node& D = nodes_[d];
+        Node& E = nodes_[e];
+
+        B.left = a;
+        B.parent = A.parent;
+        A.parent = b;
+
+        if(B.parent != NULL_NODE) {
+            if(nodes_[B.parent].left == a) {
+                nodes_[B.parent].left = b;
+            } else {
+                nodes_[B.parent].right = b;
+            }
+        } else {
+            root_ = b;
+        }
+
+        if(D.height > E.height) {
+            B.right = d;
+            A.left = e;
+            E.parent = a;
+            A.box = combine(C.box, E.box);
+            B.box = combine(A.box, D.box);
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        } else {
+            B.right = e;
+            A.left = d;
+            D.parent = a;
+            A.box = combine(C.box, D.box);
+            B.box = combine(A.box, E.box);
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+
+        return b;
+    }
+
+    return a;
+}
+
+void DynamicAABBTree::collect_leaves(int32_t node, std::vector<uint32_t>& out) const {
+    const Node& current = nodes_[node];
+    if(current.is_leaf()) {
+        out.push_back(current.data);
+        return;
+    }
+
+    collect_leaves(current.left, out);
+    collect_leaves(current.right, out);
+}
+
+void DynamicAABBTree::query_frustum(const Frustum& frustum, std::vector<uint32_t>& out) const {
+    if(root_ == NULL_NODE) {
+        return;
+    }
+
+    query_frustum(frustum, CullItem(root_, FRUSTUM_ALL_PLANES), cull_stack_, out);
+}
+
+void DynamicAABBTree::query_frustum(const Frustum& frustum, const CullItem& subtree, std::vector<CullItem>& stack, std::vector<uint32_t>& out) const {
+    stack.clear();
+    stack.push_back(subtree);
+
+    while(!stack.empty()) {
+        int32_t node = stack.back().first;
+        uint8_t planes = stack.back().second;
+        stack.pop_back();
+
+        const Node& current = nodes_[node];
+
+        if(planes) {
+            uint8_t inside = 0;
+            if(frustum.classify_aabb(current.box, planes, inside) == FRUSTUM_CLASSIFICATION_OUTSIDE) {
+                continue;
+            }
+
+            //Children can't cross a plane their parent is entirely inside
+            planes &= ~inside;
+        }
+
+        if(current.is_leaf()) {
+            out.push_back(current.data);
+        } else if(!planes) {
+            collect_leaves(node, out);
+        } else {
+            stack.push_back(CullItem(current.left, planes));
+            stack.push_back(CullItem(current.right, planes));
+        }
+    }
+}
+
+void DynamicAABBTree::split_frustum(const Frustum& frustum, uint32_t target, std::vector<CullItem>& subtrees) const {
+    subtrees.clear();
+    if(root_ == NULL_NODE) {
+        return;
+    }
+
+    subtrees.push_back(CullItem(root_, FRUSTUM_ALL_PLANES));
+
+    bool split = true;
+    while(split && subtrees.size() < target) {
+        split = false;
+
+        cull_stack_.swap(subtrees);
+        subtrees.clear();
+
+        for(const CullItem& item: cull_stack_) {
+            const Node& current = nodes_[item.first];
+
+            //Leaves and subtrees entirely inside the frustum can't be split any further
+            if(current.is_leaf() || !item.second) {
+                subtrees.push_back(item);
+                continue;
+            }
+
+            split = true;
+
+            uint8_t inside = 0;
+            if(frustum.classify_aabb(current.box, item.second, inside) == FRUSTUM_CLASSIFICATION_OUTSIDE) {
+                continue;
+            }
+
+            uint8_t planes = item.second & ~inside;
+            subtrees.push_back(CullItem(current.left, planes));
+            subtrees.push_back(CullItem(current.right, planes));
+        }
+    }
+}
+
+void DynamicAABBTree::query_sphere(const kmVec3& centre, float radius, std::vector<uint32_t>& out) const {
+    if(root_ == NULL_NODE) {
+        return;
+    }
+
+    stack_.clear();
+    stack_.push_back(root_);
+
+    while(!stack_.empty()) {
+        const Node& current = nodes_[stack_.back()];
+        stack_.pop_back();
+
+        if(!intersects_sphere(current.box, centre, radius)) {
+            continue;
+        }
+
+        if(current.is_leaf()) {
+            out.push_back(current.data);
+        } else {
+            stack_.push_back(current.left);
+            stack_.push_back(current.right);
+        }
+    }
+}
+
+void DynamicAABBTree::query_ray(const kmVec3& origin, const kmVec3& direction, float max_distance, std::vector<uint32_t>& out) const {
+    if(root_ == NULL_NODE) {
+        return;
+    }
+
+    kmVec3 inverse_direction;
+    inverse_direction.x = (direction.x != 0) ? 1.0 / direction.x : std::numeric_limits<float>::infinity();
+    inverse_direction.y = (direction.y != 0) ? 1.0 / direction.y : std::numeric_limits<float>::infinity();
+    inverse_direction.z = (direction.z != 0) ? 1.0 / direction.z : std::numeric_limits<float>::infinity();
+
+    stack_.clear();
+    stack_.push_back(root_);
+
+    while(!stack_.empty()) {
+        const Node& current = nodes_[stack_.back()];
+        stack_.pop_back();
+
+        if(!intersects_ray(current.box, origin, inverse_direction, max_distance)) {
+            continue;
+        }
+
+        if(current.is_leaf()) {
+            out.push_back(current.data);
+        } else {
+            stack_.push_back(current.left);
+            stack_.push_back(current.right);
+        }
+    }
+}
+
+bool DynamicAABBTree::validate_node(int32_t node) const {
+    const Node& current = nodes_[node];
+    if(current.is_leaf()) {
+        return current.right == NULL_NODE && current.height == 0;
+    }
+
+    const Node& left = nodes_[current.left];
+    const Node& right = nodes_[current.right];
+
+    if(left.parent != node || right.parent != node) {
+        return false;
+    }
+
+    if(current.height != 1 + std::max(left.height, right.height)) {
+        return false;
+    }
+
+    if(!contains_box(current.box, left.box) || !contains_box(current.box, right.box)) {
+        return false;
+    }
+
+    return validate_node(current.left) && validate_node(current.right);
+}
+
+bool DynamicAABBTree::validate() const {
+    if(root_ == NULL_NODE) {
+        return true;
+    }
+
+    return nodes_[root_].parent == NULL_NODE && validate_node(root_);
+}
+
+}
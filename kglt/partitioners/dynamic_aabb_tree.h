@@ -0,0 +1,89 @@
+#ifndef DYNAMIC_AABB_TREE_H
+#define DYNAMIC_AABB_TREE_H
+
+#include <vector>
+
+#include "../types.h"
+#include "../frustum.h"
+
+namespace kglt {
+
+/*
+ *  A bounding volume hierarchy of axis-aligned boxes that can be updated as things move.
+ *
+ *  Each leaf (proxy) stores a "fat" box, the object's box grown by a margin and stretched
+ *  in the direction it's moving. Moving a proxy does nothing while the object stays inside
+ *  its fat box, otherwise the leaf is removed and reinserted. Insertion picks the sibling
+ *  that grows the tree's surface area the least, and the ancestors of any changed leaf are
+ *  refitted and rebalanced with tree rotations on the way back up.
+ *
+ *  Each proxy carries a 32-bit value (e.g. a MeshID) that queries return.
+ */
+class DynamicAABBTree {
+public:
+    DynamicAABBTree(float margin=0.5);
+
+    int32_t create_proxy(const AABB& box, uint32_t data);
+    void destroy_proxy(int32_t proxy);
+    bool move_proxy(int32_t proxy, const AABB& box, const kmVec3& displacement); ///< Returns true if the proxy was reinserted
+
+    uint32_t data(int32_t proxy) const { return nodes_[proxy].data; }
+    const AABB& fat_aabb(int32_t proxy) const { return nodes_[proxy].box; }
+
+    typedef std::pair<int32_t, uint8_t> CullItem; ///< A node, and the frustum planes it still needs testing against
+
+    void query_frustum(const Frustum& frustum, std::vector<uint32_t>& out) const;
+
+    /*
+     *  For splitting a frustum query between threads. split_frustum() culls the top of the
+     *  tree until there are at least `target` subtrees left (or nothing left to split), then
+     *  each subtree can be finished off on a different thread with query_frustum(), as long
+     *  as every thread passes its own stack.
+     */
+    void split_frustum(const Frustum& frustum, uint32_t target, std::vector<CullItem>& subtrees) const;
+    void query_frustum(const Frustum& frustum, const CullItem& subtree, std::vector<CullItem>& stack, std::vector<uint32_t>& out) const;
+    void query_sphere(const kmVec3& centre, float radius, std::vector<uint32_t>& out) const;
+    void query_ray(const kmVec3& origin, const kmVec3& direction, float max_distance, std::vector<uint32_t>& out) const;
+
+    uint32_t height() const { return (root_ == NULL_NODE) ? 0 : nodes_[root_].height; }
+    bool validate() const; ///< Checks the structure of the tree, for debugging
+
+private:
+    static const int32_t NULL_NODE = -1;
+
+    struct Node {
+        AABB box;
+        uint32_t data;
+
+        int32_t parent; ///< Doubles as the next free node when the node isn't in use
+        int32_t left;
+        int32_t right;
+        int32_t height; ///< 0 for leaves, -1 for free nodes
+
+        bool is_leaf() const { return left == NULL_NODE; }
+    };
+
+    float margin_;
+
+    std::vector<Node> nodes_;
+    int32_t root_;
+    int32_t free_list_;
+
+    mutable std::vector<int32_t> stack_;
+    mutable std::vector<CullItem> cull_stack_;
+
+    int32_t allocate_node();
+    void free_node(int32_t node);
+
+    void insert_leaf(int32_t leaf);
+    void remove_leaf(int32_t leaf);
+    void refit_ancestors(int32_t node);
+    int32_t balance(int32_t node);
+
+    void collect_leaves(int32_t node, std::vector<uint32_t>& out) const;
+    bool validate_node(int32_t node) const;
+};
+
+}
+
+#endif // DYNAMIC_AABB_TREE_H
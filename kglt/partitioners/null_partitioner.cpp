@@ -3,8 +3,8 @@
 
 namespace kglt {
 
-std::vector<LightID> NullPartitioner::lights_within_range(const kmVec3& location) {
-    std::vector<std::pair<LightID, float> > lights_in_range;
+void NullPartitioner::lights_within_range(const kmVec3& location, std::vector<LightID>& out) {
+    start_light_query();
 
     //Find all the lights within range of the location
     for(LightID light_id: all_lights_) {
@@ -14,25 +14,17 @@ std::vector<LightID> NullPartitioner::lights_within_range(const kmVec3& location
         kmVec3Subtract(&diff, &location, &light.position());
         float dist = kmVec3Length(&diff);
         //if(dist < light.range()) {
-            lights_in_range.push_back(std::make_pair(light_id, dist));
+            add_light_in_range(light_id, dist);
         //}
     }
 
     //Sort them by distance
-    std::sort(lights_in_range.begin(), lights_in_range.end(),
-              [](std::pair<LightID, float> lhs, std::pair<LightID, float> rhs) { return lhs.second < rhs.second; });
-
-    //Return the LightIDs only
-    std::vector<LightID> result;
-    for(std::pair<LightID, float> p: lights_in_range) {
-        result.push_back(p.first);
-    }
-    return result;
+    finish_light_query(out);
 }
 
-std::set<MeshID> NullPartitioner::meshes_visible_from(const Camera& camera) {
-    //Just return all of the meshes
-    return all_meshes_;
+void NullPartitioner::meshes_visible_from(const Camera& camera, std::vector<MeshID>& out) {
+    //Just return all of the meshes, the set is already in order
+    out.assign(all_meshes_.begin(), all_meshes_.end());
 }
 
 }
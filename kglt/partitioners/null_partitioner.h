@@ -33,8 +33,8 @@ public:
 
     void relocate(Light& obj) {}
 
-    std::vector<LightID> lights_within_range(const kmVec3& location);
-    std::set<MeshID> meshes_visible_from(const Camera& camera);
+    void lights_within_range(const kmVec3& location, std::vector<LightID>& out);
+    void meshes_visible_from(const Camera& camera, std::vector<MeshID>& out);
 
 private:
     std::set<MeshID> all_meshes_;
@@ -0,0 +1,456 @@
+#include <cmath>
+#include <algorithm>
+
+#include "../scene.h"
+#include "../camera.h"
+#include "../job_system.h"
+#include "octree_partitioner.h"
+
+namespace kglt {
+
+static void mesh_bounding_sphere(Mesh& mesh, kmVec3& centre, float& radius) {
+    AABB box = mesh.absolute_aabb();
+
+    kmVec3 half_extents;
+    kmVec3Subtract(&half_extents, &box.max, &box.min);
+    kmVec3Scale(&half_extents, &half_extents, 0.5);
+
+    kmVec3Add(&centre, &box.min, &half_extents);
+    radius = kmVec3Length(&half_extents);
+}
+
+OctreePartitioner::OctreePartitioner(Scene& scene, float world_size, uint32_t max_depth):
+    Partitioner(scene),
+    max_depth_(max_depth) {
+
+    Node root;
+    kmVec3Zero(&root.centre);
+    root.half_size = world_size / 2.0;
+    root.depth = 0;
+    root.parent = -1;
+    std::fill(root.children, root.children + 8, -1);
+    root.child_count = 0;
+
+    nodes_.push_back(root);
+}
+
+void OctreePartitioner::add(Mesh& obj) {
+    pending_meshes_.push_back(obj.id());
+}
+
+void OctreePartitioner::remove(Mesh& obj) {
+    pending_meshes_.erase(std::remove(pending_meshes_.begin(), pending_meshes_.end(), obj.id()), pending_meshes_.end());
+    if(meshes_.find(obj.id()) != meshes_.end()) {
+        unlink_mesh(obj.id());
+    }
+}
+
+void OctreePartitioner::relocate(Mesh& obj) {
+    pending_meshes_.push_back(obj.id());
+}
+
+void OctreePartitioner::add(Light& obj) {
+    pending_lights_.push_back(obj.id());
+}
+
+void OctreePartitioner::remove(Light& obj) {
+    pending_lights_.erase(std::remove(pending_lights_.begin(), pending_lights_.end(), obj.id()), pending_lights_.end());
+    directional_lights_.erase(obj.id());
+    if(lights_.find(obj.id()) != lights_.end()) {
+        unlink_light(obj.id());
+    }
+}
+
+void OctreePartitioner::relocate(Light& obj) {
+    pending_lights_.push_back(obj.id());
+}
+
+int32_t OctreePartitioner::new_node(int32_t parent, uint32_t octant) {
+    //Copy what we need, pushing a node can move the parent
+    kmVec3 centre = nodes_[parent].centre;
+    float half_size = nodes_[parent].half_size / 2.0;
+    uint32_t depth = nodes_[parent].depth + 1;
+
+    centre.x += (octant & 1) ? half_size : -half_size;
+    centre.y += (octant & 2) ? half_size : -half_size;
+    centre.z += (octant & 4) ? half_size : -half_size;
+
+    int32_t result;
+    if(!free_nodes_.empty()) {
+        result = free_nodes_.back();
+        free_nodes_.pop_back();
+    } else {
+        result = nodes_.size();
+        nodes_.push_back(Node());
+    }
+
+    Node& node = nodes_[result];
+    node.centre = centre;
+    node.half_size = half_size;
+    node.depth = depth;
+    node.parent = parent;
+    std::fill(node.children, node.children + 8, -1);
+    node.child_count = 0;
+    node.meshes.clear();
+    node.lights.clear();
+    node.mesh_x.clear();
+    node.mesh_y.clear();
+    node.mesh_z.clear();
+    node.mesh_radius.clear();
+    node.mesh_plane_cache.clear();
+
+    nodes_[parent].children[octant] = result;
+    nodes_[parent].child_count++;
+
+    return result;
+}
+
+void OctreePartitioner::release_empty_nodes(int32_t node) {
+    //Walk up the tree, handing back any cells that are no longer used
+    while(node > 0) {
+        Node& current = nodes_[node];
+        if(!current.meshes.empty() || !current.lights.empty() || current.child_count) {
+            break;
+        }
+
+        Node& parent = nodes_[current.parent];
+        for(uint32_t i = 0; i < 8; ++i) {
+            if(parent.children[i] == node) {
+                parent.children[i] = -1;
+                parent.child_count--;
+                break;
+            }
+        }
+
+        free_nodes_.push_back(node);
+        node = current.parent;
+    }
+}
+
+int32_t OctreePartitioner::find_node(const kmVec3& centre, float radius) {
+    int32_t current = 0;
+    while(nodes_[current].depth < max_depth_) {
+        const Node& node = nodes_[current];
+
+        //Only possible at the root, anything outside the world stays there
+        if(fabs(centre.x - node.centre.x) > node.half_size ||
+           fabs(centre.y - node.centre.y) > node.half_size ||
+           fabs(centre.z - node.centre.z) > node.half_size) {
+            break;
+        }
+
+        //A child's loose bounds only hold spheres up to half the child's size
+        if(radius > node.half_size / 2.0) {
+            break;
+        }
+
+        uint32_t octant = ((centre.x >= node.centre.x) ? 1 : 0) |
+                          ((centre.y >= node.centre.y) ? 2 : 0) |
+                          ((centre.z >= node.centre.z) ? 4 : 0);
+
+        int32_t child = node.children[octant];
+        if(child < 0) {
+            child = new_node(current, octant);
+        }
+        current = child;
+    }
+
+    return current;
+}
+
+bool OctreePartitioner::fits_loose_bounds(const Node& node, const kmVec3& centre, float radius) const {
+    if(!node.depth) {
+        //The root is unbounded, see if the object now belongs further down
+        return false;
+    }
+
+    float loose_half_size = node.half_size * 2.0;
+    return fabs(centre.x - node.centre.x) + radius <= loose_half_size &&
+           fabs(centre.y - node.centre.y) + radius <= loose_half_size &&
+           fabs(centre.z - node.centre.z) + radius <= loose_half_size;
+}
+
+AABB OctreePartitioner::loose_bounds(const Node& node) const {
+    float loose_half_size = node.half_size * 2.0;
+
+    AABB result;
+    kmVec3Fill(&result.min, node.centre.x - loose_half_size, node.centre.y - loose_half_size, node.centre.z - loose_half_size);
+    kmVec3Fill(&result.max, node.centre.x + loose_half_size, node.centre.y + loose_half_size, node.centre.z + loose_half_size);
+    return result;
+}
+
+void OctreePartitioner::update_pending() {
+    std::sort(pending_meshes_.begin(), pending_meshes_.end());
+    pending_meshes_.erase(std::unique(pending_meshes_.begin(), pending_meshes_.end()), pending_meshes_.end());
+    for(MeshID mesh_id: pending_meshes_) {
+        update_mesh(scene().mesh(mesh_id));
+    }
+    pending_meshes_.clear();
+
+    std::sort(pending_lights_.begin(), pending_lights_.end());
+    pending_lights_.erase(std::unique(pending_lights_.begin(), pending_lights_.end()), pending_lights_.end());
+    for(LightID light_id: pending_lights_) {
+        update_light(scene().light(light_id));
+    }
+    pending_lights_.clear();
+}
+
+void OctreePartitioner::update_mesh(Mesh& mesh) {
+    kmVec3 centre;
+    float radius;
+    mesh_bounding_sphere(mesh, centre, radius);
+
+    std::map<MeshID, Entry>::iterator it = meshes_.find(mesh.id());
+    if(it != meshes_.end()) {
+        Entry& entry = (*it).second;
+        if(fits_loose_bounds(nodes_[entry.node], centre, radius)) {
+            //Still inside the loose cell, no need to touch the tree
+            entry.centre = centre;
+            entry.radius = radius;
+            set_mesh_bounds(nodes_[entry.node], entry.index, centre, radius);
+            return;
+        }
+        unlink_mesh(mesh.id());
+    }
+
+    int32_t node = find_node(centre, radius);
+
+    Entry entry;
+    entry.node = node;
+    entry.index = nodes_[node].meshes.size();
+    entry.centre = centre;
+    entry.radius = radius;
+
+    Node& n = nodes_[node];
+    n.meshes.push_back(mesh.id());
+    n.mesh_x.push_back(0);
+    n.mesh_y.push_back(0);
+    n.mesh_z.push_back(0);
+    n.mesh_radius.push_back(0);
+    n.mesh_plane_cache.push_back(0);
+    set_mesh_bounds(n, entry.index, centre, radius);
+
+    meshes_[mesh.id()] = entry;
+}
+
+void OctreePartitioner::set_mesh_bounds(Node& node, uint32_t index, const kmVec3& centre, float radius) {
+    node.mesh_x[index] = centre.x;
+    node.mesh_y[index] = centre.y;
+    node.mesh_z[index] = centre.z;
+    node.mesh_radius[index] = radius;
+}
+
+void OctreePartitioner::update_light(Light& light) {
+    if(light.type() == LIGHT_TYPE_DIRECTIONAL) {
+        if(lights_.find(light.id()) != lights_.end()) {
+            unlink_light(light.id());
+        }
+        directional_lights_.insert(light.id());
+        return;
+    }
+
+    directional_lights_.erase(light.id());
+
+    kmVec3 centre = light.absolute_position();
+    float radius = light.range();
+
+    std::map<LightID, Entry>::iterator it = lights_.find(light.id());
+    if(it != lights_.end()) {
+        Entry& entry = (*it).second;
+        if(fits_loose_bounds(nodes_[entry.node], centre, radius)) {
+            entry.centre = centre;
+            entry.radius = radius;
+            return;
+        }
+        unlink_light(light.id());
+    }
+
+    int32_t node = find_node(centre, radius);
+
+    Entry entry;
+    entry.node = node;
+    entry.index = nodes_[node].lights.size();
+    entry.centre = centre;
+    entry.radius = radius;
+
+    nodes_[node].lights.push_back(light.id());
+    lights_[light.id()] = entry;
+}
+
+void OctreePartitioner::unlink_mesh(MeshID mesh) {
+    Entry entry = meshes_[mesh];
+    Node& node = nodes_[entry.node];
+
+    //Swap the last mesh into the gap
+    MeshID last = node.meshes.back();
+    node.meshes[entry.index] = last;
+    node.mesh_x[entry.index] = node.mesh_x.back();
+    node.mesh_y[entry.index] = node.mesh_y.back();
+    node.mesh_z[entry.index] = node.mesh_z.back();
+    node.mesh_radius[entry.index] = node.mesh_radius.back();
+    node.mesh_plane_cache[entry.index] = node.mesh_plane_cache.back();
+    meshes_[last].index = entry.index;
+
+    node.meshes.pop_back();
+    node.mesh_x.pop_back();
+    node.mesh_y.pop_back();
+    node.mesh_z.pop_back();
+    node.mesh_radius.pop_back();
+    node.mesh_plane_cache.pop_back();
+
+    meshes_.erase(mesh);
+    release_empty_nodes(entry.node);
+}
+
+void OctreePartitioner::unlink_light(LightID light) {
+    Entry entry = lights_[light];
+    std::vector<LightID>& lights = nodes_[entry.node].lights;
+
+    LightID last = lights.back();
+    lights[entry.index] = last;
+    lights_[last].index = entry.index;
+    lights.pop_back();
+
+    lights_.erase(light);
+    release_empty_nodes(entry.node);
+}
+
+void OctreePartitioner::collect_meshes(int32_t node, std::vector<MeshID>& result) {
+    const Node& current = nodes_[node];
+    result.insert(result.end(), current.meshes.begin(), current.meshes.end());
+
+    for(uint32_t i = 0; i < 8; ++i) {
+        if(current.children[i] >= 0) {
+            collect_meshes(current.children[i], result);
+        }
+    }
+}
+
+uint32_t OctreePartitioner::depth_of(MeshID mesh) {
+    update_pending();
+    return nodes_[meshes_.at(mesh).node].depth;
+}
+
+void OctreePartitioner::meshes_visible_from(const Camera& camera, std::vector<MeshID>& out) {
+    update_pending();
+
+    out.clear();
+
+    const Frustum& frustum = camera.frustum();
+    if(!frustum.initialized()) {
+        collect_meshes(0, out);
+        std::sort(out.begin(), out.end());
+        return;
+    }
+
+    //Walk the cells first. Anything in a cell that's entirely inside the frustum is
+    //visible straight away, cells that cross a plane have their meshes culled afterwards
+    partial_nodes_.clear();
+    uint32_t partial_meshes = 0;
+
+    cull_stack_.clear();
+    cull_stack_.push_back(std::make_pair(0, FRUSTUM_ALL_PLANES));
+
+    while(!cull_stack_.empty()) {
+        int32_t idx = cull_stack_.back().first;
+        uint8_t planes = cull_stack_.back().second;
+        cull_stack_.pop_back();
+
+        Node& node = nodes_[idx];
+        if(node.depth) {
+            uint8_t inside = 0;
+            if(frustum.classify_aabb(loose_bounds(node), planes, inside) == FRUSTUM_CLASSIFICATION_OUTSIDE) {
+                continue;
+            }
+
+            //Nothing in this cell can be outside a plane the cell is inside
+            planes &= ~inside;
+            if(!planes) {
+                collect_meshes(idx, out);
+                continue;
+            }
+        }
+
+        if(!node.meshes.empty()) {
+            partial_nodes_.push_back(std::make_pair(idx, planes));
+            partial_meshes += node.meshes.size();
+        }
+
+        for(uint32_t i = 0; i < 8; ++i) {
+            if(node.children[i] >= 0) {
+                cull_stack_.push_back(std::make_pair(node.children[i], planes));
+            }
+        }
+    }
+
+    //Split the cells into chunks of roughly CULL_GRAIN meshes. Each cell is only in
+    //one chunk, so the chunks can update their cells' plane caches without locking
+    uint32_t node_count = partial_nodes_.size();
+    uint32_t grain = std::max(uint32_t(1), uint32_t(uint64_t(node_count) * CULL_GRAIN / std::max(partial_meshes, uint32_t(1))));
+    std::vector<CullChunk>& chunks = cull_chunks(JobSystem::chunk_count(node_count, grain));
+
+    jobs().parallel_for(node_count, grain, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        CullChunk& scratch = chunks[chunk];
+
+        for(uint32_t i = begin; i < end; ++i) {
+            Node& node = nodes_[partial_nodes_[i].first];
+            uint32_t count = node.meshes.size();
+
+            SphereArrays spheres = { &node.mesh_x[0], &node.mesh_y[0], &node.mesh_z[0], &node.mesh_radius[0] };
+            scratch.visibility.resize((count + 31) / 32);
+            frustum.cull_spheres(spheres, count, &scratch.visibility[0], nullptr, &node.mesh_plane_cache[0], partial_nodes_[i].second);
+
+            for(uint32_t j = 0; j < count; ++j) {
+                if(scratch.visibility[j >> 5] & (1u << (j & 31))) {
+                    scratch.visible.push_back(node.meshes[j]);
+                }
+            }
+        }
+    });
+
+    merge_cull_chunks(out);
+}
+
+void OctreePartitioner::lights_within_range(const kmVec3& location, std::vector<LightID>& out) {
+    update_pending();
+
+    start_light_query();
+    for(LightID light_id: directional_lights_) {
+        add_light_in_range(light_id, 0.0f);
+    }
+
+    //Any light that reaches the location must be in a cell whose loose bounds contain it
+    stack_.clear();
+    stack_.push_back(0);
+
+    while(!stack_.empty()) {
+        int32_t idx = stack_.back();
+        stack_.pop_back();
+
+        const Node& node = nodes_[idx];
+        if(node.depth && !loose_bounds(node).contains_point(location)) {
+            continue;
+        }
+
+        for(LightID light_id: node.lights) {
+            const Entry& entry = (*lights_.find(light_id)).second;
+
+            kmVec3 diff;
+            kmVec3Subtract(&diff, &location, &entry.centre);
+            float dist = kmVec3Length(&diff);
+            if(dist <= entry.radius) {
+                add_light_in_range(light_id, dist);
+            }
+        }
+
+        for(uint32_t i = 0; i < 8; ++i) {
+            if(node.children[i] >= 0) {
+                stack_.push_back(node.children[i]);
+            }
+        }
+    }
+
+    finish_light_query(out);
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef OCTREE_PARTITIONER_H
+#define OCTREE_PARTITIONER_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "../mesh.h"
+#include "../light.h"
+
+#include "../partitioner.h"
+
+namespace kglt {
+
+/*
+ *  A loose octree partitioner for large, open scenes.
+ *
+ *  Every cell's bounds are loosened to twice its size, so an object can be filed by its
+ *  centre alone, at the depth where its bounding sphere fits. Moving objects only need
+ *  to be re-inserted once they leave their loose cell, which is rare for small moves.
+ *
+ *  Mesh bounds are taken from Mesh::aabb() (offset by the mesh's absolute position) and
+ *  lights are filed as spheres of their range, directional lights reach everywhere.
+ *
+ *  add() and relocate() are cheap, they queue the object and its bounds are recalculated
+ *  the next time the tree is queried. This means a mesh can be created and filled with
+ *  vertices in the same frame without the tree seeing the empty mesh.
+ */
+class OctreePartitioner : public Partitioner {
+public:
+    typedef std::tr1::shared_ptr<OctreePartitioner> ptr;
+
+    OctreePartitioner(Scene& scene, float world_size=8192.0, uint32_t max_depth=8);
+
+    void add(Mesh& obj);
+    void remove(Mesh& obj);
+    void relocate(Mesh& obj);
+
+    void add(Light& obj);
+    void remove(Light& obj);
+    void relocate(Light& obj);
+
+    void lights_within_range(const kmVec3& location, std::vector<LightID>& out);
+    void meshes_visible_from(const Camera& camera, std::vector<MeshID>& out);
+
+    uint32_t node_count() const { return nodes_.size() - free_nodes_.size(); }
+    uint32_t depth_of(MeshID mesh); ///< Returns the depth of the cell holding the mesh (0 is the root)
+
+private:
+    struct Node {
+        kmVec3 centre;
+        float half_size; ///< Half the size of the cell, the loose bounds are twice this
+        uint32_t depth;
+
+        int32_t parent;
+        int32_t children[8];
+        uint32_t child_count;
+
+        std::vector<MeshID> meshes;
+        std::vector<LightID> lights;
+
+        //Mesh bounding spheres, parallel to meshes, for Frustum::cull_spheres
+        std::vector<float> mesh_x;
+        std::vector<float> mesh_y;
+        std::vector<float> mesh_z;
+        std::vector<float> mesh_radius;
+        std::vector<uint8_t> mesh_plane_cache;
+    };
+
+    struct Entry {
+        int32_t node;
+        uint32_t index; ///< Position in the node's mesh/light list
+        kmVec3 centre;
+        float radius;
+    };
+
+    uint32_t max_depth_;
+
+    std::vector<Node> nodes_; ///< Node 0 is the root, and holds anything too big (or too far away) for the tree
+    std::vector<int32_t> free_nodes_;
+    std::vector<int32_t> stack_;
+    std::vector<std::pair<int32_t, uint8_t> > cull_stack_; ///< Nodes to visit, with the frustum planes they still need testing against
+    std::vector<std::pair<int32_t, uint8_t> > partial_nodes_; ///< Cells that cross the frustum, with the planes they cross
+
+    std::map<MeshID, Entry> meshes_;
+    std::map<LightID, Entry> lights_;
+    std::set<LightID> directional_lights_;
+
+    //Sorted and deduplicated by update_pending(), vectors so they keep their capacity
+    std::vector<MeshID> pending_meshes_;
+    std::vector<LightID> pending_lights_;
+
+    int32_t new_node(int32_t parent, uint32_t octant);
+    void release_empty_nodes(int32_t node);
+
+    int32_t find_node(const kmVec3& centre, float radius);
+    bool fits_loose_bounds(const Node& node, const kmVec3& centre, float radius) const;
+    AABB loose_bounds(const Node& node) const;
+
+    void update_pending();
+    void update_mesh(Mesh& mesh);
+    void update_light(Light& light);
+
+    void set_mesh_bounds(Node& node, uint32_t index, const kmVec3& centre, float radius);
+    void unlink_mesh(MeshID mesh);
+    void unlink_light(LightID light);
+
+    void collect_meshes(int32_t node, std::vector<MeshID>& result);
+};
+
+}
+
+#endif // OCTREE_PARTITIONER_H
@@ -0,0 +1,295 @@
+#include <cmath>
+#include <algorithm>
+
+#include "../scene.h"
+#include "../camera.h"
+#include "../job_system.h"
+#include "spatial_hash_partitioner.h"
+
+namespace kglt {
+
+static bool overlaps_rectangle(const AABB& bounds, float left, float bottom, float right, float top) {
+    return bounds.max.x >= left && bounds.min.x <= right &&
+           bounds.max.y >= bottom && bounds.min.y <= top;
+}
+
+SpatialHashPartitioner::SpatialHashPartitioner(Scene& scene, float cell_size):
+    Partitioner(scene),
+    cell_size_(cell_size),
+    query_counter_(0) {
+
+    assert(cell_size_ > 0);
+}
+
+SpatialHashPartitioner::CellRange SpatialHashPartitioner::cells_for(const AABB& bounds) const {
+    CellRange result;
+    result.left = int32_t(floor(bounds.min.x / cell_size_));
+    result.bottom = int32_t(floor(bounds.min.y / cell_size_));
+    result.right = int32_t(floor(bounds.max.x / cell_size_));
+    result.top = int32_t(floor(bounds.max.y / cell_size_));
+    return result;
+}
+
+template<typename ID>
+void SpatialHashPartitioner::insert(std::tr1::unordered_map<ID, Entry>& entries, std::set<ID>& oversized, std::vector<ID> Cell::*list, ID id, const AABB& bounds) {
+    Entry entry;
+    entry.bounds = bounds;
+    entry.cells = cells_for(bounds);
+    entry.oversized = entry.cells.cell_count() > MAX_CELLS_PER_OBJECT;
+    entry.query = 0;
+
+    if(entry.oversized) {
+        oversized.insert(id);
+    } else {
+        for(int32_t x = entry.cells.left; x <= entry.cells.right; ++x) {
+            for(int32_t y = entry.cells.bottom; y <= entry.cells.top; ++y) {
+                (cells_[key(x, y)].*list).push_back(id);
+            }
+        }
+    }
+
+    entries[id] = entry;
+}
+
+template<typename ID>
+void SpatialHashPartitioner::erase(std::tr1::unordered_map<ID, Entry>& entries, std::set<ID>& oversized, std::vector<ID> Cell::*list, ID id) {
+    typename std::tr1::unordered_map<ID, Entry>::iterator it = entries.find(id);
+    if(it == entries.end()) {
+        return;
+    }
+
+    const Entry& entry = (*it).second;
+    if(entry.oversized) {
+        oversized.erase(id);
+    } else {
+        for(int32_t x = entry.cells.left; x <= entry.cells.right; ++x) {
+            for(int32_t y = entry.cells.bottom; y <= entry.cells.top; ++y) {
+                CellMap::iterator cell = cells_.find(key(x, y));
+                assert(cell != cells_.end());
+
+                std::vector<ID>& ids = (*cell).second.*list;
+                typename std::vector<ID>::iterator found = std::find(ids.begin(), ids.end(), id);
+                *found = ids.back();
+                ids.pop_back();
+
+                //Don't keep empty cells around, the grid is sparse
+                if((*cell).second.meshes.empty() && (*cell).second.lights.empty()) {
+                    cells_.erase(cell);
+                }
+            }
+        }
+    }
+
+    entries.erase(it);
+}
+
+AABB SpatialHashPartitioner::light_bounds(Light& light) const {
+    const kmVec3& position = light.absolute_position();
+    float range = light.range();
+
+    AABB result;
+    kmVec3Fill(&result.min, position.x - range, position.y - range, position.z - range);
+    kmVec3Fill(&result.max, position.x + range, position.y + range, position.z + range);
+    return result;
+}
+
+void SpatialHashPartitioner::add(Mesh& obj) {
+    insert(meshes_, oversized_meshes_, &Cell::meshes, obj.id(), obj.absolute_aabb());
+}
+
+void SpatialHashPartitioner::remove(Mesh& obj) {
+    erase(meshes_, oversized_meshes_, &Cell::meshes, obj.id());
+}
+
+void SpatialHashPartitioner::relocate(Mesh& obj) {
+    std::tr1::unordered_map<MeshID, Entry>::iterator it = meshes_.find(obj.id());
+    if(it == meshes_.end()) {
+        add(obj);
+        return;
+    }
+
+    AABB bounds = obj.absolute_aabb();
+    if(cells_for(bounds) == (*it).second.cells) {
+        //Same cells as before, nothing to move
+        (*it).second.bounds = bounds;
+        return;
+    }
+
+    remove(obj);
+    add(obj);
+}
+
+void SpatialHashPartitioner::add(Light& obj) {
+    if(obj.type() == LIGHT_TYPE_DIRECTIONAL) {
+        directional_lights_.insert(obj.id());
+        return;
+    }
+
+    insert(lights_, oversized_lights_, &Cell::lights, obj.id(), light_bounds(obj));
+}
+
+void SpatialHashPartitioner::remove(Light& obj) {
+    directional_lights_.erase(obj.id());
+    erase(lights_, oversized_lights_, &Cell::lights, obj.id());
+}
+
+void SpatialHashPartitioner::relocate(Light& obj) {
+    std::tr1::unordered_map<LightID, Entry>::iterator it = lights_.find(obj.id());
+    if(it != lights_.end() && obj.type() != LIGHT_TYPE_DIRECTIONAL) {
+        AABB bounds = light_bounds(obj);
+        if(cells_for(bounds) == (*it).second.cells) {
+            (*it).second.bounds = bounds;
+            return;
+        }
+    }
+
+    remove(obj);
+    add(obj);
+}
+
+std::vector<MeshID> SpatialHashPartitioner::meshes_in_rectangle(float left, float bottom, float right, float top) {
+    std::vector<MeshID> result;
+    gather_rectangle(left, bottom, right, top, result);
+    return result;
+}
+
+void SpatialHashPartitioner::gather_rectangle(float left, float bottom, float right, float top, std::vector<MeshID>& result) {
+    ++query_counter_;
+
+    auto check_mesh = [&](MeshID mesh_id) {
+        Entry& entry = (*meshes_.find(mesh_id)).second;
+        if(entry.query == query_counter_) {
+            return;
+        }
+        entry.query = query_counter_;
+
+        if(overlaps_rectangle(entry.bounds, left, bottom, right, top)) {
+            result.push_back(mesh_id);
+        }
+    };
+
+    AABB area;
+    kmVec3Fill(&area.min, left, bottom, 0);
+    kmVec3Fill(&area.max, right, top, 0);
+    CellRange range = cells_for(area);
+
+    if(range.cell_count() > cells_.size()) {
+        //Zoomed right out, it's quicker to go through the occupied cells
+        for(CellMap::value_type& cell: cells_) {
+            int32_t x = int32_t(cell.first >> 32);
+            int32_t y = int32_t(cell.first & 0xFFFFFFFF);
+            if(x < range.left || x > range.right || y < range.bottom || y > range.top) {
+                continue;
+            }
+
+            std::for_each(cell.second.meshes.begin(), cell.second.meshes.end(), check_mesh);
+        }
+    } else {
+        for(int32_t x = range.left; x <= range.right; ++x) {
+            for(int32_t y = range.bottom; y <= range.top; ++y) {
+                CellMap::iterator cell = cells_.find(key(x, y));
+                if(cell != cells_.end()) {
+                    std::for_each((*cell).second.meshes.begin(), (*cell).second.meshes.end(), check_mesh);
+                }
+            }
+        }
+    }
+
+    std::for_each(oversized_meshes_.begin(), oversized_meshes_.end(), check_mesh);
+}
+
+void SpatialHashPartitioner::meshes_visible_from(const Camera& camera, std::vector<MeshID>& out) {
+    out.clear();
+
+    const Frustum& frustum = camera.frustum();
+    if(!frustum.initialized()) {
+        for(std::pair<MeshID, Entry> p: meshes_) {
+            out.push_back(p.first);
+        }
+        std::sort(out.begin(), out.end());
+        return;
+    }
+
+    //Find the area of the plane covered by the frustum, then check each mesh properly
+    const kmVec3& first = frustum.near_corner(FRUSTUM_CORNER_BOTTOM_LEFT);
+    float left = first.x, right = first.x;
+    float bottom = first.y, top = first.y;
+
+    for(uint32_t i = 0; i < FRUSTUM_CORNER_MAX; ++i) {
+        const kmVec3& near_corner = frustum.near_corner(FrustumCorner(i));
+        const kmVec3& far_corner = frustum.far_corner(FrustumCorner(i));
+
+        left = std::min(left, std::min(near_corner.x, far_corner.x));
+        right = std::max(right, std::max(near_corner.x, far_corner.x));
+        bottom = std::min(bottom, std::min(near_corner.y, far_corner.y));
+        top = std::max(top, std::max(near_corner.y, far_corner.y));
+    }
+
+    candidates_.clear();
+    gather_rectangle(left, bottom, right, top, candidates_);
+
+    uint32_t count = candidates_.size();
+    if(!count) {
+        return;
+    }
+
+    min_x_.resize(count); min_y_.resize(count); min_z_.resize(count);
+    max_x_.resize(count); max_y_.resize(count); max_z_.resize(count);
+    visibility_.resize((count + 31) / 32);
+
+    //CULL_GRAIN is a multiple of 32, so every chunk has its own words of visibility_
+    std::vector<CullChunk>& chunks = cull_chunks(JobSystem::chunk_count(count, CULL_GRAIN));
+
+    jobs().parallel_for(count, CULL_GRAIN, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        for(uint32_t i = begin; i < end; ++i) {
+            const AABB& bounds = (*meshes_.find(candidates_[i])).second.bounds;
+            min_x_[i] = bounds.min.x; min_y_[i] = bounds.min.y; min_z_[i] = bounds.min.z;
+            max_x_[i] = bounds.max.x; max_y_[i] = bounds.max.y; max_z_[i] = bounds.max.z;
+        }
+
+        AABBArrays boxes = { &min_x_[begin], &min_y_[begin], &min_z_[begin], &max_x_[begin], &max_y_[begin], &max_z_[begin] };
+        frustum.cull_aabbs(boxes, end - begin, &visibility_[begin / 32]);
+
+        CullChunk& scratch = chunks[chunk];
+        for(uint32_t i = begin; i < end; ++i) {
+            uint32_t bit = i - begin;
+            if(visibility_[(begin / 32) + (bit >> 5)] & (1u << (bit & 31))) {
+                scratch.visible.push_back(candidates_[i]);
+            }
+        }
+    });
+
+    merge_cull_chunks(out);
+}
+
+void SpatialHashPartitioner::lights_within_range(const kmVec3& location, std::vector<LightID>& out) {
+    start_light_query();
+    for(LightID light_id: directional_lights_) {
+        add_light_in_range(light_id, 0.0f);
+    }
+
+    auto check_light = [&](LightID light_id) {
+        Light& light = scene().light(light_id);
+
+        kmVec3 diff;
+        kmVec3Subtract(&diff, &location, &light.absolute_position());
+        float dist = kmVec3Length(&diff);
+        if(dist <= light.range()) {
+            add_light_in_range(light_id, dist);
+        }
+    };
+
+    //Lights are registered in every cell they reach, so only one cell needs checking
+    int32_t x = int32_t(floor(location.x / cell_size_));
+    int32_t y = int32_t(floor(location.y / cell_size_));
+
+    CellMap::iterator cell = cells_.find(key(x, y));
+    if(cell != cells_.end()) {
+        std::for_each((*cell).second.lights.begin(), (*cell).second.lights.end(), check_light);
+    }
+    std::for_each(oversized_lights_.begin(), oversized_lights_.end(), check_light);
+
+    finish_light_query(out);
+}
+
+}
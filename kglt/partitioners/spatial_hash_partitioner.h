@@ -0,0 +1,113 @@
+#ifndef SPATIAL_HASH_PARTITIONER_H
+#define SPATIAL_HASH_PARTITIONER_H
+
+#include <set>
+#include <vector>
+#include <tr1/unordered_map>
+
+#include "../mesh.h"
+#include "../light.h"
+
+#include "../partitioner.h"
+
+namespace kglt {
+
+/*
+ *  A uniform grid over the XY plane, for 2D scenes with lots of sprites.
+ *
+ *  Each object is registered in every cell its bounds overlap (Z is ignored) and the
+ *  cells are stored sparsely in a hash, so the world can be any size. Relocating an
+ *  object that stays in the same cells is just a bounds update, otherwise only the
+ *  cells it left or entered are touched.
+ *
+ *  Pick a cell size around the size of a typical sprite. Objects that would cover
+ *  too many cells (e.g. a level background) are kept in a separate list that's
+ *  checked by every query.
+ */
+class SpatialHashPartitioner : public Partitioner {
+public:
+    typedef std::tr1::shared_ptr<SpatialHashPartitioner> ptr;
+
+    SpatialHashPartitioner(Scene& scene, float cell_size=1.0);
+
+    void add(Mesh& obj);
+    void remove(Mesh& obj);
+    void relocate(Mesh& obj);
+
+    void add(Light& obj);
+    void remove(Light& obj);
+    void relocate(Light& obj);
+
+    void lights_within_range(const kmVec3& location, std::vector<LightID>& out);
+    void meshes_visible_from(const Camera& camera, std::vector<MeshID>& out);
+
+    std::vector<MeshID> meshes_in_rectangle(float left, float bottom, float right, float top);
+
+    float cell_size() const { return cell_size_; }
+    uint32_t cell_count() const { return cells_.size(); }
+
+private:
+    static const uint32_t MAX_CELLS_PER_OBJECT = 64;
+
+    struct CellRange {
+        int32_t left;
+        int32_t bottom;
+        int32_t right;
+        int32_t top;
+
+        bool operator==(const CellRange& rhs) const {
+            return left == rhs.left && bottom == rhs.bottom && right == rhs.right && top == rhs.top;
+        }
+
+        uint64_t cell_count() const { return uint64_t(int64_t(right) - left + 1) * uint64_t(int64_t(top) - bottom + 1); }
+    };
+
+    struct Entry {
+        AABB bounds;
+        CellRange cells;
+        bool oversized; ///< Too big for the grid, checked by every query
+        uint32_t query; ///< Stops objects that span several cells being returned twice
+    };
+
+    struct Cell {
+        std::vector<MeshID> meshes;
+        std::vector<LightID> lights;
+    };
+
+    typedef std::tr1::unordered_map<uint64_t, Cell> CellMap;
+
+    float cell_size_;
+    CellMap cells_;
+
+    std::tr1::unordered_map<MeshID, Entry> meshes_;
+    std::tr1::unordered_map<LightID, Entry> lights_;
+    std::set<MeshID> oversized_meshes_;
+    std::set<LightID> oversized_lights_;
+    std::set<LightID> directional_lights_;
+
+    uint32_t query_counter_;
+
+    //Scratch space for culling candidates with Frustum::cull_aabbs
+    std::vector<MeshID> candidates_;
+    std::vector<float> min_x_, min_y_, min_z_, max_x_, max_y_, max_z_;
+    std::vector<uint32_t> visibility_;
+
+    uint64_t key(int32_t x, int32_t y) const {
+        return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y));
+    }
+
+    CellRange cells_for(const AABB& bounds) const;
+    void gather_rectangle(float left, float bottom, float right, float top, std::vector<MeshID>& result);
+
+    template<typename ID>
+    void insert(std::tr1::unordered_map<ID, Entry>& entries, std::set<ID>& oversized, std::vector<ID> Cell::*list, ID id, const AABB& bounds);
+
+    template<typename ID>
+    void erase(std::tr1::unordered_map<ID, Entry>& entries, std::set<ID>& oversized, std::vector<ID> Cell::*list, ID id);
+
+    AABB light_bounds(Light& light) const;
+};
+
+}
+
+#endif // SPATIAL_HASH_PARTITIONER_H
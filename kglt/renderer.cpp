@@ -1,18 +1,40 @@
 #include "renderer.h"
 #include "scene.h"
+#include "frame_packet.h"
 #include "window_base.h"
 
 namespace kglt {
-	
-void BaseRenderer::render(Scene& scene) {
-    on_start_render(scene);
+
+void BaseRenderer::prepare(Scene& scene, const Pass& pass, FramePacket& packet) {
+    scene_ = &scene;
+    packet_ = &packet;
+
+    const SceneSnapshot& snapshot = scene.snapshot();
+
+    packet.passes.push_back(PassPacket(pass));
+    packet.passes.back().options = snapshot.render_options;
+    packet.passes.back().first_item = packet.items.size();
 
     //FIXME: This is ugly and inconsistent
-    scene.active_camera().apply(&modelview().top());
-    kmMat4Assign(&projection().top(), &scene.active_camera().projection_matrix());
+    Camera& camera = scene.camera(snapshot.camera);
+    kmMat4Assign(&modelview().top(), &camera.camera_state().view_matrix);
+    kmMat4Assign(&projection().top(), &camera.camera_state().projection_matrix);
+    camera_position_ = camera.render_state().absolute_position;
+    camera_near_ = camera.camera_state().near_distance;
+
+    for(Object* object_ptr: snapshot.order.objects()) {
+        Object& object = *object_ptr;
+
+        //Submeshes go wherever their parent goes, child meshes have their own bounds
+        //so they are culled separately
+        Mesh* mesh = dynamic_cast<Mesh*>(&object);
+        if(mesh) {
+            MeshID mesh_id = mesh->mesh_state().cull_id;
+            if(mesh_id && !snapshot.queries.is_visible(mesh_id)) {
+                continue;
+            }
+        }
 
-    for(Scene::iterator it = scene.begin(); it != scene.end(); ++it) {
-        Object& object = static_cast<Object&>(*it);
         if(pre_visit(object)) {
             (*this)(object);
             post_visit(object);
@@ -24,15 +46,14 @@ void BaseRenderer::render(Scene& scene) {
     kmMat4Identity(&projection().top());
 
     /*
-      Once the entire scene has been rendered, it's time to handle the
+      Once the entire scene has been recorded, it's time to handle the
       overlays.
     */
-    for(uint32_t i = 0; i < scene.overlay_count(); ++i) {
-        Overlay& overlay = scene.overlay_ordered_by_zindex(i);
+    for(Overlay* overlay_ptr: snapshot.overlays) {
         projection().push();
 
-        for(Scene::iterator it = overlay.begin(); it != overlay.end(); ++it) {
-            Object& object = static_cast<Object&>(*it);
+        for(Object* object_ptr: overlay_ptr->published_order().objects()) {
+            Object& object = *object_ptr;
             if(pre_visit(object)) {
                 (*this)(object);
                 post_visit(object);
@@ -41,16 +62,156 @@ void BaseRenderer::render(Scene& scene) {
         projection().pop();
     }
 
+    packet.passes.back().item_count = packet.items.size() - packet.passes.back().first_item;
+
+    scene_ = nullptr;
+    packet_ = nullptr;
+}
+
+void BaseRenderer::render(Scene& scene, const FramePacket& packet, const PassPacket& pass) {
+    on_start_render(scene);
+
+    for(uint32_t i = pass.first_item; i < pass.first_item + pass.item_count; ++i) {
+        const RenderItem& item = packet.items[i];
+        if(item.type == RENDER_ITEM_MESH) {
+            draw_mesh(scene, packet, item);
+        } else {
+            draw_text(scene, packet, item);
+        }
+    }
+
     on_finish_render(scene);
 }
 
+void BaseRenderer::record_mesh(Mesh& mesh) {
+    Scene& scene = *scene_;
+    FramePacket& packet = *packet_;
+    const Mesh::MeshRenderState& state = mesh.mesh_state();
+
+    packet.items.push_back(RenderItem());
+    RenderItem& item = packet.items.back();
+    item.type = RENDER_ITEM_MESH;
+    kmMat4Assign(&item.modelview, &modelview().top());
+    kmMat4Assign(&item.projection, &projection().top());
+
+    item.mesh_id = state.id;
+    item.uuid = mesh.uuid();
+    item.buffer = mesh._geometry_buffer();
+    item.geometry = state.geometry;
+    item.geometry_version = state.geometry_version;
+    item.arrangement = state.arrangement;
+    item.draw_count = state.draw_count;
+
+    //If the camera is inside the bounds, or close enough for the near plane to cut them, an
+    //occlusion test box would be clipped. The box is drawn in the mesh's space, so test there
+    item.bounds = state.bounds;
+    kmMat4 to_local;
+    kmMat4Inverse(&to_local, &mesh.render_state().world_matrix);
+    kmVec3 camera_pos;
+    kmVec3Transform(&camera_pos, &camera_position_, &to_local);
+
+    AABB near_bounds = item.bounds;
+    kmVec3 margin;
+    kmVec3Fill(&margin, camera_near_, camera_near_, camera_near_);
+    kmVec3Subtract(&near_bounds.min, &near_bounds.min, &margin);
+    kmVec3Add(&near_bounds.max, &near_bounds.max, &margin);
+    item.camera_inside_bounds = near_bounds.contains_point(camera_pos);
+
+    item.depth_test = state.depth_test;
+    item.depth_writes = state.depth_writes;
+    item.occlusion_culling = state.occlusion_culling;
+
+    MaterialID material_id = state.material;
+    if(material_id == 0) {
+        //No material was specified so fallback to the default
+        material_id = scene.default_material();
+    }
+
+    const std::vector<Material::PassState>& passes = scene.material(material_id).pass_states();
+
+    item.first_pass = packet.material_passes.size();
+    item.pass_count = passes.size();
+    for(const Material::PassState& pass: passes) {
+        MaterialPassState recorded;
+        recorded.shader = (pass.shader != 0) ? pass.shader : scene.default_shader();
+        recorded.iteration = pass.iteration;
+        recorded.max_iterations = pass.max_iterations;
+        recorded.first_texture = packet.textures.size();
+        recorded.texture_count = pass.textures.size();
+        packet.textures.insert(packet.textures.end(), pass.textures.begin(), pass.textures.end());
+
+        packet.material_passes.push_back(recorded);
+    }
+
+    //Every pass uses the same lights, the scene found them when it published the frame
+    item.first_light = packet.lights.size();
+    item.light_count = 0;
+    if(lights_) {
+        LightSpan lights = scene.snapshot().queries.lights_of(state.cull_id);
+        for(uint32_t i = 0; i < lights.size(); ++i) {
+            packet.lights.push_back(scene.light(lights[i]).light_state());
+        }
+        item.light_count = lights.size();
+    }
+}
+
+void BaseRenderer::record_text(Text& text) {
+    FramePacket& packet = *packet_;
+    const Text::TextRenderState& state = text.text_state();
+
+    if(!state.font) {
+        return; //Nothing to draw it with
+    }
+
+    packet.items.push_back(RenderItem());
+    RenderItem& item = packet.items.back();
+    item.type = RENDER_ITEM_TEXT;
+    kmMat4Assign(&item.modelview, &modelview().top());
+    kmMat4Assign(&item.projection, &projection().top());
+
+    item.font = state.font;
+    item.font_size = state.font_size;
+    item.first_char = packet.text.size();
+    packet.text += state.text;
+    item.char_count = packet.text.size() - item.first_char;
+    packet.text += '\0'; //So the renderer can draw it straight from the packet
+}
+
+void BaseRenderer::visit(Background& background) {
+    /*
+     *  We store the current projection matrix, then manipulate it so that the correct part
+     *  of the background fills the screen. Finally we record the background layers in order
+     *  and restore the projection.
+     */
+    const Background::BackgroundRenderState& state = background.background_state();
+
+    projection().push();
+
+    kmMat4 new_proj;
+    kmMat4OrthographicProjection(
+                &new_proj, -state.visible_x / 2.0,
+                state.visible_x / 2.0,
+                -state.visible_y / 2.0,
+                state.visible_y / 2.0, -1.0, 1.0
+    );
+
+    kmMat4Assign(&projection().top(), &new_proj);
+
+    for(MeshID layer: state.layers) {
+        record_mesh(background.scene().mesh(layer));
+    }
+
+    projection().pop();
+}
+
 bool BaseRenderer::pre_visit(Object& obj) {
+    if(!obj.render_state().visible) {
+        return false;
+    }
+
     modelview().push();
 
-    kmMat4 trans;
-    kmMat4Identity(&trans);
-    kmMat4Translation(&trans, obj.absolute_position().x, obj.absolute_position().y, obj.absolute_position().z);
-    kmMat4Multiply(&modelview().top(), &modelview().top(), &trans);
+    kmMat4Multiply(&modelview().top(), &modelview().top(), &obj.render_state().world_matrix);
 
     return true;
 }
@@ -11,6 +11,7 @@
 #include "mesh.h"
 #include "background.h"
 #include "overlay.h"
+#include "partitioner.h"
 
 namespace kglt {
 	
@@ -18,31 +19,52 @@ struct RenderOptions {
     bool wireframe_enabled;
     bool texture_enabled;
     bool backface_culling_enabled;
+    bool occlusion_culling_enabled;
     uint8_t point_size;
 };
 
+class Pass;
+class FramePacket;
+struct PassPacket;
+struct RenderItem;
+
+/*
+ *  Rendering happens in two halves. prepare() walks what the scene last published (see
+ *  Scene::publish_frame()) and records what to draw into a FramePacket. It reads nothing
+ *  but published state, so with threaded rendering it runs on the render thread while
+ *  the game thread updates the live scene. render() runs on the GL thread and draws the
+ *  recorded items with draw_mesh() and draw_text(), looking at nothing in the scene but
+ *  resources.
+ *
+ *  The visit() methods do the recording, subclasses override them (or pre_visit()) to
+ *  leave things out.
+ */
 class BaseRenderer : public generic::Visitor<Object> {
 public:
     BaseRenderer(const RenderOptions& options=RenderOptions()):
-        options_(options) {
+        options_(options),
+        scene_(nullptr),
+        packet_(nullptr),
+        lights_(true) {
 
          Visits(*this, Loki::Seq<Object, Mesh, Text, Background, Overlay>::Type());
     }
 
     virtual ~BaseRenderer() {}
 
-    void render(Scene& scene);
+    void prepare(Scene& scene, const Pass& pass, FramePacket& packet);
+    void render(Scene& scene, const FramePacket& packet, const PassPacket& pass);
 
-    void set_options(RenderOptions& options) {
+    void set_options(const RenderOptions& options) {
         options_ = options;
     }
 
     virtual void visit(Object& object) {}
-    virtual void visit(Mesh& object) = 0;
-    virtual void visit(Text& object) = 0;
-    virtual void visit(Background& object) = 0;
+    virtual void visit(Mesh& mesh) { record_mesh(mesh); }
+    virtual void visit(Text& text) { record_text(text); }
+    virtual void visit(Background& background);
     virtual void visit(Overlay& overlay) {
-        kmMat4Assign(&projection().top(), &overlay.projection_matrix());
+        kmMat4Assign(&projection().top(), &overlay.overlay_state().projection_matrix);
     }
 
     virtual void _initialize(Scene& scene) {}
@@ -53,16 +75,31 @@ protected:
     MatrixStack& modelview() { return modelview_stack_; }
     MatrixStack& projection() { return projection_stack_; }
 
+    void record_mesh(Mesh& mesh); ///< Records the mesh's published state with the current modelview and projection
+    void record_text(Text& text);
+    void set_records_lights(bool value) { lights_ = value; } ///< Renderers that don't light anything can skip copying the lights
+
+    virtual void draw_mesh(Scene& scene, const FramePacket& packet, const RenderItem& item) = 0;
+    virtual void draw_text(Scene& scene, const FramePacket& packet, const RenderItem& item) {}
+
     virtual void on_start_render(Scene& scene) {}
     virtual void on_finish_render(Scene& scene) {}
     virtual bool pre_visit(Object& obj);
     virtual void post_visit(Object& object);
 
 private:
+    //Only used by render()
     RenderOptions options_;
 
+    //Only used by prepare()
     MatrixStack modelview_stack_;
     MatrixStack projection_stack_;
+
+    Scene* scene_;
+    FramePacket* packet_;
+    kmVec3 camera_position_;
+    float camera_near_;
+    bool lights_;
 };
 
 
@@ -6,21 +6,46 @@
 
 #include "kglt/scene.h"
 #include "kglt/renderer.h"
+#include "kglt/frame_packet.h"
 #include "kglt/mesh.h"
 #include "kglt/shader.h"
 #include "kglt/window.h"
 
 #include "../utils/gl_error.h"
+#include "../utils/gl_thread.h"
 
 namespace kglt {
 
 
 
-void GenericRenderer::_initialize(Scene& scene) {
+GenericRenderer::~GenericRenderer() {
+    std::vector<GLuint> queries;
+    for(std::pair<uint64_t, OcclusionQuery> p: occlusion_queries_) {
+        queries.push_back(p.second.query_id);
+    }
+
+    GLuint cube = unit_cube_vbo_;
 
+    occlusion_shader_.reset(); //Deletes its program on the GL thread itself
+
+    //Frame packets hold on to renderers, so the last one may go on the game thread
+    run_on_gl_thread([=]() {
+        for(GLuint query: queries) {
+            glDeleteQueries(1, &query);
+        }
+
+        if(cube) {
+            glDeleteBuffers(1, &cube);
+        }
+    });
 }
 
 void GenericRenderer::on_start_render(Scene& scene) {
+    ++frame_counter_;
+    if(options().occlusion_culling_enabled && (frame_counter_ % 60) == 0) {
+        purge_unused_occlusion_queries();
+    }
+
     glEnable(GL_TEXTURE_2D);
 
     if(options().wireframe_enabled) {
@@ -48,34 +73,38 @@ void GenericRenderer::on_start_render(Scene& scene) {
     assert(depth_bits > 0);
 }
 
-void GenericRenderer::visit(Text& text) {
-    KTuint kt_font = text.font().kt_font(); //Get the kaztext font ID
+void GenericRenderer::draw_text(Scene& scene, const FramePacket& packet, const RenderItem& item) {
+    KTuint kt_font = scene.font(item.font).kt_font(); //Get the kaztext font ID
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     ktBindFont(kt_font);
 
     float tmp[16];
-    for(int i = 0; i < 16; ++i) tmp[i] = (float) projection().top().mat[i];
+    for(int i = 0; i < 16; ++i) tmp[i] = (float) item.projection.mat[i];
     ktSetProjectionMatrix(tmp);
 
-    for(int i = 0; i < 16; ++i) tmp[i] = (float) modelview().top().mat[i];
+    for(int i = 0; i < 16; ++i) tmp[i] = (float) item.modelview.mat[i];
     ktSetModelviewMatrix(tmp);
 
-    ktDrawText(0, (text.font().size() * 0.25) , text.text().c_str());
+    //Each run is NUL terminated in the packet, so this doesn't need a copy
+    ktDrawText(0, (item.font_size * 0.25), &packet.text[item.first_char]);
 
     check_and_log_error(__FILE__, __LINE__);
 }
 
 void GenericRenderer::set_auto_uniforms_on_shader(
     ShaderProgram& s,
-    Scene& scene,
-    const std::vector<LightID>& lights_within_range,
+    const FramePacket& packet,
+    const RenderItem& item,
     uint32_t iteration) {
 
     //Calculate the modelview-projection matrix
     kmMat4 modelview_projection;
-    kmMat4Multiply(&modelview_projection, &projection().top(), &modelview().top());
+    kmMat4Multiply(&modelview_projection, &item.projection, &item.modelview);
+
+    //One of the lights that were in range when the item was recorded
+    const LightState* light = (iteration < item.light_count) ? &packet.lights[item.first_light + iteration] : nullptr;
 
     if(s.params().uses_auto(SP_AUTO_MODELVIEW_PROJECTION_MATRIX)) {
         s.params().set_mat4x4(
@@ -87,14 +116,14 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_MODELVIEW_MATRIX)) {
         s.params().set_mat4x4(
             s.params().auto_uniform_variable_name(SP_AUTO_MODELVIEW_MATRIX),
-            modelview().top()
+            item.modelview
         );
     }
 
     if(s.params().uses_auto(SP_AUTO_PROJECTION_MATRIX)) {
         s.params().set_mat4x4(
             s.params().auto_uniform_variable_name(SP_AUTO_PROJECTION_MATRIX),
-            projection().top()
+            item.projection
         );
     }
 
@@ -103,8 +132,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
         //passing to the shader
         kmVec3 light_pos;
         kmVec3Fill(&light_pos, 0, 0, 0);
-        if(iteration < lights_within_range.size()) {
-            light_pos = scene.light(lights_within_range.at(iteration)).position();
+        if(light) {
+            light_pos = light->position;
         }
 
         kmVec3Transform(&light_pos, &light_pos, &modelview_projection);
@@ -117,8 +146,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
 
     if(s.params().uses_auto(SP_AUTO_LIGHT_AMBIENT)) {
         kglt::Colour ambient(0, 0, 0, 1);
-        if(iteration < lights_within_range.size()) {
-            ambient = scene.light(lights_within_range.at(iteration)).ambient();
+        if(light) {
+            ambient = light->ambient;
         }
         s.params().set_colour(
             s.params().auto_uniform_variable_name(SP_AUTO_LIGHT_AMBIENT),
@@ -129,8 +158,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_LIGHT_DIFFUSE)) {
         kglt::Colour diffuse(0, 0, 0, 1);
 
-        if(iteration < lights_within_range.size()) {
-            diffuse = scene.light(lights_within_range.at(iteration)).diffuse();
+        if(light) {
+            diffuse = light->diffuse;
         }
 
         s.params().set_colour(
@@ -142,8 +171,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_LIGHT_SPECULAR)) {
         kglt::Colour specular(0, 0, 0, 1);
 
-        if(iteration < lights_within_range.size()) {
-            specular = scene.light(lights_within_range.at(iteration)).specular();
+        if(light) {
+            specular = light->specular;
         }
 
         s.params().set_colour(
@@ -155,8 +184,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_LIGHT_CONSTANT_ATTENUATION)) {
         float constant_attenuation = 1.0;
 
-        if(iteration < lights_within_range.size()) {
-            constant_attenuation = scene.light(lights_within_range.at(iteration)).constant_attenuation();
+        if(light) {
+            constant_attenuation = light->constant_attenuation;
         }
 
         s.params().set_float(
@@ -168,8 +197,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_LIGHT_LINEAR_ATTENUATION)) {
         float linear_attenuation = 1.0;
 
-        if(iteration < lights_within_range.size()) {
-            linear_attenuation = scene.light(lights_within_range.at(iteration)).linear_attenuation();
+        if(light) {
+            linear_attenuation = light->linear_attenuation;
         }
 
         s.params().set_float(
@@ -181,8 +210,8 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_LIGHT_QUADRATIC_ATTENUATION)) {
         float quadratic_attenuation = 1.0;
 
-        if(iteration < lights_within_range.size()) {
-            quadratic_attenuation = scene.light(lights_within_range.at(iteration)).quadratic_attenuation();
+        if(light) {
+            quadratic_attenuation = light->quadratic_attenuation;
         }
 
         s.params().set_float(
@@ -194,7 +223,7 @@ void GenericRenderer::set_auto_uniforms_on_shader(
     if(s.params().uses_auto(SP_AUTO_LIGHT_GLOBAL_AMBIENT)) {
         s.params().set_colour(
             s.params().auto_uniform_variable_name(SP_AUTO_LIGHT_GLOBAL_AMBIENT),
-            scene.ambient_light()
+            packet.ambient_light
         );
     }
 }
@@ -241,75 +270,126 @@ void GenericRenderer::set_auto_attributes_on_shader(ShaderProgram& s) {
     }
 }
 
-void GenericRenderer::render_mesh(Mesh& mesh, Scene& scene) {
+void GenericRenderer::draw_mesh(Scene& scene, const FramePacket& packet, const RenderItem& item) {
     glPushAttrib(GL_DEPTH_BUFFER_BIT);
 
-    if(!mesh.depth_test_enabled()) {
+    if(!item.depth_test) {
         glDisable(GL_DEPTH_TEST);
     } else {
         glEnable(GL_DEPTH_TEST);
     }
 
-    if(!mesh.depth_writes_enabled()) {
+    if(!item.depth_writes) {
         glDepthMask(GL_FALSE);
     } else {
         glDepthMask(GL_TRUE);
     }
 
-    MaterialID mid = mesh.material();
-    if(mid == 0) {
-        //No material was specified so fallback to the default
-        mid = scene.default_material();
+    bool use_occlusion_query = options().occlusion_culling_enabled &&
+                               item.occlusion_culling &&
+                               item.depth_test &&
+                               occlusion_queries_supported();
+
+    if(!use_occlusion_query) {
+        render_mesh_passes(scene, packet, item);
+        glPopAttrib();
+        return;
     }
 
-    Material& mat = scene.material(mid); //Grab the material for the mesh
+    OcclusionQuery& query = occlusion_queries_[item.uuid];
+    query.last_used_frame = frame_counter_;
+    if(!query.query_id) {
+        glGenQueries(1, &query.query_id);
+    }
 
-    //FIXME: Read the active technique from somewhere
-    MaterialTechnique& technique = mat.technique(DEFAULT_MATERIAL_SCHEME);
+    //Pick up the result of the last query if the GPU has finished with it
+    if(query.pending) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(query.query_id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(query.query_id, GL_QUERY_RESULT, &samples);
+            query.visible = samples > 0;
+            query.pending = false;
+        }
+    }
 
+    //If the camera is inside the bounds the box would be clipped, so just draw
+    if(item.camera_inside_bounds) {
+        query.visible = true;
+    }
+
+    if(query.visible) {
+        /*
+         * Visible last frame, so draw straight away and measure the draw itself,
+         * the result decides whether we bother next frame
+         */
+        if(!query.pending) {
+            glBeginQuery(GL_SAMPLES_PASSED, query.query_id);
+            render_mesh_passes(scene, packet, item);
+            glEndQuery(GL_SAMPLES_PASSED);
+            query.pending = true;
+        } else {
+            render_mesh_passes(scene, packet, item);
+        }
+    } else {
+        /*
+         * Hidden last frame. Test the bounding box and then let the GPU
+         * decide whether to draw based on that query, without waiting for it
+         */
+        if(!query.pending) {
+            issue_bounding_box_query(scene, item, query.query_id);
+            query.pending = true;
+        }
+
+        if(conditional_render_supported()) {
+            glBeginConditionalRender(query.query_id, GL_QUERY_NO_WAIT);
+            render_mesh_passes(scene, packet, item);
+            glEndConditionalRender();
+        }
+    }
+
+    glPopAttrib();
+}
+
+void GenericRenderer::render_mesh_passes(Scene& scene, const FramePacket& packet, const RenderItem& item) {
     //Set up the VBO for the mesh
-    mesh.vbo(
-        VERTEX_ATTRIBUTE_POSITION |
-        VERTEX_ATTRIBUTE_TEXCOORD_1 |
-        VERTEX_ATTRIBUTE_DIFFUSE |
-        VERTEX_ATTRIBUTE_NORMAL
-    );
+    glBindBuffer(GL_ARRAY_BUFFER, item.buffer->vbo);
 
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for(uint32_t i = 0; i < technique.pass_count(); ++i) {
-        MaterialPass& pass = technique.pass(i);
+    for(uint32_t i = 0; i < item.pass_count; ++i) {
+        const MaterialPassState& pass = packet.material_passes[item.first_pass + i];
 
         //Grab and activate the shader for the pass
-        ShaderProgram& s = scene.shader(pass.shader() != 0 ? pass.shader() : scene.default_shader());
+        ShaderProgram& s = scene.shader(pass.shader);
         s.activate(); //Activate the shader
 
-        std::vector<LightID> lights = scene.partitioner().lights_within_range(mesh.position());
         uint32_t iteration_count = 1;
-        if(pass.iteration() == ITERATE_N) {
-            iteration_count = pass.max_iterations();
-        } else if (pass.iteration() == ITERATE_ONCE_PER_LIGHT) {
-            iteration_count = std::min<uint32_t>(lights.size(), pass.max_iterations());
+        if(pass.iteration == ITERATE_N) {
+            iteration_count = pass.max_iterations;
+        } else if (pass.iteration == ITERATE_ONCE_PER_LIGHT) {
+            iteration_count = std::min<uint32_t>(item.light_count, pass.max_iterations);
         }
 
         //Attributes don't change per-iteration of a pass
         set_auto_attributes_on_shader(s);
 
         //Go through the texture units and bind the textures
-        for(uint32_t j = 0; j < pass.texture_unit_count(); ++j) {
+        for(uint32_t j = 0; j < pass.texture_count; ++j) {
             glClientActiveTexture(GL_TEXTURE0 + j);
-            glBindTexture(GL_TEXTURE_2D, scene.texture(pass.texture_unit(j).texture()).gl_tex());
+            glBindTexture(GL_TEXTURE_2D, scene.texture(packet.textures[pass.first_texture + j]).gl_tex());
         }
 
         for(uint32_t j = 0; j < iteration_count; ++j) {
-            set_auto_uniforms_on_shader(s, scene, lights, j); //Uniforms might change depending on the iteration
+            set_auto_uniforms_on_shader(s, packet, item, j); //Uniforms might change depending on the iteration
 
             //Render the mesh, once for each iteration of the pass
-            if(mesh.arrangement() == MESH_ARRANGEMENT_POINTS) {
-                glDrawArrays(GL_POINTS, 0, mesh.vertices().size());
-            } else if(mesh.arrangement() == MESH_ARRANGEMENT_LINE_STRIP) {
-                glDrawArrays(GL_LINE_STRIP, 0, mesh.vertices().size());
-            } else if(mesh.arrangement() == MESH_ARRANGEMENT_TRIANGLES) {
-                glDrawArrays(GL_TRIANGLES, 0, mesh.triangles().size() * 3);
+            if(item.arrangement == MESH_ARRANGEMENT_POINTS) {
+                glDrawArrays(GL_POINTS, 0, item.draw_count);
+            } else if(item.arrangement == MESH_ARRANGEMENT_LINE_STRIP) {
+                glDrawArrays(GL_LINE_STRIP, 0, item.draw_count);
+            } else if(item.arrangement == MESH_ARRANGEMENT_TRIANGLES) {
+                glDrawArrays(GL_TRIANGLES, 0, item.draw_count);
             } else {
                 assert(0);
             }
@@ -319,7 +399,7 @@ void GenericRenderer::render_mesh(Mesh& mesh, Scene& scene) {
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         //Unbind the textures
-        for(uint32_t j = 0; j < pass.texture_unit_count(); ++j) {
+        for(uint32_t j = 0; j < pass.texture_count; ++j) {
             glClientActiveTexture(GL_TEXTURE0 + j);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
@@ -332,40 +412,134 @@ void GenericRenderer::render_mesh(Mesh& mesh, Scene& scene) {
         glBlendFunc(GL_SRC_ALPHA, GL_ONE); //Additive after first pass
         assert(glGetError() == GL_NO_ERROR);
     }
+}
 
-    glPopAttrib();
+bool GenericRenderer::occlusion_queries_supported() const {
+    return GLEE_VERSION_1_5 || GLEE_ARB_occlusion_query;
 }
 
-void GenericRenderer::visit(Background& background) {
-    /*
-     *  We store the current projection matrix, then manipulate it so that the correct part
-     *  of the background fills the screen. Finally we render the background layers in order
-     *  and restore the projection.
-     */
-
-    projection().push();
-
-    kmMat4 new_proj;
-    kmMat4OrthographicProjection(
-                &new_proj, -background.visible_x() / 2.0,
-                background.visible_x() / 2.0,
-                -background.visible_y() / 2.0,
-                background.visible_y() / 2.0, -1.0, 1.0
-    );
+bool GenericRenderer::conditional_render_supported() const {
+    return GLEE_VERSION_3_0 || GLEE_NV_conditional_render;
+}
+
+void GenericRenderer::initialize_occlusion_resources(Scene& scene) {
+    //Owned by the renderer rather than the scene, so it goes when the renderer does
+    occlusion_shader_.reset(new ShaderProgram(&scene, 0));
+    ShaderProgram& shader = *occlusion_shader_;
+    shader.set_name("occlusion_shader");
+
+    shader.add_and_compile(SHADER_TYPE_VERTEX, R"(
+#version 120
+
+attribute vec3 vertex_position;
+uniform mat4 modelview_projection_matrix;
 
-    kmMat4Assign(&projection().top(), &new_proj);
+void main() {
+    gl_Position = modelview_projection_matrix * vec4(vertex_position, 1.0);
+}
+)");
+
+    shader.add_and_compile(SHADER_TYPE_FRAGMENT, R"(
+#version 120
 
-    for(uint32_t i = 0; i < background.layer_count(); ++i) {
-        BackgroundLayer& layer = background.layer(i);
-        render_mesh(background.scene().mesh(layer.mesh_id()), background.scene());
+void main() {
+    gl_FragColor = vec4(1.0);
+}
+)");
+
+    shader.params().register_attribute(SP_ATTR_VERTEX_POSITION, "vertex_position");
+    shader.params().register_auto(SP_AUTO_MODELVIEW_PROJECTION_MATRIX, "modelview_projection_matrix");
+    shader.bind_attrib(0, shader.params().attribute_variable_name(SP_ATTR_VERTEX_POSITION));
+    shader.relink();
+
+    //Unit cube, drawn as 12 triangles and scaled to the bounds of each mesh
+    const float c[8][3] = {
+        {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+        {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+    };
+
+    const uint8_t indexes[36] = {
+        0, 1, 2, 0, 2, 3, //Back
+        4, 6, 5, 4, 7, 6, //Front
+        0, 4, 5, 0, 5, 1, //Bottom
+        3, 2, 6, 3, 6, 7, //Top
+        0, 3, 7, 0, 7, 4, //Left
+        1, 5, 6, 1, 6, 2  //Right
+    };
+
+    float vertices[36 * 3];
+    for(uint32_t i = 0; i < 36; ++i) {
+        vertices[(i * 3) + 0] = c[indexes[i]][0];
+        vertices[(i * 3) + 1] = c[indexes[i]][1];
+        vertices[(i * 3) + 2] = c[indexes[i]][2];
     }
 
-    projection().pop();
+    glGenBuffers(1, &unit_cube_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, unit_cube_vbo_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 }
 
-void GenericRenderer::visit(Mesh& mesh) {
-    Scene& scene = mesh.scene();
-    render_mesh(mesh, scene);
+void GenericRenderer::issue_bounding_box_query(Scene& scene, const RenderItem& item, uint32_t query_id) {
+    if(!unit_cube_vbo_) {
+        initialize_occlusion_resources(scene);
+    }
+
+    const AABB& bounds = item.bounds;
+
+    //Stretch the unit cube over the bounds of the mesh, flat meshes still need some volume
+    const float MIN_EXTENT = 0.001f;
+    kmMat4 box, scale;
+    kmMat4Translation(&box, bounds.min.x, bounds.min.y, bounds.min.z);
+    kmMat4Scaling(
+        &scale,
+        std::max<float>(bounds.width(), MIN_EXTENT),
+        std::max<float>(bounds.height(), MIN_EXTENT),
+        std::max<float>(bounds.depth(), MIN_EXTENT)
+    );
+    kmMat4Multiply(&box, &box, &scale);
+
+    kmMat4 modelview_projection;
+    kmMat4Multiply(&modelview_projection, &item.projection, &item.modelview);
+    kmMat4Multiply(&modelview_projection, &modelview_projection, &box);
+
+    ShaderProgram& s = *occlusion_shader_;
+    s.activate();
+    s.params().set_mat4x4(
+        s.params().auto_uniform_variable_name(SP_AUTO_MODELVIEW_PROJECTION_MATRIX),
+        modelview_projection
+    );
+
+    //The box must not touch the colour or depth buffers, and both sides count
+    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_ENABLE_BIT);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+
+    glBindBuffer(GL_ARRAY_BUFFER, unit_cube_vbo_);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, BUFFER_OFFSET(0));
+
+    glBeginQuery(GL_SAMPLES_PASSED, query_id);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    glDisableVertexAttribArray(0);
+    glPopAttrib();
+}
+
+void GenericRenderer::purge_unused_occlusion_queries() {
+    //Meshes that haven't been drawn for a while (or were deleted) give their query back
+    const uint64_t MAX_UNUSED_FRAMES = 120;
+
+    std::map<uint64_t, OcclusionQuery>::iterator it = occlusion_queries_.begin();
+    while(it != occlusion_queries_.end()) {
+        if(frame_counter_ - (*it).second.last_used_frame > MAX_UNUSED_FRAMES) {
+            glDeleteQueries(1, &(*it).second.query_id);
+            occlusion_queries_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
 }
 
 }
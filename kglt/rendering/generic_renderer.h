@@ -2,6 +2,7 @@
 #define KGLT_GENERIC_RENDERER_H_INCLUDED
 
 #include <iostream>
+#include <map>
 
 #include "../renderer.h"
 #include "../generic/creator.h"
@@ -20,22 +21,53 @@ public:
 	typedef std::tr1::shared_ptr<Renderer> ptr;
 
     GenericRenderer(const RenderOptions& options=RenderOptions()):
-        Renderer(options) {}
-            
-    void visit(Mesh& mesh);
-    void visit(Text& text);
-    void visit(Background& background);
+        Renderer(options),
+        frame_counter_(0),
+        unit_cube_vbo_(0) {}
 
-    void _initialize(Scene& scene);
+    ~GenericRenderer();
 
 private:    
+    /*
+     *  Per-mesh occlusion state. The result of a query is only read once
+     *  it is available so the CPU never waits on the GPU, which means that
+     *  visibility always lags by (at least) a frame.
+     */
+    struct OcclusionQuery {
+        OcclusionQuery():
+            query_id(0),
+            visible(true),
+            pending(false),
+            last_used_frame(0) {}
+
+        uint32_t query_id;
+        bool visible; ///< Result of the last query that completed
+        bool pending; ///< A query has been issued and not yet read back
+        uint64_t last_used_frame;
+    };
+
+    std::map<uint64_t, OcclusionQuery> occlusion_queries_; ///< Keyed by Object::uuid()
+    uint64_t frame_counter_;
+
+    //Created the first time a bounding box query is issued
+    std::tr1::shared_ptr<ShaderProgram> occlusion_shader_;
+    uint32_t unit_cube_vbo_;
+
     void on_start_render(Scene& scene);
-    void render_mesh(Mesh& mesh, Scene& scene);
+    void draw_mesh(Scene& scene, const FramePacket& packet, const RenderItem& item);
+    void draw_text(Scene& scene, const FramePacket& packet, const RenderItem& item);
+    void render_mesh_passes(Scene& scene, const FramePacket& packet, const RenderItem& item);
+
+    bool occlusion_queries_supported() const;
+    bool conditional_render_supported() const;
+    void initialize_occlusion_resources(Scene& scene);
+    void purge_unused_occlusion_queries();
+    void issue_bounding_box_query(Scene& scene, const RenderItem& item, uint32_t query_id);
 
     void set_auto_uniforms_on_shader(
         ShaderProgram& shader,
-        Scene& scene,
-        const std::vector<LightID>& lights_within_range,
+        const FramePacket& packet,
+        const RenderItem& item,
         uint32_t iteration
     );
     void set_auto_attributes_on_shader(ShaderProgram& shader);
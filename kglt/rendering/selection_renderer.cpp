@@ -4,6 +4,7 @@
 
 #include "kglt/utils/gl_error.h"
 #include "kglt/scene.h"
+#include "kglt/frame_packet.h"
 #include "kglt/shortcuts.h"
 #include "selection_renderer.h"
 
@@ -52,15 +53,12 @@ void SelectionRenderer::_initialize(Scene& scene) {
 
     shader.add_and_compile(SHADER_TYPE_VERTEX, selection_vert_shader_120());
     shader.add_and_compile(SHADER_TYPE_FRAGMENT, selection_frag_shader_120());        
-    shader.activate();   
 
     //Bind the vertex attributes for the selection shader and relink
     shader.params().register_attribute(SP_ATTR_VERTEX_POSITION, "vertex_position");
     shader.params().register_auto(SP_AUTO_MODELVIEW_PROJECTION_MATRIX, "modelview_projection_matrix");
     shader.bind_attrib(0, shader.params().attribute_variable_name(SP_ATTR_VERTEX_POSITION));
     shader.relink();
-
-    shader.activate();
 }
 
 void SelectionRenderer::on_start_render(Scene& scene) {
@@ -83,7 +81,6 @@ void SelectionRenderer::on_start_render(Scene& scene) {
 	g_count = 0; 
 	b_count	= 0;
 	colour_mesh_lookup_.clear();
-    selected_mesh_id_ = 0;
 }
 
 void SelectionRenderer::on_finish_render(Scene &scene) {
@@ -104,15 +101,17 @@ void SelectionRenderer::on_finish_render(Scene &scene) {
 	
 	//L_DEBUG((boost::format("%f, %f, %f") % std::get<0>(selected_colour) % std::get<1>(selected_colour) % std::get<2>(selected_colour)).str());
 	
+	MeshID selected = 0;
 	if(container::contains(colour_mesh_lookup_, selected_colour)) {
-		selected_mesh_id_ = colour_mesh_lookup_[selected_colour];
+		selected = colour_mesh_lookup_[selected_colour];
 	}
+    __atomic_store_n(&selected_mesh_id_, selected, __ATOMIC_RELEASE);
 	
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);	
 }
 	
-void SelectionRenderer::visit(Mesh& mesh) {
-    ShaderProgram& s = mesh.scene().shader(selection_shader_);
+void SelectionRenderer::draw_mesh(Scene& scene, const FramePacket& packet, const RenderItem& item) {
+    ShaderProgram& s = scene.shader(selection_shader_);
 
 	b_count++;
 	if(b_count == 255) {
@@ -131,19 +130,17 @@ void SelectionRenderer::visit(Mesh& mesh) {
 		(1.0 / 255.0) * b_count
 	);
 	
-    colour_mesh_lookup_[current_colour] = mesh.scene()._mesh_id_from_mesh_ptr(&mesh);
+    colour_mesh_lookup_[current_colour] = item.mesh_id;
 	
-    kmMat4 transform;
-    kmMat4Identity(&transform);
     check_and_log_error(__FILE__, __LINE__);
     
-    //Only draw vertices
-    mesh.vbo(VERTEX_ATTRIBUTE_POSITION);
+    //Only draw vertices, skipping over the rest of the interleaved geometry
+    glBindBuffer(GL_ARRAY_BUFFER, item.buffer->vbo);
 	
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, BUFFER_OFFSET(0));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * GEOMETRY_STRIDE, BUFFER_OFFSET(0));
     
 	kmMat4 modelview_projection;
-    kmMat4Multiply(&modelview_projection, &projection().top(), &modelview().top());
+    kmMat4Multiply(&modelview_projection, &item.projection, &item.modelview);
 	
     s.params().set_mat4x4(
         s.params().auto_uniform_variable_name(SP_AUTO_MODELVIEW_PROJECTION_MATRIX),
@@ -161,12 +158,12 @@ void SelectionRenderer::visit(Mesh& mesh) {
     s.params().set_vec3("selection_colour", colour);
 	
 	glEnableVertexAttribArray(0);		
-    if(mesh.arrangement() == MESH_ARRANGEMENT_POINTS) {
-        glDrawArrays(GL_POINTS, 0, mesh.vertices().size());
-    } else if(mesh.arrangement() == MESH_ARRANGEMENT_LINE_STRIP) {
-        glDrawArrays(GL_LINE_STRIP, 0, mesh.vertices().size());
-    } else if(mesh.arrangement() == MESH_ARRANGEMENT_TRIANGLES) {
-        glDrawArrays(GL_TRIANGLES, 0, mesh.triangles().size() * 3);
+    if(item.arrangement == MESH_ARRANGEMENT_POINTS) {
+        glDrawArrays(GL_POINTS, 0, item.draw_count);
+    } else if(item.arrangement == MESH_ARRANGEMENT_LINE_STRIP) {
+        glDrawArrays(GL_LINE_STRIP, 0, item.draw_count);
+    } else if(item.arrangement == MESH_ARRANGEMENT_TRIANGLES) {
+        glDrawArrays(GL_TRIANGLES, 0, item.draw_count);
 	} else {
 		assert(0);
 	}
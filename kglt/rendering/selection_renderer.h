@@ -17,32 +17,34 @@ public:
 		
     SelectionRenderer(const RenderOptions& options=RenderOptions()):
         Renderer(options),
-		selected_mesh_id_(0) {}
+		selected_mesh_id_(0) {
+
+        set_records_lights(false);
+    }
 	
-    void visit(Mesh& mesh);
     void visit(Text& text) {} //Dunno if this should be selectable..
     void visit(Background& background) {} //You can't select backgrounds
 
-	MeshID selected_mesh() const { return selected_mesh_id_; }
+    //Written by the GL thread when a frame has been drawn
+    MeshID selected_mesh() const { return __atomic_load_n(&selected_mesh_id_, __ATOMIC_ACQUIRE); }
 	
     bool pre_visit(Object& obj) {
 	    //If this is a mesh, and the entire branch is not selectable,
 	    //then bail out
         if(Mesh* m = dynamic_cast<Mesh*>(&obj)) {
-	        if(!m->branch_selectable()) {	            
+            if(!m->mesh_state().selectable) {
 	            return false;
 	        }
 	    }
 	    
-	    Renderer::pre_visit(obj);
-	    
-	    return true;
+        return Renderer::pre_visit(obj);
 	}
 
     void _initialize(Scene& scene);
 private:
     void on_start_render(Scene& scene);
     void on_finish_render(Scene& scene);
+    void draw_mesh(Scene& scene, const FramePacket& packet, const RenderItem& item);
 
     uint8_t r_count, g_count, b_count;	
     
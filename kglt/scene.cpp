@@ -1,7 +1,11 @@
+#include <algorithm>
+
 #include "glee/GLee.h"
 #include "scene.h"
 #include "renderer.h"
+#include "utils/gl_thread.h"
 #include "ui.h"
+#include "window_base.h"
 #include "partitioners/null_partitioner.h"
 #include "shaders/default_shaders.h"
 
@@ -15,9 +19,13 @@ Scene::Scene(WindowBase* window):
     default_shader_(0),
     default_material_(0),
     ambient_light_(1.0, 1.0, 1.0, 1.0),
+    snapshot_pending_(false),
     background_(this),
     ui_interface_(new UI(this)),
-    partitioner_(new NullPartitioner(*this)) {
+    partitioner_(new NullPartitioner(*this)),
+    updating_(false),
+    update_list_has_gaps_(false),
+    parallel_updates_(false) {
 
     TemplatedManager<Scene, Mesh, MeshID>::signal_post_create().connect(sigc::mem_fun(this, &Scene::post_create_callback<Mesh, MeshID>));
     TemplatedManager<Scene, Camera, CameraID>::signal_post_create().connect(sigc::mem_fun(this, &Scene::post_create_callback<Camera, CameraID>));
@@ -32,6 +40,7 @@ Scene::Scene(WindowBase* window):
     render_options.wireframe_enabled = false;
     render_options.texture_enabled = true;
     render_options.backface_culling_enabled = true;
+    render_options.occlusion_culling_enabled = false;
     render_options.point_size = 1;
 
     /**
@@ -43,6 +52,16 @@ Scene::Scene(WindowBase* window):
 
 Scene::~Scene() {
     //TODO: Log the unfreed resources (textures, meshes, materials etc.)
+
+    //The objects outlive our members, make sure they don't try to remove themselves later
+    components_.clear();
+
+    for(Object* object: update_list_) {
+        if(object) {
+            object->update_index_ = Object::NOT_UPDATED;
+        }
+    }
+    update_list_.clear();
 }
 
 void Scene::initialize_defaults() {
@@ -62,11 +81,8 @@ void Scene::initialize_defaults() {
     default_shader_ = new_shader();
     ShaderProgram& def = shader(default_shader_); //Create a default shader;
 
-    assert(glGetError() == GL_NO_ERROR);
-
     def.add_and_compile(SHADER_TYPE_VERTEX, ambient_render_vert);
     def.add_and_compile(SHADER_TYPE_FRAGMENT, ambient_render_frag);
-    def.activate();
 
     def.params().register_auto(SP_AUTO_MODELVIEW_PROJECTION_MATRIX, "modelview_projection_matrix");
     def.params().register_auto(SP_AUTO_LIGHT_GLOBAL_AMBIENT, "global_ambient");
@@ -77,15 +93,20 @@ void Scene::initialize_defaults() {
     def.params().register_attribute(SP_ATTR_VERTEX_COLOR, "vertex_diffuse");
     //def.params().register_attribute(SP_ATTR_VERTEX_NORMAL, "vertex_normal");
 
-    def.params().set_int("texture_1", 0); //Set texture_1 to be the first texture unit
-
     def.relink();
 
+    //Set texture_1 to be the first texture unit, which needs the program built so it's done on the GL thread
+    ShaderID default_shader = default_shader_;
+    run_on_gl_thread([=]() {
+        ShaderProgram& s = shader(default_shader);
+        s.activate();
+        s.params().set_int("texture_1", 0);
+    });
+
     phong_shader_ = new_shader();
     ShaderProgram& phong = shader(phong_shader_);
     phong.add_and_compile(SHADER_TYPE_VERTEX, phong_lighting_vert);
     phong.add_and_compile(SHADER_TYPE_FRAGMENT, phong_lighting_frag);
-    phong.activate();
     
     phong.params().register_auto(SP_AUTO_MODELVIEW_PROJECTION_MATRIX, "modelview_projection_matrix");
     phong.params().register_auto(SP_AUTO_LIGHT_POSITION, "light_position");
@@ -132,8 +153,12 @@ Mesh& Scene::mesh(MeshID m) {
 }
 
 void Scene::delete_mesh(MeshID mid) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
     //Remove the mesh from the partitioner
     partitioner_->remove(mesh(mid));
+    relocated_meshes_.erase(std::remove(relocated_meshes_.begin(), relocated_meshes_.end(), mid), relocated_meshes_.end());
 
     Mesh& obj = mesh(mid);
     obj.destroy_children();
@@ -171,6 +196,9 @@ Material& Scene::material(MaterialID mid) {
 }
 
 void Scene::delete_material(MaterialID mid) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
     TemplatedManager<Scene, Material, MaterialID>::manager_delete(mid);
 }
 
@@ -179,7 +207,10 @@ TextureID Scene::new_texture() {
 }
 
 void Scene::delete_texture(TextureID tid) {
-    TemplatedManager<Scene, Texture, TextureID>::manager_delete(tid);
+    //Frames already recorded may still draw with it
+    window().after_frames_rendered([=]() {
+        TemplatedManager<Scene, Texture, TextureID>::manager_delete(tid);
+    });
 }
 
 Texture& Scene::texture(TextureID t) {
@@ -195,6 +226,9 @@ Camera& Scene::camera(CameraID c) {
 }
 
 void Scene::delete_camera(CameraID cid) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
     Camera& obj = camera(cid);
     obj.destroy_children();
     TemplatedManager<Scene, Camera, CameraID>::manager_delete(cid);
@@ -209,7 +243,9 @@ ShaderID Scene::new_shader() {
 }
 
 void Scene::delete_shader(ShaderID s) {
-    TemplatedManager<Scene, ShaderProgram, ShaderID>::manager_delete(s);
+    window().after_frames_rendered([=]() {
+        TemplatedManager<Scene, ShaderProgram, ShaderID>::manager_delete(s);
+    });
 }
 
 FontID Scene::new_font() {
@@ -221,7 +257,9 @@ Font& Scene::font(FontID f) {
 }
 
 void Scene::delete_font(FontID f) {
-    TemplatedManager<Scene, Font, FontID>::manager_delete(f);
+    window().after_frames_rendered([=]() {
+        TemplatedManager<Scene, Font, FontID>::manager_delete(f);
+    });
 }
 
 TextID Scene::new_text() {
@@ -237,6 +275,9 @@ const Text& Scene::text(TextID t) const {
 }
 
 void Scene::delete_text(TextID tid) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
     Text& obj = text(tid);
     obj.destroy_children();
     TemplatedManager<Scene, Text, TextID>::manager_delete(tid);
@@ -255,6 +296,9 @@ Overlay& Scene::overlay(OverlayID overlay) {
 }
 
 void Scene::delete_overlay(OverlayID oid) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
     Overlay& obj = overlay(oid);
     obj.destroy_children();
     TemplatedManager<Scene, Overlay, OverlayID>::manager_delete(oid);
@@ -279,14 +323,19 @@ Light& Scene::light(LightID light_id) {
 }
 
 void Scene::delete_light(LightID light_id) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
     Light& obj = light(light_id);
     partitioner_->remove(obj); //Remove the light from the partitioner
+    relocated_lights_.erase(std::remove(relocated_lights_.begin(), relocated_lights_.end(), light_id), relocated_lights_.end());
     obj.destroy_children();
     TemplatedManager<Scene, Light, LightID>::manager_delete(light_id);
 }
 
 void Scene::init() {
-    assert(glGetError() == GL_NO_ERROR);
+    //With threaded rendering this isn't the GL thread, and everything below is created lazily anyway
+    assert(!on_gl_thread() || glGetError() == GL_NO_ERROR);
 
     initialize_defaults();
 
@@ -303,36 +352,340 @@ std::pair<ShaderID, bool> Scene::find_shader(const std::string& name) {
 
 void Scene::update(double dt) {
     /*
-      Update all animated materials
+      Update all animated materials, deleted ones drop off the list as we go
     */
-    for(std::pair<MaterialID, Material::ptr> p: generic::TemplatedManager<Scene, Material, MaterialID>::objects_) {
-        p.second->update(dt);
+    for(uint32_t i = 0; i < animated_materials_.size();) {
+        MaterialID material_id = animated_materials_[i];
+        if(!TemplatedManager<Scene, Material, MaterialID>::manager_contains(material_id)) {
+            animated_materials_[i] = animated_materials_.back();
+            animated_materials_.pop_back();
+            continue;
+        }
+
+        material(material_id).update(dt);
+        ++i;
     }
 
-    for(uint32_t i = 0; i < child_count(); ++i) {
-        Object& c = child(i);
-        c.update(dt);
+    //Move everything with a velocity in one go
+    components_.integrate(dt);
+
+    update_objects(dt);
+}
+
+static uint32_t depth_of(Object& object) {
+    uint32_t depth = 0;
+    for(Object* node = &object; node->has_parent(); node = &node->parent()) {
+        ++depth;
+    }
+    return depth;
+}
+
+void Scene::update_objects(double dt) {
+    /*
+     *  Only objects that asked for updates are visited. Anything added during the loop
+     *  starts next time, anything removed leaves a gap that's closed up afterwards.
+     */
+    {
+        boost::mutex::scoped_lock lock(update_list_lock_);
+        updating_ = true;
+    }
+
+    //Counting sort the list by depth, keeping the list order within each level
+    uint32_t count = update_list_.size();
+    update_depths_.resize(count);
+
+    uint32_t max_depth = 0;
+    for(uint32_t i = 0; i < count; ++i) {
+        update_depths_[i] = depth_of(*update_list_[i]);
+        max_depth = std::max(max_depth, update_depths_[i]);
+    }
+
+    level_offsets_.assign(max_depth + 2, 0);
+    for(uint32_t i = 0; i < count; ++i) {
+        ++level_offsets_[update_depths_[i] + 1];
     }
+    for(uint32_t level = 1; level < level_offsets_.size(); ++level) {
+        level_offsets_[level] += level_offsets_[level - 1];
+    }
+
+    level_cursors_.assign(level_offsets_.begin(), level_offsets_.end());
+    update_order_.resize(count);
+    for(uint32_t i = 0; i < count; ++i) {
+        update_order_[level_cursors_[update_depths_[i]]++] = i;
+    }
+
+    JobSystem& jobs = window().jobs();
+
+    for(uint32_t level = 0; level <= max_depth; ++level) {
+        uint32_t begin = level_offsets_[level];
+        uint32_t end = level_offsets_[level + 1];
+        if(begin == end) {
+            continue;
+        }
+
+        //Bring the levels above up to date, so reading their transforms doesn't write to them
+        resolve_transforms();
+
+        auto update_range = [=](uint32_t chunk, uint32_t first, uint32_t last) {
+            for(uint32_t i = first; i < last; ++i) {
+                Object* object = update_list_[update_order_[begin + i]];
+                if(object) {
+                    object->do_update(dt);
+                }
+            }
+        };
+
+        if(parallel_updates_) {
+            jobs.parallel_for(end - begin, UPDATE_GRAIN, update_range);
+        } else {
+            update_range(0, 0, end - begin);
+        }
+    }
+
+    boost::mutex::scoped_lock lock(update_list_lock_);
+    updating_ = false;
+
+    if(!pending_updates_.empty()) {
+        update_list_.insert(update_list_.end(), pending_updates_.begin(), pending_updates_.end());
+        pending_updates_.clear();
+    }
+
+    if(update_list_has_gaps_) {
+        compact_update_list();
+    }
+}
+
+void Scene::_add_to_update_list(Object& object) {
+    boost::mutex::scoped_lock lock(update_list_lock_);
+
+    object.update_index_ = update_list_.size() + pending_updates_.size();
+    if(updating_) {
+        pending_updates_.push_back(&object);
+    } else {
+        update_list_.push_back(&object);
+    }
+}
+
+void Scene::_remove_from_update_list(Object& object) {
+    boost::mutex::scoped_lock lock(update_list_lock_);
+
+    uint32_t index = object.update_index_;
+    object.update_index_ = Object::NOT_UPDATED;
+
+    if(updating_) {
+        if(index < update_list_.size()) {
+            update_list_[index] = nullptr;
+        } else {
+            pending_updates_[index - update_list_.size()] = nullptr;
+        }
+        update_list_has_gaps_ = true;
+        return;
+    }
+
+    Object* last = update_list_.back();
+    update_list_[index] = last;
+    last->update_index_ = index;
+    update_list_.pop_back();
+}
+
+void Scene::compact_update_list() {
+    update_list_.erase(std::remove(update_list_.begin(), update_list_.end(), (Object*) nullptr), update_list_.end());
+    for(uint32_t i = 0; i < update_list_.size(); ++i) {
+        update_list_[i]->update_index_ = i;
+    }
+    update_list_has_gaps_ = false;
+}
+
+void Scene::_add_animated_material(MaterialID material) {
+    animated_materials_.push_back(material);
+}
+
+void Scene::_material_changed(MaterialID material) {
+    changed_materials_.push_back(material);
 }
 
 void Scene::render() {
+    publish_frame();
+
+    render_packet_.clear();
+    prepare_frame(render_packet_);
+    render_frame(render_packet_);
+}
+
+void Scene::wait_until_recorded(boost::recursive_mutex::scoped_lock& lock) {
+    while(snapshot_pending_) {
+        snapshot_recorded_.wait(lock);
+    }
+}
+
+void Scene::publish_frame() {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+    wait_until_recorded(lock);
+
+    update_partitioner();
+
+    //Overlays aren't part of the scene's tree, so they're resolved separately
+    const std::vector<Overlay*>& overlays = TemplatedManager<Scene, Overlay, OverlayID>::manager_objects();
+    for(Overlay* overlay: overlays) {
+        overlay->resolve_transforms();
+    }
+
+    //The camera can be moved through position() and rotation() without being marked
+    Camera& camera = active_camera();
+    camera.mark_render_state_dirty();
+
+    //Only the paths down to changed objects are walked
+    publish_render_state();
+    snapshot_.order.update(*this);
+
+    for(Overlay* overlay: overlays) {
+        overlay->publish_render_state();
+        overlay->_update_published_order();
+    }
+
+    //The background layers are kept out of the tree
+    for(uint32_t i = 0; i < background_.layer_count(); ++i) {
+        mesh(background_.layer(i).mesh_id()).publish_render_state();
+    }
+
+    for(MaterialID material_id: changed_materials_) {
+        if(TemplatedManager<Scene, Material, MaterialID>::manager_contains(material_id)) {
+            material(material_id)._publish();
+        }
+    }
+    changed_materials_.clear();
+
+    //Animated textures move on every frame
+    for(MaterialID material_id: animated_materials_) {
+        if(TemplatedManager<Scene, Material, MaterialID>::manager_contains(material_id)) {
+            material(material_id)._publish();
+        }
+    }
+
+    snapshot_.overlays.assign(overlays.begin(), overlays.end());
+    std::sort(snapshot_.overlays.begin(), snapshot_.overlays.end(), [](Overlay* x, Overlay* y) {
+        return x->overlay_state().zindex < y->overlay_state().zindex;
+    });
+
+    //Partitioner queries can't run on the render thread, so the lights are found up front
+    snapshot_.queries.reset(*partitioner_, camera);
+    for(MeshID mesh_id: snapshot_.queries.visible_meshes()) {
+        snapshot_.queries.lights_for(mesh_id, mesh(mesh_id).render_state().absolute_position);
+    }
+
+    snapshot_.camera = active_camera_;
+    snapshot_.ambient_light = ambient_light_;
+    snapshot_.render_options = render_options;
+    snapshot_.passes.assign(passes_.begin(), passes_.end());
+
+    //Without a render thread the frame is recorded straight after, on this thread
+    snapshot_pending_ = window().rendering_threaded();
+}
+
+void Scene::prepare_frame(FramePacket& packet) {
+    boost::recursive_mutex::scoped_lock lock(snapshot_lock_);
+
+    packet.ambient_light = snapshot_.ambient_light;
+
+    //Each pass records its own items, objects can be left out of some passes
+    for(Pass& pass: snapshot_.passes) {
+        pass.renderer().prepare(*this, pass, packet);
+    }
+
+    snapshot_pending_ = false;
+    snapshot_recorded_.notify_all();
+}
+
+void Scene::render_frame(const FramePacket& packet) {
+    packet.upload_geometry();
+
     /**
-     * Go through all the render passes
+     * Go through all the recorded render passes
      * set the render options and send the viewport to OpenGL
-     * before going through the scene, objects in the scene
-     * should be able to mark as only being renderered in certain
-     * passes
+     * before drawing what the pass recorded
      */
-    for(Pass& pass: passes_) {
-        pass.renderer().set_options(render_options);
+    for(const PassPacket& recorded: packet.passes) {
+        Pass pass = recorded.pass; //The signals want a Pass they can change, this keeps the renderer alive
+
+        pass.renderer().set_options(recorded.options);
         pass.viewport().update_opengl();
 
         signal_render_pass_started_(pass);
-        pass.renderer().render(*this);
+        pass.renderer().render(*this, packet, recorded);
         signal_render_pass_finished_(pass);
     }
 }
 
+void Scene::set_partitioner(Partitioner::ptr partitioner) {
+    assert(partitioner);
+
+    //It already has everything
+    if(partitioner == partitioner_) {
+        return;
+    }
+
+    for(Mesh* mesh: TemplatedManager<Scene, Mesh, MeshID>::manager_objects()) {
+        partitioner->add(*mesh);
+    }
+
+    for(Light* light: TemplatedManager<Scene, Light, LightID>::manager_objects()) {
+        partitioner->add(*light);
+    }
+
+    //Moved rather than copied, so the old one can be put back later without adding things twice
+    if(partitioner_) {
+        for(Mesh* mesh: TemplatedManager<Scene, Mesh, MeshID>::manager_objects()) {
+            partitioner_->remove(*mesh);
+        }
+
+        for(Light* light: TemplatedManager<Scene, Light, LightID>::manager_objects()) {
+            partitioner_->remove(*light);
+        }
+    }
+
+    partitioner_ = partitioner;
+}
+
+void Scene::queue_relocation(Mesh& mesh) {
+    boost::mutex::scoped_lock lock(relocation_lock_);
+    relocated_meshes_.push_back(mesh.id());
+}
+
+void Scene::queue_relocation(Light& light) {
+    boost::mutex::scoped_lock lock(relocation_lock_);
+    relocated_lights_.push_back(light.id());
+}
+
+void Scene::update_partitioner() {
+    //Work out where everything has moved to since last time, which queues up relocations
+    resolve_transforms();
+    components_.update_bounds();
+
+    /*
+     *  Objects can move many times a frame (and the whole subtree moves when
+     *  a parent does) so rather than relocating on every change, we batch them
+     *  up and do it once.
+     */
+    std::sort(relocated_meshes_.begin(), relocated_meshes_.end());
+    relocated_meshes_.erase(std::unique(relocated_meshes_.begin(), relocated_meshes_.end()), relocated_meshes_.end());
+    for(MeshID mesh_id: relocated_meshes_) {
+        //Meshes are queued during creation, before the partitioner knows about them
+        if(has_mesh(mesh_id)) {
+            partitioner_->relocate(mesh(mesh_id));
+        }
+    }
+    relocated_meshes_.clear();
+
+    std::sort(relocated_lights_.begin(), relocated_lights_.end());
+    relocated_lights_.erase(std::unique(relocated_lights_.begin(), relocated_lights_.end()), relocated_lights_.end());
+    for(LightID light_id: relocated_lights_) {
+        if(TemplatedManager<Scene, Light, LightID>::manager_contains(light_id)) {
+            partitioner_->relocate(light(light_id));
+        }
+    }
+    relocated_lights_.clear();
+}
+
 MeshID Scene::_mesh_id_from_mesh_ptr(Mesh* mesh) {
     return TemplatedManager<Scene, Mesh, MeshID>::_get_object_id_from_ptr(mesh);
 }
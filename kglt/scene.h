@@ -4,9 +4,12 @@
 #include <sigc++/sigc++.h>
 #include <boost/any.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include <stdexcept>
 #include <map>
+#include <set>
 
 #include "kazbase/list_utils.h"
 
@@ -25,9 +28,11 @@
 #include "overlay.h"
 #include "material.h"
 #include "light.h"
+#include "frame_packet.h"
 
 #include "rendering/generic_renderer.h"
 #include "partitioner.h"
+#include "component_store.h"
 
 #include "generic/visitor.h"
 #include "generic/manager.h"
@@ -37,6 +42,23 @@ namespace kglt {
 class WindowBase;
 class UI;
 
+/*
+ *  Everything about the scene as a whole that frames are recorded from, as of the last
+ *  Scene::publish_frame(). The objects' own state is in their render_state() and friends.
+ */
+struct SceneSnapshot {
+    SceneSnapshot():
+        camera(0) {}
+
+    PublishedOrder order; ///< The scene's tree, depth first
+    std::vector<Overlay*> overlays; ///< Sorted by zindex
+    QueryArena queries; ///< What the camera can see, and the lights reaching each of them
+    CameraID camera;
+    kglt::Colour ambient_light;
+    RenderOptions render_options;
+    std::vector<Pass> passes;
+};
+
 class Scene :
     public Object,
     public Loadable,
@@ -101,9 +123,32 @@ public:
     void delete_light(LightID light_id);
 
     void init();
-    void render();
+    void render(); ///< publish_frame(), prepare_frame() and render_frame() one after the other
     void update(double dt);
 
+    /*
+     *  Copies whatever changed since last time into the published state that frames are
+     *  recorded from (see Object::render_state()), then culls and finds the lights. This
+     *  is the once a frame sync point between the game thread and the render thread, it's
+     *  called on the thread that updates the scene. If the render thread hasn't recorded
+     *  the previously published frame yet, this waits for it.
+     */
+    void publish_frame();
+    const SceneSnapshot& snapshot() const { return snapshot_; }
+
+    /*
+     *  Records the published frame into the packet, reading nothing that the game thread
+     *  changes, so with threaded rendering it runs on the render thread. The packet must
+     *  be empty.
+     */
+    void prepare_frame(FramePacket& packet);
+
+    /*
+     *  Draws a recorded frame, on the GL thread. Only the scene's resources are looked at,
+     *  so with threaded rendering this runs while the next frame is updated and recorded.
+     */
+    void render_frame(const FramePacket& packet);
+
     RenderOptions render_options;
 
     WindowBase& window() { return *window_; }
@@ -128,6 +173,22 @@ public:
 
     MeshID _mesh_id_from_mesh_ptr(Mesh* mesh);
 
+    /*
+     *  Objects are updated a level of the tree at a time, parents before children. With
+     *  parallel updates enabled each level is shared out across the window's JobSystem,
+     *  so do_update() must then only change its own object. Moving it, reading its own
+     *  or its parents' transforms and enabling or disabling updates are all fine; creating,
+     *  deleting or reparenting objects isn't. The order within a level doesn't change the
+     *  results, so switching this off (the default) is a handy way to debug.
+     */
+    void set_parallel_updates(bool value=true) { parallel_updates_ = value; }
+    bool parallel_updates() const { return parallel_updates_; }
+
+    void _add_to_update_list(Object& object); ///< See Object::enable_updates()
+    void _remove_from_update_list(Object& object);
+    void _add_animated_material(MaterialID material); ///< See Material::mark_animated()
+    void _material_changed(MaterialID material); ///< See Material::mark_changed()
+
     Background& background() { return background_; }
     UI& ui() { return *ui_interface_; }
 
@@ -145,24 +206,52 @@ public:
     }
 
     uint32_t overlay_count() const { ///< Returns the number of overlays in the scene
-        return TemplatedManager<Scene, Overlay, OverlayID>::objects_.size();
+        return TemplatedManager<Scene, Overlay, OverlayID>::manager_count();
     }
 
     Overlay& overlay_ordered_by_zindex(uint32_t idx) { ///< Returns an overlay by index into a sorted list by zindex
-        std::vector<Overlay::ptr> overlays;
-        for(std::pair<OverlayID, Overlay::ptr> pair: TemplatedManager<Scene, Overlay, OverlayID>::objects_) {
-            overlays.push_back(pair.second);
-        }
-
-        std::sort(overlays.begin(), overlays.end(), [](Overlay::ptr x, Overlay::ptr y) { return x->zindex() < y->zindex(); });
+        std::vector<Overlay*> overlays;
+        overlays_ordered_by_zindex(overlays);
+        return *overlays.at(idx);
+    }
 
-        return *overlays[idx];
+    /*
+     *  Fills `out` (any container of Overlay*) with every overlay sorted by zindex. Sorting
+     *  once and walking the list is much cheaper than calling overlay_ordered_by_zindex()
+     *  for each index.
+     */
+    template<typename Container>
+    void overlays_ordered_by_zindex(Container& out) {
+        const std::vector<Overlay*>& overlays = TemplatedManager<Scene, Overlay, OverlayID>::manager_objects();
+        out.assign(overlays.begin(), overlays.end());
+
+        std::sort(out.begin(), out.end(), [](Overlay* x, Overlay* y) { return x->zindex() < y->zindex(); });
     }
 
     MaterialID default_material() const { return default_material_; }
     ShaderID default_shader() const { return default_shader_; }
 
     Partitioner& partitioner() { return *partitioner_; }
+    Partitioner::ptr partitioner_ptr() { return partitioner_; } ///< So it can be put back after replacing it
+    void set_partitioner(Partitioner::ptr partitioner); ///< Replaces the partitioner, existing meshes and lights are moved across
+
+    /*
+     *  Shortcut for creating and installing a partitioner, e.g.
+     *  scene.set_partitioner<SpatialHashPartitioner>(2.0);
+     */
+    template<typename PartitionerType, typename... Args>
+    typename PartitionerType::ptr set_partitioner(Args&&... args) {
+        typename PartitionerType::ptr partitioner(new PartitionerType(*this, std::forward<Args>(args)...));
+        set_partitioner(partitioner);
+        return partitioner;
+    }
+
+    void queue_relocation(Mesh& mesh); ///< Called when a mesh moves or changes shape, the partitioner is told at the next update_partitioner()
+    void queue_relocation(Light& light);
+    void update_partitioner(); ///< Relocates everything that moved since the last call, this happens once per frame before rendering
+
+    ComponentStore& components() { return components_; }
+    const ComponentStore& components() const { return components_; }
 
     kglt::Colour ambient_light() const { return ambient_light_; }
     void set_ambient_light(const kglt::Colour& c) { ambient_light_ = c; }
@@ -182,15 +271,58 @@ private:
 
     void initialize_defaults();
 
+    /*
+     *  Deleting an object the published frame refers to has to wait until the render
+     *  thread has recorded it. Publishing, recording and deleting take the lock, nothing
+     *  else does. Declared before the objects, so it outlives them.
+     */
+    boost::recursive_mutex snapshot_lock_;
+    boost::condition_variable_any snapshot_recorded_;
+    bool snapshot_pending_; ///< Published, but the render thread hasn't recorded it yet
+    SceneSnapshot snapshot_;
+
+    void wait_until_recorded(boost::recursive_mutex::scoped_lock& lock);
+
     Background background_;
     std::tr1::shared_ptr<UI> ui_interface_;
 
     std::vector<Pass> passes_;
+    FramePacket render_packet_; ///< Used by render()
 
     sigc::signal<void, Pass&> signal_render_pass_started_;
     sigc::signal<void, Pass&> signal_render_pass_finished_;
 
     Partitioner::ptr partitioner_;
+
+    //Vectors rather than sets so queueing doesn't allocate once they're big enough, duplicates
+    //are dropped when they're flushed
+    std::vector<MeshID> relocated_meshes_;
+    std::vector<LightID> relocated_lights_;
+
+    ComponentStore components_;
+
+    std::vector<Object*> update_list_; ///< Removals during update() leave a nullptr until it finishes
+    std::vector<Object*> pending_updates_; ///< Added during update(), joins update_list_ afterwards
+    boost::mutex update_list_lock_;
+    bool updating_;
+    bool update_list_has_gaps_;
+    bool parallel_updates_;
+
+    //Scratch space for sorting the update list into levels
+    std::vector<uint32_t> update_depths_;
+    std::vector<uint32_t> level_offsets_;
+    std::vector<uint32_t> level_cursors_;
+    std::vector<uint32_t> update_order_; ///< Indices into update_list_, shallowest first
+
+    static const uint32_t UPDATE_GRAIN = 64; ///< Objects per chunk when updating in parallel
+
+    void update_objects(double dt);
+    void compact_update_list();
+
+    boost::mutex relocation_lock_; ///< Objects can move on worker threads during update()
+
+    std::vector<MaterialID> animated_materials_;
+    std::vector<MaterialID> changed_materials_; ///< Waiting to be published
 };
 
 }
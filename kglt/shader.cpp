@@ -3,6 +3,7 @@
 
 #include "glee/GLee.h"
 #include "utils/gl_error.h"
+#include "utils/gl_thread.h"
 #include "kazbase/logging/logging.h"
 #include "kazbase/exceptions.h"
 #include "kazbase/list_utils.h"
@@ -57,40 +58,74 @@ void ShaderParams::set_colour(const std::string& uniform_name, const Colour& val
 ShaderProgram::ShaderProgram(Scene *scene, ShaderID id):
     generic::Identifiable<ShaderID>(id),
     program_id_(0),
+    link_pending_(false),
     params_(*this) {
 
     for(uint32_t i = 0; i < SHADER_TYPE_MAX; ++i) {
         shader_ids_[i] = 0;
+        compile_pending_[i] = false;
     }
 }
 
 ShaderProgram::~ShaderProgram() {
-    try {
-        for(uint32_t i = 0; i < ShaderType::SHADER_TYPE_MAX; ++i) {
-            if(shader_ids_[i] != 0) {
-                glDeleteShader(shader_ids_[i]);
-            }
+    std::vector<GLuint> shaders;
+    for(uint32_t i = 0; i < ShaderType::SHADER_TYPE_MAX; ++i) {
+        if(shader_ids_[i] != 0) {
+            shaders.push_back(shader_ids_[i]);
         }
+    }
 
-        if(program_id_) {
-            glDeleteProgram(program_id_);
-        }
-        check_and_log_error(__FILE__, __LINE__);
-    } catch (...) { }
+    GLuint program = program_id_;
+    if(shaders.empty() && !program) {
+        return;
+    }
+
+    //We might be going away on a loading thread
+    run_on_gl_thread([=]() {
+        try {
+            for(GLuint shader: shaders) {
+                glDeleteShader(shader);
+            }
+
+            if(program) {
+                glDeleteProgram(program);
+            }
+            check_and_log_error(__FILE__, __LINE__);
+        } catch (...) { }
+    });
 }
 
 void ShaderProgram::activate() {
+    build();
 
     glUseProgram(program_id_);
     check_and_log_error(__FILE__, __LINE__);
 }
 
 void ShaderProgram::bind_attrib(uint32_t idx, const std::string& name) {
-    glBindAttribLocation(program_id_, idx, name.c_str());
-    check_and_log_error(__FILE__, __LINE__);
+    //Takes effect when the program is next linked, same as glBindAttribLocation
+    attrib_bindings_[idx] = name;
 }
 
 void ShaderProgram::add_and_compile(ShaderType type, const std::string& source) {
+    if(type != ShaderType::SHADER_TYPE_VERTEX && type != ShaderType::SHADER_TYPE_FRAGMENT) {
+        throw std::logic_error("Invalid shader type");
+    }
+
+    sources_[type] = source;
+    compile_pending_[type] = true;
+    link_pending_ = true;
+}
+
+void ShaderProgram::relink() {
+    link_pending_ = true;
+}
+
+void ShaderProgram::build() {
+    if(!link_pending_) {
+        return;
+    }
+
     check_and_log_error(__FILE__, __LINE__);
 
     if(program_id_ == 0) {
@@ -98,61 +133,69 @@ void ShaderProgram::add_and_compile(ShaderType type, const std::string& source)
         check_and_log_error(__FILE__, __LINE__);
     }
 
-    if(shader_ids_[type] != 0) {
-        glDeleteShader(shader_ids_[type]);
-        shader_ids_[type] = 0;
-        check_and_log_error(__FILE__, __LINE__);
-    }
+    for(uint32_t type = 0; type < ShaderType::SHADER_TYPE_MAX; ++type) {
+        if(!compile_pending_[type]) {
+            continue;
+        }
+        compile_pending_[type] = false;
+
+        if(shader_ids_[type] != 0) {
+            glDetachShader(program_id_, shader_ids_[type]);
+            glDeleteShader(shader_ids_[type]);
+            shader_ids_[type] = 0;
+            check_and_log_error(__FILE__, __LINE__);
+        }
 
-    GLuint shader_type;
-    switch(type) {
-        case ShaderType::SHADER_TYPE_VERTEX: {
+        GLuint shader_type;
+        if(type == ShaderType::SHADER_TYPE_VERTEX) {
             L_DEBUG("Adding vertex shader");
             shader_type = GL_VERTEX_SHADER;
-        } break;
-        case ShaderType::SHADER_TYPE_FRAGMENT: {
+        } else {
             L_DEBUG("Adding fragment shader");
             shader_type = GL_FRAGMENT_SHADER;
-        } break;
-        default:
-            throw std::logic_error("Invalid shader type");
-    }
-    check_and_log_error(__FILE__, __LINE__);
-    GLuint shader = glCreateShader(shader_type);
-    check_and_log_error(__FILE__, __LINE__);
-    shader_ids_[type] = shader;
+        }
 
-    const char* c_str = source.c_str();
-    glShaderSource(shader, 1, &c_str, nullptr);
-    check_and_log_error(__FILE__, __LINE__);
+        GLuint shader = glCreateShader(shader_type);
+        check_and_log_error(__FILE__, __LINE__);
+        shader_ids_[type] = shader;
 
-    glCompileShader(shader);
-    check_and_log_error(__FILE__, __LINE__);
+        const char* c_str = sources_[type].c_str();
+        glShaderSource(shader, 1, &c_str, nullptr);
+        check_and_log_error(__FILE__, __LINE__);
 
-    GLint compiled = 0;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-    if(!compiled) {
-        GLint length;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        glCompileShader(shader);
+        check_and_log_error(__FILE__, __LINE__);
 
-        std::vector<char> log;
-        log.resize(length);
+        GLint compiled = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if(!compiled) {
+            GLint length;
+            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
 
-        glGetShaderInfoLog(shader, length, NULL, &log[0]);
-        L_ERROR(std::string(log.begin(), log.end()));
+            std::vector<char> log;
+            log.resize(length);
+
+            glGetShaderInfoLog(shader, length, NULL, &log[0]);
+            L_ERROR(std::string(log.begin(), log.end()));
+        }
+        assert(compiled);
+        assert(program_id_);
+        assert(shader);
+
+        //GL keeps its own copy
+        sources_[type].clear();
+
+        glAttachShader(program_id_, shader);
+        check_and_log_error(__FILE__, __LINE__);
     }
-    assert(compiled);
-    assert(program_id_);
-    assert(shader);
 
-    check_and_log_error(__FILE__, __LINE__);
-    glAttachShader(program_id_, shader);
-    check_and_log_error(__FILE__, __LINE__);
+    for(std::pair<const uint32_t, std::string>& binding: attrib_bindings_) {
+        glBindAttribLocation(program_id_, binding.first, binding.second.c_str());
+        check_and_log_error(__FILE__, __LINE__);
+    }
 
-    relink();
-}
+    link_pending_ = false;
 
-void ShaderProgram::relink() {
     glLinkProgram(program_id_);
     check_and_log_error(__FILE__, __LINE__);
 
@@ -169,9 +212,14 @@ void ShaderProgram::relink() {
         L_ERROR(std::string(log.begin(), log.end()));
     }
     assert(linked);
+
+    //Locations can move when a program is relinked
+    cached_uniform_locations_.clear();
 }
 
 int32_t ShaderProgram::get_attrib_loc(const std::string& name) {
+    build();
+
     GLint location = glGetAttribLocation(program_id_, name.c_str());
     if(location < 0) {
         L_WARN("No attribute with name: " + name);
@@ -181,6 +229,8 @@ int32_t ShaderProgram::get_attrib_loc(const std::string& name) {
 }
 
 int32_t ShaderProgram::get_uniform_loc(const std::string& name) {
+    build();
+
     if(container::contains(cached_uniform_locations_, name)) {
         return cached_uniform_locations_[name];
     }
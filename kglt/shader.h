@@ -2,6 +2,7 @@
 #define SHADER_H_INCLUDED
 
 #include <set>
+#include <map>
 #include <string>
 #include <tr1/memory>
 
@@ -131,6 +132,11 @@ public:
     ShaderProgram(Scene* scene, ShaderID id);
     ~ShaderProgram();
 
+    /*
+     *  add_and_compile(), bind_attrib() and relink() only record what to do, so a program
+     *  can be put together on any thread. The GL program is built the next time it's
+     *  activated or queried, which has to be on the GL thread.
+     */
     void activate();
     void add_and_compile(ShaderType type, const std::string& source);
 
@@ -155,9 +161,16 @@ private:
     ShaderProgram(const ShaderProgram& rhs);
     ShaderProgram& operator=(const ShaderProgram& rhs);
 
+    void build();
+
     uint32_t program_id_;
     uint32_t shader_ids_[SHADER_TYPE_MAX];
 
+    std::string sources_[SHADER_TYPE_MAX];
+    bool compile_pending_[SHADER_TYPE_MAX];
+    std::map<uint32_t, std::string> attrib_bindings_;
+    bool link_pending_;
+
     std::map<std::string, int32_t> cached_uniform_locations_;
 
     ShaderParams params_;
@@ -8,6 +8,7 @@ namespace kglt {
 
 void Text::apply_font(FontID font_id) {
     applied_font_ = font_id;
+    mark_render_state_dirty();
 }
 
 uint32_t Text::length() const {
@@ -20,12 +21,21 @@ double Text::width_in_pixels() {
 
 void Text::set_text(const std::string& utf8_text) {
     text_ = utf8_text;
+    mark_render_state_dirty();
 }
 
 Font& Text::font() {
     return scene().font(applied_font_);
 }
 
+void Text::publish() {
+    Object::publish();
+
+    text_state_.text = text_;
+    text_state_.font = applied_font_;
+    text_state_.font_size = applied_font_ ? font().size() : 0;
+}
+
 
 }
 
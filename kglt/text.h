@@ -23,7 +23,8 @@ public:
 
     Text(Scene* scene, TextID id=0):
         Object(scene),
-        generic::Identifiable<TextID>(id) {}
+        generic::Identifiable<TextID>(id),
+        applied_font_(0) {}
 
     void apply_font(FontID font_id);
     Font& font();
@@ -36,7 +37,26 @@ public:
     void set_colour(const kglt::Colour& colour) { colour_ = colour; }
     kglt::Colour& colour() { return colour_; }
 
+    /*
+     *  What the renderer draws, as of the last publish (see Object::render_state())
+     */
+    struct TextRenderState {
+        TextRenderState():
+            font(0),
+            font_size(0) {}
+
+        std::string text;
+        FontID font; ///< 0 until a font is applied
+        uint32_t font_size;
+    };
+
+    const TextRenderState& text_state() const { return text_state_; }
+
 private:
+    void publish();
+
+    TextRenderState text_state_;
+
     FontID applied_font_;
     std::string text_;
 
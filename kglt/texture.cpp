@@ -4,12 +4,14 @@
 
 #include "glee/GLee.h"
 #include "texture.h"
+#include "utils/gl_thread.h"
 
 namespace kglt {
 
 Texture::~Texture() {
     if(gl_tex_) {
-        glDeleteTextures(1, &gl_tex_);
+        GLuint tex = gl_tex_;
+        run_on_gl_thread([=]() { glDeleteTextures(1, &tex); });
     }
 }
 
@@ -27,15 +29,32 @@ void Texture::resize(uint32_t width, uint32_t height) {
 }
 
 void Texture::upload(bool free_after, bool generate_mipmaps, bool repeat) {
+    free_after_upload_ = free_after;
+    generate_mipmaps_ = generate_mipmaps;
+    repeat_ = repeat;
+    __atomic_store_n(&upload_pending_, true, __ATOMIC_RELEASE); //Publishes the data with it
+}
+
+uint32_t Texture::gl_tex() {
+    if(upload_pending()) {
+        do_upload();
+    }
+    return gl_tex_;
+}
+
+void Texture::do_upload() {
     assert(glGetError() == GL_NO_ERROR);
 
-    if(!gl_tex()) {
+    //Cleared first, so an upload() that comes in while this runs isn't lost
+    __atomic_store_n(&upload_pending_, false, __ATOMIC_RELEASE);
+
+    if(!gl_tex_) {
         glGenTextures(1, &gl_tex_);
     }
 
     glBindTexture(GL_TEXTURE_2D, gl_tex_);
 
-    if(repeat) {
+    if(repeat_) {
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     } else {
@@ -46,7 +65,7 @@ void Texture::upload(bool free_after, bool generate_mipmaps, bool repeat) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    if(generate_mipmaps) {
+    if(generate_mipmaps_) {
         glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
     }
 
@@ -64,7 +83,7 @@ void Texture::upload(bool free_after, bool generate_mipmaps, bool repeat) {
         throw std::runtime_error("OpenGL error: " + boost::lexical_cast<std::string>(error));
     }
 
-    if(free_after) {
+    if(free_after_upload_) {
         free();
     }
 }
@@ -19,14 +19,23 @@ public:
     typedef std::tr1::shared_ptr<Texture> ptr;
     typedef std::vector<uint8_t> Data;
 
-    uint32_t gl_tex() const { return gl_tex_; }
+    /*
+     *  The GL texture, created and uploaded here if upload() has been called since it was
+     *  last used. So only call this on the GL thread, everything else works anywhere.
+     */
+    uint32_t gl_tex();
+    bool upload_pending() const { return __atomic_load_n(&upload_pending_, __ATOMIC_ACQUIRE); }
 
     Texture(Scene* scene, TextureID id):
         generic::Identifiable<TextureID>(id),
         width_(0),
         height_(0),
         bpp_(32),
-        gl_tex_(0) { }
+        gl_tex_(0),
+        upload_pending_(false),
+        free_after_upload_(true),
+        generate_mipmaps_(true),
+        repeat_(true) { }
 
     ~Texture();
 
@@ -34,7 +43,7 @@ public:
     void resize(uint32_t width, uint32_t height);
     void upload(bool free_after=true,
                 bool generate_mipmaps=true,
-                bool repeat=true); //Upload to GL, initializes the tex ID
+                bool repeat=true); //Upload to GL the next time the texture is used
     void free(); //Frees the data used to construct the texture
 
     uint32_t width() const { return width_; }
@@ -50,6 +59,13 @@ private:
     Texture::Data data_;
 
     uint32_t gl_tex_;
+
+    bool upload_pending_; ///< Set by upload() on any thread, cleared by the GL thread
+    bool free_after_upload_;
+    bool generate_mipmaps_;
+    bool repeat_;
+
+    void do_upload();
 };
 
 }
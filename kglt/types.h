@@ -38,6 +38,26 @@ struct Vec2 : public kmVec2 {
     }
 };
 
+struct AABB {
+    kmVec3 min;
+    kmVec3 max;
+
+    AABB() {
+        kmVec3Zero(&min);
+        kmVec3Zero(&max);
+    }
+
+    double width() const { return max.x - min.x; }
+    double height() const { return max.y - min.y; }
+    double depth() const { return max.z - min.z; }
+
+    bool contains_point(const kmVec3& p) const {
+        return p.x >= min.x && p.x <= max.x &&
+               p.y >= min.y && p.y <= max.y &&
+               p.z >= min.z && p.z <= max.z;
+    }
+};
+
 
 //FIXME: Should be something like UniqueID<0>, UniqueID<1> or something so that
 //IDs can't be incorrectly passed
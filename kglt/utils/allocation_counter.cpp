@@ -0,0 +1,46 @@
+#include <new>
+#include <cstdlib>
+
+#include "allocation_counter.h"
+
+#ifdef KGLT_COUNT_ALLOCATIONS
+
+//Zero-initialized before any constructors run, so it's safe to use from operator new
+static uint64_t allocation_count = 0;
+
+void* operator new(std::size_t size) {
+    //Worker threads allocate too, so the count has to be atomic
+    __sync_fetch_and_add(&allocation_count, 1);
+
+    void* result = std::malloc(size ? size : 1);
+    if(!result) {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void operator delete(void* ptr) throw() {
+    std::free(ptr);
+}
+
+#endif
+
+namespace kglt {
+
+bool allocation_counting_enabled() {
+#ifdef KGLT_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t heap_allocation_count() {
+#ifdef KGLT_COUNT_ALLOCATIONS
+    return __sync_fetch_and_add(&allocation_count, 0);
+#else
+    return 0;
+#endif
+}
+
+}
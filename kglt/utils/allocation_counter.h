@@ -0,0 +1,19 @@
+#ifndef KGLT_ALLOCATION_COUNTER_H
+#define KGLT_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+namespace kglt {
+
+/*
+ *  Configure with -DKGLT_COUNT_ALLOCATIONS=ON to replace the global operator new with one
+ *  that counts every call, and WindowBase will log how many heap allocations each frame
+ *  made. It's meant for finding allocations on the per-frame path, so leave it off
+ *  otherwise.
+ */
+bool allocation_counting_enabled();
+uint64_t heap_allocation_count(); ///< Calls to operator new so far, always 0 unless counting is enabled
+
+}
+
+#endif // KGLT_ALLOCATION_COUNTER_H
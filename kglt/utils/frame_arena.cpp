@@ -0,0 +1,82 @@
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+
+#include "frame_arena.h"
+
+namespace kglt {
+
+static char* allocate_block(std::size_t size) {
+    char* data = static_cast<char*>(std::malloc(size));
+    if(!data) {
+        throw std::bad_alloc();
+    }
+    return data;
+}
+
+FrameArena::FrameArena(std::size_t initial_size):
+    offset_(0),
+    used_(0) {
+
+    //Room for a few extra blocks, so growing mid-frame doesn't reallocate the list too
+    blocks_.reserve(8);
+
+    Block block = { allocate_block(initial_size), initial_size };
+    blocks_.push_back(block);
+}
+
+FrameArena::~FrameArena() {
+    for(Block& block: blocks_) {
+        std::free(block.data);
+    }
+}
+
+void* FrameArena::allocate(std::size_t size, std::size_t alignment) {
+    assert(alignment && !(alignment & (alignment - 1)) && "Alignment must be a power of two");
+
+    Block* block = &blocks_.back();
+
+    std::size_t start = (offset_ + alignment - 1) & ~(alignment - 1);
+    if(start + size > block->size) {
+        //Doesn't fit, start another block at least twice the size of the last one
+        Block extra = { nullptr, std::max(block->size * 2, size + alignment) };
+        extra.data = allocate_block(extra.size);
+        blocks_.push_back(extra);
+
+        block = &blocks_.back();
+        start = 0;
+    }
+
+    //malloc'd blocks are aligned for anything, so aligning the offset is enough
+    offset_ = start + size;
+    used_ += size;
+    return block->data + start;
+}
+
+void FrameArena::reset() {
+    if(blocks_.size() > 1) {
+        //The frame overflowed, replace everything with one block that would've been big enough
+        std::size_t total = capacity();
+
+        for(Block& block: blocks_) {
+            std::free(block.data);
+        }
+        blocks_.clear();
+
+        Block block = { allocate_block(total), total };
+        blocks_.push_back(block);
+    }
+
+    offset_ = 0;
+    used_ = 0;
+}
+
+std::size_t FrameArena::capacity() const {
+    std::size_t total = 0;
+    for(const Block& block: blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+}
@@ -0,0 +1,130 @@
+#ifndef KGLT_FRAME_ARENA_H
+#define KGLT_FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <utility>
+
+namespace kglt {
+
+/*
+ *  A bump allocator for things that only live for a frame. allocate() just moves a pointer
+ *  along, nothing is freed individually, and reset() at the end of the frame makes all of
+ *  the memory available again.
+ *
+ *  If a frame needs more than the arena has, extra blocks are taken from the heap. The next
+ *  reset() swaps them all for one block big enough for the whole frame, so after the first
+ *  few frames the arena stops touching the heap at all.
+ */
+class FrameArena {
+public:
+    FrameArena(std::size_t initial_size=64 * 1024);
+    ~FrameArena();
+
+    void* allocate(std::size_t size, std::size_t alignment);
+    void reset();
+
+    std::size_t capacity() const;
+    std::size_t used() const { return used_; } ///< Bytes handed out since the last reset()
+    uint32_t block_count() const { return blocks_.size(); }
+
+private:
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+
+    struct Block {
+        char* data;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    std::size_t offset_; ///< Position in the last block
+    std::size_t used_;
+};
+
+/*
+ *  An STL allocator that takes memory from a FrameArena. Deallocating does nothing, the
+ *  memory comes back when the arena is reset, so containers using it must not outlive
+ *  the frame. Without an arena it falls back to the heap.
+ */
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator(FrameArena* arena=nullptr):
+        arena_(arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other):
+        arena_(other.arena()) {}
+
+    pointer allocate(size_type n, const void* hint=0) {
+        if(!arena_) {
+            return static_cast<pointer>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<pointer>(arena_->allocate(n * sizeof(T), __alignof__(T)));
+    }
+
+    void deallocate(pointer p, size_type n) {
+        if(!arena_) {
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new((void*) p) U(std::forward<Args>(args)...);
+    }
+
+    template<typename U>
+    void destroy(U* p) {
+        p->~U();
+    }
+
+    size_type max_size() const { return std::size_t(-1) / sizeof(T); }
+
+    pointer address(reference r) const { return &r; }
+    const_pointer address(const_reference r) const { return &r; }
+
+    FrameArena* arena() const { return arena_; }
+
+private:
+    FrameArena* arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+    return lhs.arena() == rhs.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+    return lhs.arena() != rhs.arena();
+}
+
+/*
+ *  FrameVector<T>::type is a std::vector that allocates from a FrameArena, e.g.
+ *  FrameVector<Overlay*>::type overlays((ArenaAllocator<Overlay*>(&arena)));
+ */
+template<typename T>
+struct FrameVector {
+    typedef std::vector<T, ArenaAllocator<T> > type;
+};
+
+}
+
+#endif // KGLT_FRAME_ARENA_H
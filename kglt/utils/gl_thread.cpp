@@ -0,0 +1,129 @@
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "gl_thread.h"
+
+namespace kglt {
+
+struct GLThreadTask {
+    std::tr1::function<void ()> run;
+    std::tr1::function<void ()> abandon; ///< Called instead of run if the GL thread changes first
+};
+
+static boost::mutex gl_thread_lock;
+static std::vector<GLThreadTask> gl_thread_tasks;
+static std::tr1::function<void ()> gl_thread_wake;
+
+//Bumped by every set_gl_thread(), the thread that called it last is the only one that matches.
+//on_gl_thread() is called for every GL object that's touched, so it doesn't take the lock
+static std::atomic<uint32_t> gl_thread_generation(0);
+static __thread uint32_t this_thread_generation = 0;
+
+void set_gl_thread(std::tr1::function<void ()> on_task_queued) {
+    std::vector<GLThreadTask> abandoned;
+    {
+        boost::mutex::scoped_lock lock(gl_thread_lock);
+        this_thread_generation = ++gl_thread_generation;
+        gl_thread_wake = on_task_queued;
+
+        //The names they refer to belonged to another context
+        abandoned.swap(gl_thread_tasks);
+    }
+
+    //Anyone waiting on them would otherwise wait forever
+    for(GLThreadTask& task: abandoned) {
+        if(task.abandon) {
+            task.abandon();
+        }
+    }
+}
+
+bool on_gl_thread() {
+    uint32_t generation = gl_thread_generation;
+    return !generation || generation == this_thread_generation;
+}
+
+static void queue_gl_thread_task(const GLThreadTask& task) {
+    std::tr1::function<void ()> wake;
+    {
+        boost::mutex::scoped_lock lock(gl_thread_lock);
+        gl_thread_tasks.push_back(task);
+        wake = gl_thread_wake;
+    }
+
+    if(wake) {
+        wake();
+    }
+}
+
+void run_on_gl_thread(std::tr1::function<void ()> func) {
+    if(on_gl_thread()) {
+        func();
+        return;
+    }
+
+    GLThreadTask task;
+    task.run = func;
+    queue_gl_thread_task(task);
+}
+
+void run_on_gl_thread_and_wait(std::tr1::function<void ()> func) {
+    if(on_gl_thread()) {
+        func();
+        return;
+    }
+
+    boost::mutex done_lock;
+    boost::condition_variable done_changed;
+    bool done = false;
+    std::exception_ptr error;
+
+    GLThreadTask task;
+    task.run = [&]() {
+        try {
+            func();
+        } catch(...) {
+            error = std::current_exception();
+        }
+
+        boost::mutex::scoped_lock lock(done_lock);
+        done = true;
+        done_changed.notify_all();
+    };
+    task.abandon = [&]() {
+        boost::mutex::scoped_lock lock(done_lock);
+        error = std::make_exception_ptr(std::runtime_error("The GL thread changed before this could run"));
+        done = true;
+        done_changed.notify_all();
+    };
+    queue_gl_thread_task(task);
+
+    boost::mutex::scoped_lock lock(done_lock);
+    while(!done) {
+        done_changed.wait(lock);
+    }
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void run_gl_thread_tasks() {
+    std::vector<GLThreadTask> tasks;
+    {
+        boost::mutex::scoped_lock lock(gl_thread_lock);
+        tasks.swap(gl_thread_tasks);
+    }
+
+    for(GLThreadTask& task: tasks) {
+        task.run();
+    }
+}
+
+}
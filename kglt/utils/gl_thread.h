@@ -0,0 +1,33 @@
+#ifndef KGLT_GL_THREAD_H
+#define KGLT_GL_THREAD_H
+
+#include <tr1/functional>
+
+namespace kglt {
+
+/*
+ *  GL calls have to come from the thread that owns the context. Textures, shaders, fonts
+ *  and meshes can be built and filled on any thread, and only create their GL objects
+ *  when they're first used for rendering, which is always on that thread. These let
+ *  them tidy up the same way when they're destroyed somewhere else.
+ *
+ *  Until set_gl_thread() is called every thread counts as the GL thread.
+ */
+
+/*
+ *  Called by the window on the thread that owns the context (its render thread, if it
+ *  has one). Anything still queued for a previous context is dropped, and anyone
+ *  blocked in run_on_gl_thread_and_wait() on it gets an exception instead. If given,
+ *  on_task_queued is called whenever another thread queues something, so a GL thread
+ *  that sleeps between frames knows to wake up.
+ */
+void set_gl_thread(std::tr1::function<void ()> on_task_queued=std::tr1::function<void ()>());
+bool on_gl_thread();
+
+void run_on_gl_thread(std::tr1::function<void ()> func); ///< Runs it now on the GL thread, otherwise queues it
+void run_on_gl_thread_and_wait(std::tr1::function<void ()> func); ///< As above, but blocks until it has run. Rethrows anything it threw
+void run_gl_thread_tasks(); ///< Runs anything queued, the window calls this every frame
+
+}
+
+#endif // KGLT_GL_THREAD_H
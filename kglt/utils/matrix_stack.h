@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <stack>
+#include <vector>
 #include "kazmath/mat4.h"
 
 class MatrixStack {
@@ -32,7 +33,7 @@ public:
     }
 
 private:
-    std::stack<kmMat4> stack_;
+    std::stack<kmMat4, std::vector<kmMat4> > stack_; ///< A vector, unlike a deque, keeps its memory when popped
 };
 
 #endif
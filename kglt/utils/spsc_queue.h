@@ -0,0 +1,71 @@
+#ifndef KGLT_SPSC_QUEUE_H
+#define KGLT_SPSC_QUEUE_H
+
+#include <cstdint>
+
+namespace kglt {
+
+/*
+ *  A fixed size queue for handing things from exactly one producer thread to exactly one
+ *  consumer thread without locking. push() is only called by the producer and pop() only
+ *  by the consumer. Neither blocks: push() fails when the queue is full and pop() fails
+ *  when it's empty, it's up to the caller to wait (see WindowBase's frame packets).
+ *
+ *  head_ and tail_ only ever increase and are kept on separate cache lines, so the two
+ *  threads don't fight over them. Whatever was written to an item before push() is
+ *  visible to the thread that pops it.
+ */
+template<typename T, uint32_t Capacity>
+class SPSCQueue {
+    //So the positions can wrap around without skipping a slot
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+public:
+    SPSCQueue():
+        head_(0),
+        tail_(0) {}
+
+    bool push(const T& item) {
+        uint32_t tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        if(tail - __atomic_load_n(&head_, __ATOMIC_ACQUIRE) == Capacity) {
+            return false;
+        }
+
+        items_[tail % Capacity] = item;
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint32_t head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        if(head == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+
+        item = items_[head % Capacity];
+        __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool empty() const {
+        return __atomic_load_n(&head_, __ATOMIC_ACQUIRE) == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+    }
+
+    static uint32_t capacity() { return Capacity; }
+
+private:
+    SPSCQueue(const SPSCQueue&);
+    SPSCQueue& operator=(const SPSCQueue&);
+
+    T items_[Capacity];
+
+    char pad0_[64];
+    uint32_t head_; ///< Next item to pop, only written by the consumer
+    char pad1_[64];
+    uint32_t tail_; ///< Next slot to push into, only written by the producer
+    char pad2_[64];
+};
+
+}
+
+#endif // KGLT_SPSC_QUEUE_H
@@ -6,34 +6,53 @@
 
 namespace kglt {
 
-Window::Window(int width, int height, int bpp) {
+Window::Window(int width, int height, int bpp, bool threaded_rendering):
+    surface_(nullptr),
+    requested_width_(width),
+    requested_height_(height),
+    requested_bpp_(bpp) {
+
 	if(SDL_Init(SDL_INIT_VIDEO) < 0) {
 		throw std::runtime_error("Unable to initialize SDL");
 	}
 
-	create_gl_window(width, height, bpp);
+    if(threaded_rendering) {
+        start_render_thread();
+    } else {
+        create_gl_context();
+    }
 }
 
 Window::~Window() {
+    stop_render_thread();
 	SDL_Quit();
 }
 
 void Window::set_title(const std::string& title) {
-    SDL_WM_SetCaption(title.c_str(), NULL);
+    //SDL 1.2 expects window calls from the thread that set the video mode
+    run_on_gl_thread([=]() { SDL_WM_SetCaption(title.c_str(), NULL); });
 }
 
 void Window::show_cursor(bool value) {
-	SDL_ShowCursor(value);
+    run_on_gl_thread([=]() { SDL_ShowCursor(value); });
 }
 
 void Window::cursor_position(int32_t& mouse_x, int32_t& mouse_y) {
 	SDL_GetMouseState(&mouse_x, &mouse_y);
 }
 
+void Window::pump_events() {
+    SDL_PumpEvents();
+}
+
 void Window::check_events() {
-    SDL_Event event;
+    if(!rendering_threaded()) {
+        pump_events();
+    }
 
-    while(SDL_PollEvent(&event)) {
+    //The render thread pumps the events when there is one, reading the queue is safe from here
+    SDL_Event event;
+    while(SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) > 0) {
         switch(event.type) {
             case SDL_KEYDOWN:
                 signal_key_pressed_((KeyCode)event.key.keysym.sym);
@@ -54,6 +73,10 @@ void Window::check_events() {
     }
 }
 
+void Window::create_gl_context() {
+    create_gl_window(requested_width_, requested_height_, requested_bpp_);
+}
+
 void Window::create_gl_window(int width, int height, int bpp) {
 //    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 //    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
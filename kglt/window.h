@@ -12,7 +12,11 @@ class Window : public WindowBase {
 public:
     typedef std::tr1::shared_ptr<Window> ptr;
 
-    Window(int width=640, int height=480, int bpp=0);
+    /*
+     *  With threaded_rendering the GL context lives on a render thread (see WindowBase),
+     *  and render pass signals are emitted there.
+     */
+    Window(int width=640, int height=480, int bpp=0, bool threaded_rendering=false);
     virtual ~Window();
 
     void set_title(const std::string& title);
@@ -22,16 +26,21 @@ public:
     sigc::signal<void, KeyCode>& signal_key_down() { return signal_key_pressed_; }
     sigc::signal<void, KeyCode>& signal_key_up() { return signal_key_released_; }
     
-    static kglt::Window::ptr create(int width=640, int height=480, int bpp=0) {
-        kglt::Window::ptr new_window(new kglt::Window(width, height, bpp));
+    static kglt::Window::ptr create(int width=640, int height=480, int bpp=0, bool threaded_rendering=false) {
+        kglt::Window::ptr new_window(new kglt::Window(width, height, bpp, threaded_rendering));
         new_window->init();
         return new_window;
     }
 
 private:
     SDL_Surface* surface_;
+    int requested_width_;
+    int requested_height_;
+    int requested_bpp_;
 
+    void create_gl_context();
     void create_gl_window(int width, int height, int bpp);
+    void pump_events();
     void check_events();
     void swap_buffers();
 
@@ -1,8 +1,11 @@
 #include <boost/thread/thread.hpp>
 
+#include <boost/lexical_cast.hpp>
+
 #include "glee/GLee.h"
 #include "window_base.h"
 #include "scene.h"
+#include "utils/allocation_counter.h"
 
 namespace kglt {
     
@@ -21,24 +24,190 @@ bool WindowBase::update() {
     init(); //Make sure we were initialized
 
     idle_.execute(); //Execute idle tasks first   
+    if(!rendering_threaded()) {
+        run_gl_thread_tasks(); //Then delete anything released off the GL thread
+    }
     check_events();
 
     ktiUpdateFrameTime();
 
+    scene().update(delta_time());
+
+    //Waits for the render thread to record the last frame, if we're a whole frame ahead
+    scene().publish_frame();
+    uint64_t frame = ++frames_submitted_;
+
+    if(rendering_threaded()) {
+        bool pushed = submitted_.push(frame);
+        assert(pushed && "The last frame should have been taken before publishing");
+        (void) pushed;
+
+        wake_render_thread();
+    } else {
+        render_frame(frame);
+    }
+
+    run_rendered_frame_tasks();
+
+    frame_arena_.reset();
+
+    if(allocation_counting_enabled()) {
+        uint64_t previous = allocations_last_frame_;
+        allocations_last_frame_ = heap_allocation_count() - allocations_at_frame_start_;
+
+        if(allocations_last_frame_ != previous) {
+            L_DEBUG("Heap allocations per frame: " + boost::lexical_cast<std::string>(allocations_last_frame_));
+        }
+
+        //Start counting after logging, so the log message isn't counted as part of the next frame
+        allocations_at_frame_start_ = heap_allocation_count();
+    }
+
+    if(!rendering_threaded()) {
+        //With a render thread, waiting for it to record paces the frames instead
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    
+    return is_running_;
+}
+
+void WindowBase::render_frame(uint64_t frame) {
+    packet_.clear();
+    packet_.frame = frame;
+    scene().prepare_frame(packet_);
+
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    scene().update(delta_time());
-
-    scene().render();
+    scene().render_frame(packet_);
 
     swap_buffers();
 
-    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
-    
-    return is_running_;
+    __atomic_store_n(&frames_rendered_, frame, __ATOMIC_RELEASE);
+}
+
+void WindowBase::start_render_thread() {
+    assert(!render_thread_running_);
+
+    render_thread_ = boost::thread(std::tr1::bind(&WindowBase::render_thread_main, this));
+
+    {
+        boost::mutex::scoped_lock lock(render_lock_);
+        while(!render_thread_ready_) {
+            render_thread_wake_.wait(lock);
+        }
+    }
+
+    if(render_thread_error_) {
+        render_thread_.join();
+        std::rethrow_exception(render_thread_error_);
+    }
+
+    render_thread_running_ = true;
+}
+
+void WindowBase::stop_render_thread() {
+    if(!render_thread_running_) {
+        return;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(render_lock_);
+        render_thread_stopping_ = true;
+        render_thread_wake_.notify_all();
+    }
+
+    render_thread_.join();
+    render_thread_running_ = false;
+
+    //Nothing is drawing any more, the context isn't current here but that's no worse than after it's destroyed
+    set_gl_thread();
+    run_rendered_frame_tasks();
+}
+
+void WindowBase::render_thread_main() {
+    try {
+        create_gl_context();
+    } catch(...) {
+        render_thread_error_ = std::current_exception();
+    }
+
+    if(!render_thread_error_) {
+        set_gl_thread(std::tr1::bind(&WindowBase::wake_render_thread, this));
+    }
+
+    {
+        boost::mutex::scoped_lock lock(render_lock_);
+        render_thread_ready_ = true;
+        render_thread_wake_.notify_all();
+    }
+
+    if(render_thread_error_) {
+        return;
+    }
+
+    while(true) {
+        pump_events();
+        run_gl_thread_tasks();
+
+        uint64_t frame = 0;
+        if(!submitted_.pop(frame)) {
+            boost::mutex::scoped_lock lock(render_lock_);
+            if(render_thread_stopping_) {
+                break;
+            }
+
+            if(!render_thread_woken_ && submitted_.empty()) {
+                //Wake now and then anyway, so events are pumped while the game thread is busy
+                render_thread_wake_.timed_wait(lock, boost::posix_time::milliseconds(10));
+            }
+            render_thread_woken_ = false;
+            continue;
+        }
+
+        render_frame(frame);
+    }
+
+    run_gl_thread_tasks(); //Anything released while we were stopping
+}
+
+void WindowBase::wake_render_thread() {
+    boost::mutex::scoped_lock lock(render_lock_);
+    render_thread_woken_ = true;
+    render_thread_wake_.notify_all();
+}
+
+void WindowBase::after_frames_rendered(std::tr1::function<void ()> func) {
+    if(!rendering_threaded()) {
+        func();
+        return;
+    }
+
+    //The frame being recorded may still pick it up, so wait for that one too
+    rendered_frame_tasks_.push_back(std::make_pair(frames_submitted_ + 1, func));
+}
+
+void WindowBase::run_rendered_frame_tasks() {
+    if(rendered_frame_tasks_.empty()) {
+        return;
+    }
+
+    //Tasks are queued in frame order, so the ones that are ready come first
+    uint64_t rendered = rendering_threaded() ? __atomic_load_n(&frames_rendered_, __ATOMIC_ACQUIRE) : UINT64_MAX;
+    std::vector<RenderedFrameTask>::iterator end = rendered_frame_tasks_.begin();
+    while(end != rendered_frame_tasks_.end() && (*end).first <= rendered) {
+        ++end;
+    }
+
+    //Tasks may queue more tasks
+    std::vector<RenderedFrameTask> ready(rendered_frame_tasks_.begin(), end);
+    rendered_frame_tasks_.erase(rendered_frame_tasks_.begin(), end);
+
+    for(RenderedFrameTask& task: ready) {
+        task.second();
+    }
 }
 
 Scene& WindowBase::scene() {
@@ -2,16 +2,28 @@
 #define KGLT_WINDOW_BASE_H
 
 #include <tr1/memory>
+#include <tr1/functional>
+#include <vector>
+#include <exception>
 
 #include <sigc++/sigc++.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "keyboard.h"
 
 #include "loaders/texture_loader.h"
 #include "loaders/q2bsp_loader.h"
+#include "loaders/font_loader.h"
 #include "loader.h"
 
 #include "idle_task_manager.h"
+#include "job_system.h"
+#include "utils/frame_arena.h"
+#include "utils/gl_thread.h"
+#include "utils/spsc_queue.h"
+#include "frame_packet.h"
 
 #include "kazbase/logging/logging.h"
 #include "kaztimer/kaztimer.h"
@@ -23,21 +35,33 @@ public:
     WindowBase():
         width_(0),
         height_(0),
-        is_running_(true) {
+        is_running_(true),
+        jobs_(idle_),
+        allocations_at_frame_start_(0),
+        allocations_last_frame_(0),
+        render_thread_running_(false),
+        render_thread_ready_(false),
+        render_thread_stopping_(false),
+        render_thread_woken_(false),
+        frames_submitted_(0),
+        frames_rendered_(0) {
         
         //Register the default resource loaders
         register_loader(LoaderType::ptr(new kglt::loaders::TextureLoaderType));
         register_loader(LoaderType::ptr(new kglt::loaders::Q2BSPLoaderType));
+        register_loader(LoaderType::ptr(new kglt::loaders::FontLoaderType));
 
         ktiGenTimers(1, &timer_);
         ktiBindTimer(timer_);
         ktiStartGameTimer();
+
+        set_gl_thread(); //The subclass creates the context on this thread
     }
     
     void init();
 
     virtual ~WindowBase() {
-        
+        stop_render_thread(); //Subclasses should have done this before tearing down the context
     }
     
     Loader::ptr loader_for(const std::string& filename, const std::string& type_hint) {
@@ -78,6 +102,7 @@ public:
     
     virtual void check_events() = 0;
     virtual void swap_buffers() = 0;
+    virtual void pump_events() {} ///< Collects events from the system, on the thread that created the window
     double delta_time() { return ktiGetDeltaTime(); }
 
     uint32_t width() const { return width_; }
@@ -87,8 +112,37 @@ public:
     bool update();   
 
     IdleTaskManager& idle() { return idle_; }
+    JobSystem& jobs() { return jobs_; }
+
+    FrameArena& frame_arena() { return frame_arena_; } ///< Scratch memory for the current frame, reset after the buffers are swapped
+    uint64_t heap_allocations_last_frame() const { return allocations_last_frame_; } ///< Only counted when built with KGLT_COUNT_ALLOCATIONS
+
+    bool rendering_threaded() const { return render_thread_running_; }
+
+    /*
+     *  Runs func once every frame recorded so far has been drawn, for deleting things the
+     *  render thread might still be using. Without a render thread it runs straight away.
+     *  Game thread only.
+     */
+    void after_frames_rendered(std::tr1::function<void ()> func);
 
 protected:
+    /*
+     *  With threaded rendering the window creates its context on a render thread, which
+     *  owns it from then on: it pumps window events, runs the GL tasks other threads
+     *  queue, and records and draws the frames update() publishes (Scene::publish_frame()).
+     *  update() works on the next frame while the render thread records and draws the
+     *  last one, so game logic, recording and the driver overlap, and it only waits when
+     *  it gets a whole frame ahead. Without one, update() records and draws each frame
+     *  itself.
+     *
+     *  Subclasses call start_render_thread() from their constructor in place of
+     *  create_gl_context(), and stop_render_thread() before they destroy the window.
+     */
+    void start_render_thread(); ///< Returns once create_gl_context() has run on the new thread
+    void stop_render_thread();
+    virtual void create_gl_context() {}
+
     void stop_running() { is_running_ = false; }
     
     void set_width(uint32_t width) { 
@@ -114,11 +168,43 @@ private:
     }
     
     IdleTaskManager idle_;
+    JobSystem jobs_; ///< After idle_, so it's gone before its idle task is
+    FrameArena frame_arena_;
+
+    uint64_t allocations_at_frame_start_;
+    uint64_t allocations_last_frame_;
 
     KTIuint timer_;
 
     void destroy() {}
 
+    void render_frame(uint64_t frame); ///< Records the published frame into packet_ and draws it
+    void render_thread_main();
+    void wake_render_thread();
+    void run_rendered_frame_tasks();
+
+    boost::thread render_thread_;
+    std::exception_ptr render_thread_error_; ///< Thrown by create_gl_context(), rethrown by start_render_thread()
+    bool render_thread_running_;
+    bool render_thread_ready_; ///< These three are guarded by render_lock_
+    bool render_thread_stopping_;
+    bool render_thread_woken_;
+    boost::mutex render_lock_;
+    boost::condition_variable render_thread_wake_; ///< Something was submitted or queued for the GL thread
+
+    /*
+     *  The numbers of the frames published for the render thread. Publishing waits until
+     *  the last one has been recorded, so there's never more than one in here.
+     */
+    SPSCQueue<uint64_t, 2> submitted_;
+    FramePacket packet_; ///< Only touched by whichever thread renders, reused every frame
+
+    uint64_t frames_submitted_;
+    uint64_t frames_rendered_; ///< Written by the render thread
+
+    typedef std::pair<uint64_t, std::tr1::function<void ()> > RenderedFrameTask;
+    std::vector<RenderedFrameTask> rendered_frame_tasks_;
+
 };
 
 }
@@ -9,6 +9,9 @@ int main(int argc, char* argv[]) {
 	kglt::Window window;
 	window.set_title("KGLT Sprite Sample");
 
+    //Sprites live on a plane, so a grid is a better fit than the default partitioner
+    window.scene().set_partitioner<kglt::SpatialHashPartitioner>(2.0);
+
     //Load the strip of sprites into separate textures
     kglt::additional::SpriteStripLoader loader(window.scene(), "sample_data/sonic.png", 64);
     std::vector<kglt::TextureID> frames = loader.load_frames();
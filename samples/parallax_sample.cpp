@@ -11,6 +11,9 @@ int main(int argc, char* argv[]) {
 	kglt::Window window;
 	window.set_title("KGLT Parallax Sample");
 
+    //Sprites live on a plane, so a grid is a better fit than the default partitioner
+    window.scene().set_partitioner<kglt::SpatialHashPartitioner>(2.0);
+
 	//Automatically calculate an orthographic projection, taking into account the aspect ratio
 	//and the passed height. For example, passing a height of 2.0 would mean the view would extend
 	//+1 and -1 in the vertical direction, -1.0 - +1.0 near/far, and width would be calculated from the aspect
@@ -0,0 +1,249 @@
+#include <unittest++/UnitTest++.h>
+
+#include <new>
+#include <cstdlib>
+#include <vector>
+
+#include "kglt/kglt.h"
+#include "kglt/utils/frame_arena.h"
+#include "kglt/utils/allocation_counter.h"
+#include "kglt/generic/manager.h"
+#include "kglt/generic/identifiable.h"
+
+using namespace kglt;
+
+#ifdef KGLT_COUNT_ALLOCATIONS
+
+//The library already replaces operator new with a counting one
+static uint64_t allocations() {
+    return heap_allocation_count();
+}
+
+#else
+
+static uint64_t allocation_count = 0;
+
+//Replaces the global allocator for the test binary so tests can count heap allocations
+void* operator new(std::size_t size) {
+    __sync_fetch_and_add(&allocation_count, 1);
+
+    void* result = std::malloc(size ? size : 1);
+    if(!result) {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void operator delete(void* ptr) throw() {
+    std::free(ptr);
+}
+
+static uint64_t allocations() {
+    return __sync_fetch_and_add(&allocation_count, 0);
+}
+
+#endif
+
+TEST(test_frame_arena) {
+    FrameArena arena(256);
+
+    //Allocations are aligned and don't overlap
+    char* a = static_cast<char*>(arena.allocate(3, 1));
+    double* b = static_cast<double*>(arena.allocate(sizeof(double), __alignof__(double)));
+    CHECK_EQUAL(0, uintptr_t(b) % __alignof__(double));
+    CHECK(a + 3 <= (char*) b);
+
+    //Overflowing takes another block, and reset() replaces them with one big enough for both
+    arena.allocate(1000, 16);
+    CHECK_EQUAL(2, arena.block_count());
+
+    arena.reset();
+    CHECK_EQUAL(1, arena.block_count());
+    CHECK(arena.capacity() >= 1000 + 256);
+    CHECK_EQUAL(0, arena.used());
+
+    //Containers use the arena once it's big enough
+    uint64_t before = allocations();
+    {
+        FrameVector<uint32_t>::type numbers((ArenaAllocator<uint32_t>(&arena)));
+        for(uint32_t i = 0; i < 100; ++i) {
+            numbers.push_back(i);
+        }
+    }
+    uint64_t used = allocations() - before;
+    CHECK_EQUAL(0, used);
+}
+
+TEST(test_cached_tree_iteration_doesnt_allocate) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    for(uint32_t i = 0; i < 50; ++i) {
+        scene.new_mesh();
+    }
+
+    auto walk = [&]() -> uint32_t {
+        uint32_t count = 0;
+        for(Scene::iterator it = scene.begin(); it != scene.end(); ++it) {
+            ++count;
+        }
+        return count;
+    };
+
+    //The first walk builds the cache
+    uint32_t expected = walk();
+
+    uint64_t before = allocations();
+    uint32_t count = walk();
+    uint64_t used = allocations() - before;
+
+    CHECK_EQUAL(0, used);
+    CHECK_EQUAL(expected, count);
+    CHECK(count > 50);
+}
+
+TEST(test_partitioner_queries_dont_allocate) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    scene.active_camera().set_perspective_projection(45.0, 1.0, 1.0, 100.0);
+    scene.active_camera().update_frustum();
+
+    std::vector<MeshID> meshes;
+    std::vector<LightID> lights;
+
+    for(int32_t x = -10; x <= 10; ++x) {
+        for(int32_t z = -10; z <= 10; ++z) {
+            meshes.push_back(scene.new_mesh());
+            Mesh& mesh = scene.mesh(meshes.back());
+            mesh.add_vertex(-0.5, -0.5, 0);
+            mesh.add_vertex(0.5, -0.5, 0);
+            mesh.add_vertex(0.5, 0.5, 0);
+            mesh.add_triangle(0, 1, 2);
+            mesh.move_to(x * 4.0, 0, z * 4.0);
+        }
+    }
+
+    for(int32_t i = 0; i < 10; ++i) {
+        lights.push_back(scene.new_light());
+        Light& light = scene.light(lights.back());
+        light.move_to(i * 8.0 - 40.0, 2.0, -20.0);
+        light.set_attenuation_from_range(15.0);
+    }
+
+    std::vector<Partitioner::ptr> partitioners = {
+        Partitioner::ptr(new NullPartitioner(scene)),
+        Partitioner::ptr(new OctreePartitioner(scene, 1024.0)),
+        Partitioner::ptr(new BVHPartitioner(scene)),
+        Partitioner::ptr(new SpatialHashPartitioner(scene, 4.0))
+    };
+
+    QueryArena arena;
+
+    for(Partitioner::ptr partitioner: partitioners) {
+        scene.set_partitioner(partitioner);
+        scene.update_partitioner();
+
+        //Some of the meshes and lights move a little each frame, back and forth
+        float offset = 0.01;
+        auto move_things = [&]() {
+            offset = -offset;
+            for(uint32_t i = 0; i < meshes.size(); i += 3) {
+                Mesh& mesh = scene.mesh(meshes[i]);
+                mesh.move_to(mesh.position().x + offset, 0, mesh.position().z);
+            }
+
+            for(LightID light_id: lights) {
+                Light& light = scene.light(light_id);
+                light.move_to(light.position().x, light.position().y + offset, light.position().z);
+            }
+
+            scene.update_partitioner();
+        };
+
+        //What a renderer does each frame, every visible mesh looks up its lights once per pass
+        auto render_frame = [&]() -> uint32_t {
+            move_things();
+            arena.reset(*partitioner, scene.active_camera());
+
+            uint32_t light_count = 0;
+            for(uint32_t pass = 0; pass < 2; ++pass) {
+                for(MeshID mesh_id: arena.visible_meshes()) {
+                    light_count += arena.lights_for(mesh_id, scene.mesh(mesh_id).absolute_position()).size();
+                }
+            }
+            return light_count;
+        };
+
+        //The first frames size the buffers, after that nothing should be allocated, even
+        //with things moving (an even number of frames, so they end up where they started)
+        render_frame();
+        uint32_t expected_lights = render_frame();
+
+        uint64_t before = allocations();
+
+        uint32_t light_count = 0;
+        for(uint32_t frame = 0; frame < 4; ++frame) {
+            light_count = render_frame();
+        }
+
+        uint64_t used = allocations() - before;
+
+        CHECK_EQUAL(0, used);
+        CHECK_EQUAL(expected_lights, light_count);
+        CHECK(!arena.visible_meshes().empty());
+    }
+}
+
+class BulletManager;
+
+struct Bullet : public generic::Identifiable<uint32_t> {
+    Bullet(BulletManager* manager, uint32_t id):
+        generic::Identifiable<uint32_t>(id),
+        manager(manager) {}
+
+    BulletManager* manager;
+};
+
+class BulletManager:
+    public generic::TemplatedManager<BulletManager, Bullet, uint32_t> {
+
+};
+
+TEST(test_manager_churn_doesnt_allocate) {
+    BulletManager manager;
+    std::vector<uint32_t> live;
+    live.reserve(200);
+
+    //Fire 200 bullets, then keep replacing the oldest half with new ones
+    auto churn = [&]() {
+        while(live.size() < 200) {
+            live.push_back(manager.manager_new());
+        }
+
+        for(uint32_t i = 0; i < 100; ++i) {
+            manager.manager_delete(live[i]);
+        }
+        live.erase(live.begin(), live.begin() + 100);
+    };
+
+    //The first rounds grow the pools
+    churn();
+    churn();
+
+    uint64_t before = allocations();
+    for(uint32_t frame = 0; frame < 10; ++frame) {
+        churn();
+    }
+    uint64_t used = allocations() - before;
+
+    CHECK_EQUAL(0, used);
+    CHECK_EQUAL(100, manager.manager_count());
+    CHECK_EQUAL(100, manager.manager_objects().size());
+
+    for(uint32_t id: live) {
+        Bullet& bullet = manager.manager_get(id);
+        CHECK_EQUAL(id, bullet.id());
+        CHECK_EQUAL(&manager, bullet.manager);
+    }
+}
@@ -0,0 +1,76 @@
+#include <unittest++/UnitTest++.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "kglt/kglt.h"
+#include "kglt/component_store.h"
+
+using namespace kglt;
+
+TEST(test_velocities_move_objects) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    std::vector<MeshID> meshes;
+    for(uint32_t i = 0; i < 11; ++i) { //Not a multiple of four, so the scalar tail runs too
+        MeshID mesh_id = scene.new_mesh();
+        scene.mesh(mesh_id).move_to(i, 0, 0);
+        scene.mesh(mesh_id).set_velocity(0, i, 0);
+        meshes.push_back(mesh_id);
+    }
+
+    CHECK_EQUAL(11, scene.components().size());
+
+    scene.update(0.5);
+
+    for(uint32_t i = 0; i < meshes.size(); ++i) {
+        Mesh& mesh = scene.mesh(meshes[i]);
+        CHECK_CLOSE(float(i), mesh.absolute_position().x, 0.0001);
+        CHECK_CLOSE(i * 0.5, mesh.absolute_position().y, 0.0001);
+        CHECK_CLOSE(float(i), mesh.velocity().y, 0.0001);
+    }
+
+    //Moving an object directly is seen by the next integrate
+    scene.mesh(meshes[3]).move_to(100, 0, 0);
+    scene.update(1.0);
+    CHECK_CLOSE(100.0, scene.mesh(meshes[3]).absolute_position().x, 0.0001);
+    CHECK_CLOSE(3.0, scene.mesh(meshes[3]).absolute_position().y, 0.0001);
+
+    //Deleting an object removes its entry and leaves the others alone
+    scene.delete_mesh(meshes[0]);
+    CHECK_EQUAL(10, scene.components().size());
+
+    scene.update(1.0);
+    CHECK_CLOSE(10.0 * 2.5, scene.mesh(meshes[10]).absolute_position().y, 0.0001);
+}
+
+TEST(test_component_store_culls_renderables) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    scene.active_camera().set_perspective_projection(45.0, 1.0, 1.0, 100.0);
+    scene.active_camera().update_frustum();
+
+    //A small mesh around the camera, and one far beyond the far plane
+    MeshID near = scene.new_mesh();
+    MeshID far = scene.new_mesh();
+
+    for(MeshID mesh_id: { near, far }) {
+        Mesh& mesh = scene.mesh(mesh_id);
+        mesh.add_vertex(-2, -2, -2);
+        mesh.add_vertex(2, 2, 2);
+        mesh.add_vertex(2, -2, 2);
+        mesh.add_triangle(0, 1, 2);
+        mesh.set_velocity(0, 0, 0);
+    }
+
+    scene.mesh(far).move_to(400, 0, 0);
+    scene.update_partitioner();
+
+    std::vector<MeshID> visible;
+    scene.components().visible_renderables(scene.active_camera().frustum(), visible);
+
+    CHECK_EQUAL(1, visible.size());
+    CHECK(std::find(visible.begin(), visible.end(), near) != visible.end());
+}
@@ -72,3 +72,80 @@ TEST(test_frustum_generation) {
     CHECK_CLOSE(2.0, frustum.far_height(), 0.0001);
     CHECK_CLOSE(9.0, frustum.depth(), 0.0001);
 }
+
+TEST(test_frustum_containment) {
+    Frustum frustum;
+
+    kmMat4 projection;
+    kmMat4OrthographicProjection(&projection, -1.0, 1.0, -1.0, 1.0, 1.0, 10.0);
+    frustum.build(&projection);
+
+    kmVec3 inside, outside;
+    kmVec3Fill(&inside, 0, 0, -5);
+    kmVec3Fill(&outside, 5, 0, -5);
+
+    CHECK(frustum.contains_point(inside));
+    CHECK(!frustum.contains_point(outside));
+
+    CHECK(frustum.intersects_sphere(inside, 0.5));
+    CHECK(!frustum.intersects_sphere(outside, 1.0));
+    CHECK(frustum.intersects_sphere(outside, 4.5)); //Big enough to poke in from the side
+
+    AABB box;
+    kmVec3Fill(&box.min, -0.5, -0.5, -6);
+    kmVec3Fill(&box.max, 0.5, 0.5, -4);
+    CHECK_EQUAL(FRUSTUM_CLASSIFICATION_INSIDE, frustum.classify_aabb(box));
+
+    kmVec3Fill(&box.max, 2.0, 0.5, -4);
+    CHECK_EQUAL(FRUSTUM_CLASSIFICATION_INTERSECTS, frustum.classify_aabb(box));
+
+    kmVec3Fill(&box.min, 3.0, -0.5, -6);
+    kmVec3Fill(&box.max, 4.0, 0.5, -4);
+    CHECK_EQUAL(FRUSTUM_CLASSIFICATION_OUTSIDE, frustum.classify_aabb(box));
+}
+
+TEST(test_frustum_batch_culling) {
+    Frustum frustum;
+
+    kmMat4 projection;
+    kmMat4OrthographicProjection(&projection, -1.0, 1.0, -1.0, 1.0, 1.0, 10.0);
+    frustum.build(&projection);
+
+    //Seven spheres, so both the four-wide and the single paths are used
+    float x[] = { 0, 5, 0, -5, 0.9, 0, 0 };
+    float y[] = { 0, 0, 5, 0, 0, 0, 0 };
+    float z[] = { -5, -5, -5, -5, -5, -20, -5 };
+    float r[] = { 0.5, 0.5, 0.5, 4.5, 0.5, 0.5, 0.1 };
+
+    SphereArrays spheres = { x, y, z, r };
+
+    uint32_t visible = 0;
+    uint8_t inside[7];
+    uint8_t cache[7] = { 0, 0, 0, 0, 0, 0, 0 };
+    CHECK_EQUAL(4, frustum.cull_spheres(spheres, 7, &visible, inside, cache));
+    CHECK_EQUAL(uint32_t((1 << 0) | (1 << 3) | (1 << 4) | (1 << 6)), visible);
+
+    CHECK_EQUAL(FRUSTUM_ALL_PLANES, inside[0]); //Entirely inside
+    CHECK(!(inside[4] & (1 << FRUSTUM_PLANE_RIGHT))); //Pokes out of the right
+    CHECK_EQUAL(FRUSTUM_PLANE_RIGHT, cache[1]); //Remembers which plane rejected it
+    CHECK_EQUAL(FRUSTUM_PLANE_FAR, cache[5]);
+
+    //Skipping the far plane (e.g. because a parent was inside it) lets sphere 5 through
+    uint8_t planes = FRUSTUM_ALL_PLANES & ~(1 << FRUSTUM_PLANE_FAR);
+    CHECK_EQUAL(5, frustum.cull_spheres(spheres, 7, &visible, nullptr, cache, planes));
+    CHECK(visible & (1 << 5));
+
+    float min_x[] = { -0.5, 3.0 }, min_y[] = { -0.5, -0.5 }, min_z[] = { -6, -6 };
+    float max_x[] = { 0.5, 4.0 }, max_y[] = { 0.5, 0.5 }, max_z[] = { -4, -4 };
+    AABBArrays boxes = { min_x, min_y, min_z, max_x, max_y, max_z };
+
+    CHECK_EQUAL(1, frustum.cull_aabbs(boxes, 2, &visible));
+    CHECK_EQUAL(1u, visible);
+
+    AABB box;
+    kmVec3Fill(&box.min, -0.5, -0.5, -6);
+    kmVec3Fill(&box.max, 0.5, 0.5, -4);
+    uint8_t box_inside = 0;
+    CHECK_EQUAL(FRUSTUM_CLASSIFICATION_INSIDE, frustum.classify_aabb(box, planes, box_inside));
+    CHECK_EQUAL(planes, box_inside);
+}
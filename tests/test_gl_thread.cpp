@@ -0,0 +1,55 @@
+#include <unittest++/UnitTest++.h>
+
+#include <stdexcept>
+#include <boost/thread/thread.hpp>
+
+#include "kglt/utils/gl_thread.h"
+
+using namespace kglt;
+
+TEST(test_gl_work_from_other_threads_is_queued) {
+    set_gl_thread();
+    CHECK(on_gl_thread());
+
+    uint32_t runs = 0;
+    run_on_gl_thread([&]() { ++runs; });
+    CHECK_EQUAL(1, runs); //Straight away on the GL thread
+
+    bool elsewhere = true;
+    boost::thread other([&]() {
+        elsewhere = on_gl_thread();
+        run_on_gl_thread([&]() { ++runs; });
+    });
+    other.join();
+
+    CHECK(!elsewhere);
+    CHECK_EQUAL(1, runs);
+
+    run_gl_thread_tasks();
+    CHECK_EQUAL(2, runs);
+
+    run_gl_thread_tasks();
+    CHECK_EQUAL(2, runs);
+}
+
+TEST(test_waiting_on_gl_work_ends_when_the_gl_thread_changes) {
+    set_gl_thread();
+
+    bool ran = false;
+    bool threw = false;
+    boost::thread other([&]() {
+        try {
+            run_on_gl_thread_and_wait([&]() { ran = true; });
+        } catch(std::runtime_error& e) {
+            threw = true;
+        }
+    });
+
+    //This thread never runs the queued tasks, moving the GL thread is the only way out
+    while(!other.timed_join(boost::posix_time::milliseconds(1))) {
+        set_gl_thread();
+    }
+
+    CHECK(threw);
+    CHECK(!ran);
+}
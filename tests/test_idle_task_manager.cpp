@@ -0,0 +1,70 @@
+#include <unittest++/UnitTest++.h>
+
+#include <vector>
+
+#include "kglt/idle_task_manager.h"
+
+using namespace kglt;
+
+TEST(test_idle_tasks_respect_priority_and_budget) {
+    IdleTaskManager idle;
+    idle.set_budget(0); //One task a frame
+
+    std::vector<uint32_t> order;
+    idle.add_once([&]() { order.push_back(3); }, IDLE_TASK_PRIORITY_LOW);
+    idle.add_once([&]() { order.push_back(2); });
+    idle.add_once([&]() { order.push_back(1); }, IDLE_TASK_PRIORITY_HIGH);
+    ConnectionID removed = idle.add_once([&]() { order.push_back(4); }, IDLE_TASK_PRIORITY_LOW);
+
+    idle.execute();
+    CHECK_EQUAL(1, order.size());
+    CHECK_EQUAL(1, idle.stats().run);
+    CHECK_EQUAL(3, idle.stats().carried_over);
+    CHECK_EQUAL(2, idle.stats().queued[IDLE_TASK_PRIORITY_LOW]);
+
+    idle.remove(removed);
+
+    idle.execute();
+    idle.execute();
+    idle.execute();
+
+    CHECK_EQUAL(3, order.size());
+    CHECK_EQUAL(1, order[0]);
+    CHECK_EQUAL(2, order[1]);
+    CHECK_EQUAL(3, order[2]);
+    CHECK_EQUAL(0, idle.stats().run);
+
+    //With time to spare everything runs in one go
+    idle.set_budget(1000);
+    for(uint32_t i = 0; i < 10; ++i) {
+        idle.add_once([&order, i]() { order.push_back(i); });
+    }
+    idle.execute();
+    CHECK_EQUAL(13, order.size());
+    CHECK_EQUAL(0, idle.stats().carried_over);
+}
+
+TEST(test_idle_tasks_can_yield) {
+    IdleTaskManager idle;
+    idle.set_budget(0);
+
+    //Does one item at a time while out of budget, and carries on next frame until it's done
+    uint32_t done = 0;
+    idle.add([&]() -> bool {
+        do {
+            ++done;
+        } while(done < 10 && !idle.should_yield());
+        return done < 10;
+    });
+
+    CHECK(!idle.should_yield()); //Only meaningful inside execute()
+
+    uint32_t frames = 0;
+    while(idle.stats().queued[IDLE_TASK_PRIORITY_NORMAL] || !frames) {
+        idle.execute();
+        ++frames;
+    }
+
+    CHECK_EQUAL(10, done);
+    CHECK_EQUAL(10, frames);
+}
@@ -0,0 +1,167 @@
+#include <unittest++/UnitTest++.h>
+
+#include "kglt/kglt.h"
+#include "kglt/loader.h"
+#include "kglt/loaders/texture_loader.h"
+#include "kazbase/exceptions.h"
+
+using namespace kglt;
+
+class CountingLoad : public IncrementalLoad {
+public:
+    CountingLoad(uint32_t steps):
+        steps(steps),
+        done(0),
+        undone(false) {}
+
+    uint32_t steps;
+    uint32_t done;
+    bool undone;
+
+private:
+    bool do_step() {
+        ++done;
+        set_progress(float(done) / steps);
+        return done < steps;
+    }
+
+    void do_cancel() {
+        undone = true;
+    }
+};
+
+TEST(test_incremental_loads_run_when_idle) {
+    IdleTaskManager idle;
+    idle.set_budget(0); //One step a frame
+
+    std::tr1::shared_ptr<CountingLoad> load(new CountingLoad(10));
+
+    float last_progress = 0;
+    bool finished = false;
+    load->signal_progress().connect([&](float progress) { last_progress = progress; });
+    load->signal_finished().connect([&]() { finished = true; });
+
+    load->run_when_idle(idle);
+
+    idle.execute();
+    CHECK_EQUAL(1, load->done);
+    CHECK_CLOSE(0.1, load->progress(), 0.0001);
+
+    for(uint32_t i = 0; i < 20; ++i) {
+        idle.execute();
+    }
+
+    CHECK_EQUAL(10, load->done);
+    CHECK(load->is_finished());
+    CHECK(!load->is_cancelled());
+    CHECK(finished);
+    CHECK_CLOSE(1.0, last_progress, 0.0001);
+    CHECK_EQUAL(0, idle.stats().queued[IDLE_TASK_PRIORITY_NORMAL]);
+}
+
+TEST(test_incremental_loads_can_be_cancelled) {
+    IdleTaskManager idle;
+    idle.set_budget(0);
+
+    std::tr1::shared_ptr<CountingLoad> load(new CountingLoad(10));
+    load->run_when_idle(idle);
+
+    idle.execute();
+    idle.execute();
+    load->cancel();
+
+    CHECK(load->undone);
+    CHECK(load->is_cancelled());
+    CHECK(load->is_finished());
+
+    //The idle task notices and goes away without doing any more
+    idle.execute();
+    CHECK_EQUAL(2, load->done);
+    CHECK_EQUAL(0, idle.stats().queued[IDLE_TASK_PRIORITY_NORMAL]);
+}
+
+TEST(test_cancelling_a_bsp_load_restores_the_scene) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    Partitioner* original = &scene.partitioner();
+    scene.active_camera().move_to(1, 2, 3);
+
+    //The first step reads the map, swaps in its partitioner and moves the camera to the spawn point
+    IncrementalLoad::ptr load = window.loader_for("sample_data/sample.bsp")->into_incrementally(scene);
+    CHECK(load->step());
+    CHECK(&scene.partitioner() != original);
+
+    load->cancel();
+    CHECK(load->is_cancelled());
+    CHECK(&scene.partitioner() == original);
+
+    kmVec3& pos = scene.active_camera().position();
+    CHECK_CLOSE(1.0, pos.x, 0.0001);
+    CHECK_CLOSE(2.0, pos.y, 0.0001);
+    CHECK_CLOSE(3.0, pos.z, 0.0001);
+}
+
+//Finishes with a CountingLoad, so the main thread stage takes a step per idle slot
+class SlicedLoader : public Loader {
+public:
+    SlicedLoader(uint32_t steps):
+        Loader("sliced"),
+        load(new CountingLoad(steps)) {}
+
+    std::tr1::shared_ptr<CountingLoad> load;
+
+    IncrementalLoad::ptr finish_incrementally(Loadable& resource) {
+        return load;
+    }
+};
+
+TEST(test_async_loads_finish_a_slice_at_a_time) {
+    IdleTaskManager idle;
+    idle.set_budget(0);
+    JobSystem jobs(idle, 0); //Worker jobs run from the idle task too
+
+    Loadable resource;
+    std::tr1::shared_ptr<SlicedLoader> loader(new SlicedLoader(5));
+    Future<Loadable*> loaded = loader->into_async(resource, jobs);
+
+    //The worker stage, then the first step of the main thread stage
+    idle.execute();
+    idle.execute();
+    CHECK(loader->load->done > 0);
+    CHECK(loader->load->done < 5);
+    CHECK(!loaded.is_ready());
+
+    for(uint32_t i = 0; i < 20; ++i) {
+        idle.execute();
+    }
+
+    CHECK_EQUAL(5, loader->load->done);
+    CHECK(loaded.is_ready());
+    CHECK(loaded.get() == &resource);
+}
+
+TEST(test_async_loads_finish_on_the_main_thread) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    //Asked to, missing textures fall back to a checkerboard, so this doesn't need a file
+    Texture& texture = scene.texture(scene.new_texture());
+    Loader::ptr loader(new loaders::TextureLoader("missing.png", { "FALLBACK_TO_CHECKERBOARD", "1" }));
+    Future<Loadable*> loaded = loader->into_async(texture, window.jobs());
+
+    //get() runs the main thread stage itself if the idle tasks haven't yet
+    CHECK(loaded.get() == &texture);
+    CHECK_EQUAL(64, texture.width());
+    CHECK(texture.gl_tex());
+
+    //Otherwise they fail, and errors from the worker stage come out of get()
+    Texture& missing = scene.texture(scene.new_texture());
+    Future<Loadable*> not_found = window.loader_for("missing.png")->into_async(missing, window.jobs());
+    CHECK_THROW(not_found.get(), IOError);
+
+    Font& font = scene.font(scene.new_font());
+    font.set_size(12);
+    Future<Loadable*> failed = window.loader_for("missing.ttf")->into_async(font, window.jobs());
+    CHECK_THROW(failed.get(), IOError);
+}
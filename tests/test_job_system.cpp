@@ -0,0 +1,149 @@
+#include <unittest++/UnitTest++.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include "kglt/job_system.h"
+
+using namespace kglt;
+
+TEST(test_job_graphs_run_in_dependency_order) {
+    IdleTaskManager idle;
+    JobSystem jobs(idle, 3);
+
+    //A diamond: two halves summed on workers, then combined on the main thread
+    std::vector<uint32_t> numbers(10000, 1);
+    uint32_t half = numbers.size() / 2;
+
+    auto sum = [&](uint32_t begin, uint32_t end) -> uint32_t {
+        uint32_t total = 0;
+        for(uint32_t i = begin; i < end; ++i) {
+            total += numbers[i];
+        }
+        return total;
+    };
+
+    Future<uint32_t> first = jobs.async<uint32_t>([=]() { return sum(0, half); });
+    Future<uint32_t> second = jobs.async<uint32_t>([=]() { return sum(half, numbers.size()); });
+
+    uint32_t combined = 0;
+    Job::ptr combine = jobs.schedule_on_main_thread([&]() {
+        CHECK(first.is_ready());
+        CHECK(second.is_ready());
+        combined = first.get() + second.get();
+    }, { first.job(), second.job() });
+
+    //Main thread jobs only run from the idle tasks
+    first.get();
+    second.get();
+    CHECK(!combine->is_finished());
+
+    idle.execute();
+    CHECK(combine->is_finished());
+    CHECK_EQUAL(10000, combined);
+
+    //Depending on finished jobs is fine, the job is just ready straight away
+    Job::ptr late = jobs.schedule([]() {}, { combine });
+    jobs.wait(late);
+    CHECK(late->is_finished());
+}
+
+TEST(test_job_system_without_threads) {
+    IdleTaskManager idle;
+    JobSystem jobs(idle, 0);
+    CHECK_EQUAL(0, jobs.thread_count());
+
+    std::vector<uint32_t> order;
+    Job::ptr first = jobs.schedule([&]() { order.push_back(1); });
+    Job::ptr second = jobs.schedule([&]() { order.push_back(2); }, { first });
+    jobs.schedule([&]() { order.push_back(3); }, { second });
+
+    CHECK(order.empty());
+    idle.execute();
+
+    CHECK_EQUAL(3, order.size());
+    CHECK_EQUAL(1, order[0]);
+    CHECK_EQUAL(2, order[1]);
+    CHECK_EQUAL(3, order[2]);
+
+    //Exceptions come out of wait() rather than taking down a worker
+    Future<uint32_t> failed = jobs.async<uint32_t>([]() -> uint32_t { throw std::runtime_error("Nope"); });
+    CHECK_THROW(failed.get(), std::runtime_error);
+}
+
+TEST(test_job_system_leaves_the_idle_slot_free) {
+    IdleTaskManager idle;
+    idle.set_budget(0); //One task a frame
+    JobSystem jobs(idle);
+
+    //With nothing queued for the main thread, the job system's idle task isn't in the way
+    bool ran = false;
+    idle.add_once([&]() { ran = true; }, IDLE_TASK_PRIORITY_LOW);
+    idle.execute();
+    CHECK(ran);
+
+    //While there is, the job goes first and the low priority task gets the next frame
+    bool job_ran = false;
+    ran = false;
+    jobs.schedule_on_main_thread([&]() { job_ran = true; });
+    idle.add_once([&]() { ran = true; }, IDLE_TASK_PRIORITY_LOW);
+
+    idle.execute();
+    CHECK(job_ran);
+    CHECK(!ran);
+
+    idle.execute();
+    CHECK(ran);
+    CHECK_EQUAL(0, idle.stats().queued[IDLE_TASK_PRIORITY_HIGH]);
+}
+
+TEST(test_job_system_parallel_for) {
+    IdleTaskManager idle;
+    JobSystem jobs(idle, 3);
+
+    //Every index is visited exactly once, and chunks are numbered from zero
+    std::vector<uint32_t> hits(10000, 0);
+    std::vector<uint32_t> chunk_sizes(JobSystem::chunk_count(hits.size(), 64), 0);
+    CHECK_EQUAL(157, chunk_sizes.size());
+
+    for(uint32_t run = 0; run < 10; ++run) {
+        jobs.parallel_for(hits.size(), 64, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+            chunk_sizes[chunk] = end - begin;
+            for(uint32_t i = begin; i < end; ++i) {
+                ++hits[i];
+            }
+        });
+    }
+
+    for(uint32_t count: hits) {
+        CHECK_EQUAL(10, count);
+    }
+
+    CHECK_EQUAL(64, chunk_sizes[0]);
+    CHECK_EQUAL(10000 % 64, chunk_sizes.back());
+
+    //Workers busy with a long job don't hold it up, the caller does the chunks itself
+    bool release = false;
+    Job::ptr busy = jobs.schedule([&]() {
+        while(!__atomic_load_n(&release, __ATOMIC_ACQUIRE)) {
+            boost::this_thread::yield();
+        }
+    });
+
+    uint32_t total = 0;
+    jobs.parallel_for(100, 10, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        __atomic_add_fetch(&total, end - begin, __ATOMIC_RELAXED);
+    });
+    CHECK_EQUAL(100, total);
+
+    __atomic_store_n(&release, true, __ATOMIC_RELEASE);
+    jobs.wait(busy);
+
+    //Without threads everything runs on the caller
+    JobSystem inline_jobs(idle, 0);
+    total = 0;
+    inline_jobs.parallel_for(100, 10, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        total += end - begin;
+    });
+    CHECK_EQUAL(100, total);
+}
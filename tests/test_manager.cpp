@@ -0,0 +1,91 @@
+#include <unittest++/UnitTest++.h>
+
+#include <vector>
+#include <boost/thread/thread.hpp>
+
+#include "kglt/generic/manager.h"
+#include "kglt/generic/identifiable.h"
+
+using namespace kglt;
+
+class ThingManager;
+
+struct Thing : public generic::Identifiable<uint32_t> {
+    Thing(ThingManager* manager, uint32_t id):
+        generic::Identifiable<uint32_t>(id) {}
+};
+
+class ThingManager:
+    public generic::TemplatedManager<ThingManager, Thing, uint32_t> {
+
+};
+
+TEST(test_manager_lookups_while_creating_and_deleting) {
+    ThingManager manager;
+
+    //These are never deleted, the readers must always find them
+    std::vector<uint32_t> permanent;
+    for(uint32_t i = 0; i < 100; ++i) {
+        permanent.push_back(manager.manager_new());
+    }
+
+    bool stop = false;
+    uint32_t failures = 0;
+
+    auto reader = [&]() {
+        while(!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+            for(uint32_t id: permanent) {
+                if(!manager.manager_contains(id) || manager.manager_get(id).id() != id) {
+                    __sync_fetch_and_add(&failures, 1);
+                }
+            }
+        }
+    };
+
+    boost::thread first(reader);
+    boost::thread second(reader);
+
+    //Churn through enough objects to add pages and reuse slots many times over
+    std::vector<uint32_t> temporary;
+    for(uint32_t round = 0; round < 50; ++round) {
+        for(uint32_t i = 0; i < 500; ++i) {
+            temporary.push_back(manager.manager_new());
+        }
+
+        for(uint32_t id: temporary) {
+            manager.manager_delete(id);
+            CHECK(!manager.manager_contains(id));
+        }
+        temporary.clear();
+    }
+
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    first.join();
+    second.join();
+
+    CHECK_EQUAL(0, failures);
+    CHECK_EQUAL(100, manager.manager_count());
+}
+
+TEST(test_manager_retires_slots_instead_of_reusing_ids) {
+    ThingManager manager;
+
+    //Every new object takes the same slot until its generations run out
+    uint32_t first = manager.manager_new();
+    uint32_t id = first;
+    for(uint32_t i = 1; i < generic::handle::MAX_GENERATION; ++i) {
+        manager.manager_delete(id);
+        id = manager.manager_new();
+        CHECK_EQUAL(generic::handle::index(first), generic::handle::index(id));
+    }
+    CHECK_EQUAL(generic::handle::MAX_GENERATION, generic::handle::generation(id));
+
+    manager.manager_delete(id);
+
+    uint32_t next = manager.manager_new();
+    CHECK(generic::handle::index(first) != generic::handle::index(next));
+    CHECK(!manager.manager_contains(first));
+    CHECK(!manager.manager_contains(id));
+    CHECK(manager.manager_contains(next));
+    CHECK_EQUAL(1, manager.manager_count());
+}
@@ -1,5 +1,7 @@
 #include <unittest++/UnitTest++.h>
 
+#include <cmath>
+
 #include "kglt/kglt.h"
 
 TEST(test_user_data_works) {
@@ -38,6 +40,49 @@ TEST(test_deleting_meshes_deletes_children) {
     CHECK(!scene.has_mesh(cid2));
 }
 
+TEST(test_deleted_mesh_ids_stay_invalid) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    kglt::MeshID old_id = scene.new_mesh();
+    scene.delete_mesh(old_id);
+
+    //The new mesh reuses the slot, but the old ID must not find it
+    kglt::MeshID new_id = scene.new_mesh();
+    CHECK(new_id != old_id);
+    CHECK(!scene.has_mesh(old_id));
+    CHECK(scene.has_mesh(new_id));
+    CHECK_THROW(scene.mesh(old_id), kglt::generic::NoSuchObjectError);
+
+    kglt::Mesh& mesh = scene.mesh(new_id);
+    CHECK_EQUAL(new_id, scene._mesh_id_from_mesh_ptr(&mesh));
+    CHECK(!scene.has_mesh(0));
+}
+
+TEST(test_child_meshes_follow_their_parent) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    kglt::Mesh& parent = scene.mesh(scene.new_mesh());
+    kglt::Mesh& child = scene.mesh(scene.new_mesh(&parent));
+
+    child.move_to(1, 0, 0);
+    for(uint32_t i = 0; i < 10; ++i) {
+        parent.move_to(i, 0, 0);
+    }
+
+    CHECK_CLOSE(10.0, child.absolute_position().x, 0.0001);
+
+    //A quarter turn about Y swings the child round onto the Z axis
+    parent.rotate_y(kmPI / 2.0);
+    scene.update_partitioner();
+
+    CHECK_CLOSE(9.0, child.absolute_position().x, 0.0001);
+    CHECK_CLOSE(0.0, child.absolute_position().y, 0.0001);
+    CHECK_CLOSE(1.0, fabs(child.absolute_position().z), 0.0001);
+    CHECK_CLOSE(child.absolute_position().z, child.world_matrix().mat[14], 0.0001);
+}
+
 TEST(test_procedural_rectangle_outline) {
 	kglt::Window window;
 	
@@ -50,3 +95,66 @@ TEST(test_procedural_rectangle_outline) {
 	CHECK_EQUAL(kglt::MESH_ARRANGEMENT_LINE_STRIP, mesh.arrangement());
 	CHECK_EQUAL(5, mesh.vertices().size());
 }
+
+TEST(test_mesh_bounds) {
+    kglt::Window window;
+
+    kglt::MeshID mid = window.scene().new_mesh();
+    kglt::Mesh& mesh = window.scene().mesh(mid);
+
+    kglt::procedural::mesh::rectangle(mesh, 2.0, 4.0);
+
+    CHECK_CLOSE(-1.0, mesh.aabb().min.x, 0.00001);
+    CHECK_CLOSE(-2.0, mesh.aabb().min.y, 0.00001);
+    CHECK_CLOSE(1.0, mesh.aabb().max.x, 0.00001);
+    CHECK_CLOSE(2.0, mesh.aabb().max.y, 0.00001);
+    CHECK_CLOSE(0.0, mesh.aabb().depth(), 0.00001);
+
+    //Adding a vertex should invalidate the bounds
+    mesh.add_vertex(0.0, 0.0, 5.0);
+    CHECK_CLOSE(5.0, mesh.aabb().max.z, 0.00001);
+}
+
+TEST(test_mesh_geometry_is_only_published_when_it_changes) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    kglt::MeshID mid = scene.new_mesh();
+    kglt::Mesh& mesh = scene.mesh(mid);
+    kglt::procedural::mesh::rectangle(mesh, 1.0, 1.0);
+    mesh.move_to(0.0, 0.0, -5.0); //In front of the camera
+
+    scene.publish_frame();
+    std::tr1::shared_ptr<const std::vector<float> > published = mesh.mesh_state().geometry;
+    CHECK(published);
+    CHECK_EQUAL(mesh.draw_count() * kglt::GEOMETRY_STRIDE, published->size());
+
+    //Frames share the published geometry rather than copying it
+    kglt::FramePacket packet;
+    scene.prepare_frame(packet);
+
+    uint32_t recorded = 0;
+    for(const kglt::RenderItem& item: packet.items) {
+        if(item.mesh_id == mid) {
+            CHECK(item.geometry == published);
+            ++recorded;
+        }
+    }
+    CHECK(recorded > 0);
+
+    //Nothing changed, so publishing again keeps it
+    scene.publish_frame();
+    CHECK(mesh.mesh_state().geometry == published);
+
+    //Changing the mesh isn't seen until the next publish, which replaces the geometry
+    //and leaves the old copy alone for any frame still using it
+    uint32_t old_size = published->size();
+    mesh.add_vertex(0.0, 0.0, 1.0);
+    mesh.add_triangle(0, 1, 4);
+    CHECK(mesh.mesh_state().geometry == published);
+
+    scene.publish_frame();
+    CHECK(mesh.mesh_state().geometry != published);
+    CHECK_EQUAL(old_size, published->size());
+    CHECK_EQUAL(mesh.draw_count() * kglt::GEOMETRY_STRIDE, mesh.mesh_state().geometry->size());
+}
@@ -0,0 +1,419 @@
+#include <unittest++/UnitTest++.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "kglt/kglt.h"
+#include "kglt/partitioners/bsp_partitioner.h"
+#include "kglt/partitioners/octree_partitioner.h"
+#include "kglt/partitioners/bvh_partitioner.h"
+#include "kglt/partitioners/spatial_hash_partitioner.h"
+
+using namespace kglt;
+
+static bool is_listed(const std::vector<MeshID>& meshes, MeshID mesh) {
+    return std::binary_search(meshes.begin(), meshes.end(), mesh);
+}
+
+static uint32_t count_lights(Partitioner& partitioner, const kmVec3& location) {
+    std::vector<LightID> lights;
+    partitioner.lights_within_range(location, lights);
+    return lights.size();
+}
+
+TEST(test_bsp_partitioner_pvs) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    BSPPartitioner::ptr partitioner(new BSPPartitioner(scene));
+
+    //A single plane at x = 0, leaf 0 in front (cluster 0) and leaf 1 behind (cluster 1)
+    std::vector<BSPPartitioner::Plane> planes(1);
+    kmVec3Fill(&planes[0].normal, 1, 0, 0);
+    planes[0].distance = 0;
+
+    std::vector<BSPPartitioner::Node> nodes(1);
+    nodes[0].plane = 0;
+    nodes[0].front = -1;
+    nodes[0].back = -2;
+
+    std::vector<BSPPartitioner::Leaf> leaves(2);
+    leaves[0].cluster = 0;
+    leaves[0].area = 0;
+    leaves[1].cluster = 1;
+    leaves[1].area = 0;
+
+    partitioner->set_tree(planes, nodes, leaves);
+
+    //Cluster 0 can only see itself, cluster 1 can see both (second row is "0, 0" = skip nothing)
+    std::vector<uint8_t> vis_data = {
+        2, 0, 0, 0,
+        20, 0, 0, 0, 0, 0, 0, 0,
+        21, 0, 0, 0, 0, 0, 0, 0,
+        0x01,
+        0x03
+    };
+
+    partitioner->set_visibility(2, { 20, 21 }, vis_data);
+    scene.set_partitioner(partitioner);
+
+    MeshID front = scene.new_mesh();
+    MeshID back = scene.new_mesh();
+    MeshID other = scene.new_mesh();
+
+    partitioner->set_mesh_locations(front, { {0, 0} });
+    partitioner->set_mesh_locations(back, { {1, 0} });
+
+    scene.active_camera().move_to(10, 0, 0);
+    CHECK_EQUAL(0, partitioner->cluster_at(scene.active_camera().absolute_position()));
+
+    std::vector<MeshID> visible;
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(is_listed(visible, front));
+    CHECK(!is_listed(visible, back));
+    CHECK(is_listed(visible, other)); //Not part of the map, always visible
+
+    scene.active_camera().move_to(-10, 0, 0);
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(is_listed(visible, front));
+    CHECK(is_listed(visible, back));
+    CHECK(is_listed(visible, other));
+}
+
+TEST(test_bsp_partitioner_area_portals) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    BSPPartitioner::ptr partitioner(new BSPPartitioner(scene));
+
+    std::vector<BSPPartitioner::Plane> planes(1);
+    kmVec3Fill(&planes[0].normal, 1, 0, 0);
+    planes[0].distance = 0;
+
+    std::vector<BSPPartitioner::Node> nodes(1);
+    nodes[0].plane = 0;
+    nodes[0].front = -1;
+    nodes[0].back = -2;
+
+    //Two rooms (areas 1 and 2) that can see each other, joined by portal 0
+    std::vector<BSPPartitioner::Leaf> leaves(2);
+    leaves[0].cluster = 0;
+    leaves[0].area = 1;
+    leaves[1].cluster = 1;
+    leaves[1].area = 2;
+
+    partitioner->set_tree(planes, nodes, leaves);
+
+    std::vector<uint8_t> vis_data = {
+        2, 0, 0, 0,
+        20, 0, 0, 0, 0, 0, 0, 0,
+        21, 0, 0, 0, 0, 0, 0, 0,
+        0x03,
+        0x03
+    };
+    partitioner->set_visibility(2, { 20, 21 }, vis_data);
+
+    std::vector<BSPPartitioner::Area> areas = { {0, 0}, {1, 0}, {1, 1} };
+    std::vector<BSPPartitioner::AreaPortal> portals = { {0, 2}, {0, 1} };
+    partitioner->set_areas(areas, portals);
+
+    scene.set_partitioner(partitioner);
+
+    CHECK_EQUAL(1, partitioner->portal_count());
+    CHECK(partitioner->portal_open(0));
+
+    MeshID front = scene.new_mesh();
+    MeshID back = scene.new_mesh();
+    partitioner->set_mesh_locations(front, { {0, 1} });
+    partitioner->set_mesh_locations(back, { {1, 2} });
+
+    LightID light = scene.new_light();
+    scene.light(light).move_to(10, 0, 0);
+
+    kmVec3 back_position;
+    kmVec3Fill(&back_position, -10, 0, 0);
+
+    scene.active_camera().move_to(-10, 0, 0);
+    CHECK_EQUAL(2, partitioner->area_at(scene.active_camera().absolute_position()));
+
+    std::vector<MeshID> visible;
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(is_listed(visible, front));
+    CHECK(is_listed(visible, back));
+    CHECK_EQUAL(1, count_lights(*partitioner, back_position));
+
+    //Closing the door hides the other room and its light
+    partitioner->set_portal_open(0, false);
+    CHECK(!partitioner->areas_connected(1, 2));
+
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(!is_listed(visible, front));
+    CHECK(is_listed(visible, back));
+    CHECK_EQUAL(0, count_lights(*partitioner, back_position));
+
+    partitioner->set_portal_open(0, true);
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(is_listed(visible, front));
+}
+
+TEST(test_octree_partitioner) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    OctreePartitioner::ptr partitioner(new OctreePartitioner(scene, 1024.0));
+    scene.set_partitioner(partitioner);
+
+    scene.active_camera().set_perspective_projection(45.0, 1.0, 1.0, 100.0);
+
+    //A small mesh around the camera, and one far beyond the far plane
+    MeshID near = scene.new_mesh();
+    MeshID far = scene.new_mesh();
+    for(MeshID mesh_id: { near, far }) {
+        Mesh& mesh = scene.mesh(mesh_id);
+        mesh.add_vertex(-2, -2, -2);
+        mesh.add_vertex(2, 2, 2);
+        mesh.add_vertex(2, -2, 2);
+        mesh.add_triangle(0, 1, 2);
+    }
+    scene.mesh(far).move_to(400, 0, 0);
+    partitioner->relocate(scene.mesh(far));
+
+    std::vector<MeshID> visible;
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(is_listed(visible, near));
+    CHECK(!is_listed(visible, far));
+
+    //Small meshes go deep into the tree, and small moves don't change their cell
+    uint32_t depth = partitioner->depth_of(far);
+    CHECK(depth > 0);
+    scene.mesh(far).move_to(400.5, 0, 0);
+    partitioner->relocate(scene.mesh(far));
+    CHECK_EQUAL(depth, partitioner->depth_of(far));
+
+    uint32_t nodes = partitioner->node_count();
+    scene.delete_mesh(far);
+    CHECK(partitioner->node_count() < nodes); //Empty cells are released
+
+    LightID light = scene.new_light();
+    scene.light(light).move_to(0, 0, 0);
+    scene.light(light).set_attenuation_from_range(10.0);
+    partitioner->relocate(scene.light(light));
+
+    kmVec3 location;
+    kmVec3Fill(&location, 5, 0, 0);
+    CHECK_EQUAL(1, count_lights(*partitioner, location));
+
+    kmVec3Fill(&location, 50, 0, 0);
+    CHECK_EQUAL(0, count_lights(*partitioner, location));
+}
+
+TEST(test_dynamic_aabb_tree) {
+    DynamicAABBTree tree(0.1);
+
+    std::vector<int32_t> proxies;
+    for(uint32_t i = 0; i < 128; ++i) {
+        AABB box;
+        kmVec3Fill(&box.min, i * 2.0, 0, 0);
+        kmVec3Fill(&box.max, i * 2.0 + 1.0, 1, 1);
+        proxies.push_back(tree.create_proxy(box, i));
+    }
+
+    //Inserting in order would make a list without rebalancing
+    CHECK(tree.validate());
+    CHECK(tree.height() < 16);
+
+    std::vector<uint32_t> results;
+    kmVec3 centre;
+    kmVec3Fill(&centre, 10.5, 0.5, 0.5);
+    tree.query_sphere(centre, 0.25, results);
+    CHECK_EQUAL(1, results.size());
+    CHECK_EQUAL(5, results[0]);
+
+    //Small moves stay inside the fat box, large ones reinsert
+    AABB box;
+    kmVec3Fill(&box.min, 10.05, 0, 0);
+    kmVec3Fill(&box.max, 11.05, 1, 1);
+    kmVec3 displacement;
+    kmVec3Fill(&displacement, 0.05, 0, 0);
+    CHECK(!tree.move_proxy(proxies[5], box, displacement));
+
+    kmVec3Fill(&box.min, 500, 0, 0);
+    kmVec3Fill(&box.max, 501, 1, 1);
+    kmVec3Fill(&displacement, 490, 0, 0);
+    CHECK(tree.move_proxy(proxies[5], box, displacement));
+    CHECK(tree.validate());
+
+    results.clear();
+    tree.query_sphere(centre, 0.25, results);
+    CHECK(results.empty());
+
+    //Fire a ray along the row of boxes
+    kmVec3 origin, direction;
+    kmVec3Fill(&origin, -10, 0.5, 0.5);
+    kmVec3Fill(&direction, 1, 0, 0);
+    results.clear();
+    tree.query_ray(origin, direction, 13.0, results);
+    CHECK_EQUAL(2, results.size()); //Boxes 0 and 1
+
+    for(uint32_t i = 0; i < proxies.size(); i += 2) {
+        tree.destroy_proxy(proxies[i]);
+    }
+    CHECK(tree.validate());
+}
+
+TEST(test_bvh_partitioner_relocation) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    BVHPartitioner::ptr partitioner(new BVHPartitioner(scene));
+    scene.set_partitioner(partitioner);
+
+    MeshID mesh_id = scene.new_mesh();
+    Mesh& mesh = scene.mesh(mesh_id);
+    mesh.add_vertex(-1, -1, -1);
+    mesh.add_vertex(1, 1, 1);
+    mesh.add_vertex(1, -1, 1);
+    mesh.add_triangle(0, 1, 2);
+
+    //Moving doesn't touch the partitioner until the scene flushes the moves
+    mesh.move_to(100, 0, 0);
+    scene.update_partitioner();
+
+    kmVec3 centre;
+    kmVec3Fill(&centre, 100, 0, 0);
+    CHECK_EQUAL(1, partitioner->meshes_within_sphere(centre, 1.0).size());
+
+    kmVec3Fill(&centre, 0, 0, 0);
+    CHECK_EQUAL(0, partitioner->meshes_within_sphere(centre, 1.0).size());
+
+    kmVec3 origin, direction;
+    kmVec3Fill(&origin, 0, 0, 0);
+    kmVec3Fill(&direction, 1, 0, 0);
+    CHECK_EQUAL(1, partitioner->meshes_hit_by_ray(origin, direction, 1000.0).size());
+    CHECK_EQUAL(0, partitioner->meshes_hit_by_ray(origin, direction, 50.0).size());
+
+    //Children move with their parents
+    MeshID child_id = scene.new_mesh(&mesh);
+    scene.mesh(child_id).add_vertex(0, 0, 0);
+    mesh.move_to(-100, 0, 0);
+    scene.update_partitioner();
+
+    kmVec3Fill(&centre, -100, 0, 0);
+    CHECK_EQUAL(2, partitioner->meshes_within_sphere(centre, 1.0).size());
+
+    LightID light = scene.new_light();
+    scene.light(light).move_to(-100, 0, 0);
+    scene.update_partitioner();
+    CHECK_EQUAL(1, count_lights(*partitioner, centre));
+    CHECK(partitioner->mesh_tree().validate());
+}
+
+TEST(test_spatial_hash_partitioner) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    SpatialHashPartitioner::ptr partitioner = scene.set_partitioner<SpatialHashPartitioner>(2.0);
+    CHECK_EQUAL(2.0, partitioner->cell_size());
+
+    //A row of sprite sized quads
+    std::vector<MeshID> sprites;
+    for(uint32_t i = 0; i < 10; ++i) {
+        MeshID mesh_id = scene.new_mesh();
+        Mesh& mesh = scene.mesh(mesh_id);
+        mesh.add_vertex(-0.5, -0.5, 0);
+        mesh.add_vertex(0.5, -0.5, 0);
+        mesh.add_vertex(0.5, 0.5, 0);
+        mesh.add_triangle(0, 1, 2);
+        mesh.move_to(i * 4.0, 0, 0);
+        sprites.push_back(mesh_id);
+    }
+    scene.update_partitioner();
+
+    std::vector<MeshID> found = partitioner->meshes_in_rectangle(-1, -1, 5, 1);
+    CHECK_EQUAL(2, found.size());
+
+    //Moving within a cell, then to another one
+    scene.mesh(sprites[0]).move_to(0.1, 0, 0);
+    scene.mesh(sprites[1]).move_to(100, 100, 0);
+    scene.update_partitioner();
+
+    found = partitioner->meshes_in_rectangle(-1, -1, 5, 1);
+    CHECK_EQUAL(1, found.size());
+    CHECK_EQUAL(sprites[0], found[0]);
+
+    found = partitioner->meshes_in_rectangle(99, 99, 101, 101);
+    CHECK_EQUAL(1, found.size());
+
+    //A huge rectangle still returns each mesh once
+    found = partitioner->meshes_in_rectangle(-1000, -1000, 1000, 1000);
+    CHECK_EQUAL(10, found.size());
+
+    scene.active_camera().set_orthographic_projection(-6, 6, -2, 2, -10, 10);
+    std::vector<MeshID> visible;
+    partitioner->meshes_visible_from(scene.active_camera(), visible);
+    CHECK(is_listed(visible, sprites[0]));
+    CHECK(!is_listed(visible, sprites[1]));
+    CHECK(!is_listed(visible, sprites[9]));
+
+    LightID light = scene.new_light();
+    scene.light(light).set_attenuation_from_range(3.0);
+    scene.light(light).move_to(36, 0, 0);
+    scene.update_partitioner();
+
+    kmVec3 location;
+    kmVec3Fill(&location, 35, 0, 0);
+    CHECK_EQUAL(1, count_lights(*partitioner, location));
+    kmVec3Fill(&location, 30, 0, 0);
+    CHECK_EQUAL(0, count_lights(*partitioner, location));
+
+    scene.delete_mesh(sprites[1]);
+    found = partitioner->meshes_in_rectangle(99, 99, 101, 101);
+    CHECK(found.empty());
+}
+
+TEST(test_parallel_culling) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    scene.active_camera().set_perspective_projection(45.0, 1.0, 1.0, 100.0);
+
+    //Enough meshes that culling is split into several chunks
+    std::vector<MeshID> meshes;
+    for(int32_t x = -50; x <= 50; ++x) {
+        for(int32_t z = -50; z <= 50; ++z) {
+            MeshID mesh_id = scene.new_mesh();
+            Mesh& mesh = scene.mesh(mesh_id);
+            mesh.add_vertex(-0.5, -0.5, 0);
+            mesh.add_vertex(0.5, -0.5, 0);
+            mesh.add_vertex(0.5, 0.5, 0);
+            mesh.add_triangle(0, 1, 2);
+            mesh.move_to(x * 2.0, 0, z * 2.0);
+            meshes.push_back(mesh_id);
+        }
+    }
+    scene.update_partitioner();
+
+    std::vector<Partitioner::ptr> partitioners = {
+        Partitioner::ptr(new OctreePartitioner(scene, 1024.0)),
+        Partitioner::ptr(new BVHPartitioner(scene)),
+        Partitioner::ptr(new SpatialHashPartitioner(scene, 4.0))
+    };
+
+    const Frustum& frustum = scene.active_camera().frustum();
+
+    std::vector<MeshID> visible;
+    for(Partitioner::ptr partitioner: partitioners) {
+        scene.set_partitioner(partitioner);
+        partitioner->meshes_visible_from(scene.active_camera(), visible);
+
+        //Merged in order, with nothing listed twice
+        CHECK(std::adjacent_find(visible.begin(), visible.end(), std::greater_equal<MeshID>()) == visible.end());
+        CHECK(visible.size() < meshes.size());
+
+        for(MeshID mesh_id: meshes) {
+            if(frustum.contains_point(scene.mesh(mesh_id).absolute_position())) {
+                CHECK(is_listed(visible, mesh_id));
+            }
+        }
+    }
+}
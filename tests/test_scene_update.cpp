@@ -0,0 +1,160 @@
+#include <unittest++/UnitTest++.h>
+
+#include <vector>
+
+#include "kglt/kglt.h"
+#include "kglt/object.h"
+
+using namespace kglt;
+
+class Counter : public Object {
+public:
+    Counter(Scene* scene):
+        Object(scene),
+        updates(0) {}
+
+    void do_update(double dt) {
+        ++updates;
+    }
+
+    uint32_t updates;
+};
+
+TEST(test_only_opted_in_objects_are_updated) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    std::vector<std::tr1::shared_ptr<Counter> > counters;
+    for(uint32_t i = 0; i < 10; ++i) {
+        counters.push_back(std::tr1::shared_ptr<Counter>(new Counter(&scene)));
+        counters.back()->set_parent(&scene);
+    }
+
+    counters[2]->enable_updates();
+    counters[5]->enable_updates();
+    counters[7]->enable_updates();
+
+    scene.update(0.1);
+
+    for(uint32_t i = 0; i < counters.size(); ++i) {
+        bool enabled = (i == 2 || i == 5 || i == 7);
+        CHECK_EQUAL(enabled ? 1 : 0, counters[i]->updates);
+        CHECK_EQUAL(enabled, counters[i]->updates_enabled());
+    }
+
+    //Opting out and being destroyed both take objects off the list
+    counters[5]->enable_updates(false);
+    counters[7].reset();
+
+    scene.update(0.1);
+    CHECK_EQUAL(2, counters[2]->updates);
+    CHECK_EQUAL(1, counters[5]->updates);
+}
+
+TEST(test_animated_materials_are_updated) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    Material& still = scene.material(scene.new_material());
+    still.technique().new_pass(0);
+    still.technique().pass(0).set_texture_unit(0, 1);
+    CHECK(!still.is_animated());
+
+    MaterialID animated_id = scene.new_material();
+    Material& animated = scene.material(animated_id);
+    animated.technique().new_pass(0);
+    animated.technique().pass(0).set_animated_texture_unit(0, { 1, 2 }, 1.0);
+    CHECK(animated.is_animated());
+
+    TextureUnit& unit = animated.technique().pass(0).texture_unit(0);
+    CHECK_EQUAL(1, unit.texture());
+
+    scene.update(0.6);
+    CHECK_EQUAL(2, unit.texture());
+
+    //Deleted materials just drop off the list
+    scene.delete_material(animated_id);
+    scene.update(0.6);
+}
+
+//Takes its value from its parent, so it's only right if the parent was updated first
+class Follower : public Object {
+public:
+    Follower(Scene* scene):
+        Object(scene),
+        frame(0),
+        value(0) {}
+
+    void do_update(double dt) {
+        ++frame;
+
+        Follower* leader = dynamic_cast<Follower*>(&parent());
+        value = leader ? leader->value + 1 : frame * 100;
+    }
+
+    uint32_t frame;
+    uint32_t value;
+};
+
+TEST(test_parents_update_before_children) {
+    for(bool parallel: { false, true }) {
+        kglt::Window window;
+        kglt::Scene& scene = window.scene();
+        scene.set_parallel_updates(parallel);
+
+        std::vector<std::tr1::shared_ptr<Follower> > followers;
+        auto add = [&](Object& parent) -> Follower& {
+            followers.push_back(std::tr1::shared_ptr<Follower>(new Follower(&scene)));
+            followers.back()->set_parent(&parent);
+            return *followers.back();
+        };
+
+        //Build a few levels of tree, then list them children first
+        std::vector<Follower*> roots;
+        for(uint32_t i = 0; i < 200; ++i) {
+            roots.push_back(&add(scene));
+        }
+        for(Follower* root: roots) {
+            Follower& child = add(*root);
+            add(child);
+        }
+        for(uint32_t i = followers.size(); i > 0; --i) {
+            followers[i - 1]->enable_updates();
+        }
+
+        scene.update(0.1);
+        scene.update(0.1);
+
+        for(std::tr1::shared_ptr<Follower> follower: followers) {
+            uint32_t depth = 0;
+            for(Object* node = follower.get(); dynamic_cast<Follower*>(&node->parent()); node = &node->parent()) {
+                ++depth;
+            }
+            CHECK_EQUAL(200 + depth, follower->value);
+        }
+    }
+}
+
+TEST(test_render_state_only_changes_when_published) {
+    kglt::Window window;
+    kglt::Scene& scene = window.scene();
+
+    Mesh& parent = scene.mesh(scene.new_mesh());
+    Mesh& child = scene.mesh(scene.new_mesh(&parent));
+    child.move_to(1.0, 0.0, 0.0);
+
+    scene.publish_frame();
+    CHECK_CLOSE(1.0, child.render_state().absolute_position.x, 0.00001);
+    CHECK(child.render_state().visible);
+
+    //The renderer keeps seeing the published state while the scene changes
+    parent.move_to(4.0, 0.0, 0.0);
+    child.set_visible(false);
+    CHECK_CLOSE(1.0, child.render_state().absolute_position.x, 0.00001);
+    CHECK(child.render_state().visible);
+
+    //Moving the parent moves the child's published transform too
+    scene.publish_frame();
+    CHECK_CLOSE(5.0, child.render_state().absolute_position.x, 0.00001);
+    CHECK(!child.render_state().visible);
+}
@@ -0,0 +1,57 @@
+#include <unittest++/UnitTest++.h>
+
+#include <boost/thread/thread.hpp>
+
+#include "kglt/utils/spsc_queue.h"
+
+using namespace kglt;
+
+TEST(test_spsc_queue_push_and_pop) {
+    SPSCQueue<uint32_t, 2> queue;
+    CHECK(queue.empty());
+
+    uint32_t value = 0;
+    CHECK(!queue.pop(value));
+
+    CHECK(queue.push(1));
+    CHECK(queue.push(2));
+    CHECK(!queue.push(3)); //Full
+
+    CHECK(queue.pop(value));
+    CHECK_EQUAL(1, value);
+
+    CHECK(queue.push(3)); //Wraps around
+    CHECK(queue.pop(value));
+    CHECK_EQUAL(2, value);
+    CHECK(queue.pop(value));
+    CHECK_EQUAL(3, value);
+    CHECK(queue.empty());
+}
+
+TEST(test_spsc_queue_between_threads) {
+    const uint32_t COUNT = 100000;
+    SPSCQueue<uint32_t, 4> queue;
+
+    boost::thread producer([&]() {
+        for(uint32_t i = 0; i < COUNT; ++i) {
+            while(!queue.push(i)) {
+                boost::this_thread::yield();
+            }
+        }
+    });
+
+    //Everything arrives, in order
+    bool in_order = true;
+    for(uint32_t i = 0; i < COUNT; ++i) {
+        uint32_t value = 0;
+        while(!queue.pop(value)) {
+            boost::this_thread::yield();
+        }
+        in_order = in_order && value == i;
+    }
+
+    producer.join();
+
+    CHECK(in_order);
+    CHECK(queue.empty());
+}
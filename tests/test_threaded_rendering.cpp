@@ -0,0 +1,65 @@
+#include <unittest++/UnitTest++.h>
+
+#include "kglt/kglt.h"
+#include "kglt/utils/gl_thread.h"
+
+using namespace kglt;
+
+TEST(test_threaded_rendering_runs_and_shuts_down) {
+    kglt::Window window(640, 480, 0, true);
+    CHECK(window.rendering_threaded());
+
+    kglt::Scene& scene = window.scene();
+
+    TextureID tid = scene.new_texture();
+    Texture& texture = scene.texture(tid);
+    texture.set_bpp(32);
+    texture.resize(2, 2);
+    texture.upload();
+
+    MaterialID material_id = scene.new_material(scene.default_material());
+    scene.material(material_id).technique().pass(0).set_texture_unit(0, tid);
+
+    MeshID mid = scene.new_mesh();
+    Mesh& mesh = scene.mesh(mid);
+    mesh.add_vertex(-1, 0, -5);
+    mesh.add_vertex(1, 0, -5);
+    mesh.add_vertex(0, 1, -5);
+    mesh.add_triangle(0, 1, 2);
+    mesh.apply_material(material_id);
+    mesh.done();
+
+    //Frames are published to the render thread, which records and draws them
+    for(uint32_t i = 0; i < 3; ++i) {
+        CHECK(window.update());
+    }
+
+    //GL work from the main thread is handed over to the render thread
+    CHECK(!on_gl_thread());
+    bool ran_on_gl_thread = false;
+    uint32_t gl_tex = 0;
+    run_on_gl_thread_and_wait([&]() {
+        ran_on_gl_thread = on_gl_thread();
+        gl_tex = texture.gl_tex();
+    });
+    CHECK(ran_on_gl_thread);
+    CHECK(gl_tex);
+
+    //Deleting while the render thread may still be drawing them
+    scene.delete_mesh(mid);
+    scene.delete_texture(tid);
+    scene.delete_material(material_id);
+    CHECK(!scene.has_mesh(mid));
+
+    bool rendered = false;
+    window.after_frames_rendered([&]() { rendered = true; });
+    CHECK(!rendered);
+
+    //The render thread is at most a couple of frames behind
+    for(uint32_t i = 0; i < 5; ++i) {
+        CHECK(window.update());
+    }
+    CHECK(rendered);
+
+    //Stops the render thread before the window goes
+}
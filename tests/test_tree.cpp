@@ -61,3 +61,41 @@ TEST(test_tree_iteration) {
     }
     CHECK_EQUAL(4, i);
 }
+
+TEST(test_tree_iteration_sees_changes) {
+    class Object : public generic::TreeNode<Object> {};
+
+    Object root, node1, node2, node3;
+    node1.set_parent(root);
+    node2.set_parent(node1);
+
+    auto count = [](Object& node) -> uint32_t {
+        uint32_t i = 0;
+        for(generic::tree_iterator<Object> it(node), end; it != end; ++it) {
+            ++i;
+        }
+        return i;
+    };
+
+    CHECK_EQUAL(3, count(root));
+    CHECK_EQUAL(2, count(node1));
+
+    //Attaching deep in the tree has to refresh every ancestor's cached order
+    node3.set_parent(node2);
+    CHECK_EQUAL(4, count(root));
+    CHECK_EQUAL(3, count(node1));
+
+    node2.detach();
+    CHECK_EQUAL(2, count(root));
+    CHECK_EQUAL(2, count(node2));
+
+    //Skipping node2's children steps over node3 and off the end
+    node2.set_parent(root);
+    generic::tree_iterator<Object> it(root), end;
+    ++it; //node1
+    ++it; //node2
+    CHECK_EQUAL(&node2, &(*it));
+    it.skip_children();
+    ++it;
+    CHECK(it == end);
+}